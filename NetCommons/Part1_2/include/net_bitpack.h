@@ -0,0 +1,451 @@
+#ifndef __NET_BITPACK_H__
+#define __NET_BITPACK_H__
+
+#include <cmath>
+
+#include "net_common.h"
+#include "net_message.h"
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+/*
+紧凑的报文编码：
+1. LEB128 变长整数 (varint)：每个字节存放 7 位数据，最高位表示后面是否还有字节，
+   小于 128 的数只需要 1 个字节，实体 id、计数之类的小整数不再固定占用 4 个字节
+2. zigzag：把有符号数映射为无符号数 (0, -1, 1, -2 ... -> 0, 1, 2, 3 ...)，绝对值小的负数同样很短
+3. 定长的位字段：标志位只占 1 位，枚举只占需要的位数
+4. 量化的浮点数：把 [min, max] 区间内的浮点数映射为 n 位整数，例如角度用 10 位就足够了
+
+bit_writer 把这些数据按位依次写入 message<T> 的 body，bit_reader 按照同样的顺序读出。
+位的顺序是小端的：先写入的位放在字节的低位，读取的时候可以一次加载 64 位再移位。
+*/
+
+namespace olc
+{
+	namespace net
+	{
+		inline uint64_t zigzag_encode(int64_t n)
+		{
+			return (static_cast<uint64_t>(n) << 1) ^ static_cast<uint64_t>(n >> 63);
+		}
+
+		inline int64_t zigzag_decode(uint64_t n)
+		{
+			return static_cast<int64_t>(n >> 1) ^ -static_cast<int64_t>(n & 1);
+		}
+
+		// 一个数编码成 varint 之后占用的字节数
+		inline size_t varint_size(uint64_t n)
+		{
+			size_t nBytes = 1;
+			while (n >= 0x80)
+			{
+				n >>= 7;
+				nBytes++;
+			}
+			return nBytes;
+		}
+
+		// 字节对齐的 varint 编码，pDst 至少要有 10 个字节的空间，返回写入的字节数
+		inline size_t write_varint(uint8_t *pDst, uint64_t n)
+		{
+			size_t i = 0;
+			while (n >= 0x80)
+			{
+				pDst[i++] = static_cast<uint8_t>(n | 0x80);
+				n >>= 7;
+			}
+			pDst[i++] = static_cast<uint8_t>(n);
+			return i;
+		}
+
+		namespace detail
+		{
+			constexpr uint64_t varint_continuation_bits = 0x8080808080808080ull;
+
+			// 把 64 位中每个字节的低 7 位紧挨着拼接起来（去掉每个字节的最高位）
+			inline uint64_t compact_varint_groups(uint64_t x)
+			{
+#if defined(__BMI2__)
+				return _pext_u64(x, 0x7f7f7f7f7f7f7f7full);
+#else
+				// 没有 PEXT 指令的时候，分三步两两合并：7 位 -> 14 位 -> 28 位 -> 56 位，没有任何分支
+				x &= 0x7f7f7f7f7f7f7f7full;
+				x = ((x & 0x7f007f007f007f00ull) >> 1) | (x & 0x007f007f007f007full);
+				x = ((x & 0x3fff00003fff0000ull) >> 2) | (x & 0x00003fff00003fffull);
+				x = ((x & 0x0fffffff00000000ull) >> 4) | (x & 0x000000000fffffffull);
+				return x;
+#endif
+			}
+
+			inline unsigned count_trailing_zeros(uint64_t x)
+			{
+#if defined(__GNUC__) || defined(__clang__)
+				return static_cast<unsigned>(__builtin_ctzll(x));
+#else
+				unsigned n = 0;
+				while ((x & 1) == 0)
+				{
+					x >>= 1;
+					n++;
+				}
+				return n;
+#endif
+			}
+
+			/*
+			varint 解码的快速路径：w 是从当前位置加载的 64 位数据 (小端)，nAvailBytes 是其中有效的字节数。
+			找到第一个最高位为 0 的字节就是 varint 的结尾，然后一次性把各个字节的低 7 位拼接起来。
+			varint 超过 7 个字节或者超出了有效数据时返回 0，由调用者走逐字节的慢速路径。
+			*/
+			inline size_t decode_varint_word(uint64_t w, size_t nAvailBytes, uint64_t &value)
+			{
+				uint64_t nStop = ~w & varint_continuation_bits;
+				if (nStop == 0)
+					return 0;
+
+				size_t nBytes = count_trailing_zeros(nStop) / 8 + 1;
+				if (nBytes > 7 || nBytes > nAvailBytes)
+					return 0;
+
+				value = compact_varint_groups(w & ((uint64_t(1) << (8 * nBytes)) - 1));
+				return nBytes;
+			}
+		}
+
+		// 字节对齐的 varint 解码，返回读取的字节数，数据不完整或者格式错误的时候返回 0
+		inline size_t read_varint(const uint8_t *pSrc, size_t nAvail, uint64_t &value)
+		{
+			if (nAvail >= 8)
+			{
+				uint64_t w;
+				detail::load_scalar(pSrc, w);
+				size_t nBytes = detail::decode_varint_word(w, nAvail, value);
+				if (nBytes > 0)
+					return nBytes;
+			}
+
+			// 慢速路径：逐字节解码，最多 10 个字节
+			uint64_t n = 0;
+			for (size_t i = 0; i < nAvail && i < 10; ++i)
+			{
+				n |= static_cast<uint64_t>(pSrc[i] & 0x7f) << (7 * i);
+				if ((pSrc[i] & 0x80) == 0)
+				{
+					value = n;
+					return i + 1;
+				}
+			}
+			return 0;
+		}
+
+
+		// write_quantized / read_quantized 最多使用的位数
+		constexpr unsigned quantized_max_bits = 32;
+
+
+		class bit_writer
+		{
+		public:
+			// 把数据追加到 vBuffer 的末尾
+			explicit bit_writer(std::vector<uint8_t> &vBuffer)
+				: m_vBuffer(vBuffer)
+			{
+
+			}
+
+			bit_writer(const bit_writer&) = delete;
+			bit_writer& operator = (const bit_writer&) = delete;
+
+			virtual ~bit_writer()
+			{
+				this->flush();
+			}
+
+		public:
+			// 写入 value 的低 nBits 位，nBits 取值为 0~64
+			void write_bits(uint64_t value, unsigned nBits)
+			{
+				if (nBits == 0)
+					return;
+				if (nBits < 64)
+					value &= (uint64_t(1) << nBits) - 1;
+
+				this->m_nScratch |= value << this->m_nScratchBits;
+				unsigned nTotal = this->m_nScratchBits + nBits;
+
+				if (nTotal >= 64)
+				{
+					// 攒满了 64 位，一次写出 8 个字节，剩下的高位留在 scratch 当中
+					uint8_t buf[8];
+					detail::store_scalar(buf, this->m_nScratch);
+					this->m_vBuffer.insert(this->m_vBuffer.end(), buf, buf + 8);
+
+					this->m_nScratch = this->m_nScratchBits == 0 ? 0 : value >> (64 - this->m_nScratchBits);
+					nTotal -= 64;
+				}
+
+				this->m_nScratchBits = nTotal;
+			}
+
+			void write_bool(bool b)
+			{
+				this->write_bits(b ? 1 : 0, 1);
+			}
+
+			void write_varint(uint64_t value)
+			{
+				while (value >= 0x80)
+				{
+					this->write_bits((value & 0x7f) | 0x80, 8);
+					value >>= 7;
+				}
+				this->write_bits(value, 8);
+			}
+
+			void write_signed(int64_t value)
+			{
+				this->write_varint(zigzag_encode(value));
+			}
+
+			/*
+			把 [fMin, fMax] 区间内的浮点数量化为 nBits 位的整数，超出区间的值会被截断。
+			float 只有 24 位的精度，nBits 超过 32 的时候按 32 位处理 (read_quantized 也一样)；
+			计算使用 double，nMax 在 double 中是精确的，乘积截断到 nMax，不会舍入到 2^nBits 而回绕成 0
+			*/
+			void write_quantized(float value, float fMin, float fMax, unsigned nBits)
+			{
+				nBits = std::min(nBits, quantized_max_bits);
+				const uint64_t nMax = (uint64_t(1) << nBits) - 1;
+				double t = (double(value) - fMin) / (double(fMax) - fMin);
+				t = std::min(1.0, std::max(0.0, t));
+				this->write_bits(std::min(static_cast<uint64_t>(t * static_cast<double>(nMax) + 0.5), nMax), nBits);
+			}
+
+			// 角度 (弧度) 归一化到 [0, 2pi) 之后量化，nBits 超过 63 的时候按 63 位处理 (read_angle 也一样)
+			void write_angle(float fRadians, unsigned nBits)
+			{
+				constexpr float fTwoPi = 6.28318530717958647692f;
+				nBits = std::min(nBits, 63u);
+				float a = std::fmod(fRadians, fTwoPi);
+				if (a < 0.0f)
+					a += fTwoPi;
+				// 2pi 和 0 是同一个角度，量化到 [0, 2pi) 上，最大的编码值回绕到 0
+				const uint64_t nSteps = uint64_t(1) << nBits;
+				this->write_bits(static_cast<uint64_t>(a / fTwoPi * static_cast<float>(nSteps) + 0.5f) & (nSteps - 1), nBits);
+			}
+
+			// 补齐到字节边界
+			void align()
+			{
+				if (this->m_nScratchBits % 8 != 0)
+					this->write_bits(0, 8 - this->m_nScratchBits % 8);
+			}
+
+			// 把还没有写出的位写入缓冲区 (不足一个字节的部分补 0)
+			void flush()
+			{
+				size_t nBytes = (this->m_nScratchBits + 7) / 8;
+				for (size_t i = 0; i < nBytes; ++i)
+					this->m_vBuffer.push_back(static_cast<uint8_t>(this->m_nScratch >> (8 * i)));
+
+				this->m_nScratch = 0;
+				this->m_nScratchBits = 0;
+			}
+
+		protected:
+			std::vector<uint8_t> &m_vBuffer;
+
+			uint64_t m_nScratch = 0;
+			unsigned m_nScratchBits = 0;
+		};
+
+
+		// 直接写入一个 message 的 body，结束的时候更新报头中的大小
+		template <typename T>
+		class message_bit_writer : public bit_writer
+		{
+		public:
+			explicit message_bit_writer(message<T> &msg)
+				: bit_writer(msg.body), m_msg(msg)
+			{
+
+			}
+
+			~message_bit_writer()
+			{
+				this->finish();
+			}
+
+			message<T>& finish()
+			{
+				this->flush();
+				this->m_msg.header.size = this->m_msg.size();
+				return this->m_msg;
+			}
+
+		private:
+			message<T> &m_msg;
+		};
+
+
+		class bit_reader
+		{
+		public:
+			bit_reader(const uint8_t *pData, size_t nSize)
+				: m_pData(pData), m_nSizeBits(nSize * 8)
+			{
+
+			}
+
+			template <typename T>
+			explicit bit_reader(const message<T> &msg)
+				: bit_reader(msg.body.data(), msg.body.size())
+			{
+
+			}
+
+		public:
+			uint64_t read_bits(unsigned nBits)
+			{
+				if (nBits == 0 || !this->require(nBits))
+					return 0;
+
+				if (nBits > 57)
+				{
+					// 一次加载最多保证 57 位有效，更长的字段分两次读取
+					uint64_t nLow = this->read_bits(32);
+					return nLow | (this->read_bits(nBits - 32) << 32);
+				}
+
+				uint64_t value = this->peek64();
+				if (nBits < 64)
+					value &= (uint64_t(1) << nBits) - 1;
+				this->m_nBitPos += nBits;
+				return value;
+			}
+
+			bool read_bool()
+			{
+				return this->read_bits(1) != 0;
+			}
+
+			uint64_t read_varint()
+			{
+				if (this->m_bFail)
+					return 0;
+
+				// 快速路径：一次加载 64 位，无分支地找到结尾并拼接
+				uint64_t value = 0;
+				size_t nBytes = detail::decode_varint_word(this->peek64(), this->remaining_bits() / 8, value);
+				if (nBytes > 0)
+				{
+					this->m_nBitPos += nBytes * 8;
+					return value;
+				}
+
+				value = 0;
+				for (unsigned i = 0; i < 10; ++i)
+				{
+					uint64_t nByte = this->read_bits(8);
+					if (this->m_bFail)
+						return 0;
+					value |= (nByte & 0x7f) << (7 * i);
+					if ((nByte & 0x80) == 0)
+						return value;
+				}
+
+				// 超过 10 个字节，不是合法的 varint
+				this->m_bFail = true;
+				return 0;
+			}
+
+			int64_t read_signed()
+			{
+				return zigzag_decode(this->read_varint());
+			}
+
+			float read_quantized(float fMin, float fMax, unsigned nBits)
+			{
+				// 0 位的时候没有写入任何内容，只能是 fMin
+				nBits = std::min(nBits, quantized_max_bits);
+				if (nBits == 0)
+					return fMin;
+
+				const uint64_t nMax = (uint64_t(1) << nBits) - 1;
+				uint64_t n = this->read_bits(nBits);
+				return static_cast<float>(fMin + (double(fMax) - fMin) * (static_cast<double>(n) / static_cast<double>(nMax)));
+			}
+
+			float read_angle(unsigned nBits)
+			{
+				constexpr float fTwoPi = 6.28318530717958647692f;
+				nBits = std::min(nBits, 63u);
+				uint64_t n = this->read_bits(nBits);
+				return static_cast<float>(n) / static_cast<float>(uint64_t(1) << nBits) * fTwoPi;
+			}
+
+			void align()
+			{
+				if (this->m_nBitPos % 8 != 0)
+					this->read_bits(8 - this->m_nBitPos % 8);
+			}
+
+			bool good() const
+			{
+				return !this->m_bFail;
+			}
+
+			explicit operator bool() const
+			{
+				return this->good();
+			}
+
+			size_t remaining_bits() const
+			{
+				return this->m_nSizeBits - this->m_nBitPos;
+			}
+
+		private:
+			bool require(size_t nBits)
+			{
+				if (this->m_bFail || nBits > this->remaining_bits())
+				{
+					this->m_bFail = true;
+					return false;
+				}
+				return true;
+			}
+
+			// 从当前位置加载 64 位 (至少 57 位有效)，超出数据末尾的部分补 0
+			uint64_t peek64() const
+			{
+				size_t nByte = this->m_nBitPos / 8;
+				size_t nSizeBytes = (this->m_nSizeBits + 7) / 8;
+				uint64_t w = 0;
+
+				if (nByte + 8 <= nSizeBytes)
+				{
+					detail::load_scalar(this->m_pData + nByte, w);
+				}
+				else
+				{
+					for (size_t i = 0; nByte + i < nSizeBytes; ++i)
+						w |= static_cast<uint64_t>(this->m_pData[nByte + i]) << (8 * i);
+				}
+
+				return w >> (this->m_nBitPos % 8);
+			}
+
+		private:
+			const uint8_t *m_pData = nullptr;
+			size_t m_nSizeBits = 0;
+			size_t m_nBitPos = 0;
+			bool m_bFail = false;
+		};
+	}
+}
+
+#endif
@@ -3,6 +3,8 @@
 
 #include "net_common.h"
 #include "net_connection.h"
+#include "net_shm.h"
+#include "net_loopback.h"
 #include "net_tsqueue.h"
 
 
@@ -10,6 +12,9 @@ namespace olc
 {
 	namespace net 
 	{
+		template <typename T>
+		class server_interface;
+
 		template <typename T>
 		class client_interface
 		{
@@ -33,20 +38,69 @@ namespace olc
 					asio::ip::tcp::resolver::results_type endpoints = 	\
 						resolver.resolve(host, std::to_string(port));
 
+					this->ConnectTo(endpoints, this->m_bUdp);
+					return true;
 
-					this->m_connection = std::make_unique<connection<T> >(
-						connection<T>::owner::client,	// 类型
-						this->m_context,	// 上下文
-						asio::ip::tcp::socket(this->m_context), // 与这个连接相关的 socket 
-						this->m_qMessagesIn		// 保存接收到的数据的队列
-					);
+				}
+				catch (std::exception &e)
+				{
+					std::cerr << "Client Exception: " << e.what() << '\n';
+					return false;
+				}
+			}
 
-					this->m_connection->ConnectToServer(endpoints);
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+			// 连接同一台机器上在 Unix 域套接字上监听的服务器，这种连接没有 UDP 通道
+			bool Connect(const asio::local::stream_protocol::endpoint &endpoint)
+			{
+				try
+				{
+					this->ConnectTo(asio::generic::stream_protocol::endpoint(endpoint), false);
+					return true;
+				}
+				catch (std::exception &e)
+				{
+					std::cerr << "Client Exception: " << e.what() << '\n';
+					return false;
+				}
+			}
+#endif
 
-					this->thrContext = std::thread( [this]() { this->m_context.run(); } );
+			/*
+			连接同一个进程中的服务器 (见 net_loopback.h)，报文直接在两个对象之间移交，不经过 socket。
+			需要同时包含 net_server.h
+			*/
+			bool Connect(server_interface<T> &server)
+			{
+				auto pConnection = std::make_unique<loopback_connection<T> >(connection<T>::owner::client, 
+					this->m_context, this->m_qMessagesIn);
+				pConnection->SetTimerWheel(&this->m_timers);
+				if (!server.AcceptLoopback(*pConnection))
+					return false;
 
-					return true;
+				this->m_connection = std::move(pConnection);
+
+				// 报文不需要 I/O 线程，RPC 的超时需要
+				this->StartContext();
+				return true;
+			}
 
+#ifdef OLC_NET_SHM
+			// 连接同一台机器上用 server_interface::ListenShared 创建的共享内存连接 (见 net_shm.h)
+			bool ConnectShared(const std::string &sName)
+			{
+				try
+				{
+					auto pConnection = std::make_unique<shm_connection<T> >(connection<T>::owner::client, this->m_context,
+						shm_segment::Open(sName, sizeof(message_header<T>)), this->m_qMessagesIn);
+					if (this->m_bCompression)
+						pConnection->EnableCompression(this->m_nCompressThreshold, nullptr, this->m_pCompressPool);
+					pConnection->SetTimerWheel(&this->m_timers);
+
+					pConnection->Start();
+					this->m_connection = std::move(pConnection);
+					this->StartContext();
+					return true;
 				}
 				catch (std::exception &e)
 				{
@@ -54,6 +108,49 @@ namespace olc
 					return false;
 				}
 			}
+#endif
+
+			// 在 Connect 之前调用，设定线路上的帧格式，必须和服务器一致
+			void SetFraming(framing eFraming)
+			{
+				this->m_eFraming = eFraming;
+			}
+
+			// 在 Connect 之前调用，发送的大报文按照 nFragmentSize 切分，见 connection<T>::SetFragmentSize
+			void SetFragmentSize(size_t nFragmentSize)
+			{
+				this->m_nFragmentSize = nFragmentSize;
+			}
+
+			// 在 Connect 之前调用，合并发送小报文，见 connection<T>::SetBundling
+			void SetBundling(size_t nMaxMessage, size_t nMaxBundle = 1400)
+			{
+				this->m_nBundleMaxMessage = nMaxMessage;
+				this->m_nBundleMaxSize = nMaxBundle;
+			}
+
+			// 在 Connect 之前调用，id 的报文流式接收 (handler 的第一个参数为 nullptr)，见 connection<T>::SetStreamHandler
+			void SetStreamHandler(T id, stream_handler<T> fnHandler)
+			{
+				if (fnHandler)
+					this->m_mapStreamHandlers[id] = std::move(fnHandler);
+				else
+					this->m_mapStreamHandlers.erase(id);
+			}
+
+			// 在 Connect 之前调用，对发送的报文开启压缩，参数的含义见 connection<T>::EnableCompression
+			void EnableCompression(size_t nThreshold, asio::thread_pool *pPool = nullptr)
+			{
+				this->m_bCompression = true;
+				this->m_nCompressThreshold = nThreshold;
+				this->m_pCompressPool = pPool;
+			}
+
+			// 在 Connect 之前调用，打开 UDP 通道，服务器也必须调用了 EnableUdp
+			void EnableUdp()
+			{
+				this->m_bUdp = true;
+			}
 
 			void Disconnect()
 			{
@@ -68,6 +165,10 @@ namespace olc
 				if (thrContext.joinable())
 					thrContext.join();
 
+				// I/O 线程已经结束，还在等待回复的调用不会再有结果
+				if (m_connection)
+					m_connection->FailCalls(std::make_error_code(std::errc::not_connected));
+
 				m_connection.release();
 			}
 
@@ -80,10 +181,52 @@ namespace olc
 			}
 
 		public:
-			void Send(const message<T> &msg)
+			// 没有连接或者报文被拒绝 (见 connection<T>::Send) 的时候返回 false
+			bool Send(const message<T> &msg, delivery eMode = delivery::reliable)
+			{
+				return this->IsConnected() && this->m_connection->Send(msg, eMode);
+			}
+
+			// 报文交给内核之后调用 fnSent，见 connection<T>::Send
+			void Send(const message<T> &msg, send_callback fnSent)
 			{
 				if (this->IsConnected())
-					this->m_connection->Send(msg);
+					this->m_connection->Send(msg, std::move(fnSent));
+				else if (fnSent)
+					fnSent(std::make_error_code(std::errc::not_connected));
+			}
+
+			/*
+			向服务器发出 RPC 请求，服务器在 server_interface::OnRequest 中回复，见 connection<T>::Call。
+			没有连接的时候 fnDone 以 not_connected 结束
+			*/
+			uint32_t Call(const message<T> &msg, std::chrono::steady_clock::duration timeout, rpc_callback<T> fnDone)
+			{
+				if (this->IsConnected())
+					return this->m_connection->Call(msg, timeout, std::move(fnDone));
+
+				message<T> reply;
+				fnDone(std::make_error_code(std::errc::not_connected), reply);
+				return 0;
+			}
+
+			// 见 connection<T>::AsyncCall
+			template <typename CompletionToken>
+			auto AsyncCall(const message<T> &msg, std::chrono::steady_clock::duration timeout, CompletionToken &&token)
+			{
+				return async_rpc<T>(std::forward<CompletionToken>(token),
+					[this, msg = message<T>(msg), timeout](rpc_callback<T> fnDone) { this->Call(msg, timeout, std::move(fnDone)); });
+			}
+
+			bool Cancel(uint32_t nCall)
+			{
+				return this->m_connection && this->m_connection->Cancel(nCall);
+			}
+
+			// 客户端的定时器轮 (见 net_timer.h)，回调在 I/O 线程中执行
+			timer_wheel& Timers()
+			{
+				return this->m_timers;
 			}
 
 			tsqueue<owned_message<T> >& Incoming()
@@ -91,12 +234,79 @@ namespace olc
 				return  m_qMessagesIn;
 			}	
 
+		protected:
+			// 创建到服务器的连接对象，需要使用别的连接实现 (例如 coro_connection) 的时候重载它
+			virtual std::unique_ptr<connection<T> > CreateConnection(stream_socket socket)
+			{
+				return std::make_unique<connection<T> >(
+					connection<T>::owner::client,	// 类型
+					this->m_context,	// 上下文
+					std::move(socket), // 与这个连接相关的 socket 
+					this->m_qMessagesIn		// 保存接收到的数据的队列
+				);
+			}
+
 		protected:
 			asio::io_context m_context;
 			std::thread thrContext;
+
+			// 在 m_context 之后声明，先于它析构
+			timer_wheel m_timers { m_context };
 			asio::ip::tcp::socket m_socket;
 			std::unique_ptr<connection<T> > m_connection;
 
+			bool m_bCompression = false;
+			size_t m_nCompressThreshold = 0;
+			asio::thread_pool *m_pCompressPool = nullptr;
+
+			framing m_eFraming = framing::standard;
+			size_t m_nFragmentSize = 0;
+			size_t m_nBundleMaxMessage = 0;
+			size_t m_nBundleMaxSize = 1400;
+			stream_handler_map<T> m_mapStreamHandlers;
+
+			bool m_bUdp = false;
+			std::shared_ptr<udp_channel<T> > m_pUdp;
+
+		private:
+			// Endpoints 是 TCP 解析的结果或者一个 generic 的 endpoint，见 connection<T>::ConnectToServer
+			template <typename Endpoints>
+			void ConnectTo(const Endpoints &endpoints, bool bUdp)
+			{
+				this->m_connection = this->CreateConnection(stream_socket(this->m_context));
+
+				this->m_connection->SetFraming(this->m_eFraming);
+				this->m_connection->SetFragmentSize(this->m_nFragmentSize);
+				this->m_connection->SetBundling(this->m_nBundleMaxMessage, this->m_nBundleMaxSize);
+				this->m_connection->SetTimerWheel(&this->m_timers);
+				for (auto &handler : this->m_mapStreamHandlers)
+					this->m_connection->SetStreamHandler(handler.first, handler.second);
+				if (this->m_bCompression)
+					this->m_connection->EnableCompression(this->m_nCompressThreshold, nullptr, this->m_pCompressPool);
+
+				if (bUdp)
+				{
+					this->m_pUdp = std::make_shared<udp_channel<T> >(this->m_context, 
+						asio::ip::udp::endpoint(asio::ip::udp::v4(), 0), this->m_qMessagesIn);
+					this->m_connection->AttachUdp(this->m_pUdp);
+					this->m_pUdp->Start();
+				}
+
+				this->m_connection->ConnectToServer(endpoints);
+
+				this->StartContext();
+			}
+
+			// 在新的线程中执行上下文，work guard 让它在暂时没有任务的时候 (例如 loopback 连接) 继续等待定时器
+			void StartContext()
+			{
+				this->thrContext = std::thread( [this]()
+					{
+						auto work = asio::make_work_guard(this->m_context);
+						this->m_context.run();
+					});
+			}
+
 		private:
 			tsqueue<owned_message<T> > m_qMessagesIn;
 		};
@@ -4,13 +4,22 @@
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <random>
 #include <deque>
+#include <array>
+#include <unordered_map>
 #include <optional>
 #include <vector>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdio>
 #include <algorithm>
 #include <chrono>
 #include <cstdint>
+#include <cstring>
+#include <limits>
 
 
 
@@ -0,0 +1,296 @@
+#ifndef __NET_COMPRESS_H__
+#define __NET_COMPRESS_H__
+
+#include "net_common.h"
+#include "net_bitpack.h"
+
+#ifdef OLC_NET_WITH_LZ4
+#include <lz4.h>
+#endif
+
+/*
+报文主体的压缩：
+
+压缩之后的 body 的格式为：
+	codec id (1 字节) | 原始长度 (varint) | 压缩后的数据
+报头 size 中的 frame_flags::compressed 标志表示 body 是压缩过的，接收端在连接层就会解压，
+应用程序拿到的始终是原始的报文。
+
+内置的编码器实现的是 LZ4 的 block 格式 (没有 frame 头)，和 liblz4 的 LZ4_compress_default /
+LZ4_decompress_safe 互相兼容。定义了 OLC_NET_WITH_LZ4 的时候改为调用 liblz4。
+*/
+
+namespace olc
+{
+	namespace net
+	{
+		class compressor
+		{
+		public:
+			virtual ~compressor() {}
+
+			// 写在压缩数据前面的编码器编号，接收端根据它选择解码器
+			virtual uint8_t id() const = 0;
+
+			// 压缩之后的数据最多会有多长
+			virtual size_t bound(size_t nSize) const = 0;
+
+			// 把 pSrc 压缩到 pDst 中，返回压缩之后的长度，失败返回 0
+			virtual size_t compress(const uint8_t *pSrc, size_t nSize, uint8_t *pDst, size_t nCapacity) const = 0;
+
+			// 解压出恰好 nOriginal 个字节，数据损坏的时候返回 false
+			virtual bool decompress(const uint8_t *pSrc, size_t nSize, uint8_t *pDst, size_t nOriginal) const = 0;
+		};
+
+
+		class lz4_block_compressor : public compressor
+		{
+		public:
+			static constexpr uint8_t codec_id = 1;
+
+			uint8_t id() const override
+			{
+				return codec_id;
+			}
+
+			size_t bound(size_t nSize) const override
+			{
+				return nSize + nSize / 255 + 16;
+			}
+
+#ifdef OLC_NET_WITH_LZ4
+			size_t compress(const uint8_t *pSrc, size_t nSize, uint8_t *pDst, size_t nCapacity) const override
+			{
+				int n = LZ4_compress_default(reinterpret_cast<const char*>(pSrc), reinterpret_cast<char*>(pDst),
+					static_cast<int>(nSize), static_cast<int>(nCapacity));
+				return n > 0 ? static_cast<size_t>(n) : 0;
+			}
+
+			bool decompress(const uint8_t *pSrc, size_t nSize, uint8_t *pDst, size_t nOriginal) const override
+			{
+				int n = LZ4_decompress_safe(reinterpret_cast<const char*>(pSrc), reinterpret_cast<char*>(pDst),
+					static_cast<int>(nSize), static_cast<int>(nOriginal));
+				return n >= 0 && static_cast<size_t>(n) == nOriginal;
+			}
+#else
+			size_t compress(const uint8_t *pSrc, size_t nSize, uint8_t *pDst, size_t nCapacity) const override
+			{
+				if (nCapacity < this->bound(nSize))
+					return 0;
+
+				// LZ4 的规定：最后 5 个字节必须是字面量，最后一个匹配必须在结尾的 12 个字节之前开始
+				constexpr size_t nMinMatch = 4;
+				constexpr size_t nLastLiterals = 5;
+				constexpr size_t nMatchFindLimit = 12;
+				constexpr unsigned nHashBits = 12;
+
+				std::array<uint32_t, 1 << nHashBits> vTable;
+				vTable.fill(UINT32_MAX);
+
+				uint8_t *op = pDst;
+				size_t ip = 0;
+				size_t anchor = 0;
+
+				if (nSize > nMatchFindLimit)
+				{
+					const size_t nMatchLimit = nSize - nLastLiterals;
+					const size_t nFindLimit = nSize - nMatchFindLimit;
+
+					while (ip < nFindLimit)
+					{
+						uint32_t nSequence = Read32(pSrc + ip);
+						uint32_t h = (nSequence * 2654435761u) >> (32 - nHashBits);
+						uint32_t ref = vTable[h];
+						vTable[h] = static_cast<uint32_t>(ip);
+
+						if (ref == UINT32_MAX || ip - ref > 65535 || Read32(pSrc + ref) != nSequence)
+						{
+							// 很久没有找到匹配的时候加快步长，不可压缩的数据也能很快地处理完
+							ip += 1 + ((ip - anchor) >> 6);
+							continue;
+						}
+
+						size_t nMatch = nMinMatch;
+						while (ip + nMatch < nMatchLimit && pSrc[ref + nMatch] == pSrc[ip + nMatch])
+							nMatch++;
+
+						op = WriteSequence(op, pSrc + anchor, ip - anchor, static_cast<uint16_t>(ip - ref), nMatch - nMinMatch);
+						ip += nMatch;
+						anchor = ip;
+					}
+				}
+
+				// 剩下的部分全部作为字面量
+				op = WriteLiterals(op, pSrc + anchor, nSize - anchor);
+				return static_cast<size_t>(op - pDst);
+			}
+
+			bool decompress(const uint8_t *pSrc, size_t nSize, uint8_t *pDst, size_t nOriginal) const override
+			{
+				const uint8_t *ip = pSrc;
+				const uint8_t *const iend = pSrc + nSize;
+				size_t op = 0;
+
+				while (ip < iend)
+				{
+					uint8_t nToken = *ip++;
+
+					size_t nLiterals = nToken >> 4;
+					if (nLiterals == 15 && !ReadLength(ip, iend, nLiterals))
+						return false;
+					if (nLiterals > static_cast<size_t>(iend - ip) || nLiterals > nOriginal - op)
+						return false;
+
+					if (nLiterals > 0)
+						std::memcpy(pDst + op, ip, nLiterals);
+					ip += nLiterals;
+					op += nLiterals;
+
+					// 最后一个序列只有字面量
+					if (ip == iend)
+						break;
+
+					if (iend - ip < 2)
+						return false;
+					size_t nOffset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+					ip += 2;
+					if (nOffset == 0 || nOffset > op)
+						return false;
+
+					size_t nMatch = nToken & 0x0f;
+					if (nMatch == 15 && !ReadLength(ip, iend, nMatch))
+						return false;
+					nMatch += 4;
+					if (nMatch > nOriginal - op)
+						return false;
+
+					// 匹配的区域可能和输出重叠 (offset < 长度)，只能逐字节拷贝
+					const uint8_t *pMatch = pDst + op - nOffset;
+					for (size_t i = 0; i < nMatch; ++i)
+						pDst[op + i] = pMatch[i];
+					op += nMatch;
+				}
+
+				return op == nOriginal;
+			}
+
+		private:
+			static uint32_t Read32(const uint8_t *p)
+			{
+				uint32_t n;
+				std::memcpy(&n, p, sizeof(n));
+				return n;
+			}
+
+			static uint8_t* WriteLength(uint8_t *op, size_t nLength)
+			{
+				while (nLength >= 255)
+				{
+					*op++ = 255;
+					nLength -= 255;
+				}
+				*op++ = static_cast<uint8_t>(nLength);
+				return op;
+			}
+
+			static uint8_t* WriteLiterals(uint8_t *op, const uint8_t *pLiterals, size_t nLiterals)
+			{
+				*op++ = static_cast<uint8_t>(std::min<size_t>(nLiterals, 15) << 4);
+				if (nLiterals >= 15)
+					op = WriteLength(op, nLiterals - 15);
+				std::memcpy(op, pLiterals, nLiterals);
+				return op + nLiterals;
+			}
+
+			static uint8_t* WriteSequence(uint8_t *op, const uint8_t *pLiterals, size_t nLiterals, uint16_t nOffset, size_t nMatch)
+			{
+				uint8_t *pToken = op;
+				op = WriteLiterals(op, pLiterals, nLiterals);
+				*pToken |= static_cast<uint8_t>(std::min<size_t>(nMatch, 15));
+
+				*op++ = static_cast<uint8_t>(nOffset);
+				*op++ = static_cast<uint8_t>(nOffset >> 8);
+
+				if (nMatch >= 15)
+					op = WriteLength(op, nMatch - 15);
+				return op;
+			}
+
+			static bool ReadLength(const uint8_t *&ip, const uint8_t *iend, size_t &nLength)
+			{
+				uint8_t n;
+				do
+				{
+					if (ip >= iend)
+						return false;
+					n = *ip++;
+					nLength += n;
+				} while (n == 255);
+				return true;
+			}
+#endif
+		};
+
+
+		// 默认使用的编码器
+		inline std::shared_ptr<compressor> default_compressor()
+		{
+			static std::shared_ptr<compressor> pCodec = std::make_shared<lz4_block_compressor>();
+			return pCodec;
+		}
+
+
+		/*
+		按照上面的格式压缩 vBody，压缩之后变小了才会替换 vBody 并返回 true。
+		*/
+		inline bool compress_body(const compressor &codec, std::vector<uint8_t> &vBody)
+		{
+			uint8_t prefix[11];
+			prefix[0] = codec.id();
+			size_t nPrefix = 1 + write_varint(prefix + 1, vBody.size());
+
+			std::vector<uint8_t> vOut(nPrefix + codec.bound(vBody.size()));
+			size_t nCompressed = codec.compress(vBody.data(), vBody.size(), vOut.data() + nPrefix, vOut.size() - nPrefix);
+			if (nCompressed == 0 || nPrefix + nCompressed >= vBody.size())
+				return false;
+
+			std::memcpy(vOut.data(), prefix, nPrefix);
+			vOut.resize(nPrefix + nCompressed);
+			vBody.swap(vOut);
+			return true;
+		}
+
+		/*
+		解压 vBody，pCodec 是这个连接使用的编码器 (可以为空)，编号和它不同的时候使用内置的编码器。
+		解压之后的长度超过 nMaxSize 或者数据损坏的时候返回 false。
+		*/
+		inline bool decompress_body(const compressor *pCodec, std::vector<uint8_t> &vBody, size_t nMaxSize)
+		{
+			if (vBody.empty())
+				return false;
+
+			const compressor *pDecoder = pCodec;
+			if (pDecoder == nullptr || pDecoder->id() != vBody[0])
+			{
+				pDecoder = default_compressor().get();
+				if (pDecoder->id() != vBody[0])
+					return false;
+			}
+
+			uint64_t nOriginal = 0;
+			size_t nPrefix = read_varint(vBody.data() + 1, vBody.size() - 1, nOriginal);
+			if (nPrefix == 0 || nOriginal > nMaxSize)
+				return false;
+			nPrefix += 1;
+
+			std::vector<uint8_t> vOut(nOriginal);
+			if (!pDecoder->decompress(vBody.data() + nPrefix, vBody.size() - nPrefix, vOut.data(), vOut.size()))
+				return false;
+
+			vBody.swap(vOut);
+			return true;
+		}
+	}
+}
+
+#endif
@@ -4,12 +4,64 @@
 #include "net_common.h"
 #include "net_message.h"
 #include "net_tsqueue.h"
+#include "net_compress.h"
+#include "net_frame.h"
+#include "net_udp.h"
+#include "net_zerocopy.h"
+#include "net_file.h"
+#include "net_stream.h"
+#include "net_timer.h"
+#include "net_rpc.h"
 
 
 namespace olc 
 {
 	namespace net 
 	{
+		/*
+		连接使用的 socket。generic::stream_protocol 可以容纳任何流式的协议，同一个 connection<T>
+		既可以跑在 TCP 上，也可以跑在同一台机器上的 Unix 域套接字 (asio::local::stream_protocol) 上
+		*/
+		using stream_socket = asio::generic::stream_protocol::socket;
+
+		namespace detail
+		{
+			// 如果 endpoint 是 IPv4 / IPv6 的地址，转换为 TCP 的 endpoint
+			inline bool to_tcp_endpoint(const asio::generic::stream_protocol::endpoint &from, asio::ip::tcp::endpoint &to)
+			{
+				int nFamily = from.protocol().family();
+				if ((nFamily != asio::ip::tcp::v4().family() && nFamily != asio::ip::tcp::v6().family()) || from.size() > to.capacity())
+					return false;
+
+				std::memcpy(to.data(), from.data(), from.size());
+				to.resize(from.size());
+				return true;
+			}
+
+			inline std::string describe_endpoint(const asio::generic::stream_protocol::endpoint &endpoint)
+			{
+				asio::ip::tcp::endpoint tcp;
+				if (!to_tcp_endpoint(endpoint, tcp))
+					return "local";
+
+				std::ostringstream os;
+				os << tcp;
+				return os.str();
+			}
+		}
+
+		// 控制帧 (frame_flags::control) 的 body 的第一个字节
+		enum class control_type : uint8_t
+		{
+			udp_session = 1,	// 服务器告诉客户端 UDP 会话的令牌：令牌 (8 字节，小端)
+		};
+
+		/*
+		报文的所有字节都交给了内核 (写入 socket) 之后在连接的 I/O 线程中调用，ec 为空。
+		连接出错或者关闭的时候，还没有写出去的报文以非空的 ec 结束
+		*/
+		using send_callback = std::function<void(std::error_code ec)>;
+
 		template <typename T>
 		class connection : public std::enable_shared_from_this<connection<T> >
 		{
@@ -30,14 +82,22 @@ namespace olc
 			// 4. 这个连接接收到的数据需要缓冲区存储起来
 			connection(owner parent, 
 				asio::io_context& asioContext, 
-				asio::ip::tcp::socket socket, 
+				stream_socket socket, 
 				tsqueue<owned_message<T> >& qIn)
 				: m_asioContext(asioContext), m_socket( std::move(socket) ), m_qMessagesIn(qIn)
 			{
 				this->m_nOwnerType = parent;
 			}
 
-			virtual ~connection() {}
+			virtual ~connection()
+			{
+				this->FailSends(std::make_error_code(std::errc::operation_canceled));
+				this->FailCalls(std::make_error_code(std::errc::operation_canceled));
+
+				// 等待正在定时器轮的线程中执行的超时回调结束，之后没有别的线程会再访问这个连接
+				for (auto &slot : this->m_dqCalls)
+					slot.deadline.CancelSync();
+			}
 
 			uint32_t GetID() const 
 			{
@@ -54,13 +114,13 @@ namespace olc
 				*/
 				if (this->m_nOwnerType == owner::server)
 				{
-					if (this->m_socket.is_open()) 
+					if (this->IsConnected()) 
 					{
 						this->id = uid;
 						#ifdef __DEBUG_OUT__
 							std::cout <<"add read header into context\n";
 						#endif
-						this->ReadHeader();
+						this->StartReading();
 					}
 				}
 			}
@@ -69,23 +129,43 @@ namespace olc
 			{
 				if (this->m_nOwnerType == owner::client) 
 				{
+					// m_socket 是 generic 的 socket，解析的结果要先转换为 generic 的 endpoint
+					std::vector<asio::generic::stream_protocol::endpoint> vEndpoints;
+					for (const auto &entry : endpoints)
+						vEndpoints.emplace_back(entry.endpoint());
+
 					// 尝试去连接远端
-					asio::async_connect(this->m_socket, endpoints,
-						[this](std::error_code ec, asio::ip::tcp::endpoint endpoint)
+					asio::async_connect(this->m_socket, vEndpoints,
+						[this](std::error_code ec, const asio::generic::stream_protocol::endpoint &)
 						{
 							if (!ec)
 							{	
 								/*
 									一旦连接成功，这个回调函数就会被执行，注册读报文头事件到上下文中
 								*/
-								this->ReadHeader();
+								this->StartReading();
 							}
 						}
 					);
 				}
 			}
 
-			void Disconnect() 
+			// 连接同一台机器上的服务器，endpoint 通常是一个 asio::local::stream_protocol::endpoint
+			void ConnectToServer(const asio::generic::stream_protocol::endpoint &endpoint)
+			{
+				if (this->m_nOwnerType == owner::client) 
+				{
+					this->m_socket.async_connect(endpoint,
+						[this](std::error_code ec)
+						{
+							if (!ec)
+								this->StartReading();
+						}
+					);
+				}
+			}
+
+			virtual void Disconnect() 
 			{
 				//关闭 socket 的操作也是异步进行的
 				if (this->IsConnected())
@@ -99,25 +179,503 @@ namespace olc
 				}
 			}
 
-			bool IsConnected() const
+			virtual bool IsConnected() const
 			{
 				return  this->m_socket.is_open();
 			}
 			void StartListening() { }
 
+			/*
+			设定小报文的合并发送 (见 BundleSmallMessages)：不超过 nMaxMessage 字节的报文会被合并，
+			每个合并的帧不超过 nMaxBundle 字节，nMaxMessage 为 0 表示关闭合并 (默认)。
+			对方必须能够解析 frame_flags::bundle，不认识这个标志的旧版本会把它当成一个很长的 body
+			*/
+			void SetBundling(size_t nMaxMessage, size_t nMaxBundle)
+			{
+				this->m_nBundleMaxMessage = nMaxMessage;
+				this->m_nBundleMaxSize = nMaxBundle;
+			}
+
+			/*
+			body 超过 nFragmentSize 字节的报文切分成分片发送 (frame_flags::fragment)，分片和其它报文轮流发送，
+			其它的报文最多等待一个分片；同时有几个大报文的时候它们的分片也是轮流的。
+			这样大报文可能比在它之后发送的小报文晚到达。接收端总是能够拼接分片，所以只需要发送的一方设定。
+			0 表示不切分 (默认)，需要在开始发送报文之前调用
+			*/
+			void SetFragmentSize(size_t nFragmentSize)
+			{
+				this->m_nFragmentSize = nFragmentSize;
+			}
+
+			/*
+			id 的报文的 body 随着数据的到达一段一段地交给 fnHandler 返回的 sink，不再缓存整个 body (见 net_stream.h)。
+			fnHandler 为空表示取消，需要在连接开始接收之前调用
+			*/
+			void SetStreamHandler(T id, stream_handler<T> fnHandler)
+			{
+				if (fnHandler)
+					this->m_mapStreamHandlers[id] = std::move(fnHandler);
+				else
+					this->m_mapStreamHandlers.erase(id);
+			}
+
+			// 设定线路上的帧格式 (见 net_frame.h)，连接的两端必须一致，需要在连接开始收发之前调用
+			void SetFraming(framing eFraming)
+			{
+				this->m_eFraming = eFraming;
+			}
+
+			/*
+			对这个连接发送的报文开启压缩：body 的长度不小于 nThreshold 的时候才会压缩。
+			接收端总是可以解压，所以只需要发送的一方开启。压缩在调用 Send 的线程当中完成，
+			如果给出了线程池 pPool，就在线程池中完成 (同一个连接的报文仍然保持顺序)，I/O 线程不做压缩。
+			需要在开始发送报文之前调用。
+			*/
+			void EnableCompression(size_t nThreshold, std::shared_ptr<compressor> pCodec = nullptr, 
+				asio::thread_pool *pPool = nullptr)
+			{
+				this->m_nCompressThreshold = nThreshold;
+				this->m_pCompressor = pCodec ? std::move(pCodec) : default_compressor();
+				if (pPool)
+					this->m_pCompressStrand = std::make_unique<asio::strand<asio::thread_pool::executor_type> >(pPool->get_executor());
+			}
+
+			/*
+			body 不小于 nThreshold 的报文使用 MSG_ZEROCOPY 发送 (见 net_zerocopy.h)，body 在内核发送完成之前不会释放。
+			需要在 socket 打开之后、开始发送之前调用，平台或者内核不支持 (或者连接不使用 socket) 的时候返回 false
+			*/
+			bool EnableZeroCopy(size_t nThreshold = zerocopy_default_threshold)
+			{
+#ifdef OLC_NET_ZEROCOPY
+				if (!this->m_socket.is_open() || !zerocopy_tracker<std::unique_ptr<zerocopy_frame> >::Enable(this->m_socket.native_handle()))
+					return false;
+
+				this->m_pZeroCopy = std::make_unique<zerocopy_tracker<std::unique_ptr<zerocopy_frame> > >();
+				this->m_nZeroCopyThreshold = nThreshold;
+				return true;
+#else
+				(void)nThreshold;
+				return false;
+#endif
+			}
+
+			/*
+			把这个连接和一个 UDP 通道关联起来 (见 net_udp.h)。服务器端给出新生成的令牌 nToken，
+			会在通道中注册会话并通过 TCP 把令牌发给客户端；客户端的 nToken 为 0，先注册一个没有令牌的会话
+			(可靠通道的报文在其中排队)，等待服务器发来的令牌。
+			服务器需要在 ConnectToClient 之后调用，客户端需要在 ConnectToServer 之前调用
+			*/
+			void AttachUdp(std::shared_ptr<udp_channel<T> > pChannel, uint64_t nToken = 0)
+			{
+				this->m_pUdp = std::move(pChannel);
+				this->m_pUdpState = std::make_shared<std::atomic<udp_state> >(udp_state::pending);
+				this->m_nUdpKey = nToken;
+				if (nToken == 0)
+				{
+					this->m_pUdp->Register(0, std::weak_ptr<connection<T> >(), this->m_pUdpState);
+					return;
+				}
+
+				this->m_pUdp->Register(nToken, this->weak_from_this(), this->m_pUdpState);
+
+				message<T> msg;
+				msg.header.id = T {};
+				msg.body.resize(1 + sizeof(uint64_t));
+				msg.body[0] = static_cast<uint8_t>(control_type::udp_session);
+				detail::store_scalar(msg.body.data() + 1, nToken);
+				msg.header.size = static_cast<uint32_t>(msg.body.size()) | frame_flags::control;
+				this->QueueMessage(std::move(msg), nullptr);
+			}
+
 		public:
 			/*
 			接收数据的时刻是由操作系统决定的，socket 可以读的时候就是需要接收的时候，所有的接收的过程都
-			是通过事件自动触发的，但是发送就不一样了，这是由服务器或者用户主动进行的过程
+			是通过事件自动触发的，但是发送就不一样了，这是由服务器或者用户主动进行的过程。
+			eMode 不是 delivery::reliable 的时候通过 UDP 通道的对应通道发送 (见 net_udp.h)：
+				unreliable_sequenced  会话还没有建立 (还没有收到过对方的数据报)、已经失败，或者报文太大
+				                      放不进一个数据报的时候，仍然通过 TCP 发送
+				reliable_*            会话建立之前在 UDP 会话中排队；会话失败之后通过 TCP 发送。
+				                      body 超过 udp_max_body (1437 字节) 的报文被拒绝：改走 TCP 会和同一通道上的其它报文乱序
+			通过 TCP 发送的 body 不能超过 frame_flags::size_mask。报文被拒绝的时候返回 false，没有发送任何内容
+			*/
+			bool Send(const message<T>& msg, delivery eMode = delivery::reliable)
+			{
+				if (eMode != delivery::reliable && this->m_pUdp)
+				{
+					udp_state eState = *this->m_pUdpState;
+					bool bFits = msg.body.size() <= udp_max_body;
+					if (eMode == delivery::unreliable_sequenced)
+					{
+						if (eState == udp_state::established && bFits)
+						{
+							this->m_pUdp->Send(this->m_nUdpKey, msg, eMode);
+							return true;
+						}
+					}
+					else if (eState != udp_state::failed)
+					{
+						if (!bFits)
+						{
+							std::cout << "[" << this->id << "] Message Too Large For UDP: " << msg.body.size() << " bytes\n";
+							return false;
+						}
+
+						this->m_pUdp->Send(this->m_nUdpKey, msg, eMode);
+						return true;
+					}
+				}
+
+				return this->SendReliable(msg, nullptr);
+			}
+
+			/*
+			通过 TCP 发送，报文的所有字节都交给内核之后 (不是对方收到之后) 在 I/O 线程中调用 fnSent，
+			调用者可以据此做自己的流量控制，或者尽早释放和报文有关的资源。fnSent 中不能阻塞 I/O 线程。
+			body 超过 frame_flags::size_mask 的报文不会发送，fnSent 立即以 message_size 结束
+			*/
+			void Send(const message<T>& msg, send_callback fnSent)
+			{
+				this->SendReliable(msg, std::move(fnSent));
+			}
+
+			/*
+			和 Send(msg, fnSent) 一样，完成的方式由 asio 的 completion token 决定，签名是 void(std::error_code)：
+				pClient->AsyncSend(msg, asio::use_future).get();
+				co_await pClient->AsyncSend(msg, asio::use_awaitable);
+			*/
+			template <typename CompletionToken>
+			auto AsyncSend(const message<T>& msg, CompletionToken &&token)
+			{
+				return asio::async_initiate<CompletionToken, void(std::error_code)>(
+					[this](auto handler, const message<T>& msg)
+					{
+						// send_callback 需要可以复制，use_awaitable 等的 handler 只能移动
+						auto pHandler = std::make_shared<decltype(handler)>(std::move(handler));
+						this->SendReliable(msg,
+							[pHandler](std::error_code ec)
+							{
+								auto executor = asio::get_associated_executor(*pHandler);
+								asio::dispatch(executor, [pHandler, ec]() { (*pHandler)(ec); });
+							});
+					},
+					token, msg);
+			}
+
+			/*
+			发出一个 RPC 请求 (见 net_rpc.h)，返回调用的编号。回复到达、超过 timeout、被取消或者失败的时候调用一次 fnDone。
+			timeout 为 0 或者没有 SetTimerWheel 的时候不限时。不需要等前一个请求的回复就可以发出下一个请求
+			*/
+			uint32_t Call(const message<T>& msg, std::chrono::steady_clock::duration timeout, rpc_callback<T> fnDone)
+			{
+				return this->StartCall(message<T>(msg), timeout, std::move(fnDone));
+			}
+
+			/*
+			和 Call 一样，完成的方式由 completion token 决定，签名是 void(std::error_code, message<T>)：
+				message<T> reply = pClient->AsyncCall(msg, std::chrono::seconds(1), asio::use_future).get();
+			*/
+			template <typename CompletionToken>
+			auto AsyncCall(const message<T>& msg, std::chrono::steady_clock::duration timeout, CompletionToken &&token)
+			{
+				return async_rpc<T>(std::forward<CompletionToken>(token),
+					[this, msg = message<T>(msg), timeout](rpc_callback<T> fnDone) mutable
+					{
+						this->StartCall(std::move(msg), timeout, std::move(fnDone));
+					});
+			}
+
+			// 取消一个还在等待回复的调用，它以 operation_canceled 结束；调用已经结束的时候返回 false
+			bool Cancel(uint32_t nCall)
+			{
+				return this->FinishCall(nCall, std::make_error_code(std::errc::operation_canceled));
+			}
+
+			// 回复对方的请求 nCall (见 server_interface::OnRequest)，可以在任何线程中调用
+			void Respond(uint32_t nCall, const message<T>& msg)
+			{
+				message<T> reply = msg;
+				put_call_word(reply, (nCall & rpc_word::id_mask) | rpc_word::response);
+				this->SendReliable(reply, nullptr);
+			}
+
+			// 拒绝对方的请求 nCall，对方的调用以 rpc_rejected() 结束
+			void Reject(uint32_t nCall)
+			{
+				message<T> reply;
+				put_call_word(reply, (nCall & rpc_word::id_mask) | rpc_word::response | rpc_word::error);
+				this->SendReliable(reply, nullptr);
+			}
+
+			// 所有还在等待的调用以 ec 结束，例如连接断开之后不会再有回复
+			void FailCalls(std::error_code ec)
+			{
+				std::vector<rpc_callback<T> > vCalls;
+				{
+					std::lock_guard<std::mutex> lock(this->m_muxCalls);
+					for (uint32_t i = 0; i < this->m_dqCalls.size(); ++i)
+					{
+						call_slot &slot = this->m_dqCalls[i];
+						if (!slot.bUsed)
+							continue;
+
+						vCalls.push_back(std::move(slot.fnDone));
+						slot.fnDone = nullptr;
+						slot.bUsed = false;
+						if (++slot.nGen == 0)
+							slot.nGen = 1;
+						this->m_vFreeCalls.push_back(i);
+
+						if (this->m_pTimers)
+							this->m_pTimers->Cancel(slot.deadline);
+					}
+				}
+
+				for (auto &fnDone : vCalls)
+				{
+					message<T> reply;
+					fnDone(ec, reply);
+				}
+			}
+
+			// RPC 的超时使用的定时器轮 (见 net_timer.h)，需要在第一次 Call 之前调用，定时器轮必须比连接活得久
+			void SetTimerWheel(timer_wheel *pTimers)
+			{
+				this->m_pTimers = pTimers;
+			}
+
+			// 连接所在的定时器轮，应用程序的心跳、空闲断开等也可以设定在上面。没有的时候为 nullptr
+			timer_wheel* Timers()
+			{
+				return this->m_pTimers;
+			}
+
+			/*
+			把文件 sPath 的 [nOffset, nOffset + nLength) 作为 id 的文件块发送出去 (见 net_file.h)，nLength 为 0 表示
+			一直到文件的末尾。文件块和普通的报文轮流发送。文件打不开或者这个连接不是 socket 上的连接的时候返回 false，
+			之后的进度和结果通过 fnProgress 在 I/O 线程中通知
+			*/
+			bool SendFile(const std::string &sPath, T id, uint64_t nOffset = 0, uint64_t nLength = 0, file_progress fnProgress = nullptr)
+			{
+#ifdef OLC_NET_SENDFILE
+				if (!this->m_socket.is_open())
+					return false;
+
+				std::error_code ec;
+				std::shared_ptr<file_transfer<T> > pFile = file_transfer<T>::Open(sPath, id, nOffset, nLength, std::move(fnProgress), ec);
+				if (!pFile)
+					return false;
+
+				asio::post(
+					this->m_asioContext,
+					[this, pFile]()
+					{
+						// 和 QueueMessage 一样，发送队列和文件都为空的时候才需要开始发送
+						bool bWriting = this->IsWriting();
+						this->m_qFiles.push_back(pFile);
+
+						// sendfile 不能阻塞 I/O 线程
+						asio::error_code ec;
+						this->m_socket.native_non_blocking(true, ec);
+
+						if (!bWriting)
+							this->StartWriting();
+					}
+				);
+				return true;
+#else
+				(void)sPath; (void)id; (void)nOffset; (void)nLength; (void)fnProgress;
+				return false;
+#endif
+			}
+
+		private:
+			// 报文被拒绝的时候 (fnSent 已经以 message_size 结束) 返回 false
+			bool SendReliable(const message<T>& msg, send_callback fnSent)
+			{
+				/*
+				header.size 的高位是帧标志，body 超过 frame_flags::size_mask 的时候长度会和标志重叠，
+				对方会把它当成控制帧、合并帧等等，整个流都会错乱。分片的前缀中也是同一个 size，切分也没有用
+				*/
+				if (msg.body.size() > frame_flags::size_mask)
+				{
+					std::cout << "[" << this->id << "] Message Too Large: " << msg.body.size() << " bytes\n";
+					if (fnSent)
+						fnSent(std::make_error_code(std::errc::message_size));
+					return false;
+				}
+
+				if (this->m_pCompressStrand)
+				{
+					// 所有的报文都经过同一个 strand，压缩和不压缩的报文之间的顺序不会被打乱
+					asio::post(
+						*this->m_pCompressStrand,
+						[this, msg = message<T>(msg), fnSent = std::move(fnSent)]() mutable
+						{
+							this->CompressMessage(msg);
+							this->QueueMessage(std::move(msg), std::move(fnSent));
+						}
+					);
+				}
+				else if (this->m_pCompressor && msg.body.size() >= this->m_nCompressThreshold)
+				{
+					message<T> out = msg;
+					this->CompressMessage(out);
+					this->QueueMessage(std::move(out), std::move(fnSent));
+				}
+				else 
+				{
+					this->QueueMessage(msg, std::move(fnSent));
+				}
+				return true;
+			}
+
+			// 压缩之后保留原来的标志 (例如 frame_flags::rpc)
+			void CompressMessage(message<T> &msg)
+			{
+				uint32_t nFlags = msg.header.size & frame_flags::mask;
+				if (msg.body.size() >= this->m_nCompressThreshold && compress_body(*this->m_pCompressor, msg.body))
+					msg.header.size = static_cast<uint32_t>(msg.body.size()) | nFlags | frame_flags::compressed;
+			}
+
+			uint32_t StartCall(message<T> request, std::chrono::steady_clock::duration timeout, rpc_callback<T> fnDone)
+			{
+				uint32_t nCall = this->AllocateCall(timeout, fnDone);
+				if (nCall == 0)
+				{
+					message<T> reply;
+					fnDone(std::make_error_code(std::errc::no_buffer_space), reply);
+					return 0;
+				}
+
+				put_call_word(request, nCall);
+
+				// 请求没有能够写出去 (连接已经关闭或者出错) 的时候不用等到超时
+				this->SendReliable(request,
+					[this, nCall](std::error_code ec)
+					{
+						if (ec)
+							this->FinishCall(nCall, ec);
+					});
+				return nCall;
+			}
+
+			// 分配一个调用槽，返回调用的编号 (代数 | 下标)；同时等待的调用太多的时候返回 0
+			uint32_t AllocateCall(std::chrono::steady_clock::duration timeout, rpc_callback<T> &fnDone)
+			{
+				std::lock_guard<std::mutex> lock(this->m_muxCalls);
+
+				uint32_t nSlot = 0;
+				if (!this->m_vFreeCalls.empty())
+				{
+					nSlot = this->m_vFreeCalls.back();
+					this->m_vFreeCalls.pop_back();
+				}
+				else if (this->m_dqCalls.size() < rpc_max_calls)
+				{
+					nSlot = static_cast<uint32_t>(this->m_dqCalls.size());
+					this->m_dqCalls.emplace_back();
+				}
+				else
+				{
+					return 0;
+				}
+
+				call_slot &slot = this->m_dqCalls[nSlot];
+				slot.bUsed = true;
+				slot.fnDone = std::move(fnDone);
+
+				uint32_t nCall = (uint32_t(slot.nGen) << rpc_slot_bits) | nSlot;
+				if (this->m_pTimers && timeout > std::chrono::steady_clock::duration::zero())
+					this->m_pTimers->Schedule(slot.deadline, timeout,
+						[this, nCall]() { this->FinishCall(nCall, std::make_error_code(std::errc::timed_out)); });
+				return nCall;
+			}
+
+		protected:
+			/*
+			取出调用 nCall 的回调并释放它的槽，调用已经结束 (编号的代数不对) 的时候返回空。
+			回调由调用者在锁之外执行
+			*/
+			rpc_callback<T> TakeCall(uint32_t nCall)
+			{
+				uint32_t nSlot = nCall & (rpc_max_calls - 1);
+				uint16_t nGen = static_cast<uint16_t>(nCall >> rpc_slot_bits);
+
+				std::lock_guard<std::mutex> lock(this->m_muxCalls);
+				if (nSlot >= this->m_dqCalls.size())
+					return nullptr;
+
+				call_slot &slot = this->m_dqCalls[nSlot];
+				if (!slot.bUsed || slot.nGen != nGen)
+					return nullptr;
+
+				rpc_callback<T> fnDone = std::move(slot.fnDone);
+				slot.fnDone = nullptr;
+				slot.bUsed = false;
+
+				// 代数 0 不使用，编号总是不为 0
+				if (++slot.nGen == 0)
+					slot.nGen = 1;
+				this->m_vFreeCalls.push_back(nSlot);
+
+				if (this->m_pTimers)
+					this->m_pTimers->Cancel(slot.deadline);
+				return fnDone;
+			}
+
+			// 调用 nCall 以 ec 结束 (超时、取消、发送失败)
+			bool FinishCall(uint32_t nCall, std::error_code ec)
+			{
+				rpc_callback<T> fnDone = this->TakeCall(nCall);
+				if (!fnDone)
+					return false;
+
+				message<T> reply;
+				fnDone(ec, reply);
+				return true;
+			}
+
+			// 回复 msg (已经去掉调用字 nWord) 交给等待的调用，已经结束的调用的回复直接丢弃
+			void CompleteCall(uint32_t nWord, message<T> &msg)
+			{
+				rpc_callback<T> fnDone = this->TakeCall(nWord & rpc_word::id_mask);
+				if (fnDone)
+					InvokeCall(fnDone, nWord, msg);
+			}
+
+			// 按照调用字中的拒绝标志结束一个调用
+			static void InvokeCall(rpc_callback<T> &fnDone, uint32_t nWord, message<T> &msg)
+			{
+				if (nWord & rpc_word::error)
+				{
+					message<T> reply;
+					fnDone(rpc_rejected(), reply);
+				}
+				else
+				{
+					fnDone(std::error_code(), msg);
+				}
+			}
+
+			/*
+			把一个 (已经压缩过的) 报文交给发送的一方，fnSent 可以为空 (见 send_callback)。
+			不使用 socket 的连接 (例如 net_shm.h) 重载它
 			*/
-			void Send(const message<T>& msg)
+			virtual void QueueMessage(message<T> msg, send_callback fnSent)
 			{
 				// 我们通过 Post 将一个写任务加入到上下文当中去，至于这个消息到底是什么时候发送出去的，
 				// 则是上下文所决定的
 				asio::post(
 					this->m_asioContext,
-					[this, msg]()
+					[this, msg = std::move(msg), fnSent = std::move(fnSent)]() mutable
 					{
+						// 连接已经关闭，这个报文不会再写出去了
+						if (fnSent && !this->m_socket.is_open())
+						{
+							fnSent(std::make_error_code(std::errc::not_connected));
+							return;
+						}
+
 						/*
 						我们知道，当发送队列为空的时候，就不再执行发送事件了。如果我们这一次要发送的消息是
 						消息队列中的第一个消息，那么我们需要执行添加写任务到上下文当中去。保证上下文开始监
@@ -126,24 +684,74 @@ namespace olc
 						??? 存在可能的 bug: m_qMessagesOut 当前读出来不是空，但是随后马上其中的数据被
 						发送出去了，并且变成了空
 						*/
-						bool bWritingMessage = !this->m_qMessagesOut.empty();
+						bool bWritingMessage = this->IsWriting();
 						#ifdef __DEBUG_OUT__
 							std::cout << "Push msg into outqueue\n";
 						#endif
-						this->m_qMessagesOut.push_back(msg);
+						uint64_t nSeq = this->m_qMessagesOut.push_back(std::move(msg));
+						if (fnSent)
+							this->m_qSendCallbacks.push_back({ nSeq, std::move(fnSent) });
 
 						if (!bWritingMessage)
 						{
 							#ifdef __DEBUG_OUT__
-								std::cout << "push write header into context\n";
+								std::cout << "push write message into context\n";
 							#endif
-							this->WriteHeader();
+							this->StartWriting();
 						}
 					}
 				);
 			}
 
-		private:
+		protected:
+			/*
+			开始接收和发送的入口，派生类可以替换掉下面这条回调链 (例如 net_connection_coro.h 中的协程实现)。
+			StartReading 在连接建立之后调用一次，StartWriting 在发送队列从空变为非空的时候由 I/O 线程调用
+			*/
+			virtual void StartReading()
+			{
+				if (this->m_eFraming == framing::compact)
+					this->ReadCompact();
+				else
+					this->ReadHeader();
+			}
+
+			virtual void StartWriting()
+			{
+				this->WriteNext();
+			}
+
+			// 发送队列、分片和文件中还有没有要发送的内容，只在 I/O 线程中调用
+			bool IsWriting()
+			{
+#ifdef OLC_NET_SENDFILE
+				if (!this->m_qFiles.empty())
+					return true;
+#endif
+				return !this->m_qMessagesOut.empty() || !this->m_qFragmentsOut.empty();
+			}
+
+			// 写完一个报文、一个分片或者一个文件块之后选择下一次发送的内容：它们轮流发送
+			void WriteNext()
+			{
+				this->TakeLargeMessages();
+#ifdef OLC_NET_SENDFILE
+				if (this->FileTurn())
+				{
+					this->WriteFileChunk();
+					return;
+				}
+#endif
+				if (this->FragmentTurn())
+				{
+					this->WriteFragment();
+					return;
+				}
+
+				if (!this->m_qMessagesOut.empty())
+					this->WriteMessage();
+			}
+
 			// 异步  在上下文准备好读取一个报文的头的时候
 			void ReadHeader()
 			{
@@ -156,11 +764,18 @@ namespace olc
 							#ifdef __DEBUG_OUT__
 								std::cout << "read msg header from socket:" << "size= " << this->m_msgTemporaryIn.header.size << '\n';
 							#endif
-							if (this->m_msgTemporaryIn.header.size > 0)
+							// 高位是帧标志，低位才是 body 的长度
+							uint32_t nBodySize = this->m_msgTemporaryIn.header.size & frame_flags::size_mask;
+							if (nBodySize > 0 && this->BeginStream(this->m_msgTemporaryIn.header))
+							{
+								// 这个 id 的 body 流式接收，不需要整个读入暂存区域
+								this->ReadStream();
+							}
+							else if (nBodySize > 0)
 							{
 								// 从读取到的数据头中可以得到这个数据包的主体部分的长度，因此我们需要初始化暂存区域的大小
 								// 以及向 上下文 注册读取主体部分。
-								this->m_msgTemporaryIn.body.resize(this->m_msgTemporaryIn.header.size);
+								this->m_msgTemporaryIn.body.resize(nBodySize);
 								#ifdef __DEBUG_OUT__
 									std::cout << "add read body into context\n";
 								#endif
@@ -170,91 +785,478 @@ namespace olc
 							{
 								// 如果数据头给出的主体部分的长度为 0， 那么这个数据包就只有头部。此时直接将其提交给 deque 
 								// 当中
+								this->m_msgTemporaryIn.body.clear();
 								this->AddToIncomingMessageQueue();
 							}
 						}
 						else 
 						{
 							std::cout << "[" << this->id << "] Read Header Fail.\n";
+							this->AbandonStreams();
 							this->m_socket.close();
 						}
 					}
 				);
 			}
 
-			void WriteBody()
+			/*
+			把发送队列最前面的报文写入 socket：报头和 body 通过一次聚集写 (gather write) 发送出去。
+			如果队列的最前面有好几个小报文，先把它们打包成一个 bundle 帧 (见 BundleSmallMessages)
+			*/
+			void WriteMessage() 
 			{
+				std::array<asio::const_buffer, 2> buffers = this->PrepareFrontMessage();
+
+#ifdef OLC_NET_ZEROCOPY
+				if (this->m_pZeroCopy && this->m_qMessagesOut.front().body.size() >= this->m_nZeroCopyThreshold)
+				{
+					this->WriteZeroCopy(buffers);
+					return;
+				}
+#endif
+
 				asio::async_write(
-					this->m_socket,
-					asio::buffer(this->m_qMessagesOut.front().body.data(), this->m_qMessagesOut.front().body.size()),
+					this->m_socket, 
+					buffers,
 					[this](std::error_code ec, std::size_t length)
 					{
 						if (!ec)
 						{
 							#ifdef __DEBUG_OUT__
-								std::cout << "msg body have write to socket\n";
+								std::cout << "write msg into socket\n";
 							#endif
 							this->m_qMessagesOut.pop_front();
-							if (!m_qMessagesOut.empty())
-							{
-								/*
-									发送完一个消息，查看发送队列中是否还有数据包发送，如果没有了，就没有必要再注册 WriteHeader了
-									如果还有数据包要发送，那么就需要注册 WriteHeader
-								*/
-								this->WriteHeader();
-							}
+							this->CompleteFrontMessage();
+							/*
+								发送完一个消息，查看发送队列中是否还有数据包 (或者文件块) 发送，如果没有了，就没有必要再注册 WriteMessage了
+								如果还有数据包要发送，那么就需要注册 WriteMessage
+							*/
+							this->WriteNext();
 						}
 						else 
 						{
-							std::cout << "["  << this->id << "] Write Body Fail.\n";
+							std::cout << "[" << this->id << "] Write Message Fail.\n";
 							this->m_socket.close();
+							this->FailSends(ec);
 						}
 					}
 				);
 			}
 
-			void WriteHeader() 
+#ifdef OLC_NET_ZEROCOPY
+			/*
+			零拷贝发送队列最前面的报文。报头复制到 zerocopy_frame 中 (紧凑帧格式的报头缓冲区会被下一个报文覆盖)，
+			body 直接从报文中发送；写完之后报文移动到 zerocopy_frame 中 (vector 的移动不改变数据的地址)，
+			交给 m_pZeroCopy 保存到内核的通知到达为止。报文留在队列中直到写完，QueueMessage 据此判断是否正在发送
+			*/
+			void WriteZeroCopy(const std::array<asio::const_buffer, 2> &buffers)
 			{
-				asio::async_write(
-					this->m_socket, 
-					asio::buffer(&this->m_qMessagesOut.front().header, sizeof(message_header<T>)),
-					[this](std::error_code ec, std::size_t length)
+				auto pFrame = std::make_unique<zerocopy_frame>();
+				pFrame->nHeader = buffers[0].size();
+				std::memcpy(pFrame->aHeader, buffers[0].data(), pFrame->nHeader);
+
+				this->m_pZeroCopyFrame = std::move(pFrame);
+				this->m_nZeroCopySent = 0;
+				this->ContinueZeroCopy();
+			}
+
+			void ContinueZeroCopy()
+			{
+				const message<T> &msg = this->m_qMessagesOut.front();
+				zerocopy_frame &frame = *this->m_pZeroCopyFrame;
+				size_t nTotal = frame.nHeader + msg.body.size();
+
+				while (this->m_nZeroCopySent < nTotal)
+				{
+					iovec aBuffers[2];
+					size_t nBuffers = 0;
+					if (this->m_nZeroCopySent < frame.nHeader)
+						aBuffers[nBuffers++] = { frame.aHeader + this->m_nZeroCopySent, frame.nHeader - this->m_nZeroCopySent };
+					size_t nBodySent = this->m_nZeroCopySent - std::min(this->m_nZeroCopySent, frame.nHeader);
+					aBuffers[nBuffers++] = { const_cast<uint8_t*>(msg.body.data()) + nBodySent, msg.body.size() - nBodySent };
+
+					ssize_t n = this->m_pZeroCopy->Send(this->m_socket.native_handle(), aBuffers, nBuffers);
+					if (n > 0)
 					{
-						if (!ec)
-						{
-							#ifdef __DEBUG_OUT__
-								std::cout << "write msg header into socket\n";
-							#endif
-							if (this->m_qMessagesOut.front().body.size() > 0)
-							{
-								// 数据包的 body 长度不为 0 ，就需要发送数据 body。
-								#ifdef __DEBUG_OUT__
-									std::cout << "add write body into context\n";
-								#endif
-								this->WriteBody();
-							}
-							else // 这个数据包没有 body，只有一个数据头，发送完数据头，这个数据包就完成了发送
+						this->m_nZeroCopySent += static_cast<size_t>(n);
+						continue;
+					}
+
+					if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+					{
+						this->m_socket.async_wait(asio::socket_base::wait_write,
+							[this](std::error_code ec)
 							{
-								this->m_qMessagesOut.pop_front();
-								/*
-									发送完一个消息，查看发送队列中是否还有数据包发送，如果没有了，就没有必要再注册 WriteHeader了
-									如果还有数据包要发送，那么就需要注册 WriteHeader
-								*/
-								if (!m_qMessagesOut.empty())
+								if (!ec)
 								{
-									this->WriteHeader();
+									this->ContinueZeroCopy();
 								}
-							}
+								else
+								{
+									std::cout << "[" << this->id << "] Write Message Fail.\n";
+									this->m_socket.close();
+									this->FailSends(ec);
+								}
+							});
+						return;
+					}
+
+					// ENOBUFS: 固定的内存页超过了 optmem_max，剩下的部分普通地发送
+					if (n < 0 && errno == ENOBUFS)
+					{
+						this->WriteZeroCopyRemainder();
+						return;
+					}
+
+					std::cout << "[" << this->id << "] Write Message Fail.\n";
+					this->m_socket.close();
+					this->FailSends(std::error_code(errno, std::generic_category()));
+					return;
+				}
+
+				this->FinishZeroCopy();
+			}
+
+			// 已经零拷贝发送的部分仍然由 m_pZeroCopyFrame 等待内核的通知
+			void WriteZeroCopyRemainder()
+			{
+				const message<T> &msg = this->m_qMessagesOut.front();
+				zerocopy_frame &frame = *this->m_pZeroCopyFrame;
+				size_t nHeaderSent = std::min(this->m_nZeroCopySent, frame.nHeader);
+				size_t nBodySent = this->m_nZeroCopySent - nHeaderSent;
+
+				std::array<asio::const_buffer, 2> buffers = {
+					asio::buffer(frame.aHeader + nHeaderSent, frame.nHeader - nHeaderSent),
+					asio::buffer(msg.body.data() + nBodySent, msg.body.size() - nBodySent) };
+
+				asio::async_write(this->m_socket, buffers,
+					[this](std::error_code ec, std::size_t length)
+					{
+						if (!ec)
+						{
+							this->FinishZeroCopy();
 						}
-						else 
+						else
+						{
+							std::cout << "[" << this->id << "] Write Message Fail.\n";
+							this->m_socket.close();
+							this->FailSends(ec);
+						}
+					});
+			}
+
+			void FinishZeroCopy()
+			{
+				this->m_pZeroCopyFrame->msg = this->m_qMessagesOut.pop_front();
+				this->CompleteFrontMessage();
+				this->m_pZeroCopy->Hold(std::move(this->m_pZeroCopyFrame));
+				this->ReapZeroCopy();
+
+				// 本机上的对方 (回环) 总是让内核复制一份，零拷贝只剩下固定内存页和通知的开销
+				if (this->m_pZeroCopy->CopiedInARow() >= zerocopy_copied_limit)
+					this->m_nZeroCopyThreshold = std::numeric_limits<size_t>::max();
+
+				this->WriteNext();
+			}
+
+			// 读取错误队列；还有报文在等待内核完成的时候，等待下一个通知 (错误队列非空的时候 socket 报告错误事件)
+			void ReapZeroCopy()
+			{
+				this->m_pZeroCopy->Reap(this->m_socket.native_handle());
+				if (!this->m_pZeroCopy->Pending() || this->m_bZeroCopyWaiting)
+					return;
+
+				this->m_bZeroCopyWaiting = true;
+				this->m_socket.async_wait(asio::socket_base::wait_error,
+					[this](std::error_code ec)
+					{
+						this->m_bZeroCopyWaiting = false;
+						if (!ec)
+							this->ReapZeroCopy();
+					});
+			}
+#endif
+
+			// 发送队列最前面的大报文移到 m_qFragmentsOut 中，分配分片流的编号
+			void TakeLargeMessages()
+			{
+				if (this->m_nFragmentSize == 0)
+					return;
+
+				while (!this->m_qMessagesOut.empty())
+				{
+					const message<T> &msg = this->m_qMessagesOut.front();
+					if (msg.body.size() <= this->m_nFragmentSize || (msg.header.size & (frame_flags::bundle | frame_flags::control)))
+						break;
+
+					this->m_qFragmentsOut.push_back({ this->m_nNextFragmentStream++, 0, this->m_nSendTaken++, this->m_qMessagesOut.pop_front() });
+				}
+			}
+
+			// 有大报文在分片发送，并且发送队列为空或者上一次发送的是队列中的报文
+			bool FragmentTurn()
+			{
+				if (this->m_qFragmentsOut.empty() || (!this->m_qMessagesOut.empty() && !this->m_bFragmentTurn))
+				{
+					this->m_bFragmentTurn = true;
+					return false;
+				}
+
+				this->m_bFragmentTurn = false;
+				return true;
+			}
+
+			void WriteFragment()
+			{
+				asio::async_write(
+					this->m_socket,
+					this->PrepareFragment(),
+					[this](std::error_code ec, std::size_t length)
+					{
+						if (!ec)
 						{
-							std::cout << "[" << this->id << "] Write Header Fail.\n";
+							this->FinishFragment();
+							this->WriteNext();
+						}
+						else
+						{
+							std::cout << "[" << this->id << "] Write Message Fail.\n";
 							this->m_socket.close();
+							this->FailSends(ec);
 						}
 					}
 				);
 			}
 
+			/*
+			m_qFragmentsOut 最前面的报文的下一个分片：报头 (带 frame_flags::fragment) | 分片流的编号 (4 字节) | 
+			原来的报头中的 size (4 字节，包含压缩等标志和完整的 body 长度) | 这一段 body。直到写完之前都有效
+			*/
+			std::array<asio::const_buffer, 2> PrepareFragment()
+			{
+				const fragment_out &f = this->m_qFragmentsOut.front();
+				size_t nData = std::min(this->m_nFragmentSize, f.msg.body.size() - f.nOffset);
+
+				message_header<T> header;
+				header.id = f.msg.header.id;
+				header.size = static_cast<uint32_t>(fragment_prefix + nData) | frame_flags::fragment;
+
+				size_t nHeader = sizeof(header);
+				if (this->m_eFraming == framing::compact)
+					nHeader = encode_compact_header(this->m_aFragmentPrefix, header);
+				else
+					std::memcpy(this->m_aFragmentPrefix, &header, sizeof(header));
+
+				detail::store_scalar(this->m_aFragmentPrefix + nHeader, f.nStream);
+				detail::store_scalar(this->m_aFragmentPrefix + nHeader + sizeof(uint32_t), f.msg.header.size);
+
+				return { asio::buffer(this->m_aFragmentPrefix, nHeader + fragment_prefix),
+					asio::buffer(f.msg.body.data() + f.nOffset, nData) };
+			}
+
+			// 一个分片写完了：最后一个分片写完之后报文就发送完了，否则排到最后，和其它的大报文轮流
+			void FinishFragment()
+			{
+				fragment_out f = std::move(this->m_qFragmentsOut.front());
+				this->m_qFragmentsOut.pop_front();
+
+				f.nOffset += std::min(this->m_nFragmentSize, f.msg.body.size() - f.nOffset);
+				if (f.nOffset < f.msg.body.size())
+					this->m_qFragmentsOut.push_back(std::move(f));
+				else if (!this->m_qSendCallbacks.empty())
+					this->CompleteSends(f.nSeq, 1);
+			}
+
+#ifdef OLC_NET_SENDFILE
+			// 有文件在发送，并且没有普通的报文或者上一次发送的是普通的报文
+			bool FileTurn()
+			{
+				bool bMessages = !this->m_qMessagesOut.empty() || !this->m_qFragmentsOut.empty();
+				if (this->m_qFiles.empty() || (bMessages && !this->m_bFileTurn))
+				{
+					this->m_bFileTurn = true;
+					return false;
+				}
+
+				this->m_bFileTurn = false;
+				return true;
+			}
+
+			void WriteFileChunk()
+			{
+				switch (this->StepFile())
+				{
+					case file_transfer<T>::step::chunk_done:
+						this->WriteNext();
+						break;
+
+					case file_transfer<T>::step::would_block:
+						this->m_socket.async_wait(asio::socket_base::wait_write,
+							[this](std::error_code ec)
+							{
+								if (!ec)
+									this->WriteFileChunk();
+								else
+									this->AbortFiles(ec);
+							});
+						break;
+
+					case file_transfer<T>::step::failed:
+						break;
+				}
+			}
+
+			/*
+			继续发送最前面的文件的当前一块。一块发送完之后通知进度，这个文件排到最后 (几个文件轮流发送)；
+			出错的时候关闭连接，因为线路上已经有了不完整的帧
+			*/
+			typename file_transfer<T>::step StepFile()
+			{
+				std::shared_ptr<file_transfer<T> > pFile = this->m_qFiles.front();
+				auto eStep = pFile->Step(this->m_socket.native_handle(), this->m_eFraming);
+
+				if (eStep == file_transfer<T>::step::chunk_done)
+				{
+					this->m_qFiles.pop_front();
+					pFile->NotifyProgress();
+					if (!pFile->Finished())
+						this->m_qFiles.push_back(std::move(pFile));
+				}
+				else if (eStep == file_transfer<T>::step::failed)
+				{
+					std::cout << "[" << this->id << "] Write File Fail.\n";
+					this->m_socket.close();
+					this->AbortFiles(pFile->Error());
+					this->FailSends(pFile->Error());
+				}
+				return eStep;
+			}
+
+			// 连接出错的时候，所有还没有发送完的文件都以 ec 结束
+			void AbortFiles(std::error_code ec)
+			{
+				auto qFiles = std::move(this->m_qFiles);
+				this->m_qFiles.clear();
+				for (auto &pFile : qFiles)
+					pFile->NotifyError(ec);
+			}
+#endif
+
+			// 合并发送队列最前面的小报文，返回最前面的报文的报头和 body 两段缓冲区，直到写完之前都有效
+			std::array<asio::const_buffer, 2> PrepareFrontMessage()
+			{
+				this->BundleSmallMessages();
+
+				const message<T> &msg = this->m_qMessagesOut.front();
+
+				// 紧凑的帧格式需要先把报头编码出来
+				asio::const_buffer header = asio::buffer(&msg.header, sizeof(message_header<T>));
+				if (this->m_eFraming == framing::compact)
+					header = asio::buffer(this->m_aCompactHeaderOut, 
+						encode_compact_header(this->m_aCompactHeaderOut, msg.header));
+
+				return { header, asio::buffer(msg.body.data(), msg.body.size()) };
+			}
+
+			/*
+			每一个报文都有自己的报头，大量的小报文 (移动、开火 ...) 中报头占了很大的比例。
+			如果发送队列最前面连续有两个以上的小报文，就把它们合并成一个 bundle 帧：外层只有一个报头，
+			body 中依次是每一个报文的紧凑报头 (见 net_frame.h) 和 body，接收端会拆开成原来的报文。
+			只合并队列最前面连续的报文，所以报文之间的顺序不变。
+			*/
+			void BundleSmallMessages()
+			{
+				if (this->m_nBundleMaxMessage == 0 || this->m_qMessagesOut.count() < 2)
+					return;
+
+				auto IsSmall = [this](const message<T> &msg)
+				{
+					return (msg.header.size & frame_flags::bundle) == 0 && msg.body.size() <= this->m_nBundleMaxMessage;
+				};
+
+				if (!IsSmall(this->m_qMessagesOut.front()))
+					return;
+
+				// 第二个报文也足够小才值得打包
+				message<T> first = this->m_qMessagesOut.pop_front();
+				if (!IsSmall(this->m_qMessagesOut.front()))
+				{
+					this->m_qMessagesOut.push_front(first);
+					return;
+				}
+
+				message<T> bundle;
+				bundle.header.id = first.header.id;
+				bundle.body.reserve(this->m_nBundleMaxSize);
+
+				uint8_t aHeader[compact_header_max_size];
+				auto Append = [&](const message<T> &msg, size_t nHeader)
+				{
+					bundle.body.insert(bundle.body.end(), aHeader, aHeader + nHeader);
+					bundle.body.insert(bundle.body.end(), msg.body.begin(), msg.body.end());
+				};
+
+				Append(first, encode_compact_header(aHeader, first.header));
+				this->m_nFrontBundled = 1;
+				while (!this->m_qMessagesOut.empty() && IsSmall(this->m_qMessagesOut.front()))
+				{
+					const message<T> &msg = this->m_qMessagesOut.front();
+					size_t nHeader = encode_compact_header(aHeader, msg.header);
+					if (bundle.body.size() + nHeader + msg.body.size() > this->m_nBundleMaxSize)
+						break;
+
+					Append(msg, nHeader);
+					this->m_qMessagesOut.pop_front();
+					this->m_nFrontBundled++;
+				}
+
+				bundle.header.size = static_cast<uint32_t>(bundle.body.size()) | frame_flags::bundle;
+				this->m_qMessagesOut.push_front(bundle);
+			}
+
+			/*
+			发送队列最前面的报文 (或者 bundle) 写完并且已经从队列中取出。发送队列中报文的编号就是 push_back 的序号，
+			所以取出的报文的编号是连续的，分片发送的报文在 TakeLargeMessages 中取得编号
+			*/
+			void CompleteFrontMessage()
+			{
+				size_t nCount = std::max<size_t>(this->m_nFrontBundled, 1);
+				uint64_t nFirst = this->m_nSendTaken;
+				this->m_nFrontBundled = 0;
+				this->m_nSendTaken += nCount;
+
+				// 没有等待完成通知的报文的时候，没有额外的开销
+				if (!this->m_qSendCallbacks.empty())
+					this->CompleteSends(nFirst, nCount);
+			}
+
+			// 编号为 [nFirst, nFirst + nCount) 的报文写完了。分片发送的报文会晚于之后的报文写完，所以不一定在最前面
+			void CompleteSends(uint64_t nFirst, size_t nCount)
+			{
+				auto it = this->m_qSendCallbacks.begin();
+				while (it != this->m_qSendCallbacks.end() && it->nSeq < nFirst + nCount)
+				{
+					if (it->nSeq < nFirst)
+					{
+						++it;
+						continue;
+					}
+
+					send_callback fnSent = std::move(it->fnSent);
+					it = this->m_qSendCallbacks.erase(it);
+					fnSent(std::error_code());
+				}
+			}
+
+			// 连接出错：所有等待完成通知的报文都以 ec 结束
+			void FailSends(std::error_code ec)
+			{
+				auto qCallbacks = std::move(this->m_qSendCallbacks);
+				this->m_qSendCallbacks.clear();
+				for (auto &pending : qCallbacks)
+					pending.fnSent(ec);
+			}
+
 			// 读取一个数据包的主体部分
 			void ReadBody()
 			{
@@ -266,39 +1268,433 @@ namespace olc
 						if (!ec)
 						{
 							// 读取成功，将数据存储到 deque 当中
-							std::cout << "have read body into m_msgTemporaryIn\n";
+							#ifdef __DEBUG_OUT__
+								std::cout << "have read body into m_msgTemporaryIn\n";
+							#endif
 							this->AddToIncomingMessageQueue();
 						}
 						else 
 						{
 							std::cout << "["  << this->id << "] Read Body Fail.\n";
+							this->AbandonStreams();
 							this->m_socket.close();
 						}
 					}
 				);
 			}
 
-			void AddToIncomingMessageQueue()
+			// 流式接收一个 body：每次最多读取 stream_chunk_size 字节交给 sink，读完之后继续读取下一个报头
+			void ReadStream()
+			{
+				// 标准帧格式下不使用接收缓冲区，用它来存放这一段数据
+				size_t nChunk = std::min(this->m_nStreamLeft, stream_chunk_size);
+				if (this->m_vReadBuffer.size() < nChunk)
+					this->m_vReadBuffer.resize(nChunk);
+
+				asio::async_read(
+					this->m_socket,
+					asio::buffer(this->m_vReadBuffer.data(), nChunk),
+					[this](std::error_code ec, std::size_t length)
+					{
+						if (!ec)
+						{
+							if (!this->StreamIncoming(this->m_vReadBuffer.data(), length))
+								return;
+
+							if (this->m_nStreamLeft > 0)
+								this->ReadStream();
+							else
+								this->ReadHeader();
+						}
+						else 
+						{
+							std::cout << "["  << this->id << "] Read Body Fail.\n";
+							this->AbandonStreams();
+							this->m_socket.close();
+						}
+					}
+				);
+			}
+
+			/*
+			紧凑的帧格式：报头的长度不固定，所以不再分两次读取报头和 body，而是尽可能多地读入接收缓冲区，
+			再从缓冲区中切分出完整的帧，一次读取可以得到很多个小报文
+			*/
+			void ReadCompact()
+			{
+				// 保证缓冲区的末尾有空闲的空间
+				if (this->m_vReadBuffer.size() - this->m_nReadEnd < nReadChunkSize)
+					this->m_vReadBuffer.resize(this->m_nReadEnd + nReadChunkSize);
+
+				this->m_socket.async_read_some(
+					asio::buffer(this->m_vReadBuffer.data() + this->m_nReadEnd, this->m_vReadBuffer.size() - this->m_nReadEnd),
+					[this](std::error_code ec, std::size_t length)
+					{
+						if (!ec)
+						{
+							this->m_nReadEnd += length;
+							if (this->ParseCompactFrames())
+								this->ReadCompact();
+						}
+						else 
+						{
+							std::cout << "[" << this->id << "] Read Fail.\n";
+							this->AbandonStreams();
+							this->m_socket.close();
+						}
+					}
+				);
+			}
+
+			// 从接收缓冲区中切分出所有完整的帧，格式错误的时候关闭连接并返回 false
+			bool ParseCompactFrames()
+			{
+				size_t nPos = 0;
+				while (true)
+				{
+					if (!this->StreamBuffered(nPos))
+						return false;
+					if (this->m_nStreamLeft > 0)
+						break;
+
+					const uint8_t *p = this->m_vReadBuffer.data() + nPos;
+					size_t nAvail = this->m_nReadEnd - nPos;
+
+					size_t nHeader = decode_compact_header(p, nAvail, this->m_msgTemporaryIn.header);
+					if (nHeader == compact_header_invalid)
+					{
+						std::cout << "[" << this->id << "] Invalid Frame Header.\n";
+						this->m_socket.close();
+						return false;
+					}
+					if (nHeader == 0)
+						break;
+
+					size_t nBody = this->m_msgTemporaryIn.header.size & frame_flags::size_mask;
+					if (nBody > 0 && this->BeginStream(this->m_msgTemporaryIn.header))
+					{
+						// body 交给 sink，缓冲区不需要容纳整个帧
+						nPos += nHeader;
+						continue;
+					}
+
+					if (nAvail < nHeader + nBody)
+					{
+						// body 还没有接收完整，保证缓冲区能够容纳整个帧，下一次读取可以一次读完
+						if (this->m_vReadBuffer.size() < nPos + nHeader + nBody)
+							this->m_vReadBuffer.resize(nPos + nHeader + nBody);
+						break;
+					}
+
+					this->m_msgTemporaryIn.body.assign(p + nHeader, p + nHeader + nBody);
+					nPos += nHeader + nBody;
+
+					if (!this->ProcessIncomingFrame())
+						return false;
+				}
+
+				// 把还没有处理的数据移动到缓冲区的开头
+				if (nPos > 0)
+				{
+					std::memmove(this->m_vReadBuffer.data(), this->m_vReadBuffer.data() + nPos, this->m_nReadEnd - nPos);
+					this->m_nReadEnd -= nPos;
+				}
+				return true;
+			}
+
+			/*
+			如果 header 的 body 需要流式接收，返回 handler 打开的 sink。
+			只有普通的报文可以流式接收：压缩的 body 要完整地解压，bundle、分片和控制帧由连接自己处理
+			*/
+			std::unique_ptr<body_sink> OpenStream(const message_header<T> &header)
+			{
+				if (this->m_mapStreamHandlers.empty() || (header.size & frame_flags::mask) != 0 || 
+					(header.size & frame_flags::size_mask) == 0)
+					return nullptr;
+
+				auto it = this->m_mapStreamHandlers.find(header.id);
+				if (it == this->m_mapStreamHandlers.end())
+					return nullptr;
+
+				return it->second(this->m_nOwnerType == owner::server ? this->shared_from_this() : nullptr, header);
+			}
+
+			// 开始流式接收 header 的 body，不需要的时候返回 false
+			bool BeginStream(const message_header<T> &header)
+			{
+				this->m_pStreamSink = this->OpenStream(header);
+				if (!this->m_pStreamSink)
+					return false;
+
+				this->m_nStreamLeft = header.size & frame_flags::size_mask;
+				return true;
+			}
+
+			// 把 body 中接下来的 nLength 字节交给 sink，body 收完之后通知 sink。sink 出错的时候关闭连接并返回 false
+			bool StreamIncoming(const uint8_t *pData, size_t nLength)
+			{
+				this->m_nStreamLeft -= nLength;
+				if (!this->m_pStreamSink->Write(pData, nLength))
+				{
+					std::cout << "["  << this->id << "] Stream Write Fail.\n";
+					this->AbandonStreams();
+					this->m_socket.close();
+					return false;
+				}
+
+				if (this->m_nStreamLeft == 0)
+				{
+					this->m_pStreamSink->Finish();
+					this->m_pStreamSink.reset();
+				}
+				return true;
+			}
+
+			// 连接断开或者出错的时候释放所有还没有收完的 body 的 sink (包括分片拼接中的)，不调用 Finish
+			void AbandonStreams()
+			{
+				this->m_pStreamSink.reset();
+				this->m_nStreamLeft = 0;
+				this->m_mapFragmentsIn.clear();
+			}
+
+			// 接收缓冲区中从 nPos 开始的数据属于正在流式接收的 body 的时候，把它们交给 sink 并移动 nPos
+			bool StreamBuffered(size_t &nPos)
+			{
+				size_t nLength = std::min(this->m_nReadEnd - nPos, this->m_nStreamLeft);
+				if (nLength == 0)
+					return true;
+
+				if (!this->StreamIncoming(this->m_vReadBuffer.data() + nPos, nLength))
+					return false;
+				nPos += nLength;
+				return true;
+			}
+
+			/*
+			按照帧标志处理 m_msgTemporaryIn 中一个完整接收的帧 (解压，拆开 bundle)，然后放入接收队列。
+			出错的时候关闭连接并返回 false
+			*/
+			bool ProcessIncomingFrame()
+			{
+				if (this->m_msgTemporaryIn.header.size & frame_flags::bundle)
+					return this->UnbundleIncoming();
+
+				if (this->m_msgTemporaryIn.header.size & frame_flags::fragment)
+					return this->ReassembleIncoming();
+
+				return this->DeliverIncoming(this->m_msgTemporaryIn);
+			}
+
+			// 控制帧由连接自己处理，RPC 的回复交给等待的调用，其余的报文 (包括 RPC 的请求) 解压之后放入接收队列
+			bool DeliverIncoming(message<T> &msg)
+			{
+				if (msg.header.size & frame_flags::control)
+				{
+					this->HandleControl(msg);
+					return true;
+				}
+
+				if (!this->DecodeIncoming(msg))
+					return false;
+
+				uint32_t nWord = 0;
+				if (peek_call_word(msg, nWord))
+				{
+					if (nWord & rpc_word::response)
+					{
+						take_call_word(msg, nWord);
+						this->CompleteCall(nWord, msg);
+						return true;
+					}
+
+					// 只有服务器有处理请求的地方 (server_interface::OnRequest)，客户端收到的请求直接拒绝，不交给应用程序
+					if (this->m_nOwnerType == owner::client)
+					{
+						this->Reject(nWord & rpc_word::id_mask);
+						return true;
+					}
+				}
+
+				this->PushIncoming(msg);
+				return true;
+			}
+
+			// 不认识的控制帧直接忽略，以便以后增加新的控制帧
+			void HandleControl(const message<T> &msg)
+			{
+				if (msg.body.empty())
+					return;
+
+				switch (static_cast<control_type>(msg.body[0]))
+				{
+					case control_type::udp_session:
+					{
+						if (this->m_nOwnerType != owner::client || !this->m_pUdp || msg.body.size() != 1 + sizeof(uint64_t))
+							break;
+
+						uint64_t nToken = 0;
+						detail::load_scalar(msg.body.data() + 1, nToken);
+
+						// 服务器的 UDP 通道和 TCP 使用同一个端口
+						asio::error_code ec;
+						asio::ip::tcp::endpoint server;
+						if (!detail::to_tcp_endpoint(this->m_socket.remote_endpoint(ec), server) || ec)
+							break;
+
+						this->m_pUdp->SetPeer(this->m_nUdpKey, nToken, asio::ip::udp::endpoint(server.address(), server.port()));
+					}
+					break;
+				}
+			}
+
+			bool DecodeIncoming(message<T> &msg)
+			{
+				if (msg.header.size & frame_flags::compressed)
+				{
+					if (!decompress_body(this->m_pCompressor.get(), msg.body, frame_flags::size_mask))
+					{
+						std::cout << "["  << this->id << "] Decompress Body Fail.\n";
+						this->m_socket.close();
+						return false;
+					}
+				}
+				// RPC 的请求保留标志和调用字，服务器上由 server_interface::Update 交给 OnRequest
+				msg.header.size = static_cast<uint32_t>(msg.body.size()) | (msg.header.size & frame_flags::rpc);
+				return true;
+			}
+
+			// 把一个 bundle 帧拆开成原来的报文，依次放入接收队列
+			bool UnbundleIncoming()
+			{
+				const std::vector<uint8_t> &vBundle = this->m_msgTemporaryIn.body;
+				size_t nPos = 0;
+				while (nPos < vBundle.size())
+				{
+					message<T> msg;
+					size_t nHeader = decode_compact_header(vBundle.data() + nPos, vBundle.size() - nPos, msg.header);
+					size_t nBody = msg.header.size & frame_flags::size_mask;
+					if (nHeader == 0 || nHeader == compact_header_invalid || 
+						(msg.header.size & frame_flags::bundle) || vBundle.size() - nPos - nHeader < nBody)
+					{
+						std::cout << "["  << this->id << "] Invalid Bundle.\n";
+						this->m_socket.close();
+						return false;
+					}
+
+					const uint8_t *p = vBundle.data() + nPos + nHeader;
+					msg.body.assign(p, p + nBody);
+					nPos += nHeader + nBody;
+
+					if (!this->DeliverIncoming(msg))
+						return false;
+				}
+				return true;
+			}
+
+			// 把一个分片接到同一个分片流的报文后面，报文完整之后和普通的帧一样处理 (见 PrepareFragment)
+			bool ReassembleIncoming()
+			{
+				const std::vector<uint8_t> &vFrame = this->m_msgTemporaryIn.body;
+				uint32_t nStream = 0;
+				uint32_t nSize = 0;
+				bool bValid = vFrame.size() >= fragment_prefix;
+				if (bValid)
+				{
+					detail::load_scalar(vFrame.data(), nStream);
+					detail::load_scalar(vFrame.data() + sizeof(uint32_t), nSize);
+				}
+
+				auto it = this->m_mapFragmentsIn.find(nStream);
+				if (bValid && it == this->m_mapFragmentsIn.end())
+				{
+					// 同时拼接的报文的个数有上限，分片中不会再有分片或者 bundle
+					bValid = this->m_mapFragmentsIn.size() < fragment_max_streams &&
+						(nSize & (frame_flags::fragment | frame_flags::bundle)) == 0;
+					if (bValid)
+					{
+						it = this->m_mapFragmentsIn.emplace(nStream, fragment_in()).first;
+						it->second.msg.header.id = this->m_msgTemporaryIn.header.id;
+						it->second.msg.header.size = nSize;
+
+						// 流式接收的报文不拼接，每个分片直接交给 sink
+						it->second.pSink = this->OpenStream(it->second.msg.header);
+						if (!it->second.pSink)
+							it->second.msg.body.reserve(nSize & frame_flags::size_mask);
+					}
+				}
+
+				size_t nData = vFrame.size() - std::min(vFrame.size(), fragment_prefix);
+				if (!bValid || it->second.msg.header.size != nSize || 
+					it->second.nReceived + nData > (nSize & frame_flags::size_mask))
+				{
+					std::cout << "["  << this->id << "] Invalid Fragment.\n";
+					this->AbandonStreams();
+					this->m_socket.close();
+					return false;
+				}
+
+				it->second.nReceived += nData;
+				if (!it->second.pSink)
+					it->second.msg.body.insert(it->second.msg.body.end(), vFrame.begin() + fragment_prefix, vFrame.end());
+				else if (nData > 0 && !it->second.pSink->Write(vFrame.data() + fragment_prefix, nData))
+				{
+					std::cout << "["  << this->id << "] Stream Write Fail.\n";
+					this->AbandonStreams();
+					this->m_socket.close();
+					return false;
+				}
+
+				if (it->second.nReceived < (nSize & frame_flags::size_mask))
+					return true;
+
+				if (it->second.pSink)
+				{
+					it->second.pSink->Finish();
+					this->m_mapFragmentsIn.erase(it);
+					return true;
+				}
+
+				message<T> msg = std::move(it->second.msg);
+				this->m_mapFragmentsIn.erase(it);
+				return this->DeliverIncoming(msg);
+			}
+
+			void PushIncoming(const message<T> &msg)
 			{
 				#ifdef __DEBUG_OUT__
 					std::cout << "send message into m_qMessagesIn\n";
 				#endif
 				if (this->m_nOwnerType == owner::server)
-					this->m_qMessagesIn.push_back( { this->shared_from_this(), m_msgTemporaryIn } );
+					this->m_qMessagesIn.push_back( { this->shared_from_this(), msg } );
 				else 
-					this->m_qMessagesIn.push_back( { nullptr, m_msgTemporaryIn } );
-				// 完成了一个完整的数据包的接收过程，此时重新将读取报文事件注册到 上下文(context) 当中
-				this->ReadHeader();
+					this->m_qMessagesIn.push_back( { nullptr, msg } );
 			}
 
+			void AddToIncomingMessageQueue()
+			{
+				// 完成了一个完整的数据包的接收过程，此时重新将读取报文事件注册到 上下文(context) 当中
+				if (this->ProcessIncomingFrame())
+					this->ReadHeader();
+			}
 
 		protected:
-			asio::ip::tcp::socket m_socket;
+			stream_socket m_socket;
 
 			asio::io_context& m_asioContext;
 
 			tsqueue<message<T> > m_qMessagesOut;
 
+			// 等待完成通知的报文 (见 send_callback)，按照编号排序，只在 I/O 线程中访问
+			struct pending_send
+			{
+				uint64_t nSeq;
+				send_callback fnSent;
+			};
+			std::deque<pending_send> m_qSendCallbacks;
+			uint64_t m_nSendTaken = 0;		// 发送队列最前面的报文的编号
+			size_t m_nFrontBundled = 0;		// 发送队列最前面的 bundle 中合并了几个报文，不是 bundle 的时候为 0
+
 			tsqueue<owned_message<T> >& m_qMessagesIn;
 
 			message<T> m_msgTemporaryIn;
@@ -307,6 +1703,102 @@ namespace olc
 
 			// 每一个连接拥有一个自己的唯一的标识符
 			uint32_t id = 0;
+
+			// 发送报文时使用的压缩器，为空表示不压缩
+			std::shared_ptr<compressor> m_pCompressor;
+			size_t m_nCompressThreshold = 0;
+			std::unique_ptr<asio::strand<asio::thread_pool::executor_type> > m_pCompressStrand;
+
+			framing m_eFraming = framing::standard;
+
+			// 不超过 m_nBundleMaxMessage 字节的报文会被合并发送，每个 bundle 帧不超过 m_nBundleMaxSize 字节
+			size_t m_nBundleMaxMessage = 0;
+			size_t m_nBundleMaxSize = 1400;
+
+			// 紧凑帧格式下编码好的报头
+			uint8_t m_aCompactHeaderOut[compact_header_max_size];
+
+			// 紧凑帧格式下的接收缓冲区，[0, m_nReadEnd) 是已经接收但还没有处理的数据
+			static constexpr size_t nReadChunkSize = 16 * 1024;
+			std::vector<uint8_t> m_vReadBuffer;
+			size_t m_nReadEnd = 0;
+
+#ifdef OLC_NET_ZEROCOPY
+			// 零拷贝发送中的一个帧：报头的副本和写完之后移动进来的报文
+			struct zerocopy_frame
+			{
+				uint8_t aHeader[std::max(compact_header_max_size, sizeof(message_header<T>))];
+				size_t nHeader = 0;
+				message<T> msg;
+			};
+
+			// 连续这么多次通知表示内核复制了数据之后，这个连接不再使用零拷贝
+			static constexpr size_t zerocopy_copied_limit = 16;
+
+			std::unique_ptr<zerocopy_tracker<std::unique_ptr<zerocopy_frame> > > m_pZeroCopy;
+			size_t m_nZeroCopyThreshold = zerocopy_default_threshold;
+			std::unique_ptr<zerocopy_frame> m_pZeroCopyFrame;
+			size_t m_nZeroCopySent = 0;
+			bool m_bZeroCopyWaiting = false;
+#endif
+
+			// 分片发送中的大报文，只在 I/O 线程中访问；m_bFragmentTurn 表示下一次应该发送分片
+			struct fragment_out
+			{
+				uint32_t nStream;
+				size_t nOffset;		// 下一个分片在 body 中的位置
+				uint64_t nSeq;		// 报文在发送队列中的编号 (见 CompleteFrontMessage)
+				message<T> msg;
+			};
+
+			// 分片的 body 开头的 分片流的编号 | 原来的 size
+			static constexpr size_t fragment_prefix = 2 * sizeof(uint32_t);
+			// 接收端同时拼接的报文的上限
+			static constexpr size_t fragment_max_streams = 256;
+
+			size_t m_nFragmentSize = 0;
+			std::deque<fragment_out> m_qFragmentsOut;
+			uint32_t m_nNextFragmentStream = 0;
+			bool m_bFragmentTurn = false;
+			uint8_t m_aFragmentPrefix[std::max(compact_header_max_size, sizeof(message_header<T>)) + fragment_prefix];
+
+			// 接收端正在拼接 (或者流式接收) 的报文，nReceived 是已经收到的 body 的长度
+			struct fragment_in
+			{
+				message<T> msg;
+				std::unique_ptr<body_sink> pSink;
+				size_t nReceived = 0;
+			};
+			std::unordered_map<uint32_t, fragment_in> m_mapFragmentsIn;
+
+			// 流式接收 (见 net_stream.h)：每个 id 的 handler，正在接收的 body 的 sink 和还没有收到的长度
+			stream_handler_map<T> m_mapStreamHandlers;
+			std::unique_ptr<body_sink> m_pStreamSink;
+			size_t m_nStreamLeft = 0;
+
+#ifdef OLC_NET_SENDFILE
+			// 正在发送的文件，只在 I/O 线程中访问；m_bFileTurn 表示下一次应该发送文件块
+			std::deque<std::shared_ptr<file_transfer<T> > > m_qFiles;
+			bool m_bFileTurn = false;
+#endif
+
+			// RPC 的调用槽 (见 net_rpc.h)，用 deque 保存，定时器的地址不会改变；空闲的槽的下标在 m_vFreeCalls 中
+			struct call_slot
+			{
+				uint16_t nGen = 1;
+				bool bUsed = false;
+				rpc_callback<T> fnDone;
+				timer_wheel::timer deadline;
+			};
+			std::mutex m_muxCalls;
+			std::deque<call_slot> m_dqCalls;
+			std::vector<uint32_t> m_vFreeCalls;
+			timer_wheel *m_pTimers = nullptr;
+
+			// 并行的 UDP 通道和这个连接的会话令牌，令牌为 0 表示会话还没有建立
+			std::shared_ptr<udp_channel<T> > m_pUdp;
+			uint64_t m_nUdpKey = 0;		// 通道中会话的键：服务器上是令牌，客户端上是 0
+			std::shared_ptr<std::atomic<udp_state> > m_pUdpState;
 		};
 	}
 }
@@ -0,0 +1,227 @@
+#ifndef __NET_CONNECTION_CORO_H__
+#define __NET_CONNECTION_CORO_H__
+
+#include "net_common.h"
+#include "net_connection.h"
+
+/*
+基于 C++20 协程 (asio::awaitable / co_spawn) 的连接：
+
+connection<T> 的收发是一条回调链 ReadHeader -> ReadBody -> AddToIncomingMessageQueue -> ReadHeader，
+发送也是 WriteMessage -> 完成回调 -> WriteMessage，很难在中间加入超时、取消或者批处理。
+coro_connection<T> 把它们改写成每个连接两个顺序执行的协程：
+
+	ReadLoop:  读报头 -> 读 body -> 放入接收队列 -> ...   (紧凑帧格式下是 读入缓冲区 -> 切分帧，流式接收的 body 交给 sink)
+	WriteLoop: 发送队列为空的时候等待 -> 合并小报文 -> 聚集写 -> ...   (和大报文的分片、文件块轮流)
+
+报文的格式、帧格式、压缩、合并发送和接收队列都和 connection<T> 完全一样，两种连接可以互相通信。
+协程只在连接建立的时候创建一次，之后的每一个报文都不会再分配协程帧；asio 的协程帧和异步操作
+使用的内存都来自每个线程自己的回收缓存 (thread_info_base)，不会反复调用 operator new。
+
+需要编译器支持协程 (-std=c++20)，否则这个头文件是空的。服务器和客户端通过重载 CreateConnection
+来使用它：
+
+	std::shared_ptr<olc::net::connection<T> > CreateConnection(olc::net::stream_socket socket) override
+	{
+		return std::make_shared<olc::net::coro_connection<T> >(olc::net::connection<T>::owner::server,
+			this->m_asioContext, std::move(socket), this->m_qMessageIn);
+	}
+*/
+
+#ifdef ASIO_HAS_CO_AWAIT
+
+namespace olc
+{
+	namespace net
+	{
+		template <typename T>
+		class coro_connection : public connection<T>
+		{
+		public:
+			coro_connection(typename connection<T>::owner parent,
+				asio::io_context& asioContext,
+				stream_socket socket,
+				tsqueue<owned_message<T> >& qIn)
+				: connection<T>(parent, asioContext, std::move(socket), qIn),
+				  m_timerWrite(asioContext, asio::steady_timer::time_point::max())
+			{
+
+			}
+
+		protected:
+			void StartReading() override
+			{
+				asio::co_spawn(this->m_asioContext, this->ReadLoop(), asio::detached);
+				asio::co_spawn(this->m_asioContext, this->WriteLoop(), asio::detached);
+			}
+
+			void StartWriting() override
+			{
+				// WriteLoop 在发送队列为空的时候等待这个定时器，取消它就可以唤醒 WriteLoop
+				this->m_timerWrite.cancel_one();
+			}
+
+		private:
+			asio::awaitable<void> ReadLoop()
+			{
+				asio::error_code ec;
+				auto token = asio::redirect_error(asio::use_awaitable, ec);
+
+				if (this->m_eFraming == framing::compact)
+				{
+					while (true)
+					{
+						if (this->m_vReadBuffer.size() - this->m_nReadEnd < connection<T>::nReadChunkSize)
+							this->m_vReadBuffer.resize(this->m_nReadEnd + connection<T>::nReadChunkSize);
+
+						size_t nLength = co_await this->m_socket.async_read_some(
+							asio::buffer(this->m_vReadBuffer.data() + this->m_nReadEnd, this->m_vReadBuffer.size() - this->m_nReadEnd),
+							token);
+						if (ec)
+						{
+							std::cout << "[" << this->id << "] Read Fail.\n";
+							break;
+						}
+
+						this->m_nReadEnd += nLength;
+						if (!this->ParseCompactFrames())
+							break;
+					}
+				}
+				else
+				{
+					while (true)
+					{
+						co_await asio::async_read(this->m_socket,
+							asio::buffer(&this->m_msgTemporaryIn.header, sizeof(message_header<T>)), token);
+						if (ec)
+						{
+							std::cout << "[" << this->id << "] Read Header Fail.\n";
+							break;
+						}
+
+						size_t nBody = this->m_msgTemporaryIn.header.size & frame_flags::size_mask;
+						if (nBody > 0 && this->BeginStream(this->m_msgTemporaryIn.header))
+						{
+							// 流式接收 (见 net_stream.h)：一段一段地读入缓冲区交给 sink
+							bool bStreamed = true;
+							while (bStreamed && this->m_nStreamLeft > 0)
+							{
+								size_t nChunk = std::min(this->m_nStreamLeft, stream_chunk_size);
+								if (this->m_vReadBuffer.size() < nChunk)
+									this->m_vReadBuffer.resize(nChunk);
+
+								co_await asio::async_read(this->m_socket, asio::buffer(this->m_vReadBuffer.data(), nChunk), token);
+								if (ec)
+								{
+									std::cout << "["  << this->id << "] Read Body Fail.\n";
+									break;
+								}
+
+								bStreamed = this->StreamIncoming(this->m_vReadBuffer.data(), nChunk);
+							}
+
+							if (ec || !bStreamed)
+								break;
+							continue;
+						}
+
+						this->m_msgTemporaryIn.body.resize(nBody);
+						if (!this->m_msgTemporaryIn.body.empty())
+						{
+							co_await asio::async_read(this->m_socket,
+								asio::buffer(this->m_msgTemporaryIn.body.data(), this->m_msgTemporaryIn.body.size()), token);
+							if (ec)
+							{
+								std::cout << "["  << this->id << "] Read Body Fail.\n";
+								break;
+							}
+						}
+
+						if (!this->ProcessIncomingFrame())
+							break;
+					}
+				}
+
+				// 读失败或者帧格式错误：释放没有收完的 sink，关闭连接，并唤醒 WriteLoop 让它退出
+				this->AbandonStreams();
+				this->m_socket.close();
+				this->m_timerWrite.cancel();
+			}
+
+			asio::awaitable<void> WriteLoop()
+			{
+				asio::error_code ec;
+				auto token = asio::redirect_error(asio::use_awaitable, ec);
+
+				while (this->m_socket.is_open())
+				{
+					this->TakeLargeMessages();
+
+#ifdef OLC_NET_SENDFILE
+					// 普通的报文和文件块轮流发送 (见 connection<T>::SendFile)
+					if (this->FileTurn())
+					{
+						auto eStep = this->StepFile();
+						while (eStep == file_transfer<T>::step::would_block)
+						{
+							co_await this->m_socket.async_wait(asio::socket_base::wait_write, token);
+							if (ec)
+							{
+								this->AbortFiles(ec);
+								break;
+							}
+							eStep = this->StepFile();
+						}
+						continue;
+					}
+#endif
+
+					// 大报文的分片和发送队列中的报文轮流发送 (见 connection<T>::SetFragmentSize)
+					if (this->FragmentTurn())
+					{
+						co_await asio::async_write(this->m_socket, this->PrepareFragment(), token);
+						if (ec)
+						{
+							std::cout << "[" << this->id << "] Write Message Fail.\n";
+							this->m_socket.close();
+							break;
+						}
+
+						this->FinishFragment();
+						continue;
+					}
+
+					if (this->m_qMessagesOut.empty())
+					{
+						// 被 StartWriting 或者 ReadLoop 取消的时候 ec 为 operation_aborted，都只需要重新检查
+						co_await this->m_timerWrite.async_wait(token);
+						continue;
+					}
+
+					co_await asio::async_write(this->m_socket, this->PrepareFrontMessage(), token);
+					if (ec)
+					{
+						std::cout << "[" << this->id << "] Write Message Fail.\n";
+						this->m_socket.close();
+						break;
+					}
+
+					this->m_qMessagesOut.pop_front();
+					this->CompleteFrontMessage();
+				}
+
+				// 连接关闭之后不会再写出任何报文
+				this->FailSends(ec ? std::error_code(ec) : std::make_error_code(std::errc::not_connected));
+			}
+
+		private:
+			// 只用来唤醒 WriteLoop，永远不会自己到期
+			asio::steady_timer m_timerWrite;
+		};
+	}
+}
+
+#endif
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef __NET_DISPATCH_H__
+#define __NET_DISPATCH_H__
+
+#include "net_common.h"
+#include "net_message.h"
+
+/*
+编译期生成的报文分发表：
+
+服务器和客户端原来都在 OnMessage 中手写 switch(msg.header.id)，既不检查类型，也不负责解码报文。
+message_dispatcher 把每一个报文 id 映射到一个带类型的处理函数：
+
+	using dispatcher = olc::net::message_dispatcher<CustomServer, CustomMsgTypes, 5,
+		olc::net::message_handler<CustomMsgTypes::ServerPing, olc::net::message<CustomMsgTypes>, &CustomServer::OnPing>,
+		olc::net::message_handler<CustomMsgTypes::MovePlayer, PlayerMove, &CustomServer::OnMove>,
+		olc::net::message_handler<CustomMsgTypes::MessageAll, void, &CustomServer::OnMessageAll>,
+		olc::net::ignore_message<CustomMsgTypes::ServerAccept>,
+		...>;
+
+	dispatcher::dispatch(*this, client, msg);
+
+处理函数的第二个参数由 Payload 决定：
+	message<T>   原始的报文 (可以修改)            void (Owner::*)(std::shared_ptr<connection<T> >, message<T>&)
+	void         没有参数                         void (Owner::*)(std::shared_ptr<connection<T> >)
+	其它类型      按照 message_reader 解码之后传入  void (Owner::*)(std::shared_ptr<connection<T> >, const Payload&)
+
+报文的 id 必须是 0 ~ NIds-1 的连续值，每一个 id 必须恰好有一个 message_handler 或者 ignore_message，
+漏掉的和重复的 id 都会在编译期报错。分发时查一次表，只有一次间接调用。
+*/
+
+namespace olc
+{
+	namespace net
+	{
+		template <typename T>
+		class connection;
+
+		template <auto Id, typename Payload, auto Handler>
+		struct message_handler
+		{
+			static constexpr auto id = Id;
+
+			template <typename Owner, typename T>
+			static bool invoke(Owner &owner, const std::shared_ptr<connection<T> > &client, message<T> &msg)
+			{
+				if constexpr (std::is_same<Payload, message<T> >::value)
+				{
+					(owner.*Handler)(client, msg);
+				}
+				else if constexpr (std::is_void<Payload>::value)
+				{
+					(owner.*Handler)(client);
+				}
+				else
+				{
+					// 长度必须完全一致，否则认为是格式错误的报文
+					if (msg.body.size() != wire_size_v<Payload>)
+						return false;
+
+					Payload payload {};
+					message_reader reader(msg);
+					reader >> payload;
+					(owner.*Handler)(client, static_cast<const Payload&>(payload));
+				}
+				return true;
+			}
+		};
+
+		// 明确表示不处理这个 id 的报文 (例如只会由服务器发给客户端的报文)
+		template <auto Id>
+		struct ignore_message
+		{
+			static constexpr auto id = Id;
+
+			template <typename Owner, typename T>
+			static bool invoke(Owner &, const std::shared_ptr<connection<T> > &, message<T> &)
+			{
+				return true;
+			}
+		};
+
+
+		template <typename Owner, typename T, size_t NIds, typename... Handlers>
+		class message_dispatcher
+		{
+		public:
+			using handler_fn = bool (*)(Owner&, const std::shared_ptr<connection<T> >&, message<T>&);
+
+		private:
+			template <typename Handler>
+			static constexpr size_t index_of()
+			{
+				static_assert(std::is_same<std::decay_t<decltype(Handler::id)>, T>::value,
+						"Handler id has a different type than the message id");
+				return static_cast<size_t>(Handler::id);
+			}
+
+			static constexpr size_t handler_count(size_t nIndex)
+			{
+				return ((index_of<Handlers>() == nIndex ? 1 : 0) + ... + 0);
+			}
+
+			static constexpr bool all_in_range()
+			{
+				return ((index_of<Handlers>() < NIds) && ...);
+			}
+
+			static constexpr bool each_id_handled_once()
+			{
+				for (size_t i = 0; i < NIds; ++i)
+				{
+					if (handler_count(i) != 1)
+						return false;
+				}
+				return true;
+			}
+
+			static_assert(all_in_range(), "Handler id is outside of the dispatch table");
+			static_assert(each_id_handled_once(), "Every message id needs exactly one handler (missing or duplicate handler)");
+
+			template <size_t I, typename Handler, typename... Rest>
+			static constexpr handler_fn find_handler()
+			{
+				if constexpr (index_of<Handler>() == I)
+					return &Handler::template invoke<Owner, T>;
+				else
+					return find_handler<I, Rest...>();
+			}
+
+			template <size_t... I>
+			static constexpr std::array<handler_fn, NIds> make_table(std::index_sequence<I...>)
+			{
+				return { find_handler<I, Handlers...>()... };
+			}
+
+		public:
+			static constexpr std::array<handler_fn, NIds> table = make_table(std::make_index_sequence<NIds>{});
+
+			/*
+			把报文交给对应的处理函数。id 超出了范围，或者报文的长度和 Payload 不一致的时候返回 false，
+			由调用者决定怎么处理格式错误的报文 (例如断开这个连接)
+			*/
+			static bool dispatch(Owner &owner, const std::shared_ptr<connection<T> > &client, message<T> &msg)
+			{
+				size_t nIndex = static_cast<size_t>(msg.header.id);
+				if (nIndex >= NIds)
+					return false;
+				return table[nIndex](owner, client, msg);
+			}
+		};
+	}
+}
+
+#endif
@@ -0,0 +1,298 @@
+#ifndef __NET_FILE_H__
+#define __NET_FILE_H__
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_frame.h"
+
+#include <functional>
+#include <system_error>
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#define OLC_NET_SENDFILE 1
+#endif
+
+/*
+通过连接发送文件 (资源、补丁)：
+
+把文件读入 message<T> 再发送，每一块数据要经过 read、复制进 body、write 三次复制。
+connection<T>::SendFile 把文件的一段 [nOffset, nOffset + nLength) 切分成不超过 file_chunk_size 的块，
+每一块的报头和偏移普通地写入 socket，数据用 sendfile 直接从页缓存发送到 socket，不经过用户空间。
+
+线路上每一块就是一个普通的报文：id 是调用者给出的 id，body 是 这一块在文件中的偏移 (8 字节，小端) | 数据，
+所以接收的一方不需要任何改动，用 read_file_chunk 取出偏移和数据，或者交给 file_sink 写入文件。
+文件块和普通的报文轮流发送，一个大文件不会让其它报文等到它发送完；同时发送的几个文件之间也是轮流的。
+
+断点续传：接收的一方把已经收到的长度 (file_sink::Size) 告诉发送的一方，发送的一方从这个偏移开始 SendFile。
+不使用压缩；只支持 socket 上的连接 (Linux)。
+*/
+
+namespace olc
+{
+	namespace net
+	{
+		// 一个文件块中数据的最大长度
+		constexpr size_t file_chunk_size = 256 * 1024;
+
+		// 文件块的 body 开头的偏移的长度
+		constexpr size_t file_chunk_prefix = sizeof(uint64_t);
+
+		/*
+		每发送完一块调用一次 (在连接的 I/O 线程中)，nSent 是已经发送的字节数，nSent == nTotal 表示发送完了。
+		ec 不为空表示传输失败，这是最后一次调用
+		*/
+		using file_progress = std::function<void(uint64_t nSent, uint64_t nTotal, std::error_code ec)>;
+
+		// 从文件块报文中取出偏移和数据，格式不对的时候返回 false
+		template <typename T>
+		inline bool read_file_chunk(const message<T> &msg, uint64_t &nOffset, const uint8_t *&pData, size_t &nLength)
+		{
+			if (msg.body.size() < file_chunk_prefix)
+				return false;
+
+			detail::load_scalar(msg.body.data(), nOffset);
+			pData = msg.body.data() + file_chunk_prefix;
+			nLength = msg.body.size() - file_chunk_prefix;
+			return true;
+		}
+
+#ifdef OLC_NET_SENDFILE
+		/*
+		一个正在发送的文件，只在连接的 I/O 线程中使用。
+		每一块的发送过程是 报头和偏移 -> sendfile 数据，socket 必须是非阻塞的，写不下去的时候 Step 返回 would_block
+		*/
+		template <typename T>
+		class file_transfer
+		{
+		public:
+			enum class step
+			{
+				chunk_done,		// 一块发送完了
+				would_block,	// 需要等待 socket 可写之后再调用 Step
+				failed,			// 出错，连接上已经发送了不完整的帧，只能关闭连接
+			};
+
+			// 打开文件，nLength 为 0 表示一直到文件的末尾；失败的时候返回 nullptr，原因在 ec 中
+			static std::unique_ptr<file_transfer> Open(const std::string &sPath, T id, uint64_t nOffset, uint64_t nLength,
+				file_progress fnProgress, std::error_code &ec)
+			{
+				int fd = ::open(sPath.c_str(), O_RDONLY | O_CLOEXEC);
+				if (fd < 0)
+				{
+					ec = std::error_code(errno, std::generic_category());
+					return nullptr;
+				}
+
+				struct stat st;
+				if (::fstat(fd, &st) != 0 || uint64_t(st.st_size) < nOffset)
+				{
+					ec = std::make_error_code(std::errc::invalid_argument);
+					::close(fd);
+					return nullptr;
+				}
+
+				uint64_t nAvailable = uint64_t(st.st_size) - nOffset;
+				if (nLength == 0 || nLength > nAvailable)
+					nLength = nAvailable;
+
+				return std::unique_ptr<file_transfer>(new file_transfer(fd, id, nOffset, nLength, std::move(fnProgress)));
+			}
+
+			~file_transfer()
+			{
+				::close(this->m_fd);
+			}
+
+			// 所有的数据都发送完了 (长度为 0 的文件也会发送一个空的块)
+			bool Finished() const
+			{
+				return this->m_bStarted && this->m_nSent == this->m_nTotal && !this->InChunk();
+			}
+
+			step Step(int fdSocket, framing eFraming)
+			{
+				if (!this->InChunk())
+					this->BeginChunk(eFraming);
+
+				// 报头和偏移，MSG_MORE 让内核把它们和后面的数据合并成同一个 TCP 段
+				while (this->m_nPrefixSent < this->m_nPrefix)
+				{
+					ssize_t n = ::send(fdSocket, this->m_aPrefix + this->m_nPrefixSent, this->m_nPrefix - this->m_nPrefixSent,
+						MSG_DONTWAIT | MSG_NOSIGNAL | (this->m_nChunkLeft > 0 ? MSG_MORE : 0));
+					if (n < 0)
+						return this->Fail(errno);
+					this->m_nPrefixSent += static_cast<size_t>(n);
+				}
+
+				while (this->m_nChunkLeft > 0)
+				{
+					off_t nPosition = static_cast<off_t>(this->m_nFileOffset);
+					ssize_t n = ::sendfile(fdSocket, this->m_fd, &nPosition, this->m_nChunkLeft);
+					if (n < 0)
+						return this->Fail(errno);
+
+					// 文件在发送的过程中变短了，报头中的长度已经发出去了
+					if (n == 0)
+						return this->Fail(EIO);
+
+					this->m_nFileOffset += static_cast<uint64_t>(n);
+					this->m_nChunkLeft -= static_cast<size_t>(n);
+					this->m_nSent += static_cast<uint64_t>(n);
+				}
+
+				this->m_nPrefix = 0;
+				return step::chunk_done;
+			}
+
+			void NotifyProgress()
+			{
+				if (this->m_fnProgress)
+					this->m_fnProgress(this->m_nSent, this->m_nTotal, std::error_code());
+			}
+
+			void NotifyError(std::error_code ec)
+			{
+				if (this->m_fnProgress)
+					this->m_fnProgress(this->m_nSent, this->m_nTotal, ec);
+			}
+
+			std::error_code Error() const
+			{
+				return this->m_ec;
+			}
+
+		private:
+			file_transfer(int fd, T id, uint64_t nOffset, uint64_t nLength, file_progress fnProgress)
+				: m_fd(fd), m_id(id), m_nFileOffset(nOffset), m_nTotal(nLength), m_fnProgress(std::move(fnProgress))
+			{
+
+			}
+
+			bool InChunk() const
+			{
+				return this->m_nPrefix > 0;
+			}
+
+			void BeginChunk(framing eFraming)
+			{
+				this->m_bStarted = true;
+				this->m_nChunkLeft = static_cast<size_t>(std::min<uint64_t>(file_chunk_size, this->m_nTotal - this->m_nSent));
+
+				message_header<T> header;
+				header.id = this->m_id;
+				header.size = static_cast<uint32_t>(file_chunk_prefix + this->m_nChunkLeft);
+
+				size_t nHeader = sizeof(header);
+				if (eFraming == framing::compact)
+					nHeader = encode_compact_header(this->m_aPrefix, header);
+				else
+					std::memcpy(this->m_aPrefix, &header, sizeof(header));
+
+				detail::store_scalar(this->m_aPrefix + nHeader, this->m_nFileOffset);
+				this->m_nPrefix = nHeader + file_chunk_prefix;
+				this->m_nPrefixSent = 0;
+			}
+
+			step Fail(int nError)
+			{
+				if (nError == EAGAIN || nError == EWOULDBLOCK)
+					return step::would_block;
+
+				this->m_ec = std::error_code(nError, std::generic_category());
+				return step::failed;
+			}
+
+		private:
+			int m_fd;
+			T m_id;
+			uint64_t m_nFileOffset;		// 下一个要发送的字节在文件中的位置
+			uint64_t m_nTotal;
+			uint64_t m_nSent = 0;
+			file_progress m_fnProgress;
+			std::error_code m_ec;
+			bool m_bStarted = false;
+
+			// 当前这一块的 报头 | 偏移，和还没有发送的数据的长度
+			uint8_t m_aPrefix[std::max(compact_header_max_size, sizeof(message_header<T>)) + file_chunk_prefix];
+			size_t m_nPrefix = 0;
+			size_t m_nPrefixSent = 0;
+			size_t m_nChunkLeft = 0;
+		};
+
+		/*
+		接收的一方：把文件块写入文件中对应的位置。TCP 上的文件块是按顺序到达的，
+		Size 就是从头开始连续收到的长度，断点续传的时候告诉发送的一方从这里继续
+		*/
+		class file_sink
+		{
+		public:
+			~file_sink()
+			{
+				this->Close();
+			}
+
+			// 打开 (不存在的时候创建) 文件，已有的内容保留，用于续传
+			bool Open(const std::string &sPath)
+			{
+				this->Close();
+				this->m_fd = ::open(sPath.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+				if (this->m_fd < 0)
+					return false;
+
+				struct stat st;
+				this->m_nSize = ::fstat(this->m_fd, &st) == 0 ? uint64_t(st.st_size) : 0;
+				return true;
+			}
+
+			void Close()
+			{
+				if (this->m_fd >= 0)
+					::close(this->m_fd);
+				this->m_fd = -1;
+			}
+
+			// 写入一个文件块，返回写入的字节数；格式不对或者写入失败的时候返回 -1
+			template <typename T>
+			int64_t Write(const message<T> &msg)
+			{
+				uint64_t nOffset = 0;
+				const uint8_t *pData = nullptr;
+				size_t nLength = 0;
+				if (this->m_fd < 0 || !read_file_chunk(msg, nOffset, pData, nLength))
+					return -1;
+
+				size_t nWritten = 0;
+				while (nWritten < nLength)
+				{
+					ssize_t n = ::pwrite(this->m_fd, pData + nWritten, nLength - nWritten, static_cast<off_t>(nOffset + nWritten));
+					if (n < 0 && errno == EINTR)
+						continue;
+					if (n <= 0)
+						return -1;
+					nWritten += static_cast<size_t>(n);
+				}
+
+				this->m_nSize = std::max(this->m_nSize, nOffset + nLength);
+				return static_cast<int64_t>(nLength);
+			}
+
+			uint64_t Size() const
+			{
+				return this->m_nSize;
+			}
+
+		private:
+			int m_fd = -1;
+			uint64_t m_nSize = 0;
+		};
+#endif
+	}
+}
+
+#endif
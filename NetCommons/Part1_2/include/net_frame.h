@@ -0,0 +1,122 @@
+#ifndef __NET_FRAME_H__
+#define __NET_FRAME_H__
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_bitpack.h"
+
+/*
+报文在线路上的帧格式：
+
+1. framing::standard: 直接发送内存中的 message_header<T> (sizeof(message_header<T>) 个字节)，
+   布局取决于 T 的类型、编译器的填充以及主机字节序。T = uint32_t 的时候每个报文有 8 个字节的报头。
+
+2. framing::compact: 紧凑的报头，和主机无关，所有的多字节整数都是小端序的 varint：
+	varint((id << 1) | 是否有标志字节) | [标志字节] | varint(body 长度)
+   id < 64 并且 body < 128 字节的报文 (最常见的小报文) 报头只有 2 个字节；id < 8192 时 id 最多占 2 个字节。
+   标志字节就是 size 的高 5 位 (frame_flags) 右移 27 位，没有任何标志的时候省略。
+
+连接的两端必须使用相同的帧格式。
+*/
+
+namespace olc
+{
+	namespace net
+	{
+		enum class framing
+		{
+			standard,
+			compact,
+		};
+
+		// 紧凑报头的最大长度：id 最多 5 个字节，标志 1 个字节，长度最多 4 个字节
+		constexpr size_t compact_header_max_size = 10;
+
+		// decode_compact_header 遇到格式错误的报头时返回的值
+		constexpr size_t compact_header_invalid = SIZE_MAX;
+
+		namespace detail
+		{
+			constexpr unsigned frame_flags_shift = 27;
+
+			// 报头中的 id 在线路上对应的无符号整数类型
+			template <typename T, bool = std::is_enum<T>::value>
+			struct id_wire_type
+			{
+				using type = std::make_unsigned_t<T>;
+			};
+
+			template <typename T>
+			struct id_wire_type<T, true>
+			{
+				using type = std::make_unsigned_t<std::underlying_type_t<T> >;
+			};
+
+			template <typename T>
+			inline uint64_t id_to_wire(T id)
+			{
+				return static_cast<typename id_wire_type<T>::type>(id);
+			}
+
+			template <typename T>
+			inline bool id_from_wire(uint64_t n, T &id)
+			{
+				using wire_type = typename id_wire_type<T>::type;
+				if (n > std::numeric_limits<wire_type>::max())
+					return false;
+				id = static_cast<T>(static_cast<wire_type>(n));
+				return true;
+			}
+		}
+
+		// 编码紧凑报头，pDst 至少要有 compact_header_max_size 个字节，返回报头的长度
+		template <typename T>
+		inline size_t encode_compact_header(uint8_t *pDst, const message_header<T> &header)
+		{
+			uint32_t nFlags = (header.size & frame_flags::mask) >> detail::frame_flags_shift;
+			size_t n = write_varint(pDst, (detail::id_to_wire(header.id) << 1) | (nFlags != 0 ? 1 : 0));
+			if (nFlags != 0)
+				pDst[n++] = static_cast<uint8_t>(nFlags);
+			n += write_varint(pDst + n, header.size & frame_flags::size_mask);
+			return n;
+		}
+
+		/*
+		从 nAvail 个字节中解码紧凑报头，返回报头的长度；数据还不完整时返回 0，
+		格式错误 (varint 过长，id 超出了 T 的范围，长度超过 27 位) 时返回 compact_header_invalid
+		*/
+		template <typename T>
+		inline size_t decode_compact_header(const uint8_t *pSrc, size_t nAvail, message_header<T> &header)
+		{
+			uint64_t nID = 0;
+			size_t n = read_varint(pSrc, nAvail, nID);
+			if (n == 0)
+				return nAvail >= 10 ? compact_header_invalid : 0;
+
+			if (!detail::id_from_wire(nID >> 1, header.id))
+				return compact_header_invalid;
+
+			uint32_t nFlags = 0;
+			if (nID & 1)
+			{
+				if (n >= nAvail)
+					return 0;
+				nFlags = pSrc[n++];
+				if (nFlags == 0 || nFlags >= (1u << (32 - detail::frame_flags_shift)))
+					return compact_header_invalid;
+			}
+
+			uint64_t nSize = 0;
+			size_t m = read_varint(pSrc + n, nAvail - n, nSize);
+			if (m == 0)
+				return nAvail - n >= 10 ? compact_header_invalid : 0;
+			if (nSize > frame_flags::size_mask)
+				return compact_header_invalid;
+
+			header.size = static_cast<uint32_t>(nSize) | (nFlags << detail::frame_flags_shift);
+			return n + m;
+		}
+	}
+}
+
+#endif
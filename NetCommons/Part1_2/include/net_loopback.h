@@ -0,0 +1,162 @@
+#ifndef __NET_LOOPBACK_H__
+#define __NET_LOOPBACK_H__
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_connection.h"
+
+/*
+同一个进程中的客户端和服务器之间的连接 (单人模式、主机模式、嵌入的服务器)：
+
+通过 TCP 连接同一个进程中的服务器，每个报文都要经过序列化、内核的回环和两个 I/O 线程。
+loopback_connection<T> 成对地出现，一端的 Send 把 message<T> 直接放入另一端的接收队列，
+没有 socket，没有序列化，也不需要 I/O 线程：
+
+	client_interface<T> client;
+	client.Connect(server);		// server 是同一个进程中的 server_interface<T>
+
+之后客户端和服务器的代码和使用 TCP 的时候完全一样。压缩和 UDP 对这种连接没有意义，不会启用。
+*/
+
+namespace olc
+{
+	namespace net
+	{
+		template <typename T>
+		class loopback_connection : public connection<T>
+		{
+		private:
+			// 一对连接共享的状态，任何一端析构或者断开之后另一端都不再投递报文
+			struct link
+			{
+				std::mutex mux;
+				loopback_connection<T> *pEnds[2] = { nullptr, nullptr };
+				std::atomic<bool> bOpen { true };
+			};
+
+		public:
+			loopback_connection(typename connection<T>::owner parent,
+				asio::io_context& asioContext,
+				tsqueue<owned_message<T> >& qIn)
+				: connection<T>(parent, asioContext, stream_socket(asioContext), qIn)
+			{
+
+			}
+
+			~loopback_connection()
+			{
+				if (!this->m_pLink)
+					return;
+
+				this->m_pLink->bOpen = false;
+				std::lock_guard<std::mutex> lock(this->m_pLink->mux);
+				this->m_pLink->pEnds[this->Side()] = nullptr;
+			}
+
+			// 把服务器一端和客户端一端连接起来，需要在任何一端发送报文之前调用
+			static void Link(loopback_connection<T> &server, loopback_connection<T> &client)
+			{
+				auto pLink = std::make_shared<link>();
+				pLink->pEnds[server.Side()] = &server;
+				pLink->pEnds[client.Side()] = &client;
+				server.m_pLink = pLink;
+				client.m_pLink = std::move(pLink);
+			}
+
+			bool IsConnected() const override
+			{
+				return this->m_pLink && this->m_pLink->bOpen;
+			}
+
+			void Disconnect() override
+			{
+				if (this->m_pLink)
+					this->m_pLink->bOpen = false;
+			}
+
+		protected:
+			// 没有内核参与，报文放入对方的接收队列就算发送完成，fnSent 在调用 Send 的线程中调用
+			void QueueMessage(message<T> msg, send_callback fnSent) override
+			{
+				bool bDelivered = this->Deliver(msg);
+				if (fnSent)
+					fnSent(bDelivered ? std::error_code() : std::make_error_code(std::errc::not_connected));
+			}
+
+			void StartReading() override
+			{
+				// 报文由另一端直接放入接收队列
+			}
+
+			void StartWriting() override
+			{
+				// 发送不经过 m_qMessagesOut
+			}
+
+		private:
+			bool Deliver(message<T> &msg)
+			{
+				if (!this->IsConnected())
+					return false;
+
+				// 在锁之外释放：如果这是服务器一端的最后一个引用，它的析构也需要这个锁
+				std::shared_ptr<connection<T> > pRemote;
+
+				// RPC 的回复交给对方等待的调用，回调在锁之外执行 (回调中可能再次发送)
+				rpc_callback<T> fnDone;
+				uint32_t nWord = 0;
+				bool bCall = peek_call_word(msg, nWord);
+				bool bResponse = bCall && (nWord & rpc_word::response);
+				if (bResponse)
+					take_call_word(msg, nWord);
+
+				{
+					std::lock_guard<std::mutex> lock(this->m_pLink->mux);
+					loopback_connection<T> *pPeer = this->m_pLink->pEnds[1 - this->Side()];
+					if (!pPeer)
+						return false;
+
+					if (bResponse)
+					{
+						fnDone = pPeer->TakeCall(nWord & rpc_word::id_mask);
+					}
+					else if (bCall && pPeer->m_nOwnerType == connection<T>::owner::client)
+					{
+						// 客户端不处理请求 (见 connection<T>::DeliverIncoming)，调用直接以拒绝结束
+						fnDone = this->TakeCall(nWord & rpc_word::id_mask);
+						nWord |= rpc_word::error;
+						msg.body.clear();
+					}
+					else
+					{
+						// 服务器收到的报文要带上连接本身；它的引用计数可能已经归零，正在等待这个锁完成析构
+						if (pPeer->m_nOwnerType == connection<T>::owner::server)
+						{
+							pRemote = pPeer->weak_from_this().lock();
+							if (!pRemote)
+								return false;
+						}
+
+						// 不经过线路，没有压缩和控制帧，报文直接移交到对方的接收队列；RPC 的请求保留标志和调用字
+						msg.header.size = static_cast<uint32_t>(msg.body.size()) | (msg.header.size & frame_flags::rpc);
+						pPeer->m_qMessagesIn.push_back({ pRemote, std::move(msg) });
+					}
+				}
+
+				if (fnDone)
+					connection<T>::InvokeCall(fnDone, nWord, msg);
+				return true;
+			}
+
+			size_t Side() const
+			{
+				return this->m_nOwnerType == connection<T>::owner::server ? 0 : 1;
+			}
+
+		private:
+			std::shared_ptr<link> m_pLink;
+		};
+	}
+}
+
+#endif
@@ -3,11 +3,33 @@
 
 
 #include "net_common.h"
+#include "net_schema.h"
 
 namespace olc 
 {
 	namespace net 
 	{
+		/*
+		报头 size 的高 5 位保留给连接层使用，作为这一帧的标志，剩下的 27 位是 body 的长度 (最大 128MB)。
+		这些标志只出现在线路上，交给应用程序的报文的 size 始终是 body 的真实长度。
+		*/
+		struct frame_flags
+		{
+			// body 是压缩过的 (见 net_compress.h)
+			static constexpr uint32_t compressed = 0x80000000;
+			// body 中打包了多个报文 (见 connection<T>::BundleSmallMessages)
+			static constexpr uint32_t bundle = 0x40000000;
+			// 大报文的一个分片，接收端拼接完整之后才交给应用程序 (见 connection<T>::SetFragmentSize)
+			static constexpr uint32_t fragment = 0x20000000;
+			// 连接内部使用的控制帧，不会交给应用程序 (见 connection<T>::HandleControl)
+			static constexpr uint32_t control = 0x10000000;
+			// RPC 的请求或者回复，body 的最后 4 字节是调用的编号 (见 net_rpc.h)
+			static constexpr uint32_t rpc = 0x08000000;
+
+			static constexpr uint32_t mask = 0xF8000000;
+			static constexpr uint32_t size_mask = 0x07FFFFFF;
+		};
+
 		// 每一次传递的数据的头部结构，需要指明这个报文的 id, 以及整个报文的长度信息
 		template <typename T>
 		struct message_header
@@ -44,6 +66,7 @@ namespace olc
 			// POD-like 的数据在内存上的存储是连续的，可以通过内存的拷贝就实现数据的拷贝。
 			// 例如，一个非 POD-like 的数据结构中包含了指针对象，那么直接内存的拷贝无法实现对该数据的拷贝（浅拷贝）
 			// 普通数据类型(int float char) 都是 POD-like 类型的数据
+			// 定义了 schema 的结构体 (见 net_schema.h) 按照紧凑的小端序格式写入
 			template <typename DataType>
 			friend message<T>& operator << (message<T> &msg, const DataType &data)
 			{
@@ -53,10 +76,10 @@ namespace olc
 				size_t i = msg.body.size();
 
 				// 重新设定 buffer 的大小
-				msg.body.resize(msg.body.size() + sizeof(DataType));
+				msg.body.resize(msg.body.size() + wire_size_v<DataType>);
 
 				// 将新的数据放在 buffer 的最后面
-				std::memcpy(msg.body.data() + i, static_cast<const void*>(&data), sizeof(DataType));
+				wire_store(msg.body.data() + i, data);
 
 				// 更新报头中的大小数据
 				msg.header.size = msg.size();
@@ -70,9 +93,9 @@ namespace olc
 				static_assert(std::is_standard_layout<DataType>::value, 
 						"Data is too complex to getting from vector");
 
-				size_t i = msg.body.size() - sizeof(DataType);
+				size_t i = msg.body.size() - wire_size_v<DataType>;
 
-				std::memcpy(static_cast<void*>(&data), msg.body.data() + i, sizeof(DataType));
+				wire_load(msg.body.data() + i, data);
 
 				msg.body.resize(i);
 
@@ -83,6 +106,189 @@ namespace olc
 		};
 
 
+		// 一组数据类型在 body 当中占用的总字节数，在编译期就可以得到
+		template <typename... DataTypes>
+		constexpr size_t payload_size_v = (wire_size_v<DataTypes> + ... + size_t(0));
+
+		/*
+		operator << 每放入一个字段都会 resize 一次 body 并改写一次 header.size，字段多的时候
+		vector 会反复地重新分配内存。message_builder 用于一次性地构建报文：
+		1. push(a, b, c ...) 在编译期算出所有字段的总长度，只分配一次内存，依次拷贝每个字段
+		2. 构造时给出预留的大小 nReserve，之后用 << 逐个放入字段，只要不超过预留的大小就不会重新分配
+		报头中的 size 只在 finish() (或者析构) 的时候更新一次
+		*/
+		template <typename T>
+		class message_builder
+		{
+		public:
+			explicit message_builder(message<T> &msg, size_t nReserve = 0)
+				: m_msg(msg)
+			{
+				if (nReserve > 0)
+					this->m_msg.body.reserve(this->m_msg.body.size() + nReserve);
+			}
+
+			message_builder(const message_builder<T>&) = delete;
+			message_builder<T>& operator = (const message_builder<T>&) = delete;
+
+			~message_builder()
+			{
+				this->finish();
+			}
+
+		public:
+			template <typename... DataTypes>
+			message_builder<T>& push(const DataTypes&... data)
+			{
+				static_assert((std::is_standard_layout<DataTypes>::value && ...), 
+						"Data is too complex to be pushed into vector");
+
+				size_t i = this->m_msg.body.size();
+
+				// 只分配一次内存
+				this->m_msg.body.resize(i + payload_size_v<DataTypes...>);
+
+				uint8_t *pDst = this->m_msg.body.data() + i;
+				((wire_store(pDst, data), pDst += wire_size_v<DataTypes>), ...);
+
+				return *this;
+			}
+
+			template <typename DataType>
+			message_builder<T>& operator << (const DataType &data)
+			{
+				static_assert(std::is_standard_layout<DataType>::value, 
+						"Data is too complex to be pushed into vector");
+
+				// 追加到 body 的末尾，在预留的空间之内不会重新分配内存，也不需要先清零再拷贝
+				if constexpr (detail::uses_schema<DataType>::value)
+				{
+					uint8_t buf[wire_size_v<DataType>];
+					wire_store(buf, data);
+					this->m_msg.body.insert(this->m_msg.body.end(), buf, buf + sizeof(buf));
+				}
+				else
+				{
+					const uint8_t *pSrc = reinterpret_cast<const uint8_t*>(&data);
+					this->m_msg.body.insert(this->m_msg.body.end(), pSrc, pSrc + sizeof(DataType));
+				}
+
+				return *this;
+			}
+
+			// 更新报头中的大小数据，之后仍然可以继续放入字段
+			message<T>& finish()
+			{
+				this->m_msg.header.size = this->m_msg.size();
+				return this->m_msg;
+			}
+
+		private:
+			message<T> &m_msg;
+		};
+
+
+		/*
+		operator >> 从 body 的末尾弹出数据，所以只能按照和写入相反的顺序读取，而且每读一个字段都会修改 body。
+		message_reader 是一个只读的游标，按照写入的顺序从前往后读取字段：
+		1. 既可以读取一个 const message，也可以直接读取一段原始的字节（例如共享的接收缓冲区）
+		2. 每一次读取都会检查边界，越界之后游标进入失败状态，后面的读取都会失败，不会抛出异常
+		3. 不会分配任何内存，也不会修改被读取的数据
+		*/
+		class message_reader
+		{
+		public:
+			message_reader(const uint8_t *pData, size_t nSize)
+				: m_pData(pData), m_nSize(nSize)
+			{
+
+			}
+
+			template <typename T>
+			explicit message_reader(const message<T> &msg)
+				: message_reader(msg.body.data(), msg.body.size())
+			{
+
+			}
+
+		public:
+			template <typename DataType>
+			bool read(DataType &data)
+			{
+				static_assert(std::is_standard_layout<DataType>::value, 
+						"Data is too complex to getting from vector");
+
+				if (!this->require(wire_size_v<DataType>))
+					return false;
+
+				wire_load(this->m_pData + this->m_nPos, data);
+				this->m_nPos += wire_size_v<DataType>;
+				return true;
+			}
+
+			template <typename DataType>
+			message_reader& operator >> (DataType &data)
+			{
+				this->read(data);
+				return *this;
+			}
+
+			// 不拷贝，直接返回指向接下来 nBytes 个字节的指针，越界的时候返回 nullptr
+			const uint8_t* view(size_t nBytes)
+			{
+				if (!this->require(nBytes))
+					return nullptr;
+
+				const uint8_t *p = this->m_pData + this->m_nPos;
+				this->m_nPos += nBytes;
+				return p;
+			}
+
+			bool skip(size_t nBytes)
+			{
+				return this->view(nBytes) != nullptr;
+			}
+
+			// 读取的过程中是否发生过越界
+			bool good() const
+			{
+				return !this->m_bFail;
+			}
+
+			explicit operator bool() const
+			{
+				return this->good();
+			}
+
+			size_t position() const
+			{
+				return this->m_nPos;
+			}
+
+			size_t remaining() const
+			{
+				return this->m_nSize - this->m_nPos;
+			}
+
+		private:
+			bool require(size_t nBytes)
+			{
+				if (this->m_bFail || nBytes > this->remaining())
+				{
+					this->m_bFail = true;
+					return false;
+				}
+				return true;
+			}
+
+		private:
+			const uint8_t *m_pData = nullptr;
+			size_t m_nSize = 0;
+			size_t m_nPos = 0;
+			bool m_bFail = false;
+		};
+
+
 		template <typename T>
 		class connection;
 
@@ -99,6 +305,24 @@ namespace olc
 				return os;
 			}
 		};
+
+
+		/*
+		一段连续的 owned_message (C++17 中还没有 std::span)，批量处理报文的时候使用，
+		只是一个视图，不拥有这些报文
+		*/
+		template <typename T>
+		struct message_span
+		{
+			owned_message<T> *pData = nullptr;
+			size_t nSize = 0;
+
+			owned_message<T>* begin() const { return pData; }
+			owned_message<T>* end() const { return pData + nSize; }
+			size_t size() const { return nSize; }
+			bool empty() const { return nSize == 0; }
+			owned_message<T>& operator [] (size_t i) const { return pData[i]; }
+		};
 	}
 }
 
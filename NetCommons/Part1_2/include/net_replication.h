@@ -0,0 +1,386 @@
+#ifndef __NET_REPLICATION_H__
+#define __NET_REPLICATION_H__
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_bitpack.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+实体状态的增量同步：
+
+服务器每一帧不再把所有实体的完整状态发送给每一个客户端，而是对每一个客户端记住它最后确认收到的
+快照 (baseline)，只发送相对于 baseline 发生了变化的字段：
+	tick | baseline tick | 实体数量 | { 实体序号的差值 | 字段位掩码 | 变化的字段值 } ...
+如果客户端确认的快照已经太旧，不在历史记录里面了，就发送完整的快照 (相当于以全 0 的状态作为 baseline)。
+
+实体的状态按照 SoA (structure of arrays) 的方式存放：每一个字段是一个连续的 uint32_t 数组，浮点数按位存放。
+比较两个快照的时候，每一个字段的数组可以用 SIMD 一次比较 4 个实体，得到一串脏位 (dirty bits)。
+*/
+
+namespace olc
+{
+	namespace net
+	{
+		// NFields 个 32 位字段的实体状态表，按字段连续存放
+		template <size_t NFields>
+		class snapshot_table
+		{
+		public:
+			static_assert(NFields > 0 && NFields <= 64, "Entity state must have 1 ~ 64 fields");
+
+			static constexpr size_t field_count = NFields;
+
+		public:
+			explicit snapshot_table(size_t nEntities = 0)
+			{
+				this->resize(nEntities);
+			}
+
+			void resize(size_t nEntities)
+			{
+				for (auto &vField : this->m_vFields)
+					vField.resize(nEntities, 0);
+				this->m_nEntities = nEntities;
+			}
+
+			void clear()
+			{
+				for (auto &vField : this->m_vFields)
+					std::fill(vField.begin(), vField.end(), 0);
+			}
+
+			size_t size() const
+			{
+				return this->m_nEntities;
+			}
+
+			uint32_t get(size_t nEntity, size_t nField) const
+			{
+				return this->m_vFields[nField][nEntity];
+			}
+
+			void set(size_t nEntity, size_t nField, uint32_t value)
+			{
+				this->m_vFields[nField][nEntity] = value;
+			}
+
+			float get_float(size_t nEntity, size_t nField) const
+			{
+				float f;
+				uint32_t n = this->get(nEntity, nField);
+				std::memcpy(&f, &n, sizeof(f));
+				return f;
+			}
+
+			void set_float(size_t nEntity, size_t nField, float f)
+			{
+				uint32_t n;
+				std::memcpy(&n, &f, sizeof(n));
+				this->set(nEntity, nField, n);
+			}
+
+			const uint32_t* field(size_t nField) const
+			{
+				return this->m_vFields[nField].data();
+			}
+
+			uint32_t* field(size_t nField)
+			{
+				return this->m_vFields[nField].data();
+			}
+
+		private:
+			std::array<std::vector<uint32_t>, NFields> m_vFields;
+			size_t m_nEntities = 0;
+		};
+
+
+		namespace detail
+		{
+			/*
+			比较两个字段数组 [nBegin, nEnd) 范围内的元素，把不相等的位置在 pDirty 中置 1 (按位或)。
+			pBaseline 为 nullptr 的时候表示和全 0 比较。每 4 个实体一次 SIMD 比较，movemask 得到 4 个脏位。
+			*/
+			inline void mark_dirty(const uint32_t *pCurrent, const uint32_t *pBaseline, 
+				size_t nBegin, size_t nEnd, uint64_t *pDirty)
+			{
+				size_t i = nBegin;
+#if defined(__SSE2__)
+				// 先逐个处理到 4 对齐的位置，这样每次得到的 4 个脏位不会跨越两个 64 位的字
+				for (; i < nEnd && i % 4 != 0; ++i)
+				{
+					uint32_t base = pBaseline ? pBaseline[i] : 0;
+					pDirty[i / 64] |= static_cast<uint64_t>(pCurrent[i] != base) << (i % 64);
+				}
+
+				const __m128i zero = _mm_setzero_si128();
+				for (; i + 4 <= nEnd; i += 4)
+				{
+					__m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pCurrent + i));
+					__m128i base = pBaseline ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(pBaseline + i)) : zero;
+					int nEqual = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(cur, base)));
+					uint64_t nChanged = static_cast<uint64_t>(~nEqual & 0xf);
+					pDirty[i / 64] |= nChanged << (i % 64);
+				}
+#endif
+				for (; i < nEnd; ++i)
+				{
+					uint32_t base = pBaseline ? pBaseline[i] : 0;
+					pDirty[i / 64] |= static_cast<uint64_t>(pCurrent[i] != base) << (i % 64);
+				}
+			}
+		}
+
+
+		template <typename T, size_t NFields>
+		class replication_server
+		{
+		public:
+			// nHistory: 保存多少帧的历史快照，客户端确认的快照比这个还旧的时候就发送完整的快照
+			replication_server(size_t nMaxEntities, size_t nHistory = 32)
+				: m_current(nMaxEntities), m_vHistory(nHistory), m_vHistoryTicks(nHistory, 0)
+			{
+				this->m_vDirty.resize(NFields);
+			}
+
+		public:
+			// 应用程序直接修改当前帧的状态
+			snapshot_table<NFields>& Current()
+			{
+				return this->m_current;
+			}
+
+			// 当前帧的状态已经准备好，存入历史记录中，返回这一帧的编号 (从 1 开始，0 表示没有 baseline)
+			uint32_t Tick()
+			{
+				this->m_nTick++;
+				size_t nSlot = this->m_nTick % this->m_vHistory.size();
+				this->m_vHistory[nSlot] = this->m_current;
+				this->m_vHistoryTicks[nSlot] = this->m_nTick;
+				return this->m_nTick;
+			}
+
+			// 客户端确认收到了某一帧的快照，之后就以这一帧作为这个客户端的 baseline
+			void Acknowledge(uint32_t nClientID, uint32_t nTick)
+			{
+				uint32_t &nAcked = this->m_mapAcked[nClientID];
+				if (nTick > nAcked && nTick <= this->m_nTick)
+					nAcked = nTick;
+			}
+
+			void RemoveClient(uint32_t nClientID)
+			{
+				this->m_mapAcked.erase(nClientID);
+			}
+
+			// 把最近一次 Tick() 的快照相对于这个客户端的 baseline 编码到 msg 中
+			message<T>& Encode(uint32_t nClientID, message<T> &msg)
+			{
+				uint32_t nBaseline = 0;
+				auto it = this->m_mapAcked.find(nClientID);
+				if (it != this->m_mapAcked.end())
+					nBaseline = it->second;
+
+				const snapshot_table<NFields> *pBaseline = this->FindSnapshot(nBaseline);
+				if (pBaseline == nullptr)
+					nBaseline = 0;
+
+				// 还没有调用过 Tick() 的时候直接编码当前的状态
+				const snapshot_table<NFields> *pCurrent = this->FindSnapshot(this->m_nTick);
+				const snapshot_table<NFields> &current = pCurrent ? *pCurrent : this->m_current;
+				size_t nEntities = current.size();
+				size_t nCommon = pBaseline ? std::min(nEntities, pBaseline->size()) : 0;
+				size_t nWords = (nEntities + 63) / 64;
+
+				// 逐字段比较，得到每个字段的脏位
+				for (size_t f = 0; f < NFields; ++f)
+				{
+					this->m_vDirty[f].assign(nWords, 0);
+					detail::mark_dirty(current.field(f), pBaseline ? pBaseline->field(f) : nullptr,
+						0, nCommon, this->m_vDirty[f].data());
+					// baseline 中不存在的实体和全 0 比较
+					detail::mark_dirty(current.field(f), nullptr, nCommon, nEntities, this->m_vDirty[f].data());
+				}
+
+				message_bit_writer<T> writer(msg);
+				writer.write_varint(this->m_nTick);
+				writer.write_varint(nBaseline);
+				writer.write_varint(nEntities);
+
+				// 先把所有字段的脏位合并起来，只遍历有变化的实体
+				size_t nLast = 0;
+				for (size_t w = 0; w < nWords; ++w)
+				{
+					uint64_t nAny = 0;
+					for (size_t f = 0; f < NFields; ++f)
+						nAny |= this->m_vDirty[f][w];
+
+					while (nAny != 0)
+					{
+						size_t nEntity = w * 64 + detail::count_trailing_zeros(nAny);
+						nAny &= nAny - 1;
+
+						uint64_t nMask = 0;
+						for (size_t f = 0; f < NFields; ++f)
+							nMask |= ((this->m_vDirty[f][w] >> (nEntity % 64)) & 1) << f;
+
+						// 实体序号用和上一个实体的差值表示，通常都很小
+						writer.write_varint(nEntity - nLast);
+						nLast = nEntity;
+						writer.write_bits(nMask, NFields);
+						for (size_t f = 0; f < NFields; ++f)
+						{
+							if (nMask & (uint64_t(1) << f))
+								writer.write_bits(current.get(nEntity, f), 32);
+						}
+					}
+				}
+
+				// 结束标志：差值不可能是这个值
+				writer.write_varint(this->EndMarker(nEntities));
+				writer.finish();
+
+				return msg;
+			}
+
+			uint32_t GetTick() const
+			{
+				return this->m_nTick;
+			}
+
+		private:
+			const snapshot_table<NFields>* FindSnapshot(uint32_t nTick) const
+			{
+				if (nTick == 0)
+					return nullptr;
+				size_t nSlot = nTick % this->m_vHistory.size();
+				if (this->m_vHistoryTicks[nSlot] != nTick)
+					return nullptr;
+				return &this->m_vHistory[nSlot];
+			}
+
+		public:
+			static uint64_t EndMarker(size_t nEntities)
+			{
+				return static_cast<uint64_t>(nEntities) + 1;
+			}
+
+		private:
+			snapshot_table<NFields> m_current;
+
+			std::vector<snapshot_table<NFields> > m_vHistory;
+			std::vector<uint32_t> m_vHistoryTicks;
+			uint32_t m_nTick = 0;
+
+			// 每个客户端最后确认的快照
+			std::unordered_map<uint32_t, uint32_t> m_mapAcked;
+
+			std::vector<std::vector<uint64_t> > m_vDirty;
+		};
+
+
+		template <typename T, size_t NFields>
+		class replication_client
+		{
+		public:
+			/*
+			nMaxEntities: 实体数量的上限，和服务器的 nMaxEntities 一致。实体数量来自网络，
+			超过上限的快照当作损坏的数据丢弃，不会按照对方给出的数量分配内存
+			*/
+			explicit replication_client(size_t nMaxEntities, size_t nHistory = 32)
+				: m_vHistory(nHistory), m_vHistoryTicks(nHistory, 0), m_nMaxEntities(nMaxEntities)
+			{
+
+			}
+
+		public:
+			/*
+			解码服务器发来的快照，成功的时候返回这一帧的编号，应用程序需要把它确认给服务器；
+			baseline 不在本地的历史记录中或者数据损坏的时候返回 0
+			*/
+			uint32_t Apply(const message<T> &msg)
+			{
+				bit_reader reader(msg);
+				uint64_t nTick = reader.read_varint();
+				uint64_t nBaseline = reader.read_varint();
+				uint64_t nEntities = reader.read_varint();
+				if (!reader || nTick == 0 || nTick > UINT32_MAX || nEntities > this->m_nMaxEntities)
+					return 0;
+
+				snapshot_table<NFields> snapshot;
+				if (nBaseline != 0)
+				{
+					const snapshot_table<NFields> *pBaseline = this->FindSnapshot(static_cast<uint32_t>(nBaseline));
+					if (pBaseline == nullptr)
+						return 0;
+					snapshot = *pBaseline;
+				}
+				snapshot.resize(nEntities);
+				if (nBaseline == 0)
+					snapshot.clear();
+
+				const uint64_t nEnd = replication_server<T, NFields>::EndMarker(nEntities);
+				uint64_t nEntity = 0;
+				while (true)
+				{
+					uint64_t nDelta = reader.read_varint();
+					if (!reader)
+						return 0;
+					if (nDelta == nEnd)
+						break;
+
+					nEntity += nDelta;
+					if (nEntity >= nEntities)
+						return 0;
+
+					uint64_t nMask = reader.read_bits(NFields);
+					for (size_t f = 0; f < NFields; ++f)
+					{
+						if (nMask & (uint64_t(1) << f))
+							snapshot.set(nEntity, f, static_cast<uint32_t>(reader.read_bits(32)));
+					}
+				}
+
+				if (!reader)
+					return 0;
+
+				size_t nSlot = nTick % this->m_vHistory.size();
+				this->m_vHistory[nSlot] = std::move(snapshot);
+				this->m_vHistoryTicks[nSlot] = static_cast<uint32_t>(nTick);
+				if (nTick > this->m_nLatest)
+					this->m_nLatest = static_cast<uint32_t>(nTick);
+
+				return static_cast<uint32_t>(nTick);
+			}
+
+			// 最新的一帧状态
+			const snapshot_table<NFields>* Latest() const
+			{
+				return this->FindSnapshot(this->m_nLatest);
+			}
+
+		private:
+			const snapshot_table<NFields>* FindSnapshot(uint32_t nTick) const
+			{
+				if (nTick == 0)
+					return nullptr;
+				size_t nSlot = nTick % this->m_vHistory.size();
+				if (this->m_vHistoryTicks[nSlot] != nTick)
+					return nullptr;
+				return &this->m_vHistory[nSlot];
+			}
+
+		private:
+			std::vector<snapshot_table<NFields> > m_vHistory;
+			std::vector<uint32_t> m_vHistoryTicks;
+			uint32_t m_nLatest = 0;
+			size_t m_nMaxEntities;
+		};
+	}
+}
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef __NET_RPC_H__
+#define __NET_RPC_H__
+
+#include "net_common.h"
+#include "net_message.h"
+
+#include <functional>
+#include <system_error>
+
+/*
+请求/回复 (RPC)：
+
+SimpleClient 的 ping 是手写的请求/回复：把时间戳放进 body，服务器原样发回，客户端自己对应请求和回复。
+connection<T>::Call 发出一个请求，回复到达的时候调用对应的回调 (或者完成 future、协程)，
+同一个连接上可以同时有很多个请求在等待回复 (pipelining)，不需要等前一个回复到达：
+
+	client.Call(msg, std::chrono::seconds(1),
+		[](std::error_code ec, olc::net::message<CustomMsgTypes> &reply) { ... });
+
+	auto reply = client.AsyncCall(msg, std::chrono::seconds(1), asio::use_future).get();
+
+服务器在 server_interface::OnRequest 中处理请求，用 connection<T>::Respond 回复 (可以稍后在任何线程中回复)。
+客户端没有处理请求的地方，服务器发给客户端的请求由客户端的连接直接拒绝，不会出现在客户端的接收队列中。
+
+线路上：请求和回复都是普通的报文，报头中带有 frame_flags::rpc，body 的最后 4 字节 (小端) 是调用字：
+	bit31 是回复，bit30 是拒绝 (Reject)，低 30 位是调用的编号
+编号由发起请求的连接分配：槽的下标 (低 rpc_slot_bits 位) 和槽的代数，回复按照下标在 O(1) 时间内找到等待的回调，
+代数不同的回复 (已经超时或者取消的调用) 直接丢弃。调用字在交给应用程序之前去掉，应用程序看到的 body 和发送的时候一样。
+压缩、分片、合并发送和紧凑帧格式都保留这个标志，流式接收 (net_stream.h) 不处理 RPC 报文。
+*/
+
+namespace olc
+{
+	namespace net
+	{
+		// 调用字
+		struct rpc_word
+		{
+			static constexpr uint32_t response = 0x80000000;
+			static constexpr uint32_t error = 0x40000000;
+			static constexpr uint32_t id_mask = 0x3FFFFFFF;
+		};
+
+		// 编号中槽的下标的位数，一个连接上同时等待回复的请求不超过 1 << rpc_slot_bits 个
+		constexpr uint32_t rpc_slot_bits = 14;
+		constexpr uint32_t rpc_max_calls = uint32_t(1) << rpc_slot_bits;
+
+		/*
+		请求结束的时候调用一次：ec 为空的时候 reply 是回复；否则是超时 (timed_out)、取消 (operation_canceled)、
+		服务器拒绝 (operation_not_supported)、连接断开或者同时等待的请求太多 (no_buffer_space)，reply 为空。
+		在连接的 I/O 线程、定时器轮的线程或者调用 Cancel 的线程中调用，不能阻塞
+		*/
+		template <typename T>
+		using rpc_callback = std::function<void(std::error_code ec, message<T> &reply)>;
+
+		// 服务器用 Reject 拒绝请求的时候，调用方得到的错误
+		inline std::error_code rpc_rejected()
+		{
+			return std::make_error_code(std::errc::operation_not_supported);
+		}
+
+		// 在 body 的最后放入调用字，标记为 RPC 报文
+		template <typename T>
+		inline void put_call_word(message<T> &msg, uint32_t nWord)
+		{
+			size_t i = msg.body.size();
+			msg.body.resize(i + sizeof(uint32_t));
+			detail::store_scalar(msg.body.data() + i, nWord);
+			msg.header.size = static_cast<uint32_t>(msg.body.size()) | frame_flags::rpc;
+		}
+
+		// 读出 RPC 报文的调用字，不改变报文，不是 RPC 报文的时候返回 false
+		template <typename T>
+		inline bool peek_call_word(const message<T> &msg, uint32_t &nWord)
+		{
+			if ((msg.header.size & frame_flags::rpc) == 0 || msg.body.size() < sizeof(uint32_t))
+				return false;
+
+			detail::load_scalar(msg.body.data() + msg.body.size() - sizeof(uint32_t), nWord);
+			return true;
+		}
+
+		// 取出并去掉 RPC 报文的调用字，不是 RPC 报文的时候返回 false
+		template <typename T>
+		inline bool take_call_word(message<T> &msg, uint32_t &nWord)
+		{
+			if (!peek_call_word(msg, nWord))
+				return false;
+
+			msg.body.resize(msg.body.size() - sizeof(uint32_t));
+			msg.header.size = static_cast<uint32_t>(msg.body.size());
+			return true;
+		}
+
+		/*
+		把接受 rpc_callback 的函数 fnStart (例如 connection<T>::Call) 变成 asio 的异步操作，
+		签名是 void(std::error_code, message<T>)，完成的方式由 token 决定 (use_future、use_awaitable ...)
+		*/
+		template <typename T, typename CompletionToken, typename Start>
+		auto async_rpc(CompletionToken &&token, Start fnStart)
+		{
+			return asio::async_initiate<CompletionToken, void(std::error_code, message<T>)>(
+				[](auto handler, Start fnStart)
+				{
+					// rpc_callback 需要可以复制，use_awaitable 等的 handler 只能移动
+					auto pHandler = std::make_shared<decltype(handler)>(std::move(handler));
+					fnStart(
+						[pHandler](std::error_code ec, message<T> &reply)
+						{
+							auto executor = asio::get_associated_executor(*pHandler);
+							asio::dispatch(executor,
+								[pHandler, ec, reply = std::move(reply)]() mutable { (*pHandler)(ec, std::move(reply)); });
+						});
+				},
+				token, std::move(fnStart));
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,332 @@
+#ifndef __NET_SCHEMA_H__
+#define __NET_SCHEMA_H__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+/*
+operator << 直接拷贝整个结构体的内存：填充字节也会被发送出去，并且使用的是主机字节序，
+不同的编译器或者不同的平台之间报文的布局可能不一致。
+
+这里给出一个编译期的结构体描述（schema）：列出结构体中需要传输的字段，在编译期生成
+紧凑的（没有填充字节）小端序的编码和解码函数。用法：
+
+	struct PlayerMove
+	{
+		uint32_t nEntity;
+		float x, y;
+		uint8_t nFlags;
+	};
+
+	// 必须写在全局命名空间当中，字段按照声明的顺序列出
+	OLC_NET_SCHEMA(PlayerMove,
+		OLC_NET_FIELD(PlayerMove, nEntity),
+		OLC_NET_FIELD(PlayerMove, x),
+		OLC_NET_FIELD(PlayerMove, y),
+		OLC_NET_FIELD(PlayerMove, nFlags));
+
+之后 msg << move / msg >> move / message_builder / message_reader 都会使用紧凑的格式，
+PlayerMove 在报文中占用 13 个字节，而不是 sizeof(PlayerMove) = 16 个字节。
+*/
+
+#define OLC_NET_FIELD(Type, Member) \
+	::olc::net::schema_field<&Type::Member, offsetof(Type, Member)>
+
+#define OLC_NET_SCHEMA(Type, ...) \
+	template <> \
+	struct olc::net::struct_schema<Type> : ::olc::net::schema_fields<Type, __VA_ARGS__> {}
+
+
+namespace olc
+{
+	namespace net
+	{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+		constexpr bool host_is_little_endian = false;
+#else
+		constexpr bool host_is_little_endian = true;
+#endif
+
+		// 没有特化的类型就没有 schema，仍然按照原来的方式直接拷贝内存
+		template <typename Struct>
+		struct struct_schema;
+
+		template <typename Struct, typename = void>
+		struct has_schema : std::false_type {};
+
+		template <typename Struct>
+		struct has_schema<Struct, std::void_t<decltype(struct_schema<Struct>::wire_size)> > : std::true_type {};
+
+		template <typename Struct>
+		constexpr bool has_schema_v = has_schema<Struct>::value;
+
+
+		namespace detail
+		{
+			template <typename MemberPtr>
+			struct member_pointer_traits;
+
+			template <typename Class, typename Value>
+			struct member_pointer_traits<Value Class::*>
+			{
+				using class_type = Class;
+				using value_type = Value;
+			};
+
+			template <typename Value>
+			constexpr bool is_wire_scalar_v = std::is_arithmetic<Value>::value || std::is_enum<Value>::value;
+
+			// 字段的类型只能是 数字/枚举，它们的数组，或者同样定义了 schema 的结构体
+			template <typename Value>
+			struct is_wire_value
+				: std::integral_constant<bool, is_wire_scalar_v<Value> || has_schema_v<Value> > {};
+
+			template <typename Value, size_t N>
+			struct is_wire_value<Value[N]> : is_wire_value<Value> {};
+
+			// 类型本身或者数组的元素是否定义了 schema
+			template <typename Value>
+			struct uses_schema : has_schema<Value> {};
+
+			template <typename Value, size_t N>
+			struct uses_schema<Value[N]> : uses_schema<Value> {};
+
+			template <typename Value, typename = void>
+			struct value_wire_size
+				: std::integral_constant<size_t, sizeof(Value)> {};
+
+			template <typename Value>
+			struct value_wire_size<Value, std::enable_if_t<has_schema_v<Value> > >
+				: std::integral_constant<size_t, struct_schema<Value>::wire_size> {};
+
+			template <typename Value, size_t N>
+			struct value_wire_size<Value[N], void>
+				: std::integral_constant<size_t, N * value_wire_size<Value>::value> {};
+
+			template <typename Value>
+			constexpr size_t value_wire_size_v = value_wire_size<Value>::value;
+
+			template <typename Value>
+			inline void store_scalar(uint8_t *pDst, const Value &value)
+			{
+				if constexpr (host_is_little_endian || sizeof(Value) == 1)
+				{
+					std::memcpy(pDst, &value, sizeof(Value));
+				}
+				else
+				{
+					const uint8_t *pSrc = reinterpret_cast<const uint8_t*>(&value);
+					for (size_t i = 0; i < sizeof(Value); ++i)
+						pDst[i] = pSrc[sizeof(Value) - 1 - i];
+				}
+			}
+
+			template <typename Value>
+			inline void load_scalar(const uint8_t *pSrc, Value &value)
+			{
+				if constexpr (host_is_little_endian || sizeof(Value) == 1)
+				{
+					std::memcpy(&value, pSrc, sizeof(Value));
+				}
+				else
+				{
+					uint8_t *pDst = reinterpret_cast<uint8_t*>(&value);
+					for (size_t i = 0; i < sizeof(Value); ++i)
+						pDst[i] = pSrc[sizeof(Value) - 1 - i];
+				}
+			}
+
+			template <typename Value>
+			inline void store_value(uint8_t *pDst, const Value &value)
+			{
+				if constexpr (std::is_array<Value>::value)
+				{
+					using element_type = std::remove_extent_t<Value>;
+					for (size_t i = 0; i < std::extent<Value>::value; ++i)
+						store_value<element_type>(pDst + i * value_wire_size_v<element_type>, value[i]);
+				}
+				else if constexpr (has_schema_v<Value>)
+					struct_schema<Value>::encode(pDst, value);
+				else
+					store_scalar(pDst, value);
+			}
+
+			template <typename Value>
+			inline void load_value(const uint8_t *pSrc, Value &value)
+			{
+				if constexpr (std::is_array<Value>::value)
+				{
+					using element_type = std::remove_extent_t<Value>;
+					for (size_t i = 0; i < std::extent<Value>::value; ++i)
+						load_value<element_type>(pSrc + i * value_wire_size_v<element_type>, value[i]);
+				}
+				else if constexpr (has_schema_v<Value>)
+					struct_schema<Value>::decode(pSrc, value);
+				else
+					load_scalar(pSrc, value);
+			}
+
+			// 主机上的内存布局和报文上的布局是否完全一致（小端序并且字段之间没有填充），一致的话可以整体拷贝
+			template <typename Value>
+			struct value_is_wire_layout
+				: std::integral_constant<bool, host_is_little_endian && is_wire_scalar_v<Value> > {};
+
+			template <typename Value, size_t N>
+			struct value_is_wire_layout<Value[N]> : value_is_wire_layout<Value> {};
+		}
+
+
+		// 结构体中的一个字段：成员指针以及这个成员在主机结构体当中的偏移 (offsetof)
+		template <auto MemberPtr, size_t HostOffset>
+		struct schema_field
+		{
+			using class_type = typename detail::member_pointer_traits<decltype(MemberPtr)>::class_type;
+			using value_type = typename detail::member_pointer_traits<decltype(MemberPtr)>::value_type;
+
+			static_assert(detail::is_wire_value<value_type>::value,
+					"Schema field must be arithmetic, enum, an array of them, or a struct with a schema");
+
+			static constexpr auto member = MemberPtr;
+			static constexpr size_t host_offset = HostOffset;
+			static constexpr size_t host_size = sizeof(value_type);
+			static constexpr size_t host_align = alignof(value_type);
+			static constexpr size_t wire_size = detail::value_wire_size_v<value_type>;
+		};
+
+
+		template <typename Struct, typename... Fields>
+		struct schema_fields
+		{
+			static_assert(sizeof...(Fields) > 0, "Schema must list at least one field");
+			static_assert(std::is_standard_layout<Struct>::value,
+					"Schema struct must be standard layout");
+			static_assert((std::is_same<typename Fields::class_type, Struct>::value && ...),
+					"Schema field belongs to another struct");
+
+			static constexpr size_t field_count = sizeof...(Fields);
+
+			// 报文中的总长度，没有任何填充
+			static constexpr size_t wire_size = (Fields::wire_size + ...);
+
+			static constexpr std::array<size_t, field_count> host_offsets { Fields::host_offset... };
+			static constexpr std::array<size_t, field_count> host_sizes { Fields::host_size... };
+			static constexpr std::array<size_t, field_count> host_aligns { Fields::host_align... };
+			static constexpr std::array<size_t, field_count> wire_sizes { Fields::wire_size... };
+
+		private:
+			static constexpr std::array<size_t, field_count> make_wire_offsets()
+			{
+				std::array<size_t, field_count> offsets {};
+				size_t nOffset = 0;
+				for (size_t i = 0; i < field_count; ++i)
+				{
+					offsets[i] = nOffset;
+					nOffset += wire_sizes[i];
+				}
+				return offsets;
+			}
+
+			/*
+			检查列出的字段和主机上的结构体是否对得上：按照列出的顺序和每个字段的对齐要求重新排一遍，
+			每个字段的偏移和最后补齐到 alignof(Struct) 的总长度都必须和主机上的一致。
+			这样能发现顺序错误、重叠和占据了非填充位置的漏掉的成员，但是发现不了整个落在填充字节中的成员
+			(例如 uint8_t 和 uint32_t 之间漏掉一个 uint8_t，布局和没有它的时候完全一样)
+			*/
+			static constexpr bool check_host_layout()
+			{
+				size_t nOffset = 0;
+				for (size_t i = 0; i < field_count; ++i)
+				{
+					nOffset = (nOffset + host_aligns[i] - 1) / host_aligns[i] * host_aligns[i];
+					if (host_offsets[i] != nOffset)
+						return false;
+					nOffset += host_sizes[i];
+				}
+
+				return (nOffset + alignof(Struct) - 1) / alignof(Struct) * alignof(Struct) == sizeof(Struct);
+			}
+
+			static constexpr bool check_wire_layout()
+			{
+				if (sizeof(Struct) != wire_size)
+					return false;
+				for (size_t i = 0; i < field_count; ++i)
+				{
+					if (host_offsets[i] != wire_offsets[i])
+						return false;
+				}
+				return true;
+			}
+
+		public:
+			static constexpr std::array<size_t, field_count> wire_offsets = make_wire_offsets();
+
+			static_assert(check_host_layout(),
+					"Schema fields must be listed in declaration order and account for the struct layout (members hidden in padding cannot be detected)");
+
+			// 主机布局和报文布局完全一致的时候，编码/解码退化为一次 memcpy
+			static constexpr bool host_matches_wire = check_wire_layout() &&
+				(detail::value_is_wire_layout<typename Fields::value_type>::value && ...);
+
+		public:
+			static void encode(uint8_t *pDst, const Struct &data)
+			{
+				if constexpr (host_matches_wire)
+					std::memcpy(pDst, &data, wire_size);
+				else
+					encode_fields(pDst, data, std::index_sequence_for<Fields...>{});
+			}
+
+			static void decode(const uint8_t *pSrc, Struct &data)
+			{
+				if constexpr (host_matches_wire)
+					std::memcpy(&data, pSrc, wire_size);
+				else
+					decode_fields(pSrc, data, std::index_sequence_for<Fields...>{});
+			}
+
+		private:
+			// 展开成每个字段一次定长的拷贝，偏移都是编译期常量
+			template <size_t... I>
+			static void encode_fields(uint8_t *pDst, const Struct &data, std::index_sequence<I...>)
+			{
+				(detail::store_value(pDst + wire_offsets[I], data.*(Fields::member)), ...);
+			}
+
+			template <size_t... I>
+			static void decode_fields(const uint8_t *pSrc, Struct &data, std::index_sequence<I...>)
+			{
+				(detail::load_value(pSrc + wire_offsets[I], data.*(Fields::member)), ...);
+			}
+		};
+
+
+		// 一个类型在报文当中占用的字节数：有 schema 的结构体使用紧凑的长度，其余的类型就是 sizeof
+		template <typename DataType>
+		constexpr size_t wire_size_v = detail::value_wire_size_v<DataType>;
+
+		template <typename DataType>
+		inline void wire_store(uint8_t *pDst, const DataType &data)
+		{
+			if constexpr (detail::uses_schema<DataType>::value)
+				detail::store_value(pDst, data);
+			else
+				std::memcpy(pDst, static_cast<const void*>(&data), sizeof(DataType));
+		}
+
+		template <typename DataType>
+		inline void wire_load(const uint8_t *pSrc, DataType &data)
+		{
+			if constexpr (detail::uses_schema<DataType>::value)
+				detail::load_value(pSrc, data);
+			else
+				std::memcpy(static_cast<void*>(&data), pSrc, sizeof(DataType));
+		}
+	}
+}
+
+#endif
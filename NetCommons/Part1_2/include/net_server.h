@@ -5,6 +5,14 @@
 #include "net_tsqueue.h"
 #include "net_message.h"
 #include "net_connection.h"
+#include "net_shm.h"
+#include "net_loopback.h"
+#include "net_uring.h"
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 
 namespace olc
@@ -17,14 +25,45 @@ namespace olc
 		public:
 			// 创建一个服务器，并在特定的端口上进行监听
 			server_interface(uint16_t port)
-				: m_asioAcceptor(m_asioContext, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port))
+				: m_asioAcceptor(m_asioContext, asio::generic::stream_protocol::endpoint(asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port)))
+			{
+
+			}
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+			/*
+			创建一个只接受同一台机器上的连接的服务器，在 Unix 域套接字 (例如 "/tmp/game.sock") 上进行监听。
+			和 TCP 相比没有协议栈的开销，报文的 API 完全一样；这种服务器不支持 EnableUdp
+			*/
+			server_interface(const asio::local::stream_protocol::endpoint &endpoint)
+				: m_asioAcceptor(m_asioContext, asio::generic::stream_protocol::endpoint(RemoveSocketFile(endpoint))), m_sLocalPath(endpoint.path())
 			{
 
 			}
+#endif
 
 			virtual ~server_interface()
 			{
 				this->Stop();
+
+				// 连接中的 socket 属于 m_asioContext，必须在它之前析构 (成员按照声明的逆序析构)，
+				// 连接中的定时器也必须在 m_timers 之前析构
+				this->m_deqConnections.clear();
+
+				// 接收队列中的报文也持有连接，在队列的锁之外释放它们 (连接析构的时候可能需要别的锁)
+				this->m_vBatch.clear();
+				this->m_qMessageIn.drain(this->m_vBatch);
+				this->m_vBatch.clear();
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+				// 监听的 socket 文件不会随着关闭而消失；先关闭监听，之后如果还能连上，说明文件已经属于别的服务器
+				if (!this->m_sLocalPath.empty())
+				{
+					asio::error_code ec;
+					this->m_asioAcceptor.close(ec);
+					RemoveStaleSocketFile(this->m_sLocalPath);
+				}
+#endif
 			}
 
 			bool Start()
@@ -32,11 +71,24 @@ namespace olc
 				try
 				{
 					// 把接受客户端连接的任务添加到上下文当中去， 然后让上下文在新的线程当中运行
-					this->WaitForClientConnection();
+					bool bUring = false;
+#ifdef OLC_NET_URING
+					bUring = this->m_eIoEngine == io_engine::uring && this->StartUring();
+#endif
+					if (!bUring)
+						this->WaitForClientConnection();
+
+					if (this->m_pUdp)
+						this->m_pUdp->Start();
 
 					// 在新的线程当中执行上下文的循环过程
 					// 调用了 .run() 函数，上下文才会开始事件循环
-					m_threadContext = std::thread([this]() { m_asioContext.run(); });
+					// 使用 io_uring 的时候上下文中可能暂时没有任务，work guard 让它继续运行，定时器轮 (m_timers) 才能前进
+					m_threadContext = std::thread([this]()
+						{
+							auto work = asio::make_work_guard(m_asioContext);
+							m_asioContext.run();
+						});
 				}
 				catch (std::exception &e)
 				{
@@ -56,6 +108,11 @@ namespace olc
 				// 执行结束
 				if (m_threadContext.joinable()) m_threadContext.join();
 
+#ifdef OLC_NET_URING
+				if (this->m_pUring)
+					this->m_pUring->Stop();
+#endif
+
 				std::cout << "[Server] Stopped! \n";
 
 			}
@@ -66,30 +123,13 @@ namespace olc
 				// 当事件发生的时候，回调函数(下面的 labmda 函数) 将会被执行
 				this->m_asioAcceptor.async_accept(
 					// 新的连接出现，就会有一个 socket 和其对应，asio 自动将这个 socket 传递给回调函数
-					[this] (std::error_code ec, asio::ip::tcp::socket socket)
+					[this] (std::error_code ec, stream_socket socket)
 					{
 						if (!ec)
 						{
-							std::cout << "[Server] New connection: " << socket.remote_endpoint() << '\n';
-
-							std::shared_ptr<connection<T> > newconn = 
-								std::make_shared<connection<T> >(connection<T>::owner::server,
-									m_asioContext, std::move(socket), m_qMessageIn); 
-
-							// 服务器通过一定的规则来选择是否拒绝这个连接
-							if (this->OnClientConnect(newconn))
-							{
-								// 这个连接被允许，所以这个连接需要添加到连接队列当中
-								this->m_deqConnections.push_back(std::move(newconn));
-								this->m_deqConnections.back()->ConnectToClient(this->nIDCounter++);
-
-								std::cout << "[" << this->m_deqConnections.back()->GetID() << "] Connection Approved\n";
-							}
-							else
-							{
-								std::cout << "[-----] Connection Denied" << '\n';
-							}
+							std::cout << "[Server] New connection: " << detail::describe_endpoint(socket.remote_endpoint()) << '\n';
 
+							this->AddConnection(this->CreateConnection(std::move(socket)));
 						}
 						else 
 						{
@@ -102,11 +142,145 @@ namespace olc
 				);
 			}
 
-			void MessageClient(std::shared_ptr<connection<T> > client, const message<T> &msg)
+#ifdef OLC_NET_URING
+			// 在 Start 之前调用，选择连接收发和接受新连接使用的 I/O 引擎 (见 net_uring.h)
+			void SetIoEngine(io_engine eEngine)
+			{
+				this->m_eIoEngine = eEngine;
+			}
+#endif
+
+			// 之后建立的所有连接使用的帧格式，客户端必须使用相同的格式
+			void SetFraming(framing eFraming)
+			{
+				this->m_eFraming = eFraming;
+			}
+
+			// 之后建立的所有连接发送的大报文按照 nFragmentSize 切分，见 connection<T>::SetFragmentSize
+			void SetFragmentSize(size_t nFragmentSize)
+			{
+				this->m_nFragmentSize = nFragmentSize;
+			}
+
+			// 之后建立的所有连接合并发送小报文，见 connection<T>::SetBundling
+			void SetBundling(size_t nMaxMessage, size_t nMaxBundle = 1400)
+			{
+				this->m_nBundleMaxMessage = nMaxMessage;
+				this->m_nBundleMaxSize = nMaxBundle;
+			}
+
+			// 之后建立的所有连接上 id 的报文流式接收，见 connection<T>::SetStreamHandler
+			void SetStreamHandler(T id, stream_handler<T> fnHandler)
+			{
+				if (fnHandler)
+					this->m_mapStreamHandlers[id] = std::move(fnHandler);
+				else
+					this->m_mapStreamHandlers.erase(id);
+			}
+
+			// 对之后建立的所有连接开启发送压缩，参数的含义见 connection<T>::EnableCompression
+			void EnableCompression(size_t nThreshold, asio::thread_pool *pPool = nullptr)
+			{
+				this->m_bCompression = true;
+				this->m_nCompressThreshold = nThreshold;
+				this->m_pCompressPool = pPool;
+			}
+
+			/*
+			之后建立的 TCP / Unix 域套接字连接上，body 不小于 nThreshold 的报文使用零拷贝发送，
+			见 connection<T>::EnableZeroCopy；不支持的连接仍然普通地发送
+			*/
+			void EnableZeroCopy(size_t nThreshold = zerocopy_default_threshold)
+			{
+				this->m_bZeroCopy = true;
+				this->m_nZeroCopyThreshold = nThreshold;
+			}
+
+			/*
+			在 Start 之前调用，在和 TCP 相同的端口上打开 UDP 通道 (见 net_udp.h)，
+			之后可以用 delivery::unreliable_sequenced 发送报文
+			*/
+			void EnableUdp()
+			{
+				asio::ip::tcp::endpoint local;
+				if (!detail::to_tcp_endpoint(this->m_asioAcceptor.local_endpoint(), local))
+				{
+					std::cerr << "[Server] UDP needs a TCP listener\n";
+					return;
+				}
+
+				asio::ip::udp::endpoint endpoint(asio::ip::udp::v4(), local.port());
+				this->m_pUdp = std::make_shared<udp_channel<T> >(this->m_asioContext, endpoint, this->m_qMessageIn);
+			}
+
+#ifdef OLC_NET_SHM
+			/*
+			在名为 sName 的共享内存上创建一个点对点的连接 (见 net_shm.h)，同一台机器上的另一个进程用
+			client_interface::ConnectShared 连接它。这个连接和 TCP 的连接一样先经过 OnClientConnect，
+			对方打开共享内存之前发送的报文保存在共享内存中
+			*/
+			bool ListenShared(const std::string &sName, size_t nCapacity = shm_default_capacity)
+			{
+				std::shared_ptr<connection<T> > newconn;
+				try
+				{
+					newconn = std::make_shared<shm_connection<T> >(connection<T>::owner::server, this->m_asioContext,
+						shm_segment::Create(sName, nCapacity, sizeof(message_header<T>)), this->m_qMessageIn);
+				}
+				catch (std::exception &e)
+				{
+					std::cerr << "[Server] Exception: " << e.what() << '\n';
+					return false;
+				}
+
+				if (this->m_bCompression)
+					newconn->EnableCompression(this->m_nCompressThreshold, nullptr, this->m_pCompressPool);
+				newconn->SetTimerWheel(&this->m_timers);
+
+				if (!this->OnClientConnect(newconn))
+				{
+					std::cout << "[-----] Connection Denied" << '\n';
+					return false;
+				}
+
+				this->m_deqConnections.push_back(std::move(newconn));
+				this->m_deqConnections.back()->ConnectToClient(this->nIDCounter++);
+				std::cout << "[" << this->m_deqConnections.back()->GetID() << "] Shared Memory Connection Approved\n";
+				return true;
+			}
+#endif
+
+			/*
+			接受同一个进程中的客户端 (见 net_loopback.h)，由 client_interface::Connect(server) 调用。
+			这个连接和 TCP 的连接一样先经过 OnClientConnect
+			*/
+			bool AcceptLoopback(loopback_connection<T> &client)
+			{
+				auto newconn = std::make_shared<loopback_connection<T> >(connection<T>::owner::server, 
+					this->m_asioContext, this->m_qMessageIn);
+				loopback_connection<T>::Link(*newconn, client);
+				newconn->SetTimerWheel(&this->m_timers);
+
+				if (!this->OnClientConnect(newconn))
+				{
+					newconn->Disconnect();
+					std::cout << "[-----] Connection Denied" << '\n';
+					return false;
+				}
+
+				this->m_deqConnections.push_back(std::move(newconn));
+				this->m_deqConnections.back()->ConnectToClient(this->nIDCounter++);
+				std::cout << "[" << this->m_deqConnections.back()->GetID() << "] Loopback Connection Approved\n";
+				return true;
+			}
+
+			// 客户端已经断开或者报文被拒绝 (见 connection<T>::Send) 的时候返回 false
+			bool MessageClient(std::shared_ptr<connection<T> > client, const message<T> &msg, 
+				delivery eMode = delivery::reliable)
 			{
 				if (client && client->IsConnected())
 				{
-					client->Send(msg);
+					return client->Send(msg, eMode);
 				}
 				else 
 				{
@@ -115,10 +289,12 @@ namespace olc
 					this->m_deqConnections.erase(
 						std::remove(m_deqConnections.begin(), m_deqConnections.end(),  client), m_deqConnections.end()
 					);
+					return false;
 				}
 			}
 
-			void MessageAllClient(const message<T> &msg, std::shared_ptr<connection<T> > pIgonreclient = nullptr)
+			void MessageAllClient(const message<T> &msg, std::shared_ptr<connection<T> > pIgonreclient = nullptr,
+				delivery eMode = delivery::reliable)
 			{
 				bool bInvalidClientExists = false;
 
@@ -127,7 +303,7 @@ namespace olc
 					if (client && client->IsConnected())
 					{
 						if (client != pIgonreclient)
-								client->Send(msg);
+								client->Send(msg, eMode);
 					}
 					else 
 					{
@@ -146,8 +322,24 @@ namespace olc
 				}
 			}
 
+			/*
+			开启之后，Update 会一次取出所有的报文，按照 id 分组 (稳定排序)，
+			每一组相同 id 的报文只调用一次 OnMessages。同一种报文之间保持到达的顺序，
+			所以同一个连接的同一种报文的顺序不变；不同种类的报文之间不再保证先后顺序。
+			*/
+			void SetBatchedMessages(bool bBatched)
+			{
+				this->m_bBatchedMessages = bBatched;
+			}
+
 			void Update(size_t nMaxMessages = -1) 
 			{
+				if (this->m_bBatchedMessages)
+				{
+					this->UpdateBatched(nMaxMessages);
+					return;
+				}
+
 				size_t nMessageCount = 0;
 				#ifdef __DEBUG_OUT__
 					//std::cout << "server message in : " << m_qMessageIn.count() << '\n';
@@ -156,12 +348,174 @@ namespace olc
 				{
 					auto msg = m_qMessageIn.pop_front();
 
-					OnMessage(msg.remote, msg.msg);
+					// RPC 的请求交给 OnRequest，其余的报文交给 OnMessage
+					if (!this->DispatchRequest(msg))
+						OnMessage(msg.remote, msg.msg);
 
 					nMessageCount++;
 				}
 			}
 
+			// 服务器上的定时器轮 (见 net_timer.h)，连接的 RPC 超时使用它，应用程序也可以使用，回调在 I/O 线程中执行
+			timer_wheel& Timers()
+			{
+				return this->m_timers;
+			}
+
+		private:
+			// 新接受的连接经过 OnClientConnect 之后加入连接列表，被拒绝的时候返回 false
+			bool AddConnection(std::shared_ptr<connection<T> > newconn)
+			{
+				newconn->SetFraming(this->m_eFraming);
+				newconn->SetFragmentSize(this->m_nFragmentSize);
+				newconn->SetBundling(this->m_nBundleMaxMessage, this->m_nBundleMaxSize);
+				newconn->SetTimerWheel(&this->m_timers);
+				for (auto &handler : this->m_mapStreamHandlers)
+					newconn->SetStreamHandler(handler.first, handler.second);
+				if (this->m_bCompression)
+					newconn->EnableCompression(this->m_nCompressThreshold, nullptr, this->m_pCompressPool);
+				if (this->m_bZeroCopy)
+					newconn->EnableZeroCopy(this->m_nZeroCopyThreshold);
+
+				// 服务器通过一定的规则来选择是否拒绝这个连接
+				if (this->OnClientConnect(newconn))
+				{
+					// 这个连接被允许，所以这个连接需要添加到连接队列当中。
+					// UDP 通道在加入连接队列之前关联，Update 等其它线程看到这个连接的时候它已经设定好了
+					newconn->ConnectToClient(this->nIDCounter++);
+					if (this->m_pUdp)
+						newconn->AttachUdp(this->m_pUdp, new_session_token());
+					this->m_deqConnections.push_back(std::move(newconn));
+
+					std::cout << "[" << this->m_deqConnections.back()->GetID() << "] Connection Approved\n";
+					return true;
+				}
+
+				std::cout << "[-----] Connection Denied" << '\n';
+				return false;
+			}
+
+#ifdef OLC_NET_URING
+			// 内核不支持的时候返回 false，由调用者退回到 asio
+			bool StartUring()
+			{
+				try
+				{
+					this->m_pUring = std::make_unique<uring_engine>();
+				}
+				catch (std::exception &e)
+				{
+					std::cerr << "[Server] io_uring unavailable, using asio: " << e.what() << '\n';
+					return false;
+				}
+
+				// 监听的 socket 交给引擎，不再注册在 asio 的 reactor 中
+				this->m_pUring->Listen(this->m_asioAcceptor.release(), [this](int fd) { this->OnUringAccept(fd); });
+				this->m_pUring->Start();
+				return true;
+			}
+
+			// 在引擎的线程中调用
+			void OnUringAccept(int fd)
+			{
+				sockaddr_storage addr {};
+				socklen_t nLength = sizeof(addr);
+				::getpeername(fd, reinterpret_cast<sockaddr*>(&addr), &nLength);
+				std::cout << "[Server] New connection: " 
+					<< detail::describe_endpoint(asio::generic::stream_protocol::endpoint(&addr, nLength)) << '\n';
+
+				auto newconn = std::make_shared<uring_connection<T> >(connection<T>::owner::server,
+					this->m_asioContext, *this->m_pUring, this->m_qMessageIn);
+				uint64_t nHandle = this->m_pUring->Add(fd, newconn);
+				if (nHandle == uring_engine::invalid_handle)
+				{
+					std::cout << "[Server] Too many connections\n";
+					::close(fd);
+					return;
+				}
+
+				// 引擎持有这个连接直到 socket 关闭，被拒绝的连接要主动关闭
+				newconn->SetHandle(nHandle);
+				if (!this->AddConnection(newconn))
+					newconn->Disconnect();
+			}
+#endif
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+			// 上一次异常退出时留下的 socket 文件会让 bind 失败，监听之前先删除它
+			static asio::local::stream_protocol::endpoint RemoveSocketFile(const asio::local::stream_protocol::endpoint &endpoint)
+			{
+				RemoveStaleSocketFile(endpoint.path());
+				return endpoint;
+			}
+
+			/*
+			上一个进程退出之后留下的 socket 文件会让 bind 失败，需要删除；
+			只删除 socket 文件，并且要先试着连接一下：能连上说明还有服务器在监听，不能删除
+			(普通文件或者别人正在使用的路径，bind 照样失败并报告错误)
+			*/
+			static void RemoveStaleSocketFile(const std::string &sPath)
+			{
+				struct stat st;
+				if (::lstat(sPath.c_str(), &st) != 0 || !S_ISSOCK(st.st_mode))
+					return;
+
+				asio::io_context context;
+				asio::local::stream_protocol::socket probe(context);
+				asio::error_code ec;
+				probe.connect(asio::local::stream_protocol::endpoint(sPath), ec);
+				if (ec)
+					::unlink(sPath.c_str());
+			}
+#endif
+
+			// 如果 msg 是 RPC 的请求，去掉调用字之后交给 OnRequest 并返回 true
+			bool DispatchRequest(owned_message<T> &msg)
+			{
+				uint32_t nWord = 0;
+				if (!take_call_word(msg.msg, nWord))
+					return false;
+
+				this->OnRequest(msg.remote, nWord & rpc_word::id_mask, msg.msg);
+				return true;
+			}
+
+			void UpdateBatched(size_t nMaxMessages)
+			{
+				this->m_vBatch.clear();
+				if (this->m_qMessageIn.drain(this->m_vBatch, nMaxMessages) == 0)
+					return;
+
+				// RPC 的请求不参与分组，按照到达的顺序先处理
+				size_t nKept = 0;
+				for (size_t i = 0; i < this->m_vBatch.size(); ++i)
+				{
+					if (this->DispatchRequest(this->m_vBatch[i]))
+						continue;
+					if (nKept != i)
+						this->m_vBatch[nKept] = std::move(this->m_vBatch[i]);
+					nKept++;
+				}
+				this->m_vBatch.resize(nKept);
+
+				std::stable_sort(this->m_vBatch.begin(), this->m_vBatch.end(),
+					[](const owned_message<T> &a, const owned_message<T> &b) { return a.msg.header.id < b.msg.header.id; });
+
+				size_t nBegin = 0;
+				while (nBegin < this->m_vBatch.size())
+				{
+					size_t nEnd = nBegin + 1;
+					while (nEnd < this->m_vBatch.size() && this->m_vBatch[nEnd].msg.header.id == this->m_vBatch[nBegin].msg.header.id)
+						nEnd++;
+
+					this->OnMessages(this->m_vBatch[nBegin].msg.header.id, message_span<T>{ this->m_vBatch.data() + nBegin, nEnd - nBegin });
+					nBegin = nEnd;
+				}
+
+				// 保留容量，释放连接和报文主体
+				this->m_vBatch.clear();
+			}
+
 		protected:
 			// 是否接受一个客户端的连接
 			// 具体的客户端类，应当重载这个方法
@@ -177,12 +531,36 @@ namespace olc
 
 			}
 
+			// 为新接受的 socket 创建连接对象，需要使用别的连接实现 (例如 coro_connection) 的时候重载它
+			virtual std::shared_ptr<connection<T> > CreateConnection(stream_socket socket)
+			{
+				return std::make_shared<connection<T> >(connection<T>::owner::server,
+					this->m_asioContext, std::move(socket), this->m_qMessageIn);
+			}
+
 			// 如果有信息到达的话，需要执行下面的处理过程
 			virtual void OnMessage(std::shared_ptr<connection<T> > client, message<T> &msg) 
 			{
 
 			}
 
+			/*
+			客户端发来的 RPC 请求 (见 net_rpc.h)，request 中已经去掉了调用字。用 client->Respond(nCall, reply) 回复，
+			可以保存 nCall 稍后在任何线程中回复。默认拒绝所有的请求
+			*/
+			virtual void OnRequest(std::shared_ptr<connection<T> > client, uint32_t nCall, message<T> &/* request */)
+			{
+				client->Reject(nCall);
+			}
+
+			// 开启了 SetBatchedMessages 之后，一组 id 相同的报文会一起交给这个函数，
+			// 默认逐个调用 OnMessage，需要批量处理某种报文 (例如移动输入) 的时候重载它
+			virtual void OnMessages(T id, message_span<T> batch)
+			{
+				for (auto &m : batch)
+					this->OnMessage(m.remote, m.msg);
+			}
+
 		protected:
 			// 一个线程安全的队列
 			tsqueue<owned_message<T> > m_qMessageIn;
@@ -192,11 +570,40 @@ namespace olc
 			asio::io_context m_asioContext;
 			std::thread m_threadContext;
 
-			// 用于处理连接建立的过程
-			asio::ip::tcp::acceptor m_asioAcceptor;
+			// 在 m_asioContext 之后声明，先于它析构
+			timer_wheel m_timers { m_asioContext };
+
+			// 用于处理连接建立的过程，TCP 和 Unix 域套接字都使用它
+			asio::basic_socket_acceptor<asio::generic::stream_protocol> m_asioAcceptor;
+
+			// 在 Unix 域套接字上监听时 socket 文件的路径
+			std::string m_sLocalPath;
 
 			// 每一个客户端需要使用一个唯一的 id 来进行区分
 			uint32_t nIDCounter = 10000;
+
+			bool m_bCompression = false;
+			size_t m_nCompressThreshold = 0;
+			asio::thread_pool *m_pCompressPool = nullptr;
+
+			bool m_bZeroCopy = false;
+			size_t m_nZeroCopyThreshold = zerocopy_default_threshold;
+
+			framing m_eFraming = framing::standard;
+			size_t m_nFragmentSize = 0;
+			size_t m_nBundleMaxMessage = 0;
+			size_t m_nBundleMaxSize = 1400;
+			stream_handler_map<T> m_mapStreamHandlers;
+
+			std::shared_ptr<udp_channel<T> > m_pUdp;
+
+			bool m_bBatchedMessages = false;
+			std::vector<owned_message<T> > m_vBatch;
+
+#ifdef OLC_NET_URING
+			io_engine m_eIoEngine = io_engine::asio;
+			std::unique_ptr<uring_engine> m_pUring;
+#endif
 		};
 	}
 }
@@ -0,0 +1,570 @@
+#ifndef __NET_SHM_H__
+#define __NET_SHM_H__
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_connection.h"
+
+/*
+同一台机器上两个进程之间基于共享内存的连接：
+
+即使是 Unix 域套接字，每个报文也至少需要两次系统调用和两次拷贝。shm_connection<T> 把两个进程
+之间的数据放在一块共享内存 (shm_open) 中的两个单生产者单消费者 (SPSC) 的字节环里：
+
+	[shm_segment_header][环 0 的数据: 服务器 -> 客户端][环 1 的数据: 客户端 -> 服务器]
+
+发送的一方直接在环中就地写入 记录长度 | message_header<T> | body，接收的一方直接在共享内存中读取
+报头和 body。只有一方无事可做 (环为空或者环已满) 的时候才通过 futex 睡眠，另一方看到等待标志之后
+才会调用 futex 唤醒，所以高负载时收发都不需要任何系统调用。
+
+服务器调用 server_interface::ListenShared(name) 创建共享内存，另一个进程的客户端调用
+client_interface::ConnectShared(name) 打开它，之后的报文 API 和 TCP 完全一样。报头是按照内存布局
+直接拷贝的，两个进程必须使用相同的 T 和相同的编译器。
+
+共享内存使用 shm_open 按照名字打开，这样两个没有亲缘关系的进程不需要额外传递文件描述符。
+一个进程异常退出的时候另一方不会收到通知，需要应用层的心跳来发现。
+*/
+
+#ifdef __linux__
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <system_error>
+
+#define OLC_NET_SHM 1
+
+namespace olc
+{
+	namespace net
+	{
+		// 每个方向的环的默认容量，单个报文 (报头 + body) 不能超过容量的一半
+		constexpr size_t shm_default_capacity = 4 * 1024 * 1024;
+
+		namespace detail
+		{
+			// 跨进程的 futex (不能使用 FUTEX_PRIVATE_FLAG)
+			inline void futex_wait(std::atomic<uint32_t> &word, uint32_t nExpected, long nTimeoutNs)
+			{
+				timespec ts { 0, nTimeoutNs };
+				::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, nExpected, &ts, nullptr, 0);
+			}
+
+			inline void futex_wake(std::atomic<uint32_t> &word)
+			{
+				::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+			}
+		}
+
+		/*
+		一个环在共享内存中的状态。位置是单调递增的字节数 (对 2^32 回绕)，对容量取模得到偏移。
+		生产者写的和消费者写的字段放在不同的缓存行里
+		*/
+		struct shm_ring_state
+		{
+			alignas(64) std::atomic<uint32_t> nHead;	// 生产者：已经发布的位置
+			std::atomic<uint32_t> nWriterWaiting;		// 生产者：环已满，正在等待消费者
+			alignas(64) std::atomic<uint32_t> nTail;	// 消费者：已经读完的位置
+			std::atomic<uint32_t> nReaderWaiting;		// 消费者：环为空，正在等待生产者
+		};
+
+		/*
+		共享内存中的一个 SPSC 字节环 (不拥有内存)。每条记录是
+			uint32 长度 | uint32 填充 | message_header<T> | body | 填充到 8 字节
+		记录不会跨过环的末尾：剩余的空间放不下的时候写一个回绕标记，从头开始写
+		*/
+		class shm_ring
+		{
+		public:
+			shm_ring(shm_ring_state *pState, uint8_t *pData, uint32_t nCapacity)
+				: m_pState(pState), m_pData(pData), m_nCapacity(nCapacity)
+			{
+
+			}
+
+			template <typename T>
+			static constexpr size_t RecordSize(size_t nBody)
+			{
+				return (nRecordPrefix + sizeof(message_header<T>) + nBody + 7) & ~size_t(7);
+			}
+
+			template <typename T>
+			size_t MaxBody() const
+			{
+				return this->m_nCapacity / 2 - RecordSize<T>(0);
+			}
+
+			/*
+			生产者：写入一个报文，环已满的时候等待消费者。nClosed 变为非 0 (连接已经关闭) 的时候放弃并返回 false。
+			报文的长度不能超过 MaxBody
+			*/
+			template <typename T>
+			bool Write(const message_header<T> &header, const uint8_t *pBody, size_t nBody, const std::atomic<uint32_t> &nClosed)
+			{
+				uint32_t nHead = this->m_pState->nHead.load(std::memory_order_relaxed);
+				uint32_t nOffset = nHead & (this->m_nCapacity - 1);
+				uint32_t nNeed = static_cast<uint32_t>(RecordSize<T>(nBody));
+				uint32_t nTotal = nNeed <= this->m_nCapacity - nOffset ? nNeed : this->m_nCapacity - nOffset + nNeed;
+
+				while (this->m_nCapacity - (nHead - this->m_pState->nTail.load(std::memory_order_acquire)) < nTotal)
+				{
+					if (nClosed.load(std::memory_order_acquire))
+						return false;
+					this->WaitWritable(nHead, nTotal);
+				}
+
+				if (nTotal != nNeed)
+				{
+					uint32_t nWrap = nWrapMarker;
+					std::memcpy(this->m_pData + nOffset, &nWrap, sizeof(nWrap));
+					nOffset = 0;
+				}
+
+				uint32_t nLength = static_cast<uint32_t>(sizeof(message_header<T>) + nBody);
+				uint8_t *p = this->m_pData + nOffset;
+				std::memcpy(p, &nLength, sizeof(nLength));
+				std::memcpy(p + nRecordPrefix, &header, sizeof(message_header<T>));
+				if (nBody > 0)
+					std::memcpy(p + nRecordPrefix + sizeof(message_header<T>), pBody, nBody);
+
+				this->m_pState->nHead.store(nHead + nTotal, std::memory_order_release);
+
+				// 和消费者的 WaitReadable 配对：先发布数据再检查等待标志
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (this->m_pState->nReaderWaiting.load(std::memory_order_relaxed))
+					detail::futex_wake(this->m_pState->nHead);
+				return true;
+			}
+
+			/*
+			消费者：依次把所有可读的记录交给 fn(const message_header<T>&, const uint8_t *pBody, size_t nBody)，
+			报头和 body 都直接指向共享内存，只在 fn 返回之前有效。fn 返回 false 的时候停止。返回处理的记录个数。
+			共享内存对面的进程可以随意写入，位置或者长度不合理的时候停止读取，之后 Corrupt() 返回 true
+			*/
+			template <typename T, typename F>
+			size_t Read(F &&fn)
+			{
+				if (this->m_bCorrupt)
+					return 0;
+
+				uint32_t nTail = this->m_pState->nTail.load(std::memory_order_relaxed);
+				uint32_t nHead = this->m_pState->nHead.load(std::memory_order_acquire);
+				size_t nCount = 0;
+
+				// 记录都按照 8 字节对齐
+				if (nHead - nTail > this->m_nCapacity || (nTail & 7) != 0)
+				{
+					this->m_bCorrupt = true;
+					return 0;
+				}
+
+				while (nTail != nHead)
+				{
+					uint32_t nOffset = nTail & (this->m_nCapacity - 1);
+					uint32_t nLength = 0;
+					std::memcpy(&nLength, this->m_pData + nOffset, sizeof(nLength));
+					if (nLength == nWrapMarker)
+					{
+						if (this->m_nCapacity - nOffset > nHead - nTail)
+						{
+							this->m_bCorrupt = true;
+							break;
+						}
+						nTail += this->m_nCapacity - nOffset;
+						continue;
+					}
+
+					// 记录必须有完整的报头，并且整个落在已经发布的数据和环的末尾之内
+					if (nLength < sizeof(message_header<T>) ||
+						nLength > this->m_nCapacity ||
+						RecordSize<T>(nLength - sizeof(message_header<T>)) > std::min<size_t>(this->m_nCapacity - nOffset, nHead - nTail))
+					{
+						this->m_bCorrupt = true;
+						break;
+					}
+
+					const uint8_t *p = this->m_pData + nOffset + nRecordPrefix;
+					const message_header<T> &header = *reinterpret_cast<const message_header<T>*>(p);
+					bool bContinue = fn(header, p + sizeof(message_header<T>), nLength - sizeof(message_header<T>));
+
+					nTail += static_cast<uint32_t>(RecordSize<T>(nLength - sizeof(message_header<T>)));
+					nCount++;
+					this->Release(nTail);
+
+					if (!bContinue)
+						return nCount;
+				}
+
+				this->Release(nTail);
+				return nCount;
+			}
+
+			bool Corrupt() const
+			{
+				return this->m_bCorrupt;
+			}
+
+			// 消费者：先短暂地自旋，环仍然为空的时候睡眠，最多 nTimeoutNs 纳秒
+			void WaitReadable(long nTimeoutNs)
+			{
+				uint32_t nTail = this->m_pState->nTail.load(std::memory_order_relaxed);
+				for (int i = 0; i < nSpinCount; ++i)
+				{
+					if (this->m_pState->nHead.load(std::memory_order_acquire) != nTail)
+						return;
+					std::this_thread::yield();
+				}
+
+				this->m_pState->nReaderWaiting.store(1, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (this->m_pState->nHead.load(std::memory_order_relaxed) == nTail)
+					detail::futex_wait(this->m_pState->nHead, nTail, nTimeoutNs);
+				this->m_pState->nReaderWaiting.store(0, std::memory_order_relaxed);
+			}
+
+			// 唤醒所有在这个环上等待的一方 (关闭连接的时候使用)
+			void WakeAll()
+			{
+				detail::futex_wake(this->m_pState->nHead);
+				detail::futex_wake(this->m_pState->nTail);
+			}
+
+		private:
+			void Release(uint32_t nTail)
+			{
+				if (this->m_pState->nTail.load(std::memory_order_relaxed) == nTail)
+					return;
+
+				this->m_pState->nTail.store(nTail, std::memory_order_release);
+
+				// 和生产者的 WaitWritable 配对
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (this->m_pState->nWriterWaiting.load(std::memory_order_relaxed))
+					detail::futex_wake(this->m_pState->nTail);
+			}
+
+			void WaitWritable(uint32_t nHead, uint32_t nTotal)
+			{
+				uint32_t nTail = this->m_pState->nTail.load(std::memory_order_acquire);
+				for (int i = 0; i < nSpinCount; ++i)
+				{
+					if (this->m_pState->nTail.load(std::memory_order_acquire) != nTail)
+						return;
+					std::this_thread::yield();
+				}
+
+				this->m_pState->nWriterWaiting.store(1, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (this->m_nCapacity - (nHead - this->m_pState->nTail.load(std::memory_order_relaxed)) < nTotal)
+					detail::futex_wait(this->m_pState->nTail, nTail, nWriterTimeoutNs);
+				this->m_pState->nWriterWaiting.store(0, std::memory_order_relaxed);
+			}
+
+		private:
+			static constexpr size_t nRecordPrefix = 8;
+			static constexpr uint32_t nWrapMarker = UINT32_MAX;
+			static constexpr int nSpinCount = 64;
+			static constexpr long nWriterTimeoutNs = 10 * 1000 * 1000;
+
+			shm_ring_state *m_pState;
+			uint8_t *m_pData;
+			uint32_t m_nCapacity;
+			bool m_bCorrupt = false;
+		};
+
+
+		// 共享内存的开头，由创建的一方初始化，最后写入 nMagic
+		struct shm_segment_header
+		{
+			std::atomic<uint64_t> nMagic;
+			uint32_t nVersion;
+			uint32_t nHeaderSize;	// sizeof(message_header<T>)，两端必须一致
+			uint32_t nCapacity;		// 每个环的容量
+			std::atomic<uint32_t> nClosed;
+			shm_ring_state aRings[2];	// [0] 服务器 -> 客户端，[1] 客户端 -> 服务器
+		};
+
+		// 映射到本进程的一块共享内存，创建的一方在析构的时候删除它的名字
+		class shm_segment
+		{
+		public:
+			static constexpr uint64_t nMagicValue = 0x4f4c434e45545348ull;	// "OLCNETSH"
+			static constexpr uint32_t nVersionValue = 1;
+			static constexpr uint32_t nMinCapacity = 4096;
+			static constexpr uint32_t nMaxCapacity = 1u << 30;
+
+			~shm_segment()
+			{
+				if (this->m_pBase)
+					::munmap(this->m_pBase, this->m_nSize);
+				if (this->m_bOwner)
+					::shm_unlink(this->m_sName.c_str());
+			}
+
+			// 创建 (或者替换掉同名的) 共享内存，nCapacity 向上取整为 2 的幂，失败的时候抛出 std::system_error
+			static std::unique_ptr<shm_segment> Create(const std::string &sName, size_t nCapacity, uint32_t nHeaderSize)
+			{
+				uint32_t nRing = nMinCapacity;
+				while (nRing < nCapacity && nRing < nMaxCapacity)
+					nRing <<= 1;
+
+				std::unique_ptr<shm_segment> pSegment(new shm_segment(Normalize(sName)));
+				::shm_unlink(pSegment->m_sName.c_str());
+
+				int fd = ::shm_open(pSegment->m_sName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+				if (fd < 0)
+					throw std::system_error(errno, std::generic_category(), "shm_open");
+				pSegment->m_bOwner = true;
+
+				size_t nSize = DataOffset() + 2 * size_t(nRing);
+				if (::ftruncate(fd, static_cast<off_t>(nSize)) != 0)
+				{
+					int nError = errno;
+					::close(fd);
+					throw std::system_error(nError, std::generic_category(), "ftruncate");
+				}
+				pSegment->Map(fd, nSize);
+
+				shm_segment_header *pHeader = new (pSegment->m_pBase) shm_segment_header();
+				pHeader->nVersion = nVersionValue;
+				pHeader->nHeaderSize = nHeaderSize;
+				pHeader->nCapacity = nRing;
+				pHeader->nMagic.store(nMagicValue, std::memory_order_release);
+				pSegment->m_nCapacity = nRing;
+				return pSegment;
+			}
+
+			// 打开另一个进程创建的共享内存，不存在或者格式不一致的时候抛出异常
+			static std::unique_ptr<shm_segment> Open(const std::string &sName, uint32_t nHeaderSize)
+			{
+				std::unique_ptr<shm_segment> pSegment(new shm_segment(Normalize(sName)));
+
+				int fd = ::shm_open(pSegment->m_sName.c_str(), O_RDWR, 0600);
+				if (fd < 0)
+					throw std::system_error(errno, std::generic_category(), "shm_open");
+
+				struct stat st;
+				if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < DataOffset())
+				{
+					::close(fd);
+					throw std::runtime_error("shared memory segment is too small");
+				}
+				pSegment->Map(fd, static_cast<size_t>(st.st_size));
+
+				// 头部也是对方可以写入的，容量只读取一次，必须是 Create 可能给出的值：[4096, 2^30] 之间的 2 的幂
+				shm_segment_header *pHeader = pSegment->Header();
+				uint32_t nCapacity = pHeader->nCapacity;
+				if (pHeader->nMagic.load(std::memory_order_acquire) != nMagicValue || pHeader->nVersion != nVersionValue ||
+					pHeader->nHeaderSize != nHeaderSize || nCapacity < nMinCapacity || nCapacity > nMaxCapacity ||
+					(nCapacity & (nCapacity - 1)) != 0 || DataOffset() + 2 * size_t(nCapacity) > pSegment->m_nSize)
+					throw std::runtime_error("shared memory segment has an incompatible layout");
+				pSegment->m_nCapacity = nCapacity;
+				return pSegment;
+			}
+
+			shm_segment_header* Header() const
+			{
+				return reinterpret_cast<shm_segment_header*>(this->m_pBase);
+			}
+
+			shm_ring Ring(size_t nIndex) const
+			{
+				return shm_ring(&this->Header()->aRings[nIndex],
+					static_cast<uint8_t*>(this->m_pBase) + DataOffset() + nIndex * this->m_nCapacity, this->m_nCapacity);
+			}
+
+		private:
+			explicit shm_segment(std::string sName)
+				: m_sName(std::move(sName))
+			{
+
+			}
+
+			// shm_open 的名字必须以 '/' 开头
+			static std::string Normalize(const std::string &sName)
+			{
+				return !sName.empty() && sName[0] == '/' ? sName : "/" + sName;
+			}
+
+			static constexpr size_t DataOffset()
+			{
+				return (sizeof(shm_segment_header) + 63) & ~size_t(63);
+			}
+
+			void Map(int fd, size_t nSize)
+			{
+				void *p = ::mmap(nullptr, nSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				int nError = errno;
+				::close(fd);
+				if (p == MAP_FAILED)
+					throw std::system_error(nError, std::generic_category(), "mmap");
+
+				this->m_pBase = p;
+				this->m_nSize = nSize;
+			}
+
+		private:
+			std::string m_sName;
+			bool m_bOwner = false;
+			void *m_pBase = nullptr;
+			size_t m_nSize = 0;
+			uint32_t m_nCapacity = 0;	// 每个环的容量，已经检查过的值
+		};
+
+
+		/*
+		共享内存上的连接。发送在调用 Send 的线程中直接写入环 (多个线程发送的时候用锁串行化)，
+		接收在一个专门的线程中进行，放入和 TCP 连接相同的接收队列。没有 socket，也不使用 I/O 上下文
+		*/
+		template <typename T>
+		class shm_connection : public connection<T>
+		{
+		public:
+			shm_connection(typename connection<T>::owner parent,
+				asio::io_context& asioContext,
+				std::unique_ptr<shm_segment> pSegment,
+				tsqueue<owned_message<T> >& qIn)
+				: connection<T>(parent, asioContext, stream_socket(asioContext), qIn),
+				  m_pSegment(std::move(pSegment)),
+				  m_ringOut(this->m_pSegment->Ring(parent == connection<T>::owner::server ? 0 : 1)),
+				  m_ringIn(this->m_pSegment->Ring(parent == connection<T>::owner::server ? 1 : 0))
+			{
+
+			}
+
+			// 接收线程不会释放最后一个引用 (见 ReadLoop)，析构函数总是在别的线程中执行
+			~shm_connection()
+			{
+				this->Disconnect();
+				if (this->m_threadRead.joinable())
+					this->m_threadRead.join();
+			}
+
+			// 客户端打开共享内存之后调用，开始接收；服务器一端由 ConnectToClient 开始接收
+			void Start()
+			{
+				this->StartReading();
+			}
+
+			bool IsConnected() const override
+			{
+				return this->m_pSegment->Header()->nClosed.load(std::memory_order_acquire) == 0;
+			}
+
+			// 关闭对两端都可见，两个进程中在环上等待的线程都会被唤醒
+			void Disconnect() override
+			{
+				this->m_pSegment->Header()->nClosed.store(1, std::memory_order_release);
+				this->m_ringOut.WakeAll();
+				this->m_ringIn.WakeAll();
+			}
+
+		protected:
+			// 写入环之后就算发送完成，fnSent 在调用 Send 的线程中调用
+			void QueueMessage(message<T> msg, send_callback fnSent) override
+			{
+				if (msg.body.size() > this->m_ringOut.template MaxBody<T>())
+				{
+					std::cout << "[" << this->id << "] Message Too Large For Shared Memory.\n";
+					this->Disconnect();
+					if (fnSent)
+						fnSent(std::make_error_code(std::errc::message_size));
+					return;
+				}
+
+				bool bWritten = false;
+				{
+					std::lock_guard<std::mutex> lock(this->m_muxWrite);
+					bWritten = this->m_ringOut.Write(msg.header, msg.body.data(), msg.body.size(), this->m_pSegment->Header()->nClosed);
+				}
+
+				if (fnSent)
+					fnSent(bWritten ? std::error_code() : std::make_error_code(std::errc::not_connected));
+			}
+
+			void StartReading() override
+			{
+				if (!this->m_threadRead.joinable())
+				{
+					std::weak_ptr<connection<T> > wpSelf = this->weak_from_this();
+					bool bShared = !wpSelf.expired();
+					this->m_threadRead = std::thread([this, wpSelf, bShared]() { this->ReadLoop(wpSelf, bShared); });
+				}
+			}
+
+			void StartWriting() override
+			{
+				// 发送不经过 m_qMessagesOut
+			}
+
+		private:
+			/*
+			服务器一端的连接由 shared_ptr 持有。接收线程在开始的时候取得一个引用并一直持有，交给应用程序的报文、
+			RPC 的回调和流式接收的 sink 在这个线程中释放的时候都不会是最后一个引用。只剩下这一个引用
+			(应用程序和服务器都已经放手) 或者连接关闭的时候，把它交给 I/O 线程释放并退出，
+			析构函数 join 这个线程的时候它已经不再使用 this。
+			客户端的连接由 unique_ptr 持有，没有 shared_ptr，只会在拥有者的线程中析构
+			*/
+			void ReadLoop(std::weak_ptr<connection<T> > wpSelf, bool bShared)
+			{
+				std::shared_ptr<connection<T> > pSelf = wpSelf.lock();
+				if (bShared && !pSelf)
+					return;
+
+				this->ReadRecords(pSelf);
+
+				if (pSelf)
+					asio::post(this->m_asioContext, [pSelf = std::move(pSelf)]() {});
+			}
+
+			void ReadRecords(const std::shared_ptr<connection<T> > &pSelf)
+			{
+				bool bOk = true;
+				auto fnDeliver = [this, &bOk](const message_header<T> &header, const uint8_t *pBody, size_t nBody)
+				{
+					this->m_msgTemporaryIn.header = header;
+					this->m_msgTemporaryIn.body.assign(pBody, pBody + nBody);
+					bOk = this->DeliverIncoming(this->m_msgTemporaryIn);
+					return bOk;
+				};
+
+				while (this->IsConnected())
+				{
+					if (pSelf && pSelf.use_count() == 1)
+						return;
+
+					if (this->m_ringIn.template Read<T>(fnDeliver) == 0 && !this->m_ringIn.Corrupt())
+						this->m_ringIn.WaitReadable(nIdleTimeoutNs);
+					if (this->m_ringIn.Corrupt())
+						std::cout << "[" << this->id << "] Corrupt Shared Memory Record.\n";
+					if (!bOk || this->m_ringIn.Corrupt())
+					{
+						this->Disconnect();
+						return;
+					}
+				}
+
+				// 对方在关闭之前发送的报文
+				this->m_ringIn.template Read<T>(fnDeliver);
+			}
+
+		private:
+			static constexpr long nIdleTimeoutNs = 100 * 1000 * 1000;
+
+			std::unique_ptr<shm_segment> m_pSegment;
+			shm_ring m_ringOut;
+			shm_ring m_ringIn;
+
+			std::mutex m_muxWrite;
+			std::thread m_threadRead;
+		};
+	}
+}
+
+#endif
+
+#endif
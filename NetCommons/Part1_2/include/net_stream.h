@@ -0,0 +1,95 @@
+#ifndef __NET_STREAM_H__
+#define __NET_STREAM_H__
+
+#include "net_common.h"
+#include "net_message.h"
+
+#include <functional>
+#include <fstream>
+
+/*
+流式接收大报文的 body：
+
+连接在读到报头之后会把 body 整个读入 m_msgTemporaryIn.body，再复制进接收队列，一个 100 MB 的上传
+就要在每个连接上占用 100 MB 以上的内存。对某一个 id 设定了 stream_handler 之后，这个 id 的报文
+的 body 不再缓存，而是随着数据的到达一段一段地交给 handler 返回的 body_sink (直接写入文件、边收边计算
+摘要 ...)，每个连接额外占用的内存只有一段的大小 (stream_chunk_size)：
+
+	class hash_sink : public olc::net::body_sink
+	{
+		bool Write(const uint8_t *pData, size_t nLength) override { m_hash.Update(pData, nLength); return true; }
+		void Finish() override { ... }
+	};
+
+	server.SetStreamHandler(CustomMsgTypes::Upload,
+		[](std::shared_ptr<olc::net::connection<CustomMsgTypes> > client, const olc::net::message_header<CustomMsgTypes> &header)
+		{
+			return std::make_unique<hash_sink>();
+		});
+
+handler 和 sink 都在连接的 I/O 线程中调用。流式接收的报文不会再放入接收队列，OnMessage 看不到它们。
+handler 返回 nullptr 表示这个报文仍然按照普通的方式接收；压缩的报文必须完整地解压，也按照普通的方式接收。
+分片发送的报文 (见 connection<T>::SetFragmentSize) 每收到一个分片就交给 sink 一次。
+*/
+
+namespace olc
+{
+	namespace net
+	{
+		template <typename T>
+		class connection;
+
+		// 流式接收的时候每一段的最大长度
+		constexpr size_t stream_chunk_size = 64 * 1024;
+
+		// 接收一个报文的 body
+		class body_sink
+		{
+		public:
+			virtual ~body_sink() {}
+
+			// body 中接下来的一段数据，返回 false 表示出错，连接会被关闭
+			virtual bool Write(const uint8_t *pData, size_t nLength) = 0;
+
+			// body 全部收到了；连接在中途断开的时候不会调用，sink 直接被释放
+			virtual void Finish() {}
+		};
+
+		/*
+		连接收到 id 对应的报文的报头之后调用，返回接收 body 的 sink。
+		服务器端 pRemote 是发来报文的连接，客户端为 nullptr (和 owned_message::remote 一样)
+		*/
+		template <typename T>
+		using stream_handler = std::function<std::unique_ptr<body_sink>(std::shared_ptr<connection<T> > pRemote, const message_header<T> &header)>;
+
+		template <typename T>
+		using stream_handler_map = std::unordered_map<T, stream_handler<T> >;
+
+		// 把 body 写入文件的 sink，文件打不开的时候 Write 返回 false
+		class file_body_sink : public body_sink
+		{
+		public:
+			explicit file_body_sink(const std::string &sPath)
+				: m_file(sPath, std::ios::binary | std::ios::trunc)
+			{
+
+			}
+
+			bool Write(const uint8_t *pData, size_t nLength) override
+			{
+				this->m_file.write(reinterpret_cast<const char *>(pData), static_cast<std::streamsize>(nLength));
+				return this->m_file.good();
+			}
+
+			void Finish() override
+			{
+				this->m_file.close();
+			}
+
+		private:
+			std::ofstream m_file;
+		};
+	}
+}
+
+#endif
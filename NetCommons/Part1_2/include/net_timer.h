@@ -0,0 +1,337 @@
+#ifndef __NET_TIMER_H__
+#define __NET_TIMER_H__
+
+#include "net_common.h"
+
+#include <functional>
+#include <condition_variable>
+
+/*
+共享的定时器轮：
+
+RPC 的超时、心跳、空闲断开、重传 ... 每一个都用一个 asio::steady_timer 的话，几万个连接就是几万个
+reactor 中按时间排序的项 (堆)，设定和取消都是 O(log n)，取消的时候还要把被取消的回调排进队列执行一次。
+timer_wheel 在 io_context 上只挂一个 steady_timer，按照固定的精度 (tick) 前进。
+
+定时器按照到期的 tick 放进分层的槽中 (hashed hierarchical timing wheel)：第 0 层的 256 个槽每个对应一个 tick，
+第 1 层的每个槽对应 256 个 tick，依此类推，4 层一共覆盖 2^32 个 tick (10ms 的精度下超过一年)。
+第 0 层转完一圈的时候，把第 1 层下一个槽中的定时器按照剩下的时间重新放进第 0 层 (级联)，更高层的也一样。
+设定和取消都只是双向链表的插入和删除，O(1)，不分配内存：timer 节点嵌入在使用者的对象中，
+回调是 std::function，只捕获一两个指针或者整数的时候不会分配内存。
+
+	olc::net::timer_wheel::timer deadline;
+	wheel.Schedule(deadline, std::chrono::seconds(5), [this]() { ... });
+	wheel.Cancel(deadline);
+
+所有的函数都可以在任何线程中调用，回调在 io_context 的线程中执行。没有定时器的时候不会唤醒 io_context。
+定时器轮必须比在它上面设定过的定时器活得久。
+*/
+
+namespace olc
+{
+	namespace net
+	{
+		class timer_wheel
+		{
+		public:
+			using clock = std::chrono::steady_clock;
+
+			// 双向链表的节点，每个槽的链表头是一个不带回调的节点
+			struct timer_node
+			{
+				timer_node *pPrev = nullptr;
+				timer_node *pNext = nullptr;
+			};
+
+			/*
+			一个定时器，由使用者持有，不能复制和移动 (链表中保存的是它的地址)。
+			析构的时候会取消它，并且等待正在执行的回调结束
+			*/
+			class timer : private timer_node
+			{
+			public:
+				timer() = default;
+				timer(const timer&) = delete;
+				timer& operator=(const timer&) = delete;
+
+				~timer()
+				{
+					this->CancelSync();
+				}
+
+				// 见 timer_wheel::CancelSync，没有设定过的定时器什么也不做
+				void CancelSync()
+				{
+					if (this->m_pWheel)
+						this->m_pWheel->CancelSync(*this);
+				}
+
+			private:
+				friend class timer_wheel;
+
+				timer_wheel *m_pWheel = nullptr;
+				uint64_t m_nExpire = 0;		// 到期的 tick
+				std::function<void()> m_fn;
+			};
+
+		public:
+			timer_wheel(asio::io_context &asioContext, clock::duration tick = std::chrono::milliseconds(10))
+				: m_timerTick(asioContext), m_tick(std::max<clock::duration>(tick, clock::duration(1))), m_tStart(clock::now())
+			{
+				for (auto &level : this->m_aLevels)
+					for (auto &head : level)
+						head.pPrev = head.pNext = &head;
+			}
+
+			timer_wheel(const timer_wheel&) = delete;
+			timer_wheel& operator=(const timer_wheel&) = delete;
+
+			// 还没有到期的定时器不会再执行，它们和这个定时器轮脱离关系
+			~timer_wheel()
+			{
+				std::lock_guard<std::mutex> lock(this->m_mux);
+				for (auto &level : this->m_aLevels)
+				{
+					for (auto &head : level)
+					{
+						while (head.pNext != &head)
+						{
+							timer &t = static_cast<timer&>(*head.pNext);
+							this->Unlink(t);
+							t.m_pWheel = nullptr;
+						}
+					}
+				}
+			}
+
+			clock::duration Resolution() const
+			{
+				return this->m_tick;
+			}
+
+			// 修改精度，只能在没有等待的定时器的时候修改，否则返回 false
+			bool SetResolution(clock::duration tick)
+			{
+				std::lock_guard<std::mutex> lock(this->m_mux);
+				if (this->m_nCount > 0)
+					return false;
+
+				this->m_tick = std::max<clock::duration>(tick, clock::duration(1));
+				this->m_tStart = clock::now();
+				this->m_nBase = 0;
+				return true;
+			}
+
+			/*
+			d 之后执行 fn，t 已经设定过的时候重新设定。不会早于 d，最多晚一个 tick
+			(当前的 tick 已经过去了一部分，所以到期的 tick 多加一)
+			*/
+			void Schedule(timer &t, clock::duration d, std::function<void()> fn)
+			{
+				uint64_t nTicks = static_cast<uint64_t>((std::max(d, clock::duration::zero()) + this->m_tick - clock::duration(1)) / this->m_tick);
+
+				std::lock_guard<std::mutex> lock(this->m_mux);
+				if (t.pNext)
+					this->Unlink(t);
+
+				// 定时器轮停下来的时候时间没有前进，直接跳到现在，不需要逐个处理空闲期间的 tick
+				uint64_t nNow = this->CurrentTick();
+				if (!this->m_bArmed)
+					this->m_nBase = std::max(this->m_nBase, nNow + 1);
+
+				t.m_pWheel = this;
+				t.m_nExpire = nNow + nTicks + 1;
+				t.m_fn = std::move(fn);
+				this->Link(t);
+
+				if (!this->m_bArmed)
+					this->Arm();
+			}
+
+			// 取消 t，返回它是否还在等待。不等待正在执行的回调，回调需要自己检查是否已经过时
+			bool Cancel(timer &t)
+			{
+				std::lock_guard<std::mutex> lock(this->m_mux);
+				if (!t.pNext)
+					return false;
+
+				this->Unlink(t);
+				t.m_fn = nullptr;
+				return true;
+			}
+
+			/*
+			取消 t，如果它的回调正在另一个线程中执行，等待回调结束。之后就可以释放 t 和回调中用到的对象了。
+			调用的时候不能持有回调需要的锁
+			*/
+			void CancelSync(timer &t)
+			{
+				std::unique_lock<std::mutex> lock(this->m_mux);
+				if (t.pNext)
+				{
+					this->Unlink(t);
+					t.m_fn = nullptr;
+				}
+
+				while (this->m_pRunning == &t && this->m_idRunning != std::this_thread::get_id())
+					this->m_cvRunning.wait(lock);
+			}
+
+			// 正在等待的定时器的个数
+			size_t Count()
+			{
+				std::lock_guard<std::mutex> lock(this->m_mux);
+				return this->m_nCount;
+			}
+
+		private:
+			static constexpr size_t nLevelBits = 8;
+			static constexpr size_t nSlots = size_t(1) << nLevelBits;
+			static constexpr size_t nLevels = 4;
+
+			// 最高层能够表示的最远的距离，更远的定时器先放在最高层最远的槽中，级联的时候再重新放置
+			static constexpr uint64_t nMaxDistance = (uint64_t(1) << (nLevelBits * nLevels)) - 1;
+
+			uint64_t CurrentTick() const
+			{
+				return static_cast<uint64_t>((clock::now() - this->m_tStart) / this->m_tick);
+			}
+
+			// 按照距离下一个要处理的 tick (m_nBase) 的远近选择层，层中的槽由到期的 tick 决定
+			void Link(timer &t)
+			{
+				uint64_t nExpire = std::max(t.m_nExpire, this->m_nBase);
+				uint64_t nDistance = std::min(nExpire - this->m_nBase, nMaxDistance);
+				if (nDistance == nMaxDistance)
+					nExpire = this->m_nBase + nMaxDistance;
+
+				size_t nLevel = 0;
+				while (nLevel + 1 < nLevels && nDistance >= (uint64_t(1) << (nLevelBits * (nLevel + 1))))
+					nLevel++;
+
+				timer_node &head = this->m_aLevels[nLevel][(nExpire >> (nLevelBits * nLevel)) & (nSlots - 1)];
+				t.pPrev = head.pPrev;
+				t.pNext = &head;
+				head.pPrev->pNext = &t;
+				head.pPrev = &t;
+				this->m_nCount++;
+			}
+
+			void Unlink(timer &t)
+			{
+				t.pPrev->pNext = t.pNext;
+				t.pNext->pPrev = t.pPrev;
+				t.pPrev = t.pNext = nullptr;
+				this->m_nCount--;
+			}
+
+			// 把 from 中的节点全部移到 to 中
+			static void Splice(timer_node &from, timer_node &to)
+			{
+				to.pPrev = to.pNext = &to;
+				if (from.pNext == &from)
+					return;
+
+				to.pNext = from.pNext;
+				to.pPrev = from.pPrev;
+				to.pNext->pPrev = &to;
+				to.pPrev->pNext = &to;
+				from.pPrev = from.pNext = &from;
+			}
+
+			// 持有 m_mux 的时候调用
+			void Arm()
+			{
+				this->m_bArmed = true;
+				this->m_timerTick.expires_at(this->m_tStart + this->m_tick * this->m_nBase);
+				this->m_timerTick.async_wait(
+					[this](std::error_code ec)
+					{
+						if (!ec)
+							this->Tick();
+					});
+			}
+
+			// 处理到现在为止的每一个 tick，还有定时器的时候等待下一个 tick
+			void Tick()
+			{
+				std::unique_lock<std::mutex> lock(this->m_mux);
+				uint64_t nTarget = this->CurrentTick();
+				while (this->m_nBase <= nTarget && this->m_nCount > 0)
+					this->Advance(lock);
+
+				this->m_nBase = std::max(this->m_nBase, nTarget + 1);
+				this->m_bArmed = false;
+				if (this->m_nCount > 0)
+					this->Arm();
+			}
+
+			/*
+			处理 m_nBase 这个 tick：第 0 层转完一圈的时候先从上一层级联，然后执行第 0 层对应的槽中的定时器。
+			回调在锁之外执行，回调中可以设定和取消定时器
+			*/
+			void Advance(std::unique_lock<std::mutex> &lock)
+			{
+				uint64_t nTick = this->m_nBase;
+				for (size_t nLevel = 1; nLevel < nLevels; ++nLevel)
+				{
+					if ((nTick >> (nLevelBits * (nLevel - 1))) & (nSlots - 1))
+						break;
+					this->Cascade(nLevel, (nTick >> (nLevelBits * nLevel)) & (nSlots - 1));
+				}
+
+				// 先取出到期的定时器再前进，回调中设定的定时器不会放进正在处理的槽
+				timer_node expired;
+				Splice(this->m_aLevels[0][nTick & (nSlots - 1)], expired);
+				this->m_nBase++;
+
+				while (expired.pNext != &expired)
+				{
+					timer &t = static_cast<timer&>(*expired.pNext);
+					this->Unlink(t);
+					std::function<void()> fn = std::move(t.m_fn);
+					this->m_pRunning = &t;
+					this->m_idRunning = std::this_thread::get_id();
+
+					lock.unlock();
+					fn();
+					lock.lock();
+
+					this->m_pRunning = nullptr;
+					this->m_cvRunning.notify_all();
+				}
+			}
+
+			// 把高层的一个槽中的定时器按照剩下的距离重新放置，它们都会落到更低的层中
+			void Cascade(size_t nLevel, size_t nSlot)
+			{
+				timer_node pending;
+				Splice(this->m_aLevels[nLevel][nSlot], pending);
+				while (pending.pNext != &pending)
+				{
+					timer &t = static_cast<timer&>(*pending.pNext);
+					this->Unlink(t);
+					this->Link(t);
+				}
+			}
+
+		private:
+			std::mutex m_mux;
+			asio::steady_timer m_timerTick;
+			clock::duration m_tick;
+			clock::time_point m_tStart;
+
+			std::array<std::array<timer_node, nSlots>, nLevels> m_aLevels;
+			uint64_t m_nBase = 0;		// 下一个要处理的 tick
+			size_t m_nCount = 0;
+			bool m_bArmed = false;
+
+			// 正在执行回调的定时器，CancelSync 等待它结束
+			timer *m_pRunning = nullptr;
+			std::thread::id m_idRunning;
+			std::condition_variable m_cvRunning;
+		};
+	}
+}
+
+#endif
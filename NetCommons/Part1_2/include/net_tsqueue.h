@@ -35,10 +35,20 @@ namespace olc
 				deqQueue.emplace_front(std::move(item));
 			}
 
-			void push_back(const T &item)
+			// 返回这个元素的序号：从队列创建以来第几个 push_back 的元素 (从 0 开始)，push_front 不计数
+			uint64_t push_back(const T &item)
 			{
 				std::scoped_lock lock(muxQueue);
 				deqQueue.emplace_back(std::move(item));
+				return nPushed++;
+			}
+
+			// 报文在线程之间直接移交的时候不需要拷贝 body
+			uint64_t push_back(T &&item)
+			{
+				std::scoped_lock lock(muxQueue);
+				deqQueue.emplace_back(std::move(item));
+				return nPushed++;
 			}
 
 			bool empty() 
@@ -75,9 +85,21 @@ namespace olc
 				return  t;
 			}
 
+			// 在一次加锁中取出最多 nMax 个元素，追加到 vOut 的末尾，返回取出的个数
+			size_t drain(std::vector<T> &vOut, size_t nMax = -1)
+			{
+				std::scoped_lock lock(muxQueue);
+				size_t n = std::min(nMax, deqQueue.size());
+				vOut.insert(vOut.end(), std::make_move_iterator(deqQueue.begin()),
+					std::make_move_iterator(deqQueue.begin() + n));
+				deqQueue.erase(deqQueue.begin(), deqQueue.begin() + n);
+				return n;
+			}
+
 		protected:
 			std::mutex muxQueue;
 			std::deque<T> deqQueue;
+			uint64_t nPushed = 0;
 		};
 
 	}
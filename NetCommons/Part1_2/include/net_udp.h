@@ -0,0 +1,1179 @@
+#ifndef __NET_UDP_H__
+#define __NET_UDP_H__
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_tsqueue.h"
+#include "net_frame.h"
+
+#include <map>
+#include <set>
+#include <unordered_set>
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/random.h>
+#include <cerrno>
+#endif
+
+// Linux 4.18 之后的 UDP 分段卸载 (GSO) 和接收合并 (GRO)
+#if defined(__linux__) && defined(UDP_SEGMENT) && defined(UDP_GRO)
+#define OLC_NET_UDP_OFFLOAD 1
+#endif
+
+/*
+和 TCP 连接并行的 UDP 数据报通道：
+
+TCP 上丢失一个包会阻塞后面所有的报文 (队头阻塞)，互不相关的报文流 (聊天、掉落物品、移动) 也会互相阻塞。
+服务器和客户端各有一个 udp_channel (服务器的通道和 TCP 使用同一个端口)，每一个 TCP 连接在通道中
+对应一个会话，会话用服务器生成的随机令牌 (session token) 来识别：
+
+	1. 服务器接受连接之后，通过 TCP 发送一个控制帧告诉客户端它的令牌
+	2. 客户端注册这个令牌，并向服务器发送只有头部的 hello 数据报，每 200ms 一次，直到收到服务器的数据报
+	3. 服务器从收到的数据报中得知客户端的 UDP 地址并回复一个确认，之后双方都可以发送
+一方收到对方的第一个数据报之后会话才算建立 (udp_state::established)。在这之前不可靠的报文通过 TCP 发送，
+两条可靠通道的报文在会话中排队 (客户端在收到令牌之前就有一个会话)，会话建立之后按顺序发出，不会和 TCP 上的报文交错。
+客户端没有打开 UDP、或者 UDP 被防火墙挡住的时候，会话在 udp_establish_timeout 之后失败：排队的报文被丢弃，
+以后所有的报文都通过 TCP 发送。放不进一个数据报的可靠通道的报文会被拒绝，因为改走 TCP 就会乱序。
+
+每一个数据报最多包含一个报文：
+	令牌 (8) | 包序号 (4) | ack (4) | ack 位图 (4) | 通道 (1) | 通道内序号 (4) | 紧凑报头 (见 net_frame.h) | body
+所有的整数都是小端序。没有报文的数据报是 hello (通道为 lane_hello) 或者单纯的确认 (通道为 lane_none)。
+
+一个会话中有三条通道 (lane)，共用一个 socket 和一个拥塞窗口：
+	unreliable_sequenced  可能丢失，接收端丢弃比已经收到的更旧的报文 (移动)
+	reliable_ordered      不会丢失，按发送的顺序交给应用程序 (聊天)
+	reliable_unordered    不会丢失，到达就交给应用程序，不等待前面的报文 (掉落物品)
+一条通道上的丢包不会阻塞另外两条通道。
+
+可靠性 (选择确认)：每个数据报都带有对方最新的包序号 (ack) 和它之前 32 个包是否收到的位图，
+同一个包会在之后的很多个数据报中被重复确认，单个确认包丢失没有影响。发送端记录每一个包的发送时间：
+被确认的时候得到一个 RTT 样本 (每次重传都是新的包序号，所以没有重传歧义)；
+比最新被确认的包早 3 个以上、或者超过 RTO (srtt + 4 * rttvar) 还没有被确认的包认为已经丢失，
+其中的可靠报文用新的包重新发送。
+
+拥塞控制：已经发出但还没有被确认或者判定丢失的包数不超过拥塞窗口 (慢启动 + AIMD，
+每个 RTT 最多因为丢包减半一次)。窗口满的时候报文在会话中排队，不可靠的报文排队超过一个 RTO
+就已经过时，直接丢弃。
+
+Linux 上使用 recvmmsg / sendmmsg 一次系统调用收发一批数据报。内核支持的时候还会使用：
+	UDP_SEGMENT (GSO): 发给同一个对方的连续多个数据报 (除了最后一个长度都相同) 作为一个大的缓冲区交给内核，
+	                   由内核 (或者网卡) 切分，一次 sendmmsg 中的每一项可以是一组数据报
+	UDP_GRO:           内核把同一个对方连续到达的数据报合并起来一次交给我们，按照控制消息中的长度切开
+不支持的内核上 getsockopt / setsockopt 会失败，发送的时候返回 EIO / EINVAL 也会关闭 GSO，
+之后退回到每个数据报一项的 sendmmsg。
+
+令牌决定了一个数据报属于哪一个连接，服务器总是把数据报算作持有这个令牌的连接发来的，并且把回复发到数据报的来源地址，
+所以令牌必须无法预测 (见 new_session_token)。除此之外没有别的认证，能够看到线路上的数据报的人仍然可以伪造。
+*/
+
+namespace olc
+{
+	namespace net
+	{
+		template <typename T>
+		class connection;
+
+		// 报文的发送方式
+		enum class delivery
+		{
+			reliable,				// 通过 TCP 发送，可靠有序
+			unreliable_sequenced,	// 以下通过 UDP 通道发送，见上面的说明
+			reliable_ordered,
+			reliable_unordered,
+		};
+
+		/*
+		生成一个 UDP 会话的令牌，0 保留为 "没有会话"。每个令牌都直接从操作系统的随机数源取 64 位：
+		用一个种子初始化的伪随机数发生器的话，任何一个客户端都可以从自己的令牌反推出种子，进而算出别的会话的令牌
+		*/
+		inline uint64_t new_session_token()
+		{
+			uint64_t nToken = 0;
+			while (nToken == 0)
+			{
+#if defined(__linux__)
+				if (::getrandom(&nToken, sizeof(nToken), 0) == static_cast<ssize_t>(sizeof(nToken)))
+					continue;
+#endif
+				std::random_device rd;
+				nToken = (static_cast<uint64_t>(rd()) << 32) | rd();
+			}
+			return nToken;
+		}
+
+		/*
+		UDP 会话的状态，由连接和通道共享：通道收到对方的第一个数据报之后置为 established，
+		超过 udp_establish_timeout 还没有建立的时候置为 failed。连接只在 established 的时候通过 UDP 发送
+		*/
+		enum class udp_state : uint8_t
+		{
+			pending,
+			established,
+			failed,
+		};
+
+		constexpr std::chrono::seconds udp_establish_timeout { 10 };
+
+		// 以太网 MTU (1500) 减去 IPv4 和 UDP 的报头，超过这个长度的报文不通过 UDP 发送
+		constexpr size_t udp_max_datagram = 1472;
+
+		// 数据报的头部：令牌，包序号，ack，ack 位图，通道，通道内序号
+		constexpr size_t udp_datagram_header = 25;
+
+		// 一个数据报能放下的最长的 body (紧凑报头按最长计算)：1437 字节
+		constexpr size_t udp_max_body = udp_max_datagram - udp_datagram_header - compact_header_max_size;
+
+		template <typename T>
+		class udp_channel
+		{
+		public:
+			// 在 endpoint 上绑定 UDP socket，收到的报文放入 qIn (和 TCP 报文使用同一个队列)
+			udp_channel(asio::io_context &asioContext, const asio::ip::udp::endpoint &endpoint,
+				tsqueue<owned_message<T> > &qIn)
+				: m_asioContext(asioContext), m_socket(asioContext, endpoint), m_qMessagesIn(qIn),
+				  m_timerTick(asioContext)
+			{
+				this->m_socket.non_blocking(true);
+
+#ifdef OLC_NET_UDP_OFFLOAD
+				int fd = this->m_socket.native_handle();
+				int nSegment = 0;
+				socklen_t nLength = sizeof(nSegment);
+				this->m_bGsoSupported = ::getsockopt(fd, SOL_UDP, UDP_SEGMENT, &nSegment, &nLength) == 0;
+				this->m_bGso = this->m_bGsoSupported;
+
+				int nOn = 1;
+				this->m_bGro = ::setsockopt(fd, SOL_UDP, UDP_GRO, &nOn, sizeof(nOn)) == 0;
+#endif
+				// 合并之后的数据报最大可以有 64KB，槽位需要相应地变大
+				this->m_nReceiveSlots = this->m_bGro ? nGroReceiveSlots : nMaxReceiveSlots;
+				this->m_nReceiveSlotSize = this->m_bGro ? nGroReceiveSlotSize : nReceiveSlotSize;
+				this->m_vReceiveBuffer.resize(this->m_nReceiveSlots * this->m_nReceiveSlotSize);
+
+				// 默认的接收缓冲区很小，一个 tick 内的突发数据报很容易溢出，尽量放大 (内核可能会限制)
+				asio::error_code ec;
+				this->m_socket.set_option(asio::socket_base::receive_buffer_size(nSocketBufferSize), ec);
+				this->m_socket.set_option(asio::socket_base::send_buffer_size(nSocketBufferSize), ec);
+			}
+
+			void Start()
+			{
+				this->Receive();
+				this->Tick();
+			}
+
+			void Close()
+			{
+				asio::post(this->m_asioContext,
+					[this]()
+					{
+						this->m_timerTick.cancel();
+						this->m_socket.close();
+					}
+				);
+			}
+
+			asio::ip::udp::endpoint LocalEndpoint() const
+			{
+				return this->m_socket.local_endpoint();
+			}
+
+			// 创建的时候探测到的内核支持情况
+			bool SegmentationOffloadSupported() const
+			{
+				return this->m_bGsoSupported;
+			}
+
+			bool ReceiveOffloadEnabled() const
+			{
+				return this->m_bGro;
+			}
+
+			// 打开或者关闭发送时的分段卸载 (内核不支持的时候总是关闭的)，主要用于性能对比
+			void SetSegmentationOffload(bool bEnable)
+			{
+				asio::post(this->m_asioContext, [this, bEnable]() { this->m_bGso = bEnable && this->m_bGsoSupported; });
+			}
+
+			// 调试用：按照 fRate 的比例随机丢弃发出的数据报，模拟有丢包的网络
+			void SimulatePacketLoss(float fRate)
+			{
+				asio::post(this->m_asioContext, [this, fRate]() { this->m_fSimulatedLoss = fRate; });
+			}
+
+			/*
+			注册一个会话，之后用 nKey 发送，会话的状态写入 pState。服务器端的 nKey 就是令牌，给出连接 remote，
+			它的报文会以 remote 为来源放入接收队列，连接释放之后会话自动失效。
+			客户端没有 remote：已经知道令牌和服务器的地址 peer 的时候立即开始发送 hello，
+			否则 nKey 为 0，可靠通道的报文先在会话中排队，收到令牌之后由 SetPeer 补上
+			*/
+			void Register(uint64_t nKey, std::weak_ptr<connection<T> > remote, std::shared_ptr<std::atomic<udp_state> > pState,
+				std::optional<asio::ip::udp::endpoint> peer = std::nullopt)
+			{
+				asio::post(this->m_asioContext,
+					[this, nKey, remote = std::move(remote), pState = std::move(pState), peer]()
+					{
+						this->SweepExpiredSessions();
+
+						session &s = this->m_mapSessions[nKey];
+						s = session();
+						s.nKey = nKey;
+						s.nToken = nKey;
+						s.remote = remote;
+						s.bExpires = !remote.expired();
+						s.pState = pState;
+						s.tRegistered = clock::now();
+						if (peer)
+							this->StartHello(s, *peer, s.tRegistered);
+
+						// 由 Tick 重发 hello 和检查是否超时
+						this->m_setActive.insert(nKey);
+					}
+				);
+			}
+
+			// 客户端收到了令牌 nToken：会话 nKey 开始向服务器的地址 peer 发送 hello，排队的报文随后发出
+			void SetPeer(uint64_t nKey, uint64_t nToken, const asio::ip::udp::endpoint &peer)
+			{
+				asio::post(this->m_asioContext,
+					[this, nKey, nToken, peer]()
+					{
+						auto it = this->m_mapSessions.find(nKey);
+						if (it == this->m_mapSessions.end() || *it->second.pState == udp_state::failed)
+							return;
+
+						clock::time_point now = clock::now();
+						it->second.nToken = nToken;
+						this->StartHello(it->second, peer, now);
+						this->TrySend(it->second, now);
+					}
+				);
+			}
+
+			/*
+			通过会话 nKey 的 eMode 通道发送一个报文。不可靠的报文在对方的地址还不知道的时候直接丢弃，
+			可靠的报文一直排队到会话建立为止；会话已经失败的时候丢弃 (连接之后会改用 TCP 发送)
+			*/
+			void Send(uint64_t nKey, const message<T> &msg, delivery eMode = delivery::unreliable_sequenced)
+			{
+				asio::post(this->m_asioContext,
+					[this, nKey, msg, eMode]()
+					{
+						auto it = this->m_mapSessions.find(nKey);
+						if (it == this->m_mapSessions.end())
+							return;
+
+						session &s = it->second;
+						uint8_t nLane = LaneOf(eMode);
+						if (nLane == lane_unreliable && !s.bPeerKnown)
+							return;
+						if (*s.pState == udp_state::failed)
+						{
+							std::cout << "[UDP] Session Failed, Message Dropped\n";
+							return;
+						}
+
+						clock::time_point now = clock::now();
+						outgoing out;
+						out.nLane = nLane;
+						out.nLaneSequence = s.vLanes[nLane].nSendSequence++;
+						out.tQueued = now;
+						out.vFrame.resize(compact_header_max_size + msg.body.size());
+						size_t nHeader = encode_compact_header(out.vFrame.data(), msg.header);
+						if (!msg.body.empty())
+							std::memcpy(out.vFrame.data() + nHeader, msg.body.data(), msg.body.size());
+						out.vFrame.resize(nHeader + msg.body.size());
+
+						s.qWaiting.push_back(std::move(out));
+						this->TrySend(s, now);
+					}
+				);
+			}
+
+		private:
+			using clock = std::chrono::steady_clock;
+
+			static constexpr uint8_t lane_unreliable = 0;
+			static constexpr uint8_t lane_ordered = 1;
+			static constexpr uint8_t lane_unordered = 2;
+			static constexpr uint8_t lane_count = 3;
+			static constexpr uint8_t lane_none = 0xFF;
+			static constexpr uint8_t lane_hello = 0xFE;
+
+			static uint8_t LaneOf(delivery eMode)
+			{
+				switch (eMode)
+				{
+					case delivery::reliable_ordered: return lane_ordered;
+					case delivery::reliable_unordered: return lane_unordered;
+					default: return lane_unreliable;
+				}
+			}
+
+			static uint64_t ReliableKey(uint8_t nLane, uint32_t nLaneSequence)
+			{
+				return (static_cast<uint64_t>(nLane) << 32) | nLaneSequence;
+			}
+
+			// 按照 32 位回绕比较的 a - b
+			static int32_t SequenceDistance(uint32_t a, uint32_t b)
+			{
+				return static_cast<int32_t>(a - b);
+			}
+
+			// 一个还没有发出去的报文 (已经编码成紧凑报头 + body)
+			struct outgoing
+			{
+				uint8_t nLane;
+				uint32_t nLaneSequence;
+				clock::time_point tQueued;
+				std::vector<uint8_t> vFrame;
+			};
+
+			// 发出去还没有被确认的可靠报文，nPacket 是最近一次携带它的包
+			struct unacked
+			{
+				std::vector<uint8_t> vFrame;
+				uint32_t nPacket;
+			};
+
+			struct sent_packet
+			{
+				uint32_t nSequence;
+				clock::time_point tSent;
+				bool bAcked;
+				bool bInFlight;		// 计入拥塞窗口 (确认包不计入)
+				uint8_t nLane;
+				uint32_t nLaneSequence;
+			};
+
+			struct lane_state
+			{
+				uint32_t nSendSequence = 0;
+
+				// 接收：不可靠通道是下一个可以接受的最小序号；可靠通道是下一个还没有收到的序号
+				uint32_t nNext = 0;
+				bool bReceived = false;
+
+				std::map<uint32_t, message<T> > mapEarly;	// reliable_ordered: 提前到达，等待前面的报文
+				std::set<uint32_t> setEarly;				// reliable_unordered: 已经交付的超前序号
+			};
+
+			struct session
+			{
+				uint64_t nKey = 0;		// m_mapSessions 中的键，客户端收到令牌之前为 0
+				uint64_t nToken = 0;	// 线路上的令牌
+				std::weak_ptr<connection<T> > remote;
+				bool bExpires = false;
+
+				asio::ip::udp::endpoint peer;
+				bool bPeerKnown = false;
+
+				// 建立会话：客户端一直发送 hello，直到收到服务器的数据报
+				std::shared_ptr<std::atomic<udp_state> > pState;
+				clock::time_point tRegistered;
+				clock::time_point tHello;
+				bool bSendsHello = false;
+
+				std::array<lane_state, lane_count> vLanes;
+
+				// 发送端：包序号从 1 开始，0 表示 "没有"
+				uint32_t nPacketSequence = 0;
+				std::deque<sent_packet> qSent;
+				std::unordered_map<uint64_t, unacked> mapUnacked;
+				std::deque<uint64_t> qRetransmit;
+				std::deque<outgoing> qWaiting;
+
+				// 接收端：对方最新的包序号和之前 32 个包的位图
+				uint32_t nRemotePacket = 0;
+				uint32_t nAckBits = 0;
+				bool bAckPending = false;
+
+				// RTT 和拥塞窗口
+				double fSrtt = 0.1;
+				double fRttVar = 0.05;
+				bool bRttSampled = false;
+				double fWindow = 32.0;
+				double fSlowStartThreshold = 1e9;
+				uint32_t nInFlight = 0;
+				uint32_t nLargestAcked = 0;
+				uint32_t nRecoveryPacket = 0;
+
+				clock::duration Rto() const
+				{
+					double fRto = std::clamp(this->fSrtt + 4.0 * this->fRttVar, 0.02, 2.0);
+					return std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(fRto));
+				}
+
+				bool Pending() const
+				{
+					return *this->pState == udp_state::pending;
+				}
+
+				bool Idle() const
+				{
+					return !this->Pending() && this->qSent.empty() && this->qWaiting.empty() && this->qRetransmit.empty();
+				}
+			};
+
+			struct pending_datagram
+			{
+				asio::ip::udp::endpoint peer;
+				size_t nOffset;
+				size_t nSize;
+			};
+
+			// 连接释放之后会话就没有用了，会话的数量翻倍的时候清理一次
+			void SweepExpiredSessions()
+			{
+				if (this->m_mapSessions.size() < this->m_nSweepAt)
+					return;
+
+				for (auto it = this->m_mapSessions.begin(); it != this->m_mapSessions.end(); )
+				{
+					if (it->second.bExpires && it->second.remote.expired())
+					{
+						this->m_setActive.erase(it->first);
+						it = this->m_mapSessions.erase(it);
+					}
+					else
+					{
+						++it;
+					}
+				}
+				this->m_nSweepAt = std::max<size_t>(64, this->m_mapSessions.size() * 2);
+			}
+
+			// 在拥塞窗口允许的范围内发送等待中的报文，重传的报文优先
+			void TrySend(session &s, clock::time_point now)
+			{
+				if (!s.bPeerKnown)
+					return;
+
+				while (s.nInFlight < static_cast<uint32_t>(s.fWindow))
+				{
+					if (!s.qRetransmit.empty())
+					{
+						uint64_t nKey = s.qRetransmit.front();
+						s.qRetransmit.pop_front();
+
+						auto it = s.mapUnacked.find(nKey);
+						if (it == s.mapUnacked.end())
+							continue;
+
+						it->second.nPacket = this->SendPacket(s, static_cast<uint8_t>(nKey >> 32), static_cast<uint32_t>(nKey),
+							it->second.vFrame.data(), it->second.vFrame.size(), now);
+						continue;
+					}
+
+					if (s.qWaiting.empty())
+						break;
+
+					outgoing out = std::move(s.qWaiting.front());
+					s.qWaiting.pop_front();
+
+					if (out.nLane == lane_unreliable)
+					{
+						// 等待太久的状态更新已经过时了
+						if (now - out.tQueued > s.Rto())
+							continue;
+						this->SendPacket(s, out.nLane, out.nLaneSequence, out.vFrame.data(), out.vFrame.size(), now);
+					}
+					else
+					{
+						uint32_t nPacket = this->SendPacket(s, out.nLane, out.nLaneSequence, out.vFrame.data(), out.vFrame.size(), now);
+						s.mapUnacked[ReliableKey(out.nLane, out.nLaneSequence)] = { std::move(out.vFrame), nPacket };
+					}
+				}
+
+				if (!s.Idle())
+					this->m_setActive.insert(s.nKey);
+			}
+
+			// 组装并发送一个数据报，返回它的包序号
+			uint32_t SendPacket(session &s, uint8_t nLane, uint32_t nLaneSequence, const uint8_t *pFrame, size_t nFrame,
+				clock::time_point now)
+			{
+				uint32_t nPacket = ++s.nPacketSequence;
+				if (nPacket == 0)
+					nPacket = ++s.nPacketSequence;
+
+				uint8_t aHeader[udp_datagram_header];
+				detail::store_scalar(aHeader, s.nToken);
+				detail::store_scalar(aHeader + 8, nPacket);
+				detail::store_scalar(aHeader + 12, s.nRemotePacket);
+				detail::store_scalar(aHeader + 16, s.nAckBits);
+				aHeader[20] = nLane;
+				detail::store_scalar(aHeader + 21, nLaneSequence);
+
+				bool bInFlight = nLane != lane_none && nLane != lane_hello;
+				s.qSent.push_back({ nPacket, now, false, bInFlight, nLane, nLaneSequence });
+				if (bInFlight)
+				{
+					s.nInFlight++;
+					this->m_setActive.insert(s.nKey);
+				}
+				s.bAckPending = false;
+
+				this->QueueDatagram(s.peer, aHeader, sizeof(aHeader), pFrame, nFrame);
+				return nPacket;
+			}
+
+			// 处理对方发来的 ack 和位图
+			void ProcessAcks(session &s, uint32_t nAck, uint32_t nAckBits, clock::time_point now)
+			{
+				if (nAck == 0)
+					return;
+
+				if (s.nLargestAcked == 0 || SequenceDistance(nAck, s.nLargestAcked) > 0)
+					s.nLargestAcked = nAck;
+
+				this->OnPacketAcked(s, nAck, now);
+				for (uint32_t i = 0; i < 32; ++i)
+				{
+					if (nAckBits & (1u << i))
+						this->OnPacketAcked(s, nAck - 1 - i, now);
+				}
+
+				this->DetectLosses(s, now);
+			}
+
+			void OnPacketAcked(session &s, uint32_t nPacket, clock::time_point now)
+			{
+				if (s.qSent.empty())
+					return;
+
+				uint32_t nIndex = nPacket - s.qSent.front().nSequence;
+				if (nIndex >= s.qSent.size())
+					return;
+
+				sent_packet &p = s.qSent[nIndex];
+				if (p.bAcked)
+					return;
+				p.bAcked = true;
+
+				if (p.bInFlight)
+				{
+					s.nInFlight--;
+					if (s.fWindow < s.fSlowStartThreshold)
+						s.fWindow += 1.0;
+					else
+						s.fWindow += 1.0 / s.fWindow;
+					s.fWindow = std::min(s.fWindow, fMaxWindow);
+				}
+				else
+				{
+					// 确认包只会被顺带确认，它的 RTT 不准确
+					return;
+				}
+
+				// RFC 6298 的 RTT 估计
+				double fSample = std::chrono::duration<double>(now - p.tSent).count();
+				if (!s.bRttSampled)
+				{
+					s.fSrtt = fSample;
+					s.fRttVar = fSample / 2.0;
+					s.bRttSampled = true;
+				}
+				else
+				{
+					s.fRttVar = 0.75 * s.fRttVar + 0.25 * std::abs(s.fSrtt - fSample);
+					s.fSrtt = 0.875 * s.fSrtt + 0.125 * fSample;
+				}
+
+				if (p.nLane == lane_ordered || p.nLane == lane_unordered)
+					s.mapUnacked.erase(ReliableKey(p.nLane, p.nLaneSequence));
+			}
+
+			// 从最旧的包开始，移除已经确认的包，判定丢失的包
+			void DetectLosses(session &s, clock::time_point now)
+			{
+				clock::duration rto = s.Rto();
+				while (!s.qSent.empty())
+				{
+					sent_packet &p = s.qSent.front();
+					if (!p.bAcked)
+					{
+						bool bLost = (s.nLargestAcked != 0 && SequenceDistance(s.nLargestAcked, p.nSequence) >= 3) ||
+							now - p.tSent > rto;
+						if (!bLost)
+							break;
+
+						if (p.bInFlight)
+						{
+							s.nInFlight--;
+
+							// 同一个窗口内的多次丢包只减小一次窗口
+							if (s.nRecoveryPacket == 0 || SequenceDistance(p.nSequence, s.nRecoveryPacket) > 0)
+							{
+								s.fWindow = std::max(2.0, s.fWindow / 2.0);
+								s.fSlowStartThreshold = s.fWindow;
+								s.nRecoveryPacket = s.nPacketSequence;
+							}
+						}
+
+						if (p.nLane == lane_ordered || p.nLane == lane_unordered)
+						{
+							uint64_t nKey = ReliableKey(p.nLane, p.nLaneSequence);
+							auto it = s.mapUnacked.find(nKey);
+							if (it != s.mapUnacked.end() && it->second.nPacket == p.nSequence)
+								s.qRetransmit.push_back(nKey);
+						}
+					}
+					s.qSent.pop_front();
+				}
+			}
+
+			// 记录收到了包 nPacket，之后发出的数据报会确认它
+			void MarkReceived(session &s, uint32_t nPacket)
+			{
+				if (s.nRemotePacket == 0)
+				{
+					s.nRemotePacket = nPacket;
+					s.nAckBits = 0;
+					return;
+				}
+
+				int32_t d = SequenceDistance(nPacket, s.nRemotePacket);
+				if (d > 0)
+				{
+					s.nAckBits = d > 32 ? 0 : ((d == 32 ? 0 : s.nAckBits << d) | (1u << (d - 1)));
+					s.nRemotePacket = nPacket;
+				}
+				else if (d < 0 && d >= -32)
+				{
+					s.nAckBits |= 1u << (-d - 1);
+				}
+			}
+
+			// 定时检查超时的包，并发送拥塞窗口打开之后可以发送的报文
+			void Tick()
+			{
+				this->m_timerTick.expires_after(std::chrono::milliseconds(10));
+				this->m_timerTick.async_wait(
+					[this](std::error_code ec)
+					{
+						if (ec)
+							return;
+
+						clock::time_point now = clock::now();
+						for (auto it = this->m_setActive.begin(); it != this->m_setActive.end(); )
+						{
+							auto itSession = this->m_mapSessions.find(*it);
+							if (itSession == this->m_mapSessions.end())
+							{
+								it = this->m_setActive.erase(it);
+								continue;
+							}
+
+							session &s = itSession->second;
+							if (s.Pending())
+								this->Handshake(s, now);
+							this->DetectLosses(s, now);
+							this->TrySend(s, now);
+							it = s.Idle() ? this->m_setActive.erase(it) : std::next(it);
+						}
+
+						this->Tick();
+					}
+				);
+			}
+
+			// 客户端知道了服务器的地址，开始发送 hello
+			void StartHello(session &s, const asio::ip::udp::endpoint &peer, clock::time_point now)
+			{
+				s.peer = peer;
+				s.bPeerKnown = true;
+				s.bSendsHello = true;
+				s.tHello = now;
+				this->SendPacket(s, lane_hello, 0, nullptr, 0, now);
+			}
+
+			/*
+			还没有建立的会话：客户端按时重发 hello (hello 和它的回复都可能丢失)。
+			超时的时候置为失败，排队和在途的报文都丢弃，不再重传
+			*/
+			void Handshake(session &s, clock::time_point now)
+			{
+				if (now - s.tRegistered > udp_establish_timeout)
+				{
+					size_t nDropped = s.qWaiting.size() + s.mapUnacked.size();
+					s.qWaiting.clear();
+					s.mapUnacked.clear();
+					s.qRetransmit.clear();
+					s.qSent.clear();
+					s.nInFlight = 0;
+
+					*s.pState = udp_state::failed;
+					std::cout << "[UDP] Session Not Established, " << nDropped << " Messages Dropped, Using TCP\n";
+					return;
+				}
+
+				if (s.bSendsHello && now - s.tHello >= nHelloInterval)
+				{
+					s.tHello = now;
+					this->SendPacket(s, lane_hello, 0, nullptr, 0, now);
+				}
+			}
+
+			/*
+			把数据报追加到待发送的缓冲区中。同一轮事件循环中 Send 的所有数据报都会积累起来，
+			由 Flush 一次发送出去
+			*/
+			void QueueDatagram(const asio::ip::udp::endpoint &peer, const uint8_t *pHeader, size_t nHeader,
+				const uint8_t *pBody, size_t nBody)
+			{
+				if (this->m_fSimulatedLoss > 0.0f && std::uniform_real_distribution<float>(0.0f, 1.0f)(this->m_rngLoss) < this->m_fSimulatedLoss)
+					return;
+
+				bool bFlushPending = !this->m_vPending.empty();
+
+				size_t nOffset = this->m_vSendBuffer.size();
+				this->m_vSendBuffer.insert(this->m_vSendBuffer.end(), pHeader, pHeader + nHeader);
+				if (nBody > 0)
+					this->m_vSendBuffer.insert(this->m_vSendBuffer.end(), pBody, pBody + nBody);
+				this->m_vPending.push_back({ peer, nOffset, nHeader + nBody });
+
+				if (!bFlushPending && !this->m_bWaitingWritable)
+					asio::post(this->m_asioContext, [this]() { this->Flush(); });
+			}
+
+			void Flush()
+			{
+				size_t nSent = 0;
+				bool bWouldBlock = false;
+
+#if defined(__linux__)
+				constexpr size_t nBatch = 64;
+				constexpr size_t nMaxIov = 1024;
+				std::array<mmsghdr, nBatch> vHeaders;
+				std::array<size_t, nBatch> vUnitCount;
+				std::array<iovec, nMaxIov> vIov;
+#ifdef OLC_NET_UDP_OFFLOAD
+				std::array<std::array<uint64_t, 4>, nBatch> vControl;
+
+				// 同一个对方的数据报排在一起才能组成 GSO 的一组，稳定排序不会改变同一个对方的数据报的顺序
+				if (this->m_bGso)
+					std::stable_sort(this->m_vPending.begin(), this->m_vPending.end(),
+						[](const pending_datagram &a, const pending_datagram &b) { return a.peer < b.peer; });
+#endif
+
+				while (nSent < this->m_vPending.size())
+				{
+					size_t nUnits = 0;
+					size_t nIov = 0;
+					size_t i = nSent;
+					while (nUnits < nBatch && i < this->m_vPending.size() && nIov < nMaxIov)
+					{
+						// 一组：同一个对方，长度相同 (最后一个可以更短)，总长度不超过一个 UDP 报文
+						size_t nSegment = this->m_vPending[i].nSize;
+						size_t nCount = 1;
+						size_t nTotal = nSegment;
+						while (this->m_bGso && i + nCount < this->m_vPending.size() && nCount < nMaxSegments && 
+							nIov + nCount < nMaxIov)
+						{
+							const pending_datagram &prev = this->m_vPending[i + nCount - 1];
+							const pending_datagram &next = this->m_vPending[i + nCount];
+							if (next.peer != prev.peer || prev.nSize != nSegment || next.nSize > nSegment || 
+								nTotal + next.nSize > nMaxSegmentedBytes)
+								break;
+							nTotal += next.nSize;
+							nCount++;
+						}
+
+						for (size_t k = 0; k < nCount; ++k)
+						{
+							pending_datagram &d = this->m_vPending[i + k];
+							vIov[nIov + k].iov_base = this->m_vSendBuffer.data() + d.nOffset;
+							vIov[nIov + k].iov_len = d.nSize;
+						}
+
+						pending_datagram &d = this->m_vPending[i];
+						std::memset(&vHeaders[nUnits], 0, sizeof(mmsghdr));
+						vHeaders[nUnits].msg_hdr.msg_name = d.peer.data();
+						vHeaders[nUnits].msg_hdr.msg_namelen = static_cast<socklen_t>(d.peer.size());
+						vHeaders[nUnits].msg_hdr.msg_iov = &vIov[nIov];
+						vHeaders[nUnits].msg_hdr.msg_iovlen = nCount;
+#ifdef OLC_NET_UDP_OFFLOAD
+						if (nCount > 1)
+						{
+							msghdr &h = vHeaders[nUnits].msg_hdr;
+							h.msg_control = vControl[nUnits].data();
+							h.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+							cmsghdr *pControl = CMSG_FIRSTHDR(&h);
+							pControl->cmsg_level = SOL_UDP;
+							pControl->cmsg_type = UDP_SEGMENT;
+							pControl->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+							uint16_t nGsoSize = static_cast<uint16_t>(nSegment);
+							std::memcpy(CMSG_DATA(pControl), &nGsoSize, sizeof(nGsoSize));
+						}
+#endif
+						vUnitCount[nUnits] = nCount;
+						nUnits++;
+						nIov += nCount;
+						i += nCount;
+					}
+
+					int r = ::sendmmsg(this->m_socket.native_handle(), vHeaders.data(), static_cast<unsigned>(nUnits), 0);
+					if (r < 0)
+					{
+						if (errno == EAGAIN || errno == EWOULDBLOCK)
+						{
+							bWouldBlock = true;
+							break;
+						}
+						if (errno == EINTR)
+							continue;
+						if (this->m_bGso && (errno == EIO || errno == EINVAL))
+						{
+							// 网卡或者内核不支持分段卸载，以后都逐个发送
+							this->m_bGso = false;
+							this->m_bGsoSupported = false;
+							continue;
+						}
+
+						// 发不出去的数据报直接丢弃，可靠的报文会因为没有被确认而重传
+						nSent += vUnitCount[0];
+						continue;
+					}
+
+					for (int k = 0; k < r; ++k)
+						nSent += vUnitCount[k];
+				}
+#else
+				while (nSent < this->m_vPending.size())
+				{
+					pending_datagram &d = this->m_vPending[nSent];
+					asio::error_code ec;
+					this->m_socket.send_to(asio::buffer(this->m_vSendBuffer.data() + d.nOffset, d.nSize), d.peer, 0, ec);
+					if (ec == asio::error::would_block)
+					{
+						bWouldBlock = true;
+						break;
+					}
+					nSent++;
+				}
+#endif
+
+				this->m_vPending.erase(this->m_vPending.begin(), this->m_vPending.begin() + nSent);
+				if (this->m_vPending.empty())
+				{
+					this->m_vSendBuffer.clear();
+				}
+				else if (bWouldBlock)
+				{
+					// 发送缓冲区满了，等到可写的时候再继续
+					this->m_bWaitingWritable = true;
+					this->m_socket.async_wait(asio::ip::udp::socket::wait_write,
+						[this](std::error_code ec)
+						{
+							this->m_bWaitingWritable = false;
+							if (!ec)
+								this->Flush();
+						}
+					);
+				}
+			}
+
+			void Receive()
+			{
+				this->m_socket.async_wait(asio::ip::udp::socket::wait_read,
+					[this](std::error_code ec)
+					{
+						if (ec)
+							return;
+
+						this->ReadAvailable();
+						this->SendPendingAcks();
+						this->Receive();
+					}
+				);
+			}
+
+			// 读出所有已经到达的数据报
+			void ReadAvailable()
+			{
+				clock::time_point now = clock::now();
+
+#if defined(__linux__)
+				std::array<mmsghdr, nMaxReceiveSlots> vHeaders;
+				std::array<iovec, nMaxReceiveSlots> vIov;
+				std::array<asio::ip::udp::endpoint, nMaxReceiveSlots> vPeers;
+				std::array<std::array<uint64_t, 4>, nMaxReceiveSlots> vControl;
+
+				while (true)
+				{
+					for (size_t i = 0; i < this->m_nReceiveSlots; ++i)
+					{
+						vIov[i].iov_base = this->m_vReceiveBuffer.data() + i * this->m_nReceiveSlotSize;
+						vIov[i].iov_len = this->m_nReceiveSlotSize;
+
+						std::memset(&vHeaders[i], 0, sizeof(mmsghdr));
+						vHeaders[i].msg_hdr.msg_name = vPeers[i].data();
+						vHeaders[i].msg_hdr.msg_namelen = static_cast<socklen_t>(vPeers[i].capacity());
+						vHeaders[i].msg_hdr.msg_iov = &vIov[i];
+						vHeaders[i].msg_hdr.msg_iovlen = 1;
+						if (this->m_bGro)
+						{
+							vHeaders[i].msg_hdr.msg_control = vControl[i].data();
+							vHeaders[i].msg_hdr.msg_controllen = sizeof(vControl[i]);
+						}
+					}
+
+					int r = ::recvmmsg(this->m_socket.native_handle(), vHeaders.data(), static_cast<unsigned>(this->m_nReceiveSlots), 
+						MSG_DONTWAIT, nullptr);
+					if (r <= 0)
+						break;
+
+					for (int i = 0; i < r; ++i)
+					{
+						if (vHeaders[i].msg_hdr.msg_flags & MSG_TRUNC)
+							continue;
+						vPeers[i].resize(vHeaders[i].msg_hdr.msg_namelen);
+
+						// 合并过的数据报按照 GRO 给出的长度切开，没有合并的时候整个就是一个数据报
+						size_t nLength = vHeaders[i].msg_len;
+						size_t nSegment = nLength;
+#ifdef OLC_NET_UDP_OFFLOAD
+						for (cmsghdr *pControl = CMSG_FIRSTHDR(&vHeaders[i].msg_hdr); pControl != nullptr; 
+							pControl = CMSG_NXTHDR(&vHeaders[i].msg_hdr, pControl))
+						{
+							if (pControl->cmsg_level == SOL_UDP && pControl->cmsg_type == UDP_GRO)
+							{
+								int nGsoSize = 0;
+								std::memcpy(&nGsoSize, CMSG_DATA(pControl), sizeof(nGsoSize));
+								if (nGsoSize > 0)
+									nSegment = static_cast<size_t>(nGsoSize);
+							}
+						}
+#endif
+						const uint8_t *p = this->m_vReceiveBuffer.data() + i * this->m_nReceiveSlotSize;
+						for (size_t nOffset = 0; nOffset < nLength; nOffset += nSegment)
+							this->ProcessDatagram(p + nOffset, std::min(nSegment, nLength - nOffset), vPeers[i], now);
+					}
+
+					if (static_cast<size_t>(r) < this->m_nReceiveSlots)
+						break;
+				}
+#else
+				while (true)
+				{
+					asio::ip::udp::endpoint peer;
+					asio::error_code ec;
+					size_t n = this->m_socket.receive_from(asio::buffer(this->m_vReceiveBuffer), peer, 0, ec);
+					if (ec)
+						break;
+					this->ProcessDatagram(this->m_vReceiveBuffer.data(), n, peer, now);
+				}
+#endif
+			}
+
+			// 一批数据报处理完之后，还没有顺带发出确认的会话单独发送一个确认包
+			void SendPendingAcks()
+			{
+				clock::time_point now = clock::now();
+				for (uint64_t nKey : this->m_vAckPending)
+				{
+					auto it = this->m_mapSessions.find(nKey);
+					if (it != this->m_mapSessions.end() && it->second.bAckPending && it->second.bPeerKnown)
+						this->SendPacket(it->second, lane_none, 0, nullptr, 0, now);
+				}
+				this->m_vAckPending.clear();
+			}
+
+			void ProcessDatagram(const uint8_t *p, size_t nSize, const asio::ip::udp::endpoint &peer, clock::time_point now)
+			{
+				if (nSize < udp_datagram_header)
+					return;
+
+				uint64_t nToken = 0;
+				uint32_t nPacket = 0;
+				uint32_t nAck = 0;
+				uint32_t nAckBits = 0;
+				uint8_t nLane = p[20];
+				uint32_t nLaneSequence = 0;
+				detail::load_scalar(p, nToken);
+				detail::load_scalar(p + 8, nPacket);
+				detail::load_scalar(p + 12, nAck);
+				detail::load_scalar(p + 16, nAckBits);
+				detail::load_scalar(p + 21, nLaneSequence);
+
+				if (nToken == 0 || nPacket == 0)
+					return;
+
+				// 客户端的会话在收到令牌之前注册，键是 0
+				auto it = this->m_mapSessions.find(nToken);
+				if (it == this->m_mapSessions.end())
+					it = this->m_mapSessions.find(0);
+				if (it == this->m_mapSessions.end() || it->second.nToken != nToken)
+					return;
+
+				session &s = it->second;
+				std::shared_ptr<connection<T> > remote = s.remote.lock();
+				if (s.bExpires && !remote)
+				{
+					this->m_setActive.erase(it->first);
+					this->m_mapSessions.erase(it);
+					return;
+				}
+
+				// 对方的地址可能因为 NAT 而改变，总是使用最近一次的地址
+				s.peer = peer;
+				s.bPeerKnown = true;
+
+				// 收到了对方的数据报，会话建立。已经失败的会话不再恢复，连接已经改用 TCP 发送了
+				udp_state ePending = udp_state::pending;
+				s.pState->compare_exchange_strong(ePending, udp_state::established);
+
+				this->ProcessAcks(s, nAck, nAckBits, now);
+
+				if (nLane == lane_none || nLane == lane_hello)
+				{
+					if (nSize == udp_datagram_header)
+						this->MarkReceived(s, nPacket);
+
+					// 确认包不需要再确认；hello 立即回复，客户端收到之后才知道会话已经建立
+					if (nLane == lane_hello)
+						this->SendPacket(s, lane_none, 0, nullptr, 0, now);
+					this->TrySend(s, now);
+					return;
+				}
+				if (nLane >= lane_count)
+					return;
+
+				owned_message<T> msg;
+				size_t nHeader = decode_compact_header(p + udp_datagram_header, nSize - udp_datagram_header, msg.msg.header);
+				if (nHeader == 0 || nHeader == compact_header_invalid || (msg.msg.header.size & frame_flags::mask) ||
+					udp_datagram_header + nHeader + msg.msg.header.size != nSize)
+					return;
+
+				const uint8_t *pBody = p + udp_datagram_header + nHeader;
+				msg.msg.body.assign(pBody, pBody + msg.msg.header.size);
+				msg.remote = std::move(remote);
+
+				// 超出接收窗口的可靠报文不确认，让对方以后重传
+				if (!this->DeliverLane(s.vLanes[nLane], nLane, nLaneSequence, msg))
+					return;
+
+				this->MarkReceived(s, nPacket);
+				if (!s.bAckPending)
+				{
+					s.bAckPending = true;
+					this->m_vAckPending.push_back(s.nKey);
+				}
+
+				this->TrySend(s, now);
+			}
+
+			// 按照通道的规则把报文交给应用程序，报文没有被接受 (需要对方重传) 的时候返回 false
+			bool DeliverLane(lane_state &lane, uint8_t nLane, uint32_t nLaneSequence, owned_message<T> &msg)
+			{
+				int32_t d = SequenceDistance(nLaneSequence, lane.nNext);
+
+				if (nLane == lane_unreliable)
+				{
+					// 丢弃乱序到达的旧报文
+					if (lane.bReceived && d < 0)
+						return true;
+					lane.bReceived = true;
+					lane.nNext = nLaneSequence + 1;
+					this->m_qMessagesIn.push_back(msg);
+					return true;
+				}
+
+				// 重复收到的报文：已经交付过了，但仍然需要确认
+				if (d < 0)
+					return true;
+				if (d >= static_cast<int32_t>(nReceiveWindow))
+					return false;
+
+				if (nLane == lane_ordered)
+				{
+					if (d > 0)
+					{
+						lane.mapEarly.emplace(nLaneSequence, msg.msg);
+						return true;
+					}
+
+					this->m_qMessagesIn.push_back(msg);
+					lane.nNext++;
+					for (auto it = lane.mapEarly.find(lane.nNext); it != lane.mapEarly.end(); it = lane.mapEarly.find(lane.nNext))
+					{
+						this->m_qMessagesIn.push_back({ msg.remote, std::move(it->second) });
+						lane.mapEarly.erase(it);
+						lane.nNext++;
+					}
+					return true;
+				}
+
+				// reliable_unordered
+				if (d > 0)
+				{
+					if (lane.setEarly.insert(nLaneSequence).second)
+						this->m_qMessagesIn.push_back(msg);
+					return true;
+				}
+
+				this->m_qMessagesIn.push_back(msg);
+				lane.nNext++;
+				while (lane.setEarly.erase(lane.nNext) > 0)
+					lane.nNext++;
+				return true;
+			}
+
+		private:
+			static constexpr size_t nMaxReceiveSlots = 32;
+			static constexpr size_t nReceiveSlotSize = 2048;
+			static constexpr size_t nGroReceiveSlots = 8;
+			static constexpr size_t nGroReceiveSlotSize = 65536;
+
+			// 一组 GSO 最多的数据报个数和总长度 (内核的 UDP_MAX_SEGMENTS 和 UDP 报文的最大长度)
+			static constexpr size_t nMaxSegments = 64;
+			static constexpr size_t nMaxSegmentedBytes = 65000;
+			static constexpr int nSocketBufferSize = 4 * 1024 * 1024;
+
+			// 客户端重发 hello 的间隔
+			static constexpr std::chrono::milliseconds nHelloInterval { 200 };
+
+			// 可靠通道中最多可以提前接收多少个报文
+			static constexpr uint32_t nReceiveWindow = 4096;
+			static constexpr double fMaxWindow = 4096.0;
+
+			asio::io_context &m_asioContext;
+			asio::ip::udp::socket m_socket;
+			tsqueue<owned_message<T> > &m_qMessagesIn;
+
+			// 下面的成员都只在 I/O 线程中访问
+			std::unordered_map<uint64_t, session> m_mapSessions;
+			size_t m_nSweepAt = 64;
+
+			// 有报文在途或者在排队的会话，由 Tick 检查
+			std::unordered_set<uint64_t> m_setActive;
+			asio::steady_timer m_timerTick;
+
+			// 收到了新的包、还需要发送确认的会话
+			std::vector<uint64_t> m_vAckPending;
+
+			std::vector<uint8_t> m_vSendBuffer;
+			std::vector<pending_datagram> m_vPending;
+			bool m_bWaitingWritable = false;
+
+			std::vector<uint8_t> m_vReceiveBuffer;
+			size_t m_nReceiveSlots = nMaxReceiveSlots;
+			size_t m_nReceiveSlotSize = nReceiveSlotSize;
+
+			bool m_bGsoSupported = false;
+			bool m_bGso = false;
+			bool m_bGro = false;
+
+			float m_fSimulatedLoss = 0.0f;
+			std::mt19937 m_rngLoss { 2021 };
+		};
+	}
+}
+
+#endif
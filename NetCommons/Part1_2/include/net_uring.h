@@ -0,0 +1,956 @@
+#ifndef __NET_URING_H__
+#define __NET_URING_H__
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_connection.h"
+
+/*
+基于 io_uring 的 I/O 引擎 (Linux)：
+
+asio 的 epoll reactor 每一次 async_read / async_write 至少需要一次系统调用。uring_engine 在自己的
+线程中直接使用 io_uring (不依赖 liburing)：
+
+	1. 批量提交：一轮循环中准备好的所有 SQE 和等待完成合并成一次 io_uring_enter
+	2. 固定文件：每个连接的 fd 注册在 io_uring 的文件表中，提交的时候使用表中的下标 (IOSQE_FIXED_FILE)
+	3. 注册的缓冲区：发送使用预先注册的发送块 (IORING_OP_WRITE_FIXED)，多个报文合并写入一个发送块
+	4. multishot：监听的 socket 上只提交一次 accept，每个连接只提交一次 recv；接收的数据放在内核
+	   从提供的缓冲区环 (provided buffer ring) 中挑选的缓冲区里，用完之后归还
+
+服务器在 Start 之前调用 SetIoEngine(io_engine::uring) 开启；内核不支持需要的功能 (5.19 之前，或者
+io_uring 被禁用) 的时候打印原因并退回到 asio。客户端仍然使用 asio。
+定义 OLC_NET_NO_URING 可以在编译期去掉这个引擎。
+*/
+
+#if defined(__linux__) && defined(__has_include) && !defined(OLC_NET_NO_URING)
+#if __has_include(<linux/io_uring.h>)
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <functional>
+#include <system_error>
+
+#define OLC_NET_URING 1
+
+namespace olc
+{
+	namespace net
+	{
+		// 服务器的连接使用的 I/O 引擎
+		enum class io_engine
+		{
+			asio,
+			uring,
+		};
+
+		// uring_engine 回调的接口，所有的函数都在 uring_engine 的线程中调用
+		class uring_socket
+		{
+		public:
+			virtual ~uring_socket() {}
+
+			// 收到了 nLength 个字节，返回 false 表示数据有误，需要关闭连接
+			virtual bool OnReceive(const uint8_t *pData, size_t nLength) = 0;
+
+			// 把要发送的数据写入 pChunk (最多 nCapacity 个字节)，返回写入的字节数，0 表示没有要发送的数据
+			virtual size_t FillSend(uint8_t *pChunk, size_t nCapacity) = 0;
+
+			// 连接已经关闭，fd 也已经关闭，之后引擎不再引用这个对象
+			virtual void OnClosed() = 0;
+		};
+
+		// uring_engine 的参数
+		struct uring_options
+		{
+			unsigned nEntries = 4096;			// SQ 的大小，CQ 是它的 4 倍
+			unsigned nFiles = 16384;			// 固定文件表的大小，也就是连接数的上限
+			unsigned nRecvBuffers = 4096;		// 提供给内核的接收缓冲区的个数 (2 的幂)
+			unsigned nRecvBufferSize = 4096;
+			unsigned nSendChunks = 1024;		// 注册的发送块的个数
+			unsigned nSendChunkSize = 16384;
+		};
+
+		class uring_engine
+		{
+		public:
+			static constexpr uint64_t invalid_handle = UINT64_MAX;
+
+			// 内核不支持需要的功能的时候抛出 std::system_error
+			explicit uring_engine(const uring_options &opt = uring_options())
+				: m_opt(opt)
+			{
+				try
+				{
+					this->Setup();
+				}
+				catch (...)
+				{
+					this->Release();
+					throw;
+				}
+			}
+
+			~uring_engine()
+			{
+				this->Stop();
+				for (auto &s : this->m_vSlots)
+				{
+					if (s.pSocket)
+					{
+						::close(s.fd);
+						s.pSocket.reset();
+					}
+				}
+				this->Release();
+			}
+
+			void Start()
+			{
+				this->m_bRunning = true;
+				this->m_thread = std::thread([this]() { this->Run(); });
+			}
+
+			void Stop()
+			{
+				if (!this->m_thread.joinable())
+					return;
+
+				this->m_bRunning = false;
+				this->Wake();
+				this->m_thread.join();
+			}
+
+			// 在监听的 socket 上开始 multishot accept，fd 的所有权交给引擎；fnAccept 在引擎的线程中调用
+			void Listen(int fdListen, std::function<void(int)> fnAccept)
+			{
+				this->m_fdListen = fdListen;
+				this->m_fnAccept = std::move(fnAccept);
+				this->ArmAccept();
+			}
+
+			/*
+			把一个已经连接的 socket 加入固定文件表并开始接收，返回以后 RequestWrite / RequestClose 使用的句柄，
+			表满的时候返回 invalid_handle (fd 仍然属于调用者)。只能在引擎的线程 (例如 fnAccept) 或者 Start 之前调用
+			*/
+			uint64_t Add(int fd, std::shared_ptr<uring_socket> pSocket)
+			{
+				if (this->m_vFreeSlots.empty())
+					return invalid_handle;
+
+				uint32_t nSlot = this->m_vFreeSlots.back();
+				if (!this->UpdateFile(nSlot, fd))
+					return invalid_handle;
+				this->m_vFreeSlots.pop_back();
+
+				slot &s = this->m_vSlots[nSlot];
+				s.fd = fd;
+				s.pSocket = std::move(pSocket);
+				s.bClosing = false;
+				this->ArmRecv(nSlot);
+				return (uint64_t(s.nGeneration) << 32) | nSlot;
+			}
+
+			// 任何线程：这个连接有新的数据要发送
+			void RequestWrite(uint64_t nHandle)
+			{
+				this->Request(this->m_vPendingWrite, nHandle);
+			}
+
+			// 任何线程：关闭这个连接，完成之后调用 OnClosed
+			void RequestClose(uint64_t nHandle)
+			{
+				this->Request(this->m_vPendingClose, nHandle);
+			}
+
+		private:
+			enum op : uint8_t
+			{
+				op_wake,
+				op_accept,
+				op_recv,
+				op_write,
+			};
+
+			struct slot
+			{
+				std::shared_ptr<uring_socket> pSocket;
+				int fd = -1;
+				uint32_t nGeneration = 0;
+				bool bRecvArmed = false;
+				bool bWriting = false;
+				bool bWaitingChunk = false;
+				bool bClosing = false;
+
+				// 正在发送的注册发送块和其中 [nSendOffset, nSendLength) 还没有写完
+				int nChunk = -1;
+				uint32_t nSendOffset = 0;
+				uint32_t nSendLength = 0;
+			};
+
+			static uint64_t UserData(op eOp, uint32_t nSlot = 0)
+			{
+				return (uint64_t(nSlot) << 8) | eOp;
+			}
+
+			static int Enter(int fd, unsigned nSubmit, unsigned nWait, unsigned nFlags)
+			{
+				return static_cast<int>(::syscall(__NR_io_uring_enter, fd, nSubmit, nWait, nFlags, nullptr, 0));
+			}
+
+			static int Register(int fd, unsigned nOpcode, const void *pArg, unsigned nArgs)
+			{
+				return static_cast<int>(::syscall(__NR_io_uring_register, fd, nOpcode, pArg, nArgs));
+			}
+
+			static void Throw(const char *szWhat)
+			{
+				throw std::system_error(errno, std::generic_category(), szWhat);
+			}
+
+			void Setup()
+			{
+				io_uring_params params {};
+				params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+				params.cq_entries = this->m_opt.nEntries * 4;
+				this->m_fdRing = static_cast<int>(::syscall(__NR_io_uring_setup, this->m_opt.nEntries, &params));
+				if (this->m_fdRing < 0)
+					Throw("io_uring_setup");
+
+				if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP))
+				{
+					errno = ENOTSUP;
+					Throw("io_uring features");
+				}
+
+				// SQ 和 CQ 的环共享一次映射
+				this->m_nRingSize = std::max(params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+					params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+				this->m_pRing = ::mmap(nullptr, this->m_nRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+					this->m_fdRing, IORING_OFF_SQ_RING);
+				if (this->m_pRing == MAP_FAILED)
+				{
+					this->m_pRing = nullptr;
+					Throw("mmap sq ring");
+				}
+
+				this->m_nSqeSize = params.sq_entries * sizeof(io_uring_sqe);
+				void *pSqes = ::mmap(nullptr, this->m_nSqeSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+					this->m_fdRing, IORING_OFF_SQES);
+				if (pSqes == MAP_FAILED)
+					Throw("mmap sqes");
+				this->m_pSqes = static_cast<io_uring_sqe*>(pSqes);
+
+				uint8_t *p = static_cast<uint8_t*>(this->m_pRing);
+				this->m_pSqHead = reinterpret_cast<unsigned*>(p + params.sq_off.head);
+				this->m_pSqTail = reinterpret_cast<unsigned*>(p + params.sq_off.tail);
+				this->m_pSqArray = reinterpret_cast<unsigned*>(p + params.sq_off.array);
+				this->m_nSqMask = *reinterpret_cast<unsigned*>(p + params.sq_off.ring_mask);
+				this->m_nSqEntries = params.sq_entries;
+				this->m_pCqHead = reinterpret_cast<unsigned*>(p + params.cq_off.head);
+				this->m_pCqTail = reinterpret_cast<unsigned*>(p + params.cq_off.tail);
+				this->m_pCqes = reinterpret_cast<io_uring_cqe*>(p + params.cq_off.cqes);
+				this->m_nCqMask = *reinterpret_cast<unsigned*>(p + params.cq_off.ring_mask);
+
+				// 稀疏的固定文件表
+				io_uring_rsrc_register files {};
+				files.nr = this->m_opt.nFiles;
+				files.flags = IORING_RSRC_REGISTER_SPARSE;
+				if (Register(this->m_fdRing, IORING_REGISTER_FILES2, &files, sizeof(files)) < 0)
+					Throw("register files");
+
+				this->m_vSlots = std::vector<slot>(this->m_opt.nFiles);
+				for (uint32_t i = this->m_opt.nFiles; i > 0; --i)
+					this->m_vFreeSlots.push_back(i - 1);
+
+				// 接收缓冲区和提供给内核的缓冲区环
+				this->m_nRecvSize = size_t(this->m_opt.nRecvBuffers) * this->m_opt.nRecvBufferSize;
+				this->m_pRecvBuffers = static_cast<uint8_t*>(this->MapAnonymous(this->m_nRecvSize));
+				this->m_nBufRingSize = this->m_opt.nRecvBuffers * sizeof(io_uring_buf);
+				this->m_pBufRing = static_cast<io_uring_buf_ring*>(this->MapAnonymous(this->m_nBufRingSize));
+
+				io_uring_buf_reg reg {};
+				reg.ring_addr = reinterpret_cast<uint64_t>(this->m_pBufRing);
+				reg.ring_entries = this->m_opt.nRecvBuffers;
+				reg.bgid = 0;
+				if (Register(this->m_fdRing, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+					Throw("register buffer ring");
+
+				for (uint16_t i = 0; i < this->m_opt.nRecvBuffers; ++i)
+					this->RecycleBuffer(i);
+				this->PublishBuffers();
+
+				// 注册的发送块
+				this->m_nSendSize = size_t(this->m_opt.nSendChunks) * this->m_opt.nSendChunkSize;
+				this->m_pSendChunks = static_cast<uint8_t*>(this->MapAnonymous(this->m_nSendSize));
+				iovec iov { this->m_pSendChunks, this->m_nSendSize };
+				if (Register(this->m_fdRing, IORING_REGISTER_BUFFERS, &iov, 1) < 0)
+					Throw("register buffers");
+
+				for (int i = static_cast<int>(this->m_opt.nSendChunks); i > 0; --i)
+					this->m_vFreeChunks.push_back(i - 1);
+
+				// 其它线程通过 eventfd 唤醒在 io_uring_enter 中等待的引擎线程
+				this->m_fdWake = ::eventfd(0, EFD_CLOEXEC);
+				if (this->m_fdWake < 0)
+					Throw("eventfd");
+				this->ArmWake();
+			}
+
+			void *MapAnonymous(size_t nSize)
+			{
+				void *p = ::mmap(nullptr, nSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				if (p == MAP_FAILED)
+					Throw("mmap");
+				this->m_vMappings.emplace_back(p, nSize);
+				return p;
+			}
+
+			void Release()
+			{
+				if (this->m_fdListen >= 0)
+					::close(this->m_fdListen);
+				if (this->m_fdWake >= 0)
+					::close(this->m_fdWake);
+				if (this->m_pSqes)
+					::munmap(this->m_pSqes, this->m_nSqeSize);
+				if (this->m_pRing)
+					::munmap(this->m_pRing, this->m_nRingSize);
+				if (this->m_fdRing >= 0)
+					::close(this->m_fdRing);
+				for (auto &m : this->m_vMappings)
+					::munmap(m.first, m.second);
+
+				this->m_fdListen = this->m_fdWake = this->m_fdRing = -1;
+				this->m_pSqes = nullptr;
+				this->m_pRing = nullptr;
+				this->m_vMappings.clear();
+			}
+
+			bool UpdateFile(uint32_t nSlot, int fd)
+			{
+				io_uring_files_update update {};
+				update.offset = nSlot;
+				update.fds = reinterpret_cast<uint64_t>(&fd);
+				return Register(this->m_fdRing, IORING_REGISTER_FILES_UPDATE, &update, 1) == 1;
+			}
+
+			// SQ 已满的时候先把已经准备好的提交掉
+			io_uring_sqe *GetSqe()
+			{
+				unsigned nTail = *this->m_pSqTail;
+				while (nTail - __atomic_load_n(this->m_pSqHead, __ATOMIC_ACQUIRE) >= this->m_nSqEntries)
+					this->Submit(0);
+
+				io_uring_sqe *pSqe = &this->m_pSqes[nTail & this->m_nSqMask];
+				std::memset(pSqe, 0, sizeof(*pSqe));
+				this->m_pSqArray[nTail & this->m_nSqMask] = nTail & this->m_nSqMask;
+				__atomic_store_n(this->m_pSqTail, nTail + 1, __ATOMIC_RELEASE);
+				this->m_nToSubmit++;
+				return pSqe;
+			}
+
+			void Submit(unsigned nWait)
+			{
+				if (this->m_nToSubmit == 0 && nWait == 0)
+					return;
+
+				int nRet = Enter(this->m_fdRing, this->m_nToSubmit, nWait, nWait > 0 ? IORING_ENTER_GETEVENTS : 0);
+				if (nRet >= 0)
+					this->m_nToSubmit -= std::min<unsigned>(this->m_nToSubmit, static_cast<unsigned>(nRet));
+				else if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+					std::cerr << "[uring] io_uring_enter: " << std::strerror(errno) << '\n';
+			}
+
+			void ArmWake()
+			{
+				io_uring_sqe *pSqe = this->GetSqe();
+				pSqe->opcode = IORING_OP_READ;
+				pSqe->fd = this->m_fdWake;
+				pSqe->addr = reinterpret_cast<uint64_t>(&this->m_nWakeValue);
+				pSqe->len = sizeof(this->m_nWakeValue);
+				pSqe->user_data = UserData(op_wake);
+			}
+
+			void ArmAccept()
+			{
+				io_uring_sqe *pSqe = this->GetSqe();
+				pSqe->opcode = IORING_OP_ACCEPT;
+				pSqe->fd = this->m_fdListen;
+				pSqe->ioprio = IORING_ACCEPT_MULTISHOT;
+				pSqe->accept_flags = SOCK_CLOEXEC;
+				pSqe->user_data = UserData(op_accept);
+			}
+
+			void ArmRecv(uint32_t nSlot)
+			{
+				io_uring_sqe *pSqe = this->GetSqe();
+				pSqe->opcode = IORING_OP_RECV;
+				pSqe->fd = static_cast<int>(nSlot);
+				pSqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+				pSqe->ioprio = IORING_RECV_MULTISHOT;
+				pSqe->buf_group = 0;
+				pSqe->user_data = UserData(op_recv, nSlot);
+				this->m_vSlots[nSlot].bRecvArmed = true;
+			}
+
+			void SubmitWrite(uint32_t nSlot)
+			{
+				slot &s = this->m_vSlots[nSlot];
+				io_uring_sqe *pSqe = this->GetSqe();
+				pSqe->opcode = IORING_OP_WRITE_FIXED;
+				pSqe->fd = static_cast<int>(nSlot);
+				pSqe->flags = IOSQE_FIXED_FILE;
+				pSqe->addr = reinterpret_cast<uint64_t>(this->ChunkData(s.nChunk) + s.nSendOffset);
+				pSqe->len = s.nSendLength - s.nSendOffset;
+				pSqe->buf_index = 0;
+				pSqe->user_data = UserData(op_write, nSlot);
+			}
+
+			uint8_t *ChunkData(int nChunk) const
+			{
+				return this->m_pSendChunks + size_t(nChunk) * this->m_opt.nSendChunkSize;
+			}
+
+			void RecycleBuffer(uint16_t nBid)
+			{
+				// 按照内核的布局从环的起始地址计算：C++ 中 __DECLARE_FLEX_ARRAY 展开后 bufs 的偏移不是 0
+				io_uring_buf &buf = reinterpret_cast<io_uring_buf*>(this->m_pBufRing)[this->m_nBufTail & (this->m_opt.nRecvBuffers - 1)];
+				buf.addr = reinterpret_cast<uint64_t>(this->m_pRecvBuffers + size_t(nBid) * this->m_opt.nRecvBufferSize);
+				buf.len = this->m_opt.nRecvBufferSize;
+				buf.bid = nBid;
+				this->m_nBufTail++;
+			}
+
+			void PublishBuffers()
+			{
+				__atomic_store_n(&this->m_pBufRing->tail, this->m_nBufTail, __ATOMIC_RELEASE);
+			}
+
+			void Request(std::vector<uint64_t> &vPending, uint64_t nHandle)
+			{
+				{
+					std::scoped_lock lock(this->m_muxPending);
+					vPending.push_back(nHandle);
+				}
+				if (this->m_bSleeping.load())
+					this->Wake();
+			}
+
+			void Wake()
+			{
+				uint64_t nOne = 1;
+				ssize_t n = ::write(this->m_fdWake, &nOne, sizeof(nOne));
+				(void)n;
+			}
+
+			// 句柄对应的连接已经关闭 (槽已经被重新使用) 的时候返回 nullptr
+			slot *Lookup(uint64_t nHandle)
+			{
+				uint32_t nSlot = static_cast<uint32_t>(nHandle);
+				if (nSlot >= this->m_vSlots.size())
+					return nullptr;
+				slot &s = this->m_vSlots[nSlot];
+				return s.pSocket && s.nGeneration == uint32_t(nHandle >> 32) ? &s : nullptr;
+			}
+
+			void Run()
+			{
+				std::vector<uint64_t> vWrites, vCloses;
+				while (this->m_bRunning)
+				{
+					{
+						std::scoped_lock lock(this->m_muxPending);
+						vWrites.swap(this->m_vPendingWrite);
+						vCloses.swap(this->m_vPendingClose);
+					}
+					for (uint64_t nHandle : vWrites)
+						if (this->Lookup(nHandle))
+							this->StartWrite(static_cast<uint32_t>(nHandle));
+					for (uint64_t nHandle : vCloses)
+						if (this->Lookup(nHandle))
+							this->BeginClose(static_cast<uint32_t>(nHandle));
+					vWrites.clear();
+					vCloses.clear();
+
+					// 没有新的请求和已经完成的事件的时候才在内核中等待，提交和等待是同一次系统调用
+					this->m_bSleeping = true;
+					bool bIdle = false;
+					{
+						std::scoped_lock lock(this->m_muxPending);
+						bIdle = this->m_vPendingWrite.empty() && this->m_vPendingClose.empty();
+					}
+					bIdle = bIdle && *this->m_pCqHead == __atomic_load_n(this->m_pCqTail, __ATOMIC_ACQUIRE);
+					this->Submit(bIdle && this->m_bRunning ? 1 : 0);
+					this->m_bSleeping = false;
+
+					this->Reap();
+				}
+			}
+
+			void Reap()
+			{
+				unsigned nHead = *this->m_pCqHead;
+				unsigned nTail = __atomic_load_n(this->m_pCqTail, __ATOMIC_ACQUIRE);
+				bool bRecycled = false;
+
+				for (; nHead != nTail; ++nHead)
+				{
+					io_uring_cqe cqe = this->m_pCqes[nHead & this->m_nCqMask];
+					uint32_t nSlot = static_cast<uint32_t>(cqe.user_data >> 8);
+
+					switch (static_cast<op>(cqe.user_data & 0xff))
+					{
+						case op_wake:
+							this->ArmWake();
+							break;
+
+						case op_accept:
+							if (cqe.res >= 0)
+								this->m_fnAccept(cqe.res);
+							if (!(cqe.flags & IORING_CQE_F_MORE) && this->m_bRunning)
+								this->ArmAccept();
+							break;
+
+						case op_recv:
+							bRecycled |= this->OnRecv(nSlot, cqe);
+							break;
+
+						case op_write:
+							this->OnWrite(nSlot, cqe.res);
+							break;
+					}
+				}
+
+				if (bRecycled)
+					this->PublishBuffers();
+				__atomic_store_n(this->m_pCqHead, nHead, __ATOMIC_RELEASE);
+			}
+
+			bool OnRecv(uint32_t nSlot, const io_uring_cqe &cqe)
+			{
+				slot &s = this->m_vSlots[nSlot];
+				bool bRecycled = false;
+
+				if (cqe.flags & IORING_CQE_F_BUFFER)
+				{
+					uint16_t nBid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+					if (cqe.res > 0 && !s.bClosing &&
+						!s.pSocket->OnReceive(this->m_pRecvBuffers + size_t(nBid) * this->m_opt.nRecvBufferSize, cqe.res))
+						this->BeginClose(nSlot);
+					this->RecycleBuffer(nBid);
+					bRecycled = true;
+				}
+
+				// 对方关闭 (0) 或者出错；缓冲区暂时用完 (ENOBUFS) 的时候只需要重新提交
+				if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS))
+					this->BeginClose(nSlot);
+
+				if (!(cqe.flags & IORING_CQE_F_MORE))
+				{
+					s.bRecvArmed = false;
+					if (!s.bClosing)
+						this->ArmRecv(nSlot);
+					else
+						this->TryFinish(nSlot);
+				}
+				return bRecycled;
+			}
+
+			void StartWrite(uint32_t nSlot)
+			{
+				slot &s = this->m_vSlots[nSlot];
+				if (s.bWriting || s.bWaitingChunk || s.bClosing)
+					return;
+
+				if (this->m_vFreeChunks.empty())
+				{
+					s.bWaitingChunk = true;
+					this->m_qChunkWaiters.push_back((uint64_t(s.nGeneration) << 32) | nSlot);
+					return;
+				}
+
+				int nChunk = this->m_vFreeChunks.back();
+				size_t nLength = s.pSocket->FillSend(this->ChunkData(nChunk), this->m_opt.nSendChunkSize);
+				if (nLength == 0)
+					return;
+
+				this->m_vFreeChunks.pop_back();
+				s.nChunk = nChunk;
+				s.nSendOffset = 0;
+				s.nSendLength = static_cast<uint32_t>(nLength);
+				s.bWriting = true;
+				this->SubmitWrite(nSlot);
+			}
+
+			void OnWrite(uint32_t nSlot, int nResult)
+			{
+				slot &s = this->m_vSlots[nSlot];
+				if (nResult <= 0)
+				{
+					this->FinishWrite(nSlot);
+					this->BeginClose(nSlot);
+					return;
+				}
+
+				s.nSendOffset += static_cast<uint32_t>(nResult);
+				if (s.nSendOffset < s.nSendLength)
+				{
+					this->SubmitWrite(nSlot);
+					return;
+				}
+
+				// 发送块写完了，继续用它发送后面的报文
+				size_t nLength = s.bClosing ? 0 : s.pSocket->FillSend(this->ChunkData(s.nChunk), this->m_opt.nSendChunkSize);
+				if (nLength > 0)
+				{
+					s.nSendOffset = 0;
+					s.nSendLength = static_cast<uint32_t>(nLength);
+					this->SubmitWrite(nSlot);
+					return;
+				}
+
+				this->FinishWrite(nSlot);
+				this->TryFinish(nSlot);
+			}
+
+			// 归还发送块，交给等待发送块的连接
+			void FinishWrite(uint32_t nSlot)
+			{
+				slot &s = this->m_vSlots[nSlot];
+				s.bWriting = false;
+				this->m_vFreeChunks.push_back(s.nChunk);
+				s.nChunk = -1;
+
+				while (!this->m_qChunkWaiters.empty() && !this->m_vFreeChunks.empty())
+				{
+					uint64_t nHandle = this->m_qChunkWaiters.front();
+					this->m_qChunkWaiters.pop_front();
+
+					slot *pWaiter = this->Lookup(nHandle);
+					if (!pWaiter)
+						continue;
+					pWaiter->bWaitingChunk = false;
+					this->StartWrite(static_cast<uint32_t>(nHandle));
+				}
+			}
+
+			// shutdown 让 multishot recv 结束，所有的操作完成之后在 TryFinish 中关闭 fd
+			void BeginClose(uint32_t nSlot)
+			{
+				slot &s = this->m_vSlots[nSlot];
+				if (s.bClosing)
+					return;
+
+				s.bClosing = true;
+				::shutdown(s.fd, SHUT_RDWR);
+				this->TryFinish(nSlot);
+			}
+
+			void TryFinish(uint32_t nSlot)
+			{
+				slot &s = this->m_vSlots[nSlot];
+				if (!s.bClosing || s.bRecvArmed || s.bWriting || !s.pSocket)
+					return;
+
+				this->UpdateFile(nSlot, -1);
+				::close(s.fd);
+				s.fd = -1;
+				s.bWaitingChunk = false;
+				s.nGeneration++;
+
+				std::shared_ptr<uring_socket> pSocket = std::move(s.pSocket);
+				this->m_vFreeSlots.push_back(nSlot);
+				pSocket->OnClosed();
+			}
+
+		private:
+			uring_options m_opt;
+			int m_fdRing = -1;
+			int m_fdWake = -1;
+			int m_fdListen = -1;
+			std::function<void(int)> m_fnAccept;
+
+			void *m_pRing = nullptr;
+			size_t m_nRingSize = 0;
+			io_uring_sqe *m_pSqes = nullptr;
+			size_t m_nSqeSize = 0;
+			unsigned *m_pSqHead = nullptr;
+			unsigned *m_pSqTail = nullptr;
+			unsigned *m_pSqArray = nullptr;
+			unsigned m_nSqMask = 0;
+			unsigned m_nSqEntries = 0;
+			unsigned *m_pCqHead = nullptr;
+			unsigned *m_pCqTail = nullptr;
+			io_uring_cqe *m_pCqes = nullptr;
+			unsigned m_nCqMask = 0;
+			unsigned m_nToSubmit = 0;
+
+			std::vector<std::pair<void*, size_t> > m_vMappings;
+			uint8_t *m_pRecvBuffers = nullptr;
+			size_t m_nRecvSize = 0;
+			io_uring_buf_ring *m_pBufRing = nullptr;
+			size_t m_nBufRingSize = 0;
+			uint16_t m_nBufTail = 0;
+			uint8_t *m_pSendChunks = nullptr;
+			size_t m_nSendSize = 0;
+			std::vector<int> m_vFreeChunks;
+			std::deque<uint64_t> m_qChunkWaiters;
+
+			std::vector<slot> m_vSlots;
+			std::vector<uint32_t> m_vFreeSlots;
+
+			std::mutex m_muxPending;
+			std::vector<uint64_t> m_vPendingWrite;
+			std::vector<uint64_t> m_vPendingClose;
+			std::atomic<bool> m_bSleeping { false };
+			uint64_t m_nWakeValue = 0;
+
+			std::atomic<bool> m_bRunning { false };
+			std::thread m_thread;
+		};
+
+
+		/*
+		由 uring_engine 驱动的服务器端连接。fd 属于引擎，收发都在引擎的线程中完成：
+		接收到的字节流按照帧格式切分后放入接收队列，发送的报文按照帧格式编码后合并写入注册的发送块
+		*/
+		template <typename T>
+		class uring_connection : public connection<T>, public uring_socket
+		{
+		public:
+			uring_connection(typename connection<T>::owner parent,
+				asio::io_context& asioContext,
+				uring_engine &engine,
+				tsqueue<owned_message<T> >& qIn)
+				: connection<T>(parent, asioContext, stream_socket(asioContext), qIn), m_engine(engine)
+			{
+
+			}
+
+			// uring_engine::Add 之后调用，在此之前不能发送报文
+			void SetHandle(uint64_t nHandle)
+			{
+				this->m_nHandle = nHandle;
+				this->m_bOpen = true;
+			}
+
+			bool IsConnected() const override
+			{
+				return this->m_bOpen;
+			}
+
+			void Disconnect() override
+			{
+				if (this->m_bOpen.exchange(false))
+					this->m_engine.RequestClose(this->m_nHandle);
+			}
+
+		protected:
+			// 报文复制进引擎的发送块就算发送完成，fnSent 在引擎的线程中调用
+			void QueueMessage(message<T> msg, send_callback fnSent) override
+			{
+				if (!this->m_bOpen)
+				{
+					if (fnSent)
+						fnSent(std::make_error_code(std::errc::not_connected));
+					return;
+				}
+
+				if (fnSent)
+					this->QueueWithCallback(std::move(msg), std::move(fnSent));
+				else
+					this->m_qMessagesOut.push_back(std::move(msg));
+
+				if (!this->m_bWriteQueued.exchange(true))
+					this->m_engine.RequestWrite(this->m_nHandle);
+			}
+
+			void StartReading() override
+			{
+				// 引擎在 Add 的时候已经开始接收
+			}
+
+			void StartWriting() override
+			{
+				// 发送由引擎调用 FillSend 完成
+			}
+
+			bool OnReceive(const uint8_t *pData, size_t nLength) override
+			{
+				if (this->m_vReadBuffer.size() < this->m_nReadEnd + nLength)
+					this->m_vReadBuffer.resize(this->m_nReadEnd + nLength);
+				std::memcpy(this->m_vReadBuffer.data() + this->m_nReadEnd, pData, nLength);
+				this->m_nReadEnd += nLength;
+
+				return this->m_eFraming == framing::compact ? this->ParseCompactFrames() : this->ParseStandardFrames();
+			}
+
+			size_t FillSend(uint8_t *pChunk, size_t nCapacity) override
+			{
+				// 先清除标志再读取发送队列，之后加入的报文会重新请求发送
+				this->m_bWriteQueued = false;
+
+				size_t nFilled = 0;
+				while (nFilled < nCapacity && !this->m_qMessagesOut.empty())
+				{
+					const message<T> &msg = this->m_qMessagesOut.front();
+					if (this->m_nFrontOffset == 0)
+						this->m_nFrontHeader = this->EncodeHeader(msg.header);
+
+					// 编码之后的帧是 报头 | body，从 m_nFrontOffset 处继续复制
+					if (this->m_nFrontOffset < this->m_nFrontHeader)
+					{
+						size_t n = std::min(this->m_nFrontHeader - this->m_nFrontOffset, nCapacity - nFilled);
+						std::memcpy(pChunk + nFilled, this->m_aFrontHeader + this->m_nFrontOffset, n);
+						nFilled += n;
+						this->m_nFrontOffset += n;
+					}
+
+					size_t nBodyOffset = this->m_nFrontOffset - std::min(this->m_nFrontOffset, this->m_nFrontHeader);
+					if (this->m_nFrontOffset >= this->m_nFrontHeader && nBodyOffset < msg.body.size())
+					{
+						size_t n = std::min(msg.body.size() - nBodyOffset, nCapacity - nFilled);
+						std::memcpy(pChunk + nFilled, msg.body.data() + nBodyOffset, n);
+						nFilled += n;
+						this->m_nFrontOffset += n;
+					}
+
+					if (this->m_nFrontOffset == this->m_nFrontHeader + msg.body.size())
+					{
+						this->m_qMessagesOut.pop_front();
+						this->m_nFrontOffset = 0;
+
+						this->m_nSendPopped.store(this->m_nSendPopped.load() + 1);
+						if (this->m_nSendWaiting.load() > 0)
+							this->CompleteUringSends(false);
+					}
+				}
+				return nFilled;
+			}
+
+			void OnClosed() override
+			{
+				this->m_bOpen = false;
+				this->AbandonStreams();
+				this->CompleteUringSends(true);
+			}
+
+		private:
+			/*
+			发送队列由调用 Send 的线程写入、引擎的线程读取，等待完成通知的报文 (m_qSendCallbacks) 用 m_muxSent 保护。
+			先增加 m_nSendWaiting 再放入报文，所以引擎取出这个报文之后一定会加锁检查；
+			引擎在登记之前就已经取出了这个报文的时候，由这里直接完成
+			*/
+			void QueueWithCallback(message<T> msg, send_callback fnSent)
+			{
+				bool bDone = false;
+				{
+					std::lock_guard<std::mutex> lock(this->m_muxSent);
+					this->m_nSendWaiting++;
+					uint64_t nSeq = this->m_qMessagesOut.push_back(std::move(msg));
+					bDone = nSeq < this->m_nSendPopped.load();
+					if (bDone)
+						this->m_nSendWaiting--;
+					else
+						this->m_qSendCallbacks.push_back({ nSeq, std::move(fnSent) });
+				}
+
+				if (bDone)
+					fnSent(std::error_code());
+			}
+
+			// 完成已经取出的报文的通知，bClosed 的时候所有的报文都以错误结束。在锁之外调用，fnSent 中可以继续 Send
+			void CompleteUringSends(bool bClosed)
+			{
+				std::deque<typename connection<T>::pending_send> qDone;
+				{
+					std::lock_guard<std::mutex> lock(this->m_muxSent);
+					uint64_t nPopped = this->m_nSendPopped.load();
+					while (!this->m_qSendCallbacks.empty() && (bClosed || this->m_qSendCallbacks.front().nSeq < nPopped))
+					{
+						qDone.push_back(std::move(this->m_qSendCallbacks.front()));
+						this->m_qSendCallbacks.pop_front();
+					}
+					this->m_nSendWaiting -= qDone.size();
+				}
+
+				for (auto &pending : qDone)
+					pending.fnSent(pending.nSeq < this->m_nSendPopped.load() ? std::error_code() : std::make_error_code(std::errc::not_connected));
+			}
+
+			size_t EncodeHeader(const message_header<T> &header)
+			{
+				if (this->m_eFraming == framing::compact)
+					return encode_compact_header(this->m_aFrontHeader, header);
+
+				std::memcpy(this->m_aFrontHeader, &header, sizeof(header));
+				return sizeof(header);
+			}
+
+			// 标准帧格式下从 m_vReadBuffer 中切分出完整的帧，和 ParseCompactFrames 对应
+			bool ParseStandardFrames()
+			{
+				size_t nPos = 0;
+				while (true)
+				{
+					if (!this->StreamBuffered(nPos))
+						return false;
+					if (this->m_nStreamLeft > 0 || this->m_nReadEnd - nPos < sizeof(message_header<T>))
+						break;
+
+					const uint8_t *p = this->m_vReadBuffer.data() + nPos;
+					std::memcpy(&this->m_msgTemporaryIn.header, p, sizeof(message_header<T>));
+
+					size_t nBody = this->m_msgTemporaryIn.header.size & frame_flags::size_mask;
+					if (nBody > 0 && this->BeginStream(this->m_msgTemporaryIn.header))
+					{
+						nPos += sizeof(message_header<T>);
+						continue;
+					}
+
+					if (this->m_nReadEnd - nPos < sizeof(message_header<T>) + nBody)
+						break;
+
+					p += sizeof(message_header<T>);
+					this->m_msgTemporaryIn.body.assign(p, p + nBody);
+					nPos += sizeof(message_header<T>) + nBody;
+
+					if (!this->ProcessIncomingFrame())
+						return false;
+				}
+
+				if (nPos > 0)
+				{
+					std::memmove(this->m_vReadBuffer.data(), this->m_vReadBuffer.data() + nPos, this->m_nReadEnd - nPos);
+					this->m_nReadEnd -= nPos;
+				}
+				return true;
+			}
+
+		private:
+			uring_engine &m_engine;
+			uint64_t m_nHandle = uring_engine::invalid_handle;
+			std::atomic<bool> m_bOpen { false };
+			std::atomic<bool> m_bWriteQueued { false };
+
+			// 发送队列头部的报文编码之后的报头，以及这个帧已经写入发送块的字节数
+			uint8_t m_aFrontHeader[std::max(compact_header_max_size, sizeof(message_header<T>))];
+			size_t m_nFrontHeader = 0;
+			size_t m_nFrontOffset = 0;
+
+			// 从发送队列中取出的报文的个数 (只由引擎的线程写入)，和 m_qSendCallbacks 中登记的报文的个数
+			std::mutex m_muxSent;
+			std::atomic<uint64_t> m_nSendPopped { 0 };
+			std::atomic<size_t> m_nSendWaiting { 0 };
+		};
+	}
+}
+
+#endif
+#endif
+
+#endif
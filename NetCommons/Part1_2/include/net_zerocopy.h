@@ -0,0 +1,168 @@
+#ifndef __NET_ZEROCOPY_H__
+#define __NET_ZEROCOPY_H__
+
+#include "net_common.h"
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <cerrno>
+#endif
+
+// Linux 4.14 之后 TCP 支持 MSG_ZEROCOPY
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define OLC_NET_ZEROCOPY 1
+#endif
+
+/*
+大报文 (地图分块、资源补丁 ...) 的零拷贝发送：
+
+普通的 send 会把整个 body 复制到内核的缓冲区中。socket 开启 SO_ZEROCOPY 之后，带 MSG_ZEROCOPY 的
+sendmsg 只是把 body 所在的内存页固定下来，由网卡直接从中读取，所以 sendmsg 返回之后 body 仍然不能
+释放或者修改。内核发送完成之后在 socket 的错误队列 (MSG_ERRQUEUE) 中放一条通知：每一次成功的
+sendmsg 按顺序得到一个 32 位的编号，通知中给出一段已经完成的编号 [ee_info, ee_data]。
+
+zerocopy_tracker 负责编号的计数，保存还在发送中的 body，读取错误队列并释放已经完成的 body。
+内核没有办法零拷贝的时候 (例如对方在本机上，数据要交给另一个 socket) 会自己复制一份，通知中带有
+SO_EE_CODE_ZEROCOPY_COPIED；连续出现的时候零拷贝只剩下额外的开销，调用者可以据此关闭它。
+*/
+
+namespace olc
+{
+	namespace net
+	{
+		// body 不小于这个长度的时候使用零拷贝发送，更小的报文固定内存页和处理通知的开销比复制更大
+		constexpr size_t zerocopy_default_threshold = 64 * 1024;
+
+#ifdef OLC_NET_ZEROCOPY
+		/*
+		一个 socket 上零拷贝发送的状态，Payload 是需要保持有效的数据 (例如 message<T>)。
+		所有的函数都必须在同一个线程 (连接的 I/O 线程) 中调用
+		*/
+		template <typename Payload>
+		class zerocopy_tracker
+		{
+		public:
+			// 在 socket 上开启 SO_ZEROCOPY，内核不支持的时候返回 false
+			static bool Enable(int fd)
+			{
+				int nOne = 1;
+				return ::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &nOne, sizeof(nOne)) == 0;
+			}
+
+			/*
+			非阻塞地零拷贝发送 aBuffers 中的数据，返回值和 sendmsg 相同。
+			发送了数据 (返回值大于 0) 之后，这些数据在 Hold 交给的 Payload 释放之前必须保持有效
+			*/
+			ssize_t Send(int fd, iovec *pBuffers, size_t nBuffers)
+			{
+				msghdr mh {};
+				mh.msg_iov = pBuffers;
+				mh.msg_iovlen = nBuffers;
+
+				ssize_t n = ::sendmsg(fd, &mh, MSG_ZEROCOPY | MSG_DONTWAIT | MSG_NOSIGNAL);
+				if (n >= 0)
+					this->m_nNextId++;
+				return n;
+			}
+
+			// 上一次 Hold 之后的所有 Send 使用的都是 payload 中的数据，等它们全部完成之后再释放 payload
+			void Hold(Payload payload)
+			{
+				if (this->m_nNextId == this->m_nHeldId)
+					return;
+
+				this->m_qInFlight.push_back({ this->m_nHeldId, this->m_nNextId - this->m_nHeldId, 0, std::move(payload) });
+				this->m_nHeldId = this->m_nNextId;
+			}
+
+			// 读取错误队列中所有的通知，释放已经完成的 payload，返回释放的个数
+			size_t Reap(int fd)
+			{
+				while (true)
+				{
+					alignas(cmsghdr) uint8_t aControl[CMSG_SPACE(sizeof(sock_extended_err)) + 64];
+					msghdr mh {};
+					mh.msg_control = aControl;
+					mh.msg_controllen = sizeof(aControl);
+
+					if (::recvmsg(fd, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+						break;
+
+					for (cmsghdr *pControl = CMSG_FIRSTHDR(&mh); pControl; pControl = CMSG_NXTHDR(&mh, pControl))
+					{
+						bool bRecvErr = (pControl->cmsg_level == SOL_IP && pControl->cmsg_type == IP_RECVERR) ||
+							(pControl->cmsg_level == SOL_IPV6 && pControl->cmsg_type == IPV6_RECVERR);
+						if (!bRecvErr)
+							continue;
+
+						sock_extended_err err;
+						std::memcpy(&err, CMSG_DATA(pControl), sizeof(err));
+						if (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY || err.ee_errno != 0)
+							continue;
+
+						this->Complete(err.ee_info, err.ee_data);
+						if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+							this->m_nCopied++;
+						else
+							this->m_nCopied = 0;
+					}
+				}
+
+				// 按照发送的顺序释放，前面的还没有完成的时候后面的先留着
+				size_t nReleased = 0;
+				while (!this->m_qInFlight.empty() && this->m_qInFlight.front().nDone == this->m_qInFlight.front().nCount)
+				{
+					this->m_qInFlight.pop_front();
+					++nReleased;
+				}
+				return nReleased;
+			}
+
+			// 还有没有等待内核完成的 payload
+			bool Pending() const
+			{
+				return !this->m_qInFlight.empty();
+			}
+
+			// 最近连续多少次通知表示内核实际上复制了数据
+			size_t CopiedInARow() const
+			{
+				return this->m_nCopied;
+			}
+
+		private:
+			struct in_flight
+			{
+				uint32_t nFirst;	// 第一次 Send 的编号
+				uint32_t nCount;	// Send 的次数
+				uint32_t nDone;		// 已经完成的次数
+				Payload payload;
+			};
+
+			// 编号 [nLow, nHigh] 的发送已经完成
+			void Complete(uint32_t nLow, uint32_t nHigh)
+			{
+				for (auto &f : this->m_qInFlight)
+				{
+					// 编号是 32 位的，会回绕；还在发送中的编号相差不大，相对于 nFirst 的有符号偏移不会溢出
+					int64_t nFrom = std::max<int64_t>(int32_t(nLow - f.nFirst), 0);
+					int64_t nTo = std::min<int64_t>(int32_t(nHigh - f.nFirst), int64_t(f.nCount) - 1);
+					if (nTo >= nFrom)
+						f.nDone += static_cast<uint32_t>(nTo - nFrom + 1);
+				}
+			}
+
+		private:
+			uint32_t m_nNextId = 0;
+			uint32_t m_nHeldId = 0;
+			size_t m_nCopied = 0;
+			std::deque<in_flight> m_qInFlight;
+		};
+#endif
+	}
+}
+
+#endif
@@ -16,22 +16,26 @@ enum class CustomMsgTypes : uint32_t
 class CustomClient : public olc::net::client_interface<CustomMsgTypes>
 {
 public:
+	// ping 是一次 RPC：回复由 Call 对应到这个请求，不需要在 body 中放入编号；回调在 I/O 线程中执行
 	void PingServer(const int &msg_id)
 	{
 		std::cout << "Ping Server\n";
 		olc::net::message<CustomMsgTypes> msg;
 		msg.header.id = CustomMsgTypes::ServerPing;
 
-		std::chrono::system_clock::time_point timenow = \
-			std::chrono::system_clock::now();
-
-		msg << msg_id;
-		msg << timenow;
-		Send(msg);
+		std::chrono::steady_clock::time_point timesend = std::chrono::steady_clock::now();
+		Call(msg, std::chrono::seconds(2),
+			[msg_id, timesend](std::error_code ec, olc::net::message<CustomMsgTypes> &)
+			{
+				if (ec)
+				{
+					std::cout << "Ping [" << msg_id << "] failed: " << ec.message() << '\n';
+					return;
+				}
 
-		#ifdef __DEBUG_OUT__
-			std::cout << "msg body size = " << msg.header.size << '\n';
-		#endif
+				std::cout << "Ping [" << msg_id << "] take " << \
+					std::chrono::duration<double>(std::chrono::steady_clock::now() - timesend).count() << " seconds\n";
+			});
 	}
 
 
@@ -74,29 +78,6 @@ int main(int argc, char *argv[])
 					}
 					break;
 
-					case CustomMsgTypes::ServerPing:
-					{
-						//std::chrono::system_clock::time_point timenow = \
-						//	std::chrono::system_clock::now();
-
-						//std::chrono::system_clock::time_point timethen;
-						//msg >> timethen;
-
-						//std::cout << "Ping: " << std::chrono::duration<double>(timenow - timethen).count() << '\n'; 
-
-
-						// modified
-						std::chrono::system_clock::time_point time_send;
-						std::chrono::system_clock::time_point time_then;
-						int id;
-						msg >> time_then;
-						msg >> time_send;
-						msg >> id;
-						std::cout << "Message [" << id << "]" <<" take " << \
-							std::chrono::duration<double>(time_then - time_send).count() << " seconds to server\n";
-					}
-					break;
-
 					case CustomMsgTypes::ServerMessage:
 					{
 						uint32_t clientID;
@@ -104,6 +85,9 @@ int main(int argc, char *argv[])
 						std::cout << "Hello from [" << clientID << "]\n";
 					}
 					break;
+
+					default:
+					break;
 				}
 			}
 		}
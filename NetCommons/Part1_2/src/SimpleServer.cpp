@@ -3,6 +3,7 @@
 #include "net_tsqueue.h"
 #include "net_common.h"
 #include "net_connection.h"
+#include "net_dispatch.h"
 
 
 using namespace std::chrono_literals;	// using for s, ms, us
@@ -48,34 +49,41 @@ protected:
 	virtual void OnMessage(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client, 
 			olc::net::message<CustomMsgTypes> &msg) 
 	{
-		switch(msg.header.id)
+		if (!dispatcher::dispatch(*this, client, msg))
+			std::cout << "[" << client->GetID() << "]: Bad message\n";
+	} 
+
+	// RPC 的请求，ping 原样回复，客户端自己计算往返的时间
+	virtual void OnRequest(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client, uint32_t nCall,
+			olc::net::message<CustomMsgTypes> &request)
+	{
+		if (request.header.id != CustomMsgTypes::ServerPing)
 		{
-			case CustomMsgTypes::ServerPing:
-			{
-				std::cout << "[" << client->GetID() << "]: Server Ping\n";
-
-				//client->Send(msg);
-
-				// msg 当中先存储着客户端发送时候的时间，服务器再存储自己发送的时间
-				// 两个程序在同一台电脑上进行模拟，时钟相同
-				std::chrono::system_clock::time_point timenow = std::chrono::system_clock::now();
-				msg << timenow;
-				client->Send(msg);
-			}
-			break;
-
-			case CustomMsgTypes::MessageAll:
-			{
-				std::cout << "[" << client->GetID() << "]: Message All\n";
-
-				olc::net::message<CustomMsgTypes> msg;
-				msg.header.id = CustomMsgTypes::ServerMessage;
-				msg << client->GetID();
-				MessageAllClient(msg, client);
-			}
-			break;
+			client->Reject(nCall);
+			return;
 		}
-	} 
+
+		std::cout << "[" << client->GetID() << "]: Server Ping\n";
+		client->Respond(nCall, request);
+	}
+
+	void OnMessageAll(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client)
+	{
+		std::cout << "[" << client->GetID() << "]: Message All\n";
+
+		olc::net::message<CustomMsgTypes> msg;
+		msg.header.id = CustomMsgTypes::ServerMessage;
+		msg << client->GetID();
+		MessageAllClient(msg, client);
+	}
+
+	// 每一种报文对应的处理函数，只会发给客户端的报文明确忽略
+	using dispatcher = olc::net::message_dispatcher<CustomServer, CustomMsgTypes, 5,
+		olc::net::ignore_message<CustomMsgTypes::ServerAccept>,
+		olc::net::ignore_message<CustomMsgTypes::ServerDeny>,
+		olc::net::ignore_message<CustomMsgTypes::ServerPing>,
+		olc::net::message_handler<CustomMsgTypes::MessageAll, void, &CustomServer::OnMessageAll>,
+		olc::net::ignore_message<CustomMsgTypes::ServerMessage> >;
 };
 
 
@@ -0,0 +1,138 @@
+#include <iostream>
+#include <cmath>
+#include "net_bitpack.h"
+
+
+/*
+量化浮点数的往返检查和编码/解码的耗时：
+	每个位数 (0~64) 写入区间的两端和中间的值再读出，两端必须原样读回，中间的误差不超过半个量化步长
+	(32 位以上按 32 位处理)；角度在 0 附近和 2pi 附近都要读回同一个角度。
+任何一项检查失败的时候返回 1
+*/
+
+constexpr int nIterations = 1000000;
+
+struct sample
+{
+	float value;
+	float fMin;
+	float fMax;
+};
+
+// 写入一个值，再按同样的参数读出
+float RoundTrip(float value, float fMin, float fMax, unsigned nBits)
+{
+	std::vector<uint8_t> vBuffer;
+	{
+		olc::net::bit_writer writer(vBuffer);
+		writer.write_quantized(value, fMin, fMax, nBits);
+	}
+
+	olc::net::bit_reader reader(vBuffer.data(), vBuffer.size());
+	return reader.read_quantized(fMin, fMax, nBits);
+}
+
+float AngleRoundTrip(float fRadians, unsigned nBits)
+{
+	std::vector<uint8_t> vBuffer;
+	{
+		olc::net::bit_writer writer(vBuffer);
+		writer.write_angle(fRadians, nBits);
+	}
+
+	olc::net::bit_reader reader(vBuffer.data(), vBuffer.size());
+	return reader.read_angle(nBits);
+}
+
+bool CheckQuantized()
+{
+	bool bOk = true;
+	for (const sample &s : { sample { 100.0f, -100.0f, 100.0f }, sample { 0.0f, -1.0f, 1.0f }, sample { 1e6f, -1e6f, 1e6f } })
+	{
+		for (unsigned nBits = 0; nBits <= 64; ++nBits)
+		{
+			unsigned nUsed = std::min(nBits, olc::net::quantized_max_bits);
+			double dStep = nUsed == 0 ? double(s.fMax) - s.fMin : (double(s.fMax) - s.fMin) / double((uint64_t(1) << nUsed) - 1);
+			// 读出的值最后转换为 float，还要加上 float 的舍入误差
+			double dTolerance = dStep / 2 + std::fabs(double(s.fMax)) * 1e-7;
+
+			float fLow = RoundTrip(s.fMin, s.fMin, s.fMax, nBits);
+			float fHigh = RoundTrip(s.fMax, s.fMin, s.fMax, nBits);
+			float fMid = RoundTrip(s.value * 0.37f, s.fMin, s.fMax, nBits);
+			bool bEnds = fLow == s.fMin && (nBits == 0 || fHigh == s.fMax);
+			bool bMid = nBits == 0 || std::fabs(double(fMid) - double(s.value) * 0.37) <= dTolerance;
+			if (!bEnds || !bMid)
+			{
+				std::cout << "quantized [" << s.fMin << ", " << s.fMax << "] " << nBits << " bits: min -> " << fLow
+					<< ", max -> " << fHigh << ", " << s.value * 0.37f << " -> " << fMid << '\n';
+				bOk = false;
+			}
+		}
+	}
+	return bOk;
+}
+
+bool CheckAngles()
+{
+	constexpr float fTwoPi = 6.28318530717958647692f;
+	bool bOk = true;
+	for (unsigned nBits = 4; nBits <= 64; ++nBits)
+	{
+		unsigned nUsed = std::min(nBits, 63u);
+		double dTolerance = double(fTwoPi) / double(uint64_t(1) << std::min(nUsed, 62u)) + 1e-6;
+		for (float a : { 0.0f, 1.0f, fTwoPi - 1e-6f, -1.0f })
+		{
+			double dExpected = std::fmod(double(a) + fTwoPi, double(fTwoPi));
+			double dDiff = std::fabs(double(AngleRoundTrip(a, nBits)) - dExpected);
+			// 2pi 附近的值可以回绕到 0
+			dDiff = std::min(dDiff, std::fabs(dDiff - fTwoPi));
+			if (dDiff > dTolerance)
+			{
+				std::cout << "angle " << a << " " << nBits << " bits: diff " << dDiff << '\n';
+				bOk = false;
+			}
+		}
+	}
+	return bOk;
+}
+
+void RunBench(unsigned nBits)
+{
+	std::vector<uint8_t> vBuffer;
+	vBuffer.reserve(nIterations * 12 + 8);
+
+	auto tStart = std::chrono::steady_clock::now();
+	{
+		olc::net::bit_writer writer(vBuffer);
+		for (int i = 0; i < nIterations; ++i)
+		{
+			float f = float(i % 2000) - 1000.0f;
+			writer.write_quantized(f, -1000.0f, 1000.0f, nBits);
+			writer.write_quantized(-f, -1000.0f, 1000.0f, nBits);
+			writer.write_quantized(f * 0.5f, -1000.0f, 1000.0f, nBits);
+		}
+	}
+	auto tWritten = std::chrono::steady_clock::now();
+
+	double dChecksum = 0;
+	olc::net::bit_reader reader(vBuffer.data(), vBuffer.size());
+	for (int i = 0; i < nIterations * 3; ++i)
+		dChecksum += reader.read_quantized(-1000.0f, 1000.0f, nBits);
+	auto tRead = std::chrono::steady_clock::now();
+
+	std::cout << nBits << " bits: write " << std::chrono::duration<double, std::nano>(tWritten - tStart).count() / (nIterations * 3)
+		<< " ns, read " << std::chrono::duration<double, std::nano>(tRead - tWritten).count() / (nIterations * 3)
+		<< " ns  (checksum " << dChecksum << ")\n";
+}
+
+
+int main(int argc, char *argv[])
+{
+	bool bOk = CheckQuantized();
+	bOk = CheckAngles() && bOk;
+	std::cout << "round trip: " << (bOk ? "ok" : "FAILED") << '\n';
+
+	for (unsigned nBits : { 10u, 16u, 24u, 32u })
+		RunBench(nBits);
+	return bOk ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+#include <iostream>
+#include <random>
+#include "net_message.h"
+#include "net_compress.h"
+
+
+enum class CustomMsgTypes : uint32_t
+{
+	ChatHistory,
+	Inventory,
+	MapChunk,
+	Random,
+};
+
+struct InventoryItem
+{
+	uint32_t nItemID;
+	uint16_t nCount;
+	uint8_t nSlot;
+	uint8_t nFlags;
+	float fDurability;
+};
+
+
+// 生成不同类型、不同长度的报文：聊天记录，背包，地图块，不可压缩的随机数据
+std::vector<olc::net::message<CustomMsgTypes> > MakeMessages(std::mt19937 &rng)
+{
+	const char *words[] = { "hello ", "guild ", "raid ", "tonight ", "need ", "healer ", "lfg ", "dungeon ", "gg ", "wp " };
+	std::vector<olc::net::message<CustomMsgTypes> > vMessages;
+
+	for (int i = 0; i < 2000; ++i)
+	{
+		olc::net::message<CustomMsgTypes> msg;
+		msg.header.id = static_cast<CustomMsgTypes>(i % 4);
+		size_t nSize = size_t(16) << (rng() % 11);	// 16 字节 ~ 16KB
+
+		switch (msg.header.id)
+		{
+			case CustomMsgTypes::ChatHistory:
+				while (msg.size() < nSize)
+				{
+					const char *w = words[rng() % 10];
+					msg.body.insert(msg.body.end(), w, w + std::strlen(w));
+				}
+				break;
+
+			case CustomMsgTypes::Inventory:
+				while (msg.size() < nSize)
+				{
+					InventoryItem item { static_cast<uint32_t>(1000 + rng() % 50), static_cast<uint16_t>(rng() % 20), 
+						static_cast<uint8_t>(msg.size() / sizeof(InventoryItem)), 0, 100.0f };
+					msg << item;
+				}
+				break;
+
+			case CustomMsgTypes::MapChunk:
+				while (msg.size() < nSize)
+				{
+					uint8_t nTile = static_cast<uint8_t>(rng() % 4);
+					msg.body.insert(msg.body.end(), 1 + rng() % 32, nTile);
+				}
+				break;
+
+			case CustomMsgTypes::Random:
+				while (msg.size() < nSize)
+					msg << static_cast<uint32_t>(rng());
+				break;
+		}
+		msg.header.size = msg.size();
+		vMessages.push_back(std::move(msg));
+	}
+
+	return vMessages;
+}
+
+
+int main(int argc, char *argv[]) 
+{
+	std::mt19937 rng(2021);
+	auto vMessages = MakeMessages(rng);
+	auto pCodec = olc::net::default_compressor();
+
+	std::cout << "threshold   bytes in   bytes out   saved    cpu (us)   ns/saved byte\n";
+	for (size_t nThreshold : { size_t(0), size_t(64), size_t(256), size_t(1024), size_t(4096), SIZE_MAX })
+	{
+		size_t nBytesIn = 0;
+		size_t nBytesOut = 0;
+		auto tStart = std::chrono::steady_clock::now();
+
+		for (const auto &msg : vMessages)
+		{
+			std::vector<uint8_t> vBody = msg.body;
+			nBytesIn += vBody.size();
+			if (vBody.size() >= nThreshold)
+				olc::net::compress_body(*pCodec, vBody);
+			nBytesOut += vBody.size();
+		}
+
+		auto tEnd = std::chrono::steady_clock::now();
+		double us = std::chrono::duration<double, std::micro>(tEnd - tStart).count();
+		size_t nSaved = nBytesIn - nBytesOut;
+
+		std::cout << (nThreshold == SIZE_MAX ? std::string("off") : std::to_string(nThreshold)) << "\t\t"
+			<< nBytesIn << "\t" << nBytesOut << "\t" << nSaved << "\t" << us << "\t" 
+			<< (nSaved ? us * 1000.0 / nSaved : 0.0) << '\n';
+	}
+
+	// 检查解压之后和原始数据一致
+	for (const auto &msg : vMessages)
+	{
+		std::vector<uint8_t> vBody = msg.body;
+		if (olc::net::compress_body(*pCodec, vBody) &&
+			(!olc::net::decompress_body(pCodec.get(), vBody, olc::net::frame_flags::size_mask) || vBody != msg.body))
+		{
+			std::cout << "round trip failed\n";
+			return 1;
+		}
+	}
+
+	return  0;
+}
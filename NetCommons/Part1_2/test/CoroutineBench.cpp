@@ -0,0 +1,153 @@
+#include <iostream>
+#include <atomic>
+#include "net_connection.h"
+#include "net_connection_coro.h"
+
+
+enum class CustomMsgTypes : uint32_t
+{
+	Data,
+	Ping,
+};
+
+using Message = olc::net::message<CustomMsgTypes>;
+using Connection = olc::net::connection<CustomMsgTypes>;
+
+
+/*
+在本机的回环地址上建立一对连接 (客户端 -> 服务器)，两端都使用 Conn 类型的连接，
+所有的 I/O 都在一个 I/O 线程中完成，主线程负责发送和从接收队列中取出报文
+*/
+template <template <typename> class Conn>
+struct Loopback
+{
+	asio::io_context context;
+	olc::net::tsqueue<olc::net::owned_message<CustomMsgTypes> > qServerIn;
+	olc::net::tsqueue<olc::net::owned_message<CustomMsgTypes> > qClientIn;
+	std::shared_ptr<Connection> pServer;
+	std::shared_ptr<Connection> pClient;
+	std::thread thread;
+
+	explicit Loopback(olc::net::framing eFraming)
+	{
+		asio::ip::tcp::acceptor acceptor(this->context, asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+		std::atomic<bool> bAccepted { false };
+
+		acceptor.async_accept(
+			[&](std::error_code ec, asio::ip::tcp::socket socket)
+			{
+				socket.set_option(asio::ip::tcp::no_delay(true));
+				this->pServer = std::make_shared<Conn<CustomMsgTypes> >(Connection::owner::server,
+					this->context, std::move(socket), this->qServerIn);
+				this->pServer->SetFraming(eFraming);
+				this->pServer->ConnectToClient(1);
+				bAccepted = true;
+			}
+		);
+
+		asio::ip::tcp::resolver resolver(this->context);
+		auto endpoints = resolver.resolve("127.0.0.1", std::to_string(acceptor.local_endpoint().port()));
+
+		this->pClient = std::make_shared<Conn<CustomMsgTypes> >(Connection::owner::client,
+			this->context, asio::ip::tcp::socket(this->context), this->qClientIn);
+		this->pClient->SetFraming(eFraming);
+		this->pClient->ConnectToServer(endpoints);
+
+		this->thread = std::thread([this]() { this->context.run(); });
+		while (!bAccepted || !this->pClient->IsConnected())
+			std::this_thread::yield();
+	}
+
+	~Loopback()
+	{
+		this->context.stop();
+		this->thread.join();
+		this->pServer.reset();
+		this->pClient.reset();
+	}
+};
+
+
+// 客户端连续发送 nMessages 个报文，直到服务器全部收到为止，返回每秒的报文数
+template <template <typename> class Conn>
+double Throughput(olc::net::framing eFraming, size_t nMessages, size_t nBody)
+{
+	Loopback<Conn> loop(eFraming);
+
+	Message msg;
+	msg.header.id = CustomMsgTypes::Data;
+	msg.body.resize(nBody, 0x5a);
+	msg.header.size = msg.size();
+
+	auto tStart = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < nMessages; ++i)
+		loop.pClient->Send(msg);
+
+	std::vector<olc::net::owned_message<CustomMsgTypes> > vDrained;
+	size_t nReceived = 0;
+	while (nReceived < nMessages)
+	{
+		vDrained.clear();
+		if (loop.qServerIn.drain(vDrained) == 0)
+			std::this_thread::yield();
+		nReceived += vDrained.size();
+	}
+	auto tEnd = std::chrono::steady_clock::now();
+
+	return nMessages / std::chrono::duration<double>(tEnd - tStart).count();
+}
+
+// 客户端和服务器之间来回发送 nRounds 次，返回平均的往返时间 (微秒)
+template <template <typename> class Conn>
+double RoundTrip(olc::net::framing eFraming, size_t nRounds)
+{
+	Loopback<Conn> loop(eFraming);
+
+	Message msg;
+	msg.header.id = CustomMsgTypes::Ping;
+	msg << uint64_t(0);
+
+	auto tStart = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < nRounds; ++i)
+	{
+		loop.pClient->Send(msg);
+		while (loop.qServerIn.empty())
+			std::this_thread::yield();
+		auto ping = loop.qServerIn.pop_front();
+
+		loop.pServer->Send(ping.msg);
+		while (loop.qClientIn.empty())
+			std::this_thread::yield();
+		loop.qClientIn.pop_front();
+	}
+	auto tEnd = std::chrono::steady_clock::now();
+
+	return std::chrono::duration<double, std::micro>(tEnd - tStart).count() / nRounds;
+}
+
+
+template <template <typename> class Conn>
+void Run(const char *szName)
+{
+	for (auto eFraming : { olc::net::framing::standard, olc::net::framing::compact })
+	{
+		const char *szFraming = eFraming == olc::net::framing::standard ? "standard" : "compact";
+		std::cout << szName << "\t" << szFraming
+			<< "\t" << Throughput<Conn>(eFraming, 200000, 32) << "\t"
+			<< Throughput<Conn>(eFraming, 20000, 4096) << "\t"
+			<< RoundTrip<Conn>(eFraming, 20000) << '\n';
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	std::cout << "connection\tframing\t\tmsg/s (32B)\tmsg/s (4KB)\tround trip (us)\n";
+	Run<olc::net::connection>("callback");
+#ifdef ASIO_HAS_CO_AWAIT
+	Run<olc::net::coro_connection>("coroutine");
+#else
+	std::cout << "coroutine\t(not available, build with -std=c++20)\n";
+#endif
+	return  0;
+}
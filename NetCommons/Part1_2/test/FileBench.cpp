@@ -0,0 +1,330 @@
+#include <iostream>
+#include <fstream>
+#include <atomic>
+#include <random>
+#include "net_server.h"
+#include "net_client.h"
+
+
+enum class CustomMsgTypes : uint32_t
+{
+	ServerAccept,
+	Request,
+	FileChunk,
+	Done,
+};
+
+using Message = olc::net::message<CustomMsgTypes>;
+
+
+/*
+文件传输 (connection<T>::SendFile 和 file_sink) 的检查和吞吐量：
+	客户端发送 Request (偏移，发送方式)，服务器从这个偏移开始把文件发送过来，发送完之后发回 Done，
+	客户端用 file_sink 写入文件，最后和原来的文件逐字节比较。
+	两种帧格式下各检查：完整的传输、从 file_sink::Size 开始的续传、长度为 0 的文件。
+	发送方式 sendfile 是 SendFile，message 是把文件读入报文再 Send，两者的块格式相同，用来对比吞吐量。
+任何一项检查失败的时候返回 1
+*/
+
+constexpr uint64_t nFileSize = 32 * 1024 * 1024 + 12345;
+constexpr uint64_t nResumeAt = 3 * olc::net::file_chunk_size + 777;
+
+std::string sSource;
+std::string sEmpty;
+
+
+class FileServer : public olc::net::server_interface<CustomMsgTypes>
+{
+public:
+	FileServer() : olc::net::server_interface<CustomMsgTypes>(uint16_t(0))
+	{
+
+	}
+
+	uint16_t Port()
+	{
+		asio::ip::tcp::endpoint endpoint;
+		olc::net::detail::to_tcp_endpoint(this->m_asioAcceptor.local_endpoint(), endpoint);
+		return endpoint.port();
+	}
+
+	// 最后一次传输在进度回调中报告的错误
+	std::atomic<bool> bFailed { false };
+
+protected:
+	bool OnClientConnect(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client) override
+	{
+		Message msg;
+		msg.header.id = CustomMsgTypes::ServerAccept;
+		client->Send(msg);
+		return true;
+	}
+
+	void OnMessage(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client, Message &msg) override
+	{
+		if (msg.header.id != CustomMsgTypes::Request)
+			return;
+
+		std::string sPath;
+		uint64_t nOffset = 0;
+		uint8_t bSendFile = 0;
+		msg >> bSendFile >> nOffset;
+		sPath.assign(msg.body.begin(), msg.body.end());
+
+		if (bSendFile)
+			this->SendWithSendFile(client, sPath, nOffset);
+		else
+			this->SendWithMessages(client, sPath, nOffset);
+	}
+
+private:
+	// 进度回调在连接的 I/O 线程中执行，最后一块发送完之后发回 Done，Done 在所有文件块之后到达
+	void SendWithSendFile(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client, const std::string &sPath, uint64_t nOffset)
+	{
+		std::weak_ptr<olc::net::connection<CustomMsgTypes> > wpClient = client;
+		bool bStarted = client->SendFile(sPath, CustomMsgTypes::FileChunk, nOffset, 0,
+			[this, wpClient](uint64_t nSent, uint64_t nTotal, std::error_code ec)
+			{
+				if (ec)
+					this->bFailed = true;
+				if (ec || nSent == nTotal)
+				{
+					Message done;
+					done.header.id = CustomMsgTypes::Done;
+					if (auto pClient = wpClient.lock())
+						pClient->Send(done);
+				}
+			});
+
+		if (!bStarted)
+		{
+			this->bFailed = true;
+			Message done;
+			done.header.id = CustomMsgTypes::Done;
+			client->Send(done);
+		}
+	}
+
+	// 对比用：每一块读入一个报文再发送，多出 read 和复制进 body 两次复制
+	void SendWithMessages(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client, const std::string &sPath, uint64_t nOffset)
+	{
+		std::ifstream file(sPath, std::ios::binary);
+		file.seekg(static_cast<std::streamoff>(nOffset));
+		while (file)
+		{
+			Message msg;
+			msg.header.id = CustomMsgTypes::FileChunk;
+			msg.body.resize(olc::net::file_chunk_prefix + olc::net::file_chunk_size);
+			olc::net::detail::store_scalar(msg.body.data(), nOffset);
+			file.read(reinterpret_cast<char*>(msg.body.data() + olc::net::file_chunk_prefix), olc::net::file_chunk_size);
+			size_t nRead = static_cast<size_t>(file.gcount());
+			if (nRead == 0)
+				break;
+
+			msg.body.resize(olc::net::file_chunk_prefix + nRead);
+			msg.header.size = msg.size();
+			client->Send(msg);
+			nOffset += nRead;
+		}
+
+		Message done;
+		done.header.id = CustomMsgTypes::Done;
+		client->Send(done);
+	}
+};
+
+
+// 一个服务器和一个已经连接上的客户端，两端使用同一种帧格式
+struct Session
+{
+	FileServer server;
+	olc::net::client_interface<CustomMsgTypes> client;
+	std::atomic<bool> bStop { false };
+	std::thread thread;
+
+	explicit Session(olc::net::framing eFraming)
+	{
+		this->server.SetFraming(eFraming);
+		this->server.Start();
+		this->thread = std::thread([this]()
+			{
+				while (!this->bStop)
+				{
+					this->server.Update();
+					std::this_thread::yield();
+				}
+			});
+
+		this->client.SetFraming(eFraming);
+		this->client.Connect("127.0.0.1", this->server.Port());
+		while (this->client.IsConnected() && this->client.Incoming().empty())
+			std::this_thread::yield();
+		if (!this->client.Incoming().empty())
+			this->client.Incoming().pop_front();
+	}
+
+	~Session()
+	{
+		this->client.Disconnect();
+		this->bStop = true;
+		this->thread.join();
+	}
+};
+
+
+struct transfer
+{
+	bool bOk = false;
+	uint64_t nFirstOffset = 0;	// 收到的第一块的偏移，续传的时候必须是请求的偏移
+	size_t nChunks = 0;
+	double dSeconds = 0;
+};
+
+/*
+请求从 sink.Size() 开始传输 sPath，收到的文件块写入 sink，直到 Done 为止。
+格式不对的文件块、写入失败、服务器报告的错误和连接断开都算失败
+*/
+transfer Receive(Session &s, olc::net::file_sink &sink, const std::string &sPath, bool bSendFile)
+{
+	transfer result;
+	s.server.bFailed = false;
+
+	Message request;
+	request.header.id = CustomMsgTypes::Request;
+	request.body.assign(sPath.begin(), sPath.end());
+	request.header.size = request.size();
+	request << sink.Size() << uint8_t(bSendFile ? 1 : 0);
+
+	bool bOk = true;
+	auto tStart = std::chrono::steady_clock::now();
+	s.client.Send(request);
+	while (true)
+	{
+		if (s.client.Incoming().empty())
+		{
+			if (!s.client.IsConnected() || std::chrono::steady_clock::now() - tStart > std::chrono::seconds(60))
+				return result;
+			std::this_thread::yield();
+			continue;
+		}
+
+		Message msg = s.client.Incoming().pop_front().msg;
+		if (msg.header.id == CustomMsgTypes::Done)
+			break;
+		if (msg.header.id != CustomMsgTypes::FileChunk)
+			continue;
+
+		uint64_t nOffset = 0;
+		const uint8_t *pData = nullptr;
+		size_t nLength = 0;
+		if (olc::net::read_file_chunk(msg, nOffset, pData, nLength) && result.nChunks++ == 0)
+			result.nFirstOffset = nOffset;
+		bOk = sink.Write(msg) >= 0 && bOk;
+	}
+	result.dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	result.bOk = bOk && !s.server.bFailed;
+	return result;
+}
+
+bool SameContents(const std::string &sA, const std::string &sB)
+{
+	std::ifstream a(sA, std::ios::binary), b(sB, std::ios::binary);
+	std::vector<char> vA((std::istreambuf_iterator<char>(a)), std::istreambuf_iterator<char>());
+	std::vector<char> vB((std::istreambuf_iterator<char>(b)), std::istreambuf_iterator<char>());
+	return vA == vB;
+}
+
+// 目标文件的开头写入源文件的前 nPrefix 个字节，模拟上一次传输中断在这里
+void WritePrefix(const std::string &sTarget, uint64_t nPrefix)
+{
+	std::ifstream in(sSource, std::ios::binary);
+	std::vector<char> vData(nPrefix);
+	in.read(vData.data(), static_cast<std::streamsize>(nPrefix));
+	std::ofstream out(sTarget, std::ios::binary | std::ios::trunc);
+	out.write(vData.data(), static_cast<std::streamsize>(nPrefix));
+}
+
+// 一种帧格式下的全部检查，结果写入 vResults
+bool Run(const char *szName, olc::net::framing eFraming, const std::string &sTarget, std::vector<std::string> &vResults)
+{
+	Session s(eFraming);
+	bool bAllOk = true;
+	auto fnReport = [&](const std::string &sCase, bool bOk, const transfer &t, bool bThroughput)
+	{
+		std::ostringstream os;
+		os << szName << "\t" << sCase << "\t" << (bOk ? "ok" : "FAILED");
+		if (bThroughput && bOk)
+			os << "\t" << (nFileSize / (1024.0 * 1024.0)) / t.dSeconds << " MB/s";
+		vResults.push_back(os.str());
+		bAllOk = bAllOk && bOk;
+	};
+
+	for (bool bSendFile : { true, false })
+	{
+		std::remove(sTarget.c_str());
+		olc::net::file_sink sink;
+		bool bOpened = sink.Open(sTarget);
+		transfer t = Receive(s, sink, sSource, bSendFile);
+		sink.Close();
+		bool bOk = bOpened && t.bOk && t.nFirstOffset == 0 && sink.Size() == nFileSize && SameContents(sSource, sTarget);
+		fnReport(bSendFile ? "sendfile" : "message ", bOk, t, true);
+	}
+
+	// 续传：已经有 nResumeAt 个字节，只请求剩下的部分
+	{
+		WritePrefix(sTarget, nResumeAt);
+		olc::net::file_sink sink;
+		bool bOpened = sink.Open(sTarget) && sink.Size() == nResumeAt;
+		transfer t = Receive(s, sink, sSource, true);
+		sink.Close();
+		bool bOk = bOpened && t.bOk && t.nFirstOffset == nResumeAt && sink.Size() == nFileSize && SameContents(sSource, sTarget);
+		fnReport("resume  ", bOk, t, false);
+	}
+
+	// 长度为 0 的文件也会发送一个空的块
+	{
+		std::remove(sTarget.c_str());
+		olc::net::file_sink sink;
+		bool bOpened = sink.Open(sTarget);
+		transfer t = Receive(s, sink, sEmpty, true);
+		sink.Close();
+		bool bOk = bOpened && t.bOk && t.nChunks == 1 && sink.Size() == 0 && SameContents(sEmpty, sTarget);
+		fnReport("empty   ", bOk, t, false);
+	}
+
+	std::remove(sTarget.c_str());
+	return bAllOk;
+}
+
+
+int main(int argc, char *argv[])
+{
+	std::string sPrefix = "/tmp/olc_file_bench_" + std::to_string(::getpid());
+	sSource = sPrefix + ".src";
+	sEmpty = sPrefix + ".empty";
+	{
+		std::mt19937 rng(12345);
+		std::vector<char> vData(nFileSize);
+		for (char &c : vData)
+			c = static_cast<char>(rng());
+		std::ofstream(sSource, std::ios::binary).write(vData.data(), static_cast<std::streamsize>(vData.size()));
+		std::ofstream(sEmpty, std::ios::binary);
+	}
+
+	// 服务器和客户端会打印连接的日志，结果先保存起来，最后一起输出
+	std::ofstream null("/dev/null");
+	std::streambuf *pOut = std::cout.rdbuf(null.rdbuf());
+
+	std::vector<std::string> vResults;
+	bool bOk = Run("standard", olc::net::framing::standard, sPrefix + ".standard", vResults);
+	bOk = Run("compact ", olc::net::framing::compact, sPrefix + ".compact", vResults) && bOk;
+
+	std::cout.rdbuf(pOut);
+	std::remove(sSource.c_str());
+	std::remove(sEmpty.c_str());
+
+	std::cout << "framing\t\tcase\t\tresult\tthroughput (" << nFileSize / (1024 * 1024) << " MB)\n";
+	for (auto &s : vResults)
+		std::cout << s << '\n';
+	return bOk ? 0 : 1;
+}
@@ -0,0 +1,458 @@
+#include <iostream>
+#include <fstream>
+#include <atomic>
+#include "net_server.h"
+#include "net_client.h"
+
+
+enum class CustomMsgTypes : uint32_t
+{
+	Small,
+	Large,
+	Ping,
+};
+
+using Header = olc::net::message_header<CustomMsgTypes>;
+using Message = olc::net::message<CustomMsgTypes>;
+
+
+/*
+大报文的分片 (connection<T>::SetFragmentSize) 的检查：
+	顺序		服务器一次排入两个大报文和一串小报文，客户端用普通的 socket 读出线路上的每一帧：
+				每个小报文之前最多有一个分片，两个大报文的分片轮流发送，小报文之间保持顺序
+	拼接		几个大报文和小报文交错发送，两种帧格式下客户端收到的大报文逐字节和发送的一致
+	拒绝		用普通的 socket 向服务器发送构造的分片：长度超过报头中的总长度、同一个分片流中总长度前后不一致、
+				分片中嵌套分片，服务器必须关闭连接并且不交出报文；长度正确的一组分片必须交出完整的报文
+另外测量 32 MB 的报文之后发出的小报文的往返时间，分片和不分片对比。
+任何一项检查失败的时候返回 1
+*/
+
+constexpr size_t nFragmentSize = 16 * 1024;
+
+
+// 第 n 个大报文的内容
+Message MakeLarge(size_t n, size_t nBody)
+{
+	Message msg;
+	msg.header.id = CustomMsgTypes::Large;
+	msg.body.resize(nBody);
+	for (size_t i = 0; i < nBody; ++i)
+		msg.body[i] = static_cast<uint8_t>(n * 131 + i * 7 + (i >> 12));
+	msg.header.size = msg.size();
+	return msg;
+}
+
+Message MakeSmall(uint32_t nIndex)
+{
+	Message msg;
+	msg.header.id = CustomMsgTypes::Small;
+	msg << nIndex;
+	return msg;
+}
+
+
+class FragmentServer : public olc::net::server_interface<CustomMsgTypes>
+{
+public:
+	FragmentServer() : olc::net::server_interface<CustomMsgTypes>(uint16_t(0))
+	{
+
+	}
+
+	uint16_t Port()
+	{
+		asio::ip::tcp::endpoint endpoint;
+		olc::net::detail::to_tcp_endpoint(this->m_asioAcceptor.local_endpoint(), endpoint);
+		return endpoint.port();
+	}
+
+	// 在 I/O 线程中一次排入所有的报文，第一个报文开始写入之前其余的都已经在发送队列中
+	void SendBatch(std::vector<Message> vMessages)
+	{
+		auto pClient = std::atomic_load(&this->pClient);
+		asio::post(this->m_asioContext, [pClient, vMessages = std::move(vMessages)]()
+			{
+				for (const Message &msg : vMessages)
+					pClient->Send(msg);
+			});
+	}
+
+	std::shared_ptr<olc::net::connection<CustomMsgTypes> > pClient;
+	Message msgPingLarge;	// 收到 Ping 的时候先发回这个大报文
+	std::mutex muxReceived;
+	std::vector<Message> vReceived;
+
+protected:
+	bool OnClientConnect(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client) override
+	{
+		std::atomic_store(&this->pClient, client);
+		return true;
+	}
+
+	void OnMessage(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client, Message &msg) override
+	{
+		if (msg.header.id == CustomMsgTypes::Ping)
+		{
+			client->Send(this->msgPingLarge);
+			client->Send(msg);
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(this->muxReceived);
+		this->vReceived.push_back(msg);
+	}
+};
+
+
+// 服务器的 Update 在单独的线程中执行
+struct Session
+{
+	FragmentServer server;
+	std::atomic<bool> bStop { false };
+	std::thread thread;
+
+	Session(olc::net::framing eFraming, size_t nFragment)
+	{
+		this->server.SetFraming(eFraming);
+		this->server.SetFragmentSize(nFragment);
+		this->server.Start();
+		this->thread = std::thread([this]()
+			{
+				while (!this->bStop)
+				{
+					this->server.Update();
+					std::this_thread::yield();
+				}
+			});
+	}
+
+	~Session()
+	{
+		this->bStop = true;
+		this->thread.join();
+	}
+
+	std::shared_ptr<olc::net::connection<CustomMsgTypes> > WaitClient()
+	{
+		std::shared_ptr<olc::net::connection<CustomMsgTypes> > pClient;
+		while (!(pClient = std::atomic_load(&this->server.pClient)))
+			std::this_thread::yield();
+		return pClient;
+	}
+};
+
+
+// 线路上的一帧 (标准帧格式)
+struct frame
+{
+	Header header;
+	std::vector<uint8_t> vBody;
+
+	bool Fragment() const
+	{
+		return (this->header.size & olc::net::frame_flags::fragment) != 0;
+	}
+
+	uint32_t Stream() const
+	{
+		uint32_t nStream = 0;
+		olc::net::detail::load_scalar(this->vBody.data(), nStream);
+		return nStream;
+	}
+};
+
+frame ReadFrame(asio::ip::tcp::socket &socket)
+{
+	frame f;
+	asio::read(socket, asio::buffer(&f.header, sizeof(f.header)));
+	f.vBody.resize(f.header.size & olc::net::frame_flags::size_mask);
+	asio::read(socket, asio::buffer(f.vBody));
+	return f;
+}
+
+bool CheckOrder(std::string &sOrder)
+{
+	constexpr size_t nLarge = 4 * nFragmentSize;
+	constexpr uint32_t nSmall = 8;
+
+	Session s(olc::net::framing::standard, nFragmentSize);
+	asio::io_context context;
+	asio::ip::tcp::socket socket(context);
+	socket.connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), s.server.Port()));
+	s.WaitClient();
+
+	std::vector<Message> vMessages = { MakeLarge(1, nLarge), MakeLarge(2, nLarge) };
+	for (uint32_t i = 0; i < nSmall; ++i)
+		vMessages.push_back(MakeSmall(i));
+	s.server.SendBatch(std::move(vMessages));
+
+	// 两个大报文各 4 个分片
+	std::vector<frame> vFrames;
+	for (size_t i = 0; i < nSmall + 8; ++i)
+		vFrames.push_back(ReadFrame(socket));
+
+	bool bOk = true;
+	size_t nFragmentsBefore = 0;
+	uint32_t nNextSmall = 0;
+	int nLastStream = -1;
+	size_t aFragments[2] = { 0, 0 };
+	for (const frame &f : vFrames)
+	{
+		if (f.Fragment())
+		{
+			uint32_t nStream = f.Stream();
+			sOrder += "F" + std::to_string(nStream) + " ";
+
+			// 第二个大报文在第一个分片写完之后才进入分片队列，之后两个流都还有分片的时候轮流发送
+			if (nStream > 1 || (int(nStream) == nLastStream && aFragments[1 - nStream] > 0 && aFragments[1 - nStream] < 4))
+				bOk = false;
+			aFragments[nStream & 1]++;
+			nLastStream = int(nStream);
+
+			// 还有小报文在等待的时候，它前面最多有一个分片
+			if (nNextSmall < nSmall && ++nFragmentsBefore > 1)
+				bOk = false;
+		}
+		else
+		{
+			uint32_t nIndex = 0;
+			olc::net::detail::load_scalar(f.vBody.data(), nIndex);
+			sOrder += "S" + std::to_string(nIndex) + " ";
+			bOk = bOk && nIndex == nNextSmall;
+			nNextSmall++;
+			nFragmentsBefore = 0;
+		}
+	}
+	return bOk && aFragments[0] == 4 && aFragments[1] == 4;
+}
+
+// 大报文和小报文交错发送，客户端收到的大报文逐字节一致，小报文之间保持顺序
+bool CheckReassembly(olc::net::framing eFraming)
+{
+	const size_t aLarge[] = { 100000, 37 * 1024 + 1, 5 * nFragmentSize, nFragmentSize + 1, 300000 };
+
+	Session s(eFraming, nFragmentSize);
+	olc::net::client_interface<CustomMsgTypes> client;
+	client.SetFraming(eFraming);
+	client.Connect("127.0.0.1", s.server.Port());
+	s.WaitClient();
+
+	std::vector<Message> vMessages;
+	uint32_t nSmall = 0;
+	for (size_t i = 0; i < sizeof(aLarge) / sizeof(aLarge[0]); ++i)
+	{
+		vMessages.push_back(MakeLarge(i, aLarge[i]));
+		for (size_t k = 0; k <= i; ++k)
+			vMessages.push_back(MakeSmall(nSmall++));
+	}
+	size_t nTotal = vMessages.size();
+	s.server.SendBatch(std::move(vMessages));
+
+	bool bOk = true;
+	uint32_t nNextSmall = 0;
+	size_t aLargeSeen[sizeof(aLarge) / sizeof(aLarge[0])] = {};
+	auto tStart = std::chrono::steady_clock::now();
+	for (size_t nReceived = 0; nReceived < nTotal; )
+	{
+		if (client.Incoming().empty())
+		{
+			if (!client.IsConnected() || std::chrono::steady_clock::now() - tStart > std::chrono::seconds(10))
+				return false;
+			std::this_thread::yield();
+			continue;
+		}
+
+		Message msg = client.Incoming().pop_front().msg;
+		nReceived++;
+		if (msg.header.id == CustomMsgTypes::Small)
+		{
+			uint32_t nIndex = 0;
+			msg >> nIndex;
+			bOk = bOk && nIndex == nNextSmall++;
+			continue;
+		}
+
+		// 按长度和内容找到它是第几个大报文
+		bool bMatched = false;
+		for (size_t i = 0; i < sizeof(aLarge) / sizeof(aLarge[0]); ++i)
+		{
+			if (msg.body.size() == aLarge[i] && msg.body == MakeLarge(i, aLarge[i]).body)
+			{
+				aLargeSeen[i]++;
+				bMatched = true;
+			}
+		}
+		bOk = bOk && bMatched;
+	}
+
+	for (size_t n : aLargeSeen)
+		bOk = bOk && n == 1;
+	client.Disconnect();
+	return bOk && nNextSmall == nSmall;
+}
+
+
+// 一个分片帧：报头 | 分片流的编号 | 原来的 size | 数据 (见 connection<T>::PrepareFragment)
+std::vector<uint8_t> MakeFragment(uint32_t nStream, uint32_t nSize, size_t nData)
+{
+	Header header;
+	header.id = CustomMsgTypes::Large;
+	header.size = static_cast<uint32_t>(2 * sizeof(uint32_t) + nData) | olc::net::frame_flags::fragment;
+
+	std::vector<uint8_t> vFrame(sizeof(header) + 2 * sizeof(uint32_t) + nData, 0x33);
+	std::memcpy(vFrame.data(), &header, sizeof(header));
+	olc::net::detail::store_scalar(vFrame.data() + sizeof(header), nStream);
+	olc::net::detail::store_scalar(vFrame.data() + sizeof(header) + sizeof(uint32_t), nSize);
+	return vFrame;
+}
+
+// 只有 4 个字节、装不下分片流的编号和总长度的分片
+std::vector<uint8_t> MakeShortFragment()
+{
+	Header header;
+	header.id = CustomMsgTypes::Large;
+	header.size = static_cast<uint32_t>(sizeof(uint32_t)) | olc::net::frame_flags::fragment;
+
+	std::vector<uint8_t> vFrame(sizeof(header) + sizeof(uint32_t), 0);
+	std::memcpy(vFrame.data(), &header, sizeof(header));
+	return vFrame;
+}
+
+struct forged
+{
+	const char *szName;
+	std::vector<std::vector<uint8_t> > vFrames;
+	bool bValid;
+};
+
+// 发送构造的分片，之后服务器应该关闭连接 (bValid 为 false) 或者交出一个 1000 字节的报文 (bValid 为 true)
+bool CheckForged(const forged &test)
+{
+	Session s(olc::net::framing::standard, 0);
+	asio::io_context context;
+	asio::ip::tcp::socket socket(context);
+	socket.connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), s.server.Port()));
+	s.WaitClient();
+
+	for (const auto &vFrame : test.vFrames)
+		asio::write(socket, asio::buffer(vFrame));
+
+	// 对方关闭的时候读出 eof；合法的分片之后连接保持，等到报文交出为止
+	bool bClosed = false;
+	auto tStart = std::chrono::steady_clock::now();
+	while (std::chrono::steady_clock::now() - tStart < std::chrono::seconds(2))
+	{
+		asio::error_code ec;
+		socket.non_blocking(true);
+		uint8_t nByte;
+		socket.read_some(asio::buffer(&nByte, 1), ec);
+		if (ec && ec != asio::error::would_block)
+		{
+			bClosed = true;
+			break;
+		}
+
+		std::lock_guard<std::mutex> lock(s.server.muxReceived);
+		if (test.bValid && !s.server.vReceived.empty())
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	std::lock_guard<std::mutex> lock(s.server.muxReceived);
+	if (!test.bValid)
+		return bClosed && s.server.vReceived.empty();
+	return !bClosed && s.server.vReceived.size() == 1 && s.server.vReceived[0].body == std::vector<uint8_t>(1000, 0x33);
+}
+
+bool CheckRejection(std::vector<std::string> &vResults)
+{
+	const std::vector<forged> vTests =
+	{
+		{ "600 + 400 of 1000 bytes (valid)", { MakeFragment(7, 1000, 600), MakeFragment(7, 1000, 400) }, true },
+		{ "600 + 600 of 1000 bytes", { MakeFragment(7, 1000, 600), MakeFragment(7, 1000, 600) }, false },
+		{ "1001 of 1000 bytes", { MakeFragment(7, 1000, 1001) }, false },
+		{ "total 1000, then 2000", { MakeFragment(7, 1000, 600), MakeFragment(7, 2000, 400) }, false },
+		{ "nested fragment flag", { MakeFragment(7, 1000 | olc::net::frame_flags::fragment, 600) }, false },
+		{ "shorter than the prefix", { MakeShortFragment() }, false },
+	};
+
+	bool bOk = true;
+	for (const forged &test : vTests)
+	{
+		bool bPassed = CheckForged(test);
+		vResults.push_back(std::string("reject\t") + test.szName + ": " + (bPassed ? "ok" : "FAILED"));
+		bOk = bOk && bPassed;
+	}
+	return bOk;
+}
+
+
+// 服务器收到 Ping 之后先发回 32 MB 的报文再发回 Ping，返回 Ping 的平均往返时间 (毫秒)
+double PingBehindLarge(size_t nFragment)
+{
+	constexpr size_t nRounds = 5;
+
+	Session s(olc::net::framing::standard, nFragment);
+	s.server.msgPingLarge = MakeLarge(0, 32 * 1024 * 1024);
+	olc::net::client_interface<CustomMsgTypes> client;
+	client.Connect("127.0.0.1", s.server.Port());
+	s.WaitClient();
+
+	double dTotal = 0;
+	for (size_t i = 0; i < nRounds; ++i)
+	{
+		Message ping;
+		ping.header.id = CustomMsgTypes::Ping;
+		auto tStart = std::chrono::steady_clock::now();
+		client.Send(ping);
+
+		// 大报文和 Ping 都收到之后才开始下一轮
+		bool bPing = false, bLarge = false;
+		while (!bPing || !bLarge)
+		{
+			if (client.Incoming().empty())
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			if (client.Incoming().pop_front().msg.header.id == CustomMsgTypes::Ping)
+			{
+				dTotal += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+				bPing = true;
+			}
+			else
+				bLarge = true;
+		}
+	}
+	client.Disconnect();
+	return dTotal / nRounds;
+}
+
+
+int main(int argc, char *argv[])
+{
+	// 服务器和客户端会打印连接的日志，结果先保存起来，最后一起输出
+	std::ofstream null("/dev/null");
+	std::streambuf *pOut = std::cout.rdbuf(null.rdbuf());
+
+	std::vector<std::string> vResults;
+	std::string sOrder;
+	bool bOrder = CheckOrder(sOrder);
+	vResults.push_back("order\t" + sOrder + ": " + (bOrder ? "ok" : "FAILED"));
+
+	bool bStandard = CheckReassembly(olc::net::framing::standard);
+	bool bCompact = CheckReassembly(olc::net::framing::compact);
+	vResults.push_back(std::string("reassembly\tstandard: ") + (bStandard ? "ok" : "FAILED"));
+	vResults.push_back(std::string("reassembly\tcompact: ") + (bCompact ? "ok" : "FAILED"));
+
+	bool bReject = CheckRejection(vResults);
+
+	double dWhole = PingBehindLarge(0);
+	double dFragmented = PingBehindLarge(64 * 1024);
+
+	std::cout.rdbuf(pOut);
+	for (auto &s : vResults)
+		std::cout << s << '\n';
+	std::cout << "ping behind a 32 MB message (ms)\tunfragmented " << dWhole << "\tfragments of 64 KB " << dFragmented << '\n';
+	return bOrder && bStandard && bCompact && bReject ? 0 : 1;
+}
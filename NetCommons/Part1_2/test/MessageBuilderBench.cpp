@@ -0,0 +1,70 @@
+#include <iostream>
+#include "net_message.h"
+#include "net_common.h"
+
+
+enum class CustomMsgTypes : uint32_t
+{
+	FireBullet,
+	MovePlayer
+};
+
+struct vec3
+{
+	float x, y, z;
+};
+
+// 对比 operator << 链式调用和 message_builder 构建一个 20 个字段的报文的耗时
+constexpr int nIterations = 1000000;
+
+
+template <typename Func>
+void RunBench(const char *name, Func func)
+{
+	uint64_t nChecksum = 0;
+	auto tStart = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < nIterations; ++i)
+	{
+		olc::net::message<CustomMsgTypes> msg;
+		msg.header.id = CustomMsgTypes::MovePlayer;
+		func(msg, i);
+		nChecksum += msg.header.size + msg.body[msg.body.size() - 1];
+	}
+
+	auto tEnd = std::chrono::steady_clock::now();
+	double ns = std::chrono::duration<double, std::nano>(tEnd - tStart).count() / nIterations;
+	std::cout << name << ": " << ns << " ns/msg  (checksum " << nChecksum << ")\n";
+}
+
+
+int main(int argc, char *argv[]) 
+{
+	int a = 1;
+	float b = 2.0f;
+	uint8_t c = 3;
+	uint16_t d = 4;
+	vec3 e { 1.0f, 2.0f, 3.0f };
+
+	RunBench("operator <<         ", [&](olc::net::message<CustomMsgTypes> &msg, int i)
+	{
+		msg << a << b << c << d << e << a << b << c << d << e 
+			<< a << b << c << d << e << a << b << c << d << i;
+	});
+
+	RunBench("builder.push        ", [&](olc::net::message<CustomMsgTypes> &msg, int i)
+	{
+		olc::net::message_builder<CustomMsgTypes> builder(msg);
+		builder.push(a, b, c, d, e, a, b, c, d, e, 
+			a, b, c, d, e, a, b, c, d, i);
+	});
+
+	RunBench("builder reserve + <<", [&](olc::net::message<CustomMsgTypes> &msg, int i)
+	{
+		olc::net::message_builder<CustomMsgTypes> builder(msg, 128);
+		builder << a << b << c << d << e << a << b << c << d << e 
+			<< a << b << c << d << e << a << b << c << d << i;
+	});
+
+	return  0;
+}
@@ -0,0 +1,118 @@
+#include <iostream>
+#include <random>
+#include "net_replication.h"
+
+
+enum class CustomMsgTypes : uint32_t
+{
+	Snapshot,
+};
+
+// 每个实体 8 个字段：位置 xyz，朝向，血量，动画，状态标志，武器
+constexpr size_t nFields = 8;
+constexpr size_t nEntities = 1000;
+constexpr int nTicks = 600;
+// 客户端确认需要经过几帧才能到达服务器
+constexpr int nAckDelay = 3;
+
+
+// 客户端解码出来的最新一帧必须和服务器当前的状态完全一致
+bool SameState(const olc::net::snapshot_table<nFields> &server, const olc::net::snapshot_table<nFields> *pClient)
+{
+	if (pClient == nullptr || pClient->size() != server.size())
+		return false;
+
+	for (size_t f = 0; f < nFields; ++f)
+	{
+		if (!std::equal(server.field(f), server.field(f) + server.size(), pClient->field(f)))
+			return false;
+	}
+	return true;
+}
+
+
+int main(int argc, char *argv[]) 
+{
+	std::mt19937 rng(2021);
+	olc::net::replication_server<CustomMsgTypes, nFields> server(nEntities);
+	olc::net::replication_client<CustomMsgTypes, nFields> client(nEntities);
+
+	for (size_t e = 0; e < nEntities; ++e)
+		for (size_t f = 0; f < nFields; ++f)
+			server.Current().set(e, f, rng());
+
+	size_t nFullBytes = 0;
+	size_t nDeltaBytes = 0;
+	std::deque<uint32_t> qAcks;
+	int nBadTicks = 0;
+
+	for (int t = 0; t < nTicks; ++t)
+	{
+		// 每一帧大约 10% 的实体在移动，1% 的实体其它状态发生了变化
+		for (size_t e = 0; e < nEntities; ++e)
+		{
+			if (rng() % 10 == 0)
+			{
+				server.Current().set_float(e, 0, server.Current().get_float(e, 0) + 0.1f);
+				server.Current().set_float(e, 1, server.Current().get_float(e, 1) + 0.1f);
+				server.Current().set_float(e, 3, static_cast<float>(rng() % 360));
+			}
+			if (rng() % 100 == 0)
+				server.Current().set(e, 4 + rng() % 4, rng());
+		}
+		server.Tick();
+
+		// 原来的做法：每一帧发送所有实体的完整状态
+		olc::net::message<CustomMsgTypes> full;
+		full.header.id = CustomMsgTypes::Snapshot;
+		for (size_t e = 0; e < nEntities; ++e)
+			for (size_t f = 0; f < nFields; ++f)
+				full << server.Current().get(e, f);
+		nFullBytes += sizeof(full.header) + full.size();
+
+		olc::net::message<CustomMsgTypes> delta;
+		delta.header.id = CustomMsgTypes::Snapshot;
+		server.Encode(1, delta);
+		nDeltaBytes += sizeof(delta.header) + delta.size();
+
+		uint32_t nApplied = client.Apply(delta);
+		if (!SameState(server.Current(), client.Latest()) || nApplied == 0)
+			nBadTicks++;
+
+		qAcks.push_back(nApplied);
+		if (qAcks.size() > nAckDelay)
+		{
+			server.Acknowledge(1, qAcks.front());
+			qAcks.pop_front();
+		}
+	}
+
+	std::cout << "full snapshot : " << nFullBytes / nTicks << " bytes/tick\n";
+	std::cout << "delta snapshot: " << nDeltaBytes / nTicks << " bytes/tick\n";
+
+	if (nBadTicks > 0)
+	{
+		std::cout << "client state differs from server in " << nBadTicks << " of " << nTicks << " ticks\n";
+		return 1;
+	}
+
+	std::cout << "client state matches server in all " << nTicks << " ticks\n";
+
+	// 实体数量超过上限的快照 (tick = 1, baseline = 0, 2^34 个实体) 必须被拒绝，而不是按照这个数量分配内存
+	olc::net::message<CustomMsgTypes> bogus;
+	{
+		olc::net::message_bit_writer<CustomMsgTypes> writer(bogus);
+		writer.write_varint(1);
+		writer.write_varint(0);
+		writer.write_varint(uint64_t(1) << 34);
+		writer.finish();
+	}
+	if (client.Apply(bogus) != 0)
+	{
+		std::cout << "oversized entity count accepted\n";
+		return 1;
+	}
+
+	std::cout << "oversized entity count rejected\n";
+	return  0;
+}
@@ -0,0 +1,184 @@
+#include <iostream>
+#include <fstream>
+#include <atomic>
+#include "net_server.h"
+#include "net_client.h"
+
+
+enum class CustomMsgTypes : uint32_t
+{
+	Echo,
+	Data,
+	Done,
+};
+
+using Message = olc::net::message<CustomMsgTypes>;
+
+/*
+同一个连接上同时等待回复的请求数 (窗口) 对 RPC 吞吐量的影响。窗口为 1 就是 SimpleClient 原来的 ping：
+发出一个请求，等到回复再发下一个，吞吐量受往返时间限制。窗口变大之后请求连续地发出去 (pipelining)，
+stream 一行是同样大小的报文单向连续发送的吞吐量，作为线路能够达到的上限
+*/
+
+// 回显服务器：Echo 请求原样回复；收到 nExpected 个 Data 之后发回一个 Done
+class EchoServer : public olc::net::server_interface<CustomMsgTypes>
+{
+public:
+	EchoServer() : olc::net::server_interface<CustomMsgTypes>(uint16_t(0))
+	{
+
+	}
+
+	uint16_t Port()
+	{
+		asio::ip::tcp::endpoint endpoint;
+		olc::net::detail::to_tcp_endpoint(this->m_asioAcceptor.local_endpoint(), endpoint);
+		return endpoint.port();
+	}
+
+	size_t nExpected = 0;
+
+protected:
+	bool OnClientConnect(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client) override
+	{
+		return true;
+	}
+
+	void OnRequest(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client, uint32_t nCall, Message &request) override
+	{
+		client->Respond(nCall, request);
+	}
+
+	void OnMessage(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client, Message &msg) override
+	{
+		if (++this->m_nReceived == this->nExpected)
+		{
+			this->m_nReceived = 0;
+			Message done;
+			done.header.id = CustomMsgTypes::Done;
+			client->Send(done);
+		}
+	}
+
+private:
+	size_t m_nReceived = 0;
+};
+
+
+// 窗口为 nWindow 的时候 nCalls 次调用的耗时 (秒)，回复出错的时候返回负数
+double RunCalls(olc::net::client_interface<CustomMsgTypes> &client, size_t nCalls, size_t nWindow, const Message &msg)
+{
+	std::atomic<size_t> nDone { 0 };
+	std::atomic<bool> bFailed { false };
+
+	auto tStart = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < nCalls; ++i)
+	{
+		while (i - nDone >= nWindow)
+			std::this_thread::yield();
+
+		client.Call(msg, std::chrono::seconds(10),
+			[&](std::error_code ec, Message &reply)
+			{
+				if (ec || reply.body.size() != msg.body.size())
+					bFailed = true;
+				nDone++;
+			});
+	}
+
+	while (nDone < nCalls)
+		std::this_thread::yield();
+
+	double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	return bFailed ? -1.0 : dSeconds;
+}
+
+// 单向连续发送 nMessages 个报文，等到服务器确认全部收到的耗时 (秒)
+double RunStream(EchoServer &server, olc::net::client_interface<CustomMsgTypes> &client, size_t nMessages, Message msg)
+{
+	msg.header.id = CustomMsgTypes::Data;
+	server.nExpected = nMessages;
+
+	auto tStart = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < nMessages; ++i)
+		client.Send(msg);
+
+	while (client.Incoming().empty())
+		std::this_thread::yield();
+	client.Incoming().pop_front();
+
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+}
+
+std::string Format(size_t nCalls, size_t nBody, double dSeconds)
+{
+	if (dSeconds < 0)
+		return "failed";
+
+	// MB/s 只计算一个方向上的 body，RPC 的回复在另一个方向上传输同样多的数据
+	std::ostringstream os;
+	os << size_t(nCalls / dSeconds) << "\t\t" << double(nCalls) * nBody / dSeconds / (1024 * 1024);
+	return os.str();
+}
+
+
+// 每一种 body 大小和窗口的一行结果
+std::vector<std::string> RunAll()
+{
+	EchoServer server;
+	uint16_t nPort = server.Port();
+	server.Start();
+
+	std::atomic<bool> bStop { false };
+	std::thread thread([&]()
+		{
+			while (!bStop)
+			{
+				server.Update();
+				std::this_thread::yield();
+			}
+		});
+
+	olc::net::client_interface<CustomMsgTypes> client;
+	client.Connect("127.0.0.1", nPort);
+	while (!client.IsConnected())
+		std::this_thread::yield();
+
+	std::vector<std::string> vResults;
+	for (size_t nBody : { 64, 16 * 1024 })
+	{
+		Message msg;
+		msg.header.id = CustomMsgTypes::Echo;
+		msg.body.resize(nBody, 0x5a);
+		msg.header.size = msg.size();
+
+		size_t nCalls = nBody < 1024 ? 200000 : 20000;
+		for (size_t nWindow : { 1, 16, 256 })
+		{
+			vResults.push_back(std::to_string(nBody) + "\twindow " + std::to_string(nWindow) + "\t" +
+				Format(nCalls, nBody, RunCalls(client, nCalls, nWindow, msg)));
+		}
+		vResults.push_back(std::to_string(nBody) + "\tstream\t\t" + Format(nCalls, nBody, RunStream(server, client, nCalls, msg)));
+	}
+
+	client.Disconnect();
+	bStop = true;
+	thread.join();
+	return vResults;
+}
+
+
+int main(int argc, char *argv[])
+{
+	// 服务器每接受一个连接都会打印日志，测量的时候丢弃
+	std::ofstream null("/dev/null");
+	std::streambuf *pOut = std::cout.rdbuf(null.rdbuf());
+
+	std::vector<std::string> vResults = RunAll();
+
+	std::cout.rdbuf(pOut);
+	std::cout << "body\tmode\t\tcalls/s\t\tMB/s (one way)\n";
+	for (auto &s : vResults)
+		std::cout << s << '\n';
+	return  0;
+}
@@ -0,0 +1,282 @@
+#include <iostream>
+#include <fstream>
+#include <sys/wait.h>
+#include "net_server.h"
+#include "net_client.h"
+
+
+enum class CustomMsgTypes : uint32_t
+{
+	ServerAccept,
+	Data,
+	Done,
+	Ping,
+	Echo,
+};
+
+using Message = olc::net::message<CustomMsgTypes>;
+
+
+/*
+共享内存连接 (net_shm.h) 的跨进程测试：服务器在这个进程中，客户端在 fork 出来的子进程中。
+	吞吐量和往返时间		和 UdsBench 的测量方式一样
+	回显					长度从 0 到接近环的一半的报文，带有序号和按序号生成的内容，环会回绕很多次，
+						客户端检查回来的报文完整、有序
+之后在本进程中检查：对方写坏了容量的共享内存不能被打开，对方写坏了环的位置之后服务器一端断开连接。
+任何一项检查失败的时候返回 1
+*/
+
+constexpr size_t nCapacity = 1024 * 1024;
+constexpr size_t nEchoMessages = 5000;
+
+// 第 i 个回显报文的长度和内容
+size_t EchoSize(size_t i)
+{
+	static const size_t aSizes[] = { 0, 1, 7, 100, 1000, 4096, 60000, 400000 };
+	return aSizes[i % (sizeof(aSizes) / sizeof(aSizes[0]))];
+}
+
+uint8_t EchoByte(size_t i, size_t nPos)
+{
+	return static_cast<uint8_t>(i * 31 + nPos);
+}
+
+
+class BenchServer : public olc::net::server_interface<CustomMsgTypes>
+{
+public:
+	BenchServer() : olc::net::server_interface<CustomMsgTypes>(uint16_t(0))
+	{
+
+	}
+
+protected:
+	bool OnClientConnect(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client) override
+	{
+		Message msg;
+		msg.header.id = CustomMsgTypes::ServerAccept;
+		client->Send(msg);
+		return true;
+	}
+
+	void OnMessage(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client, Message &msg) override
+	{
+		// 报文按顺序到达，Done 回到客户端的时候之前的 Data 都已经处理完了
+		if (msg.header.id != CustomMsgTypes::Data)
+			client->Send(msg);
+	}
+};
+
+
+class BenchClient : public olc::net::client_interface<CustomMsgTypes>
+{
+public:
+	Message Wait(CustomMsgTypes id)
+	{
+		while (true)
+		{
+			if (this->Incoming().empty())
+			{
+				if (!this->IsConnected())
+					return Message();
+				std::this_thread::yield();
+				continue;
+			}
+
+			Message msg = this->Incoming().pop_front().msg;
+			if (msg.header.id == id)
+				return msg;
+		}
+	}
+};
+
+
+double Throughput(BenchClient &client, size_t nMessages, size_t nBody)
+{
+	Message msg;
+	msg.header.id = CustomMsgTypes::Data;
+	msg.body.resize(nBody, 0x5a);
+	msg.header.size = msg.size();
+
+	auto tStart = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < nMessages; ++i)
+		client.Send(msg);
+	Message done;
+	done.header.id = CustomMsgTypes::Done;
+	client.Send(done);
+	client.Wait(CustomMsgTypes::Done);
+	auto tEnd = std::chrono::steady_clock::now();
+
+	return nMessages / std::chrono::duration<double>(tEnd - tStart).count();
+}
+
+double RoundTrip(BenchClient &client, size_t nRounds)
+{
+	Message msg;
+	msg.header.id = CustomMsgTypes::Ping;
+	msg << uint64_t(0);
+
+	auto tStart = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < nRounds; ++i)
+	{
+		client.Send(msg);
+		client.Wait(CustomMsgTypes::Ping);
+	}
+	auto tEnd = std::chrono::steady_clock::now();
+
+	return std::chrono::duration<double, std::micro>(tEnd - tStart).count() / nRounds;
+}
+
+// 一边发送一边接收，最多有 nWindow 个报文在路上；返回和发送的不一致的报文个数
+size_t EchoCheck(BenchClient &client, size_t nWindow)
+{
+	size_t nSent = 0;
+	size_t nBad = 0;
+	for (size_t i = 0; i < nEchoMessages; ++i)
+	{
+		while (nSent < nEchoMessages && nSent < i + nWindow)
+		{
+			Message msg;
+			msg.header.id = CustomMsgTypes::Echo;
+			msg.body.resize(EchoSize(nSent));
+			for (size_t p = 0; p < msg.body.size(); ++p)
+				msg.body[p] = EchoByte(nSent, p);
+			msg.header.size = msg.size();
+			client.Send(msg);
+			nSent++;
+		}
+
+		Message reply = client.Wait(CustomMsgTypes::Echo);
+		bool bOk = reply.header.id == CustomMsgTypes::Echo && reply.body.size() == EchoSize(i);
+		for (size_t p = 0; bOk && p < reply.body.size(); ++p)
+			bOk = reply.body[p] == EchoByte(i, p);
+		if (!bOk)
+		{
+			nBad++;
+			if (!client.IsConnected())
+				return nBad + nEchoMessages - i - 1;
+		}
+	}
+	return nBad;
+}
+
+// 子进程：客户端。结果写到标准输出，检查失败的时候返回 1
+int RunClient(const std::string &sName)
+{
+	BenchClient client;
+	auto tStart = std::chrono::steady_clock::now();
+	while (!client.ConnectShared(sName))
+	{
+		if (std::chrono::steady_clock::now() - tStart > std::chrono::seconds(5))
+			return 1;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	client.Wait(CustomMsgTypes::ServerAccept);
+
+	double dSmall = Throughput(client, 100000, 32);
+	double dLarge = Throughput(client, 10000, 4096);
+	double dRound = RoundTrip(client, 5000);
+	size_t nBad = EchoCheck(client, 1) + EchoCheck(client, 16);
+
+	std::cout << "transport\tmsg/s (32B)\tmsg/s (4KB)\tround trip (us)\n";
+	std::cout << "shm\t\t" << dSmall << "\t" << dLarge << "\t" << dRound << '\n';
+	std::cout << "echo (" << 2 * nEchoMessages << " messages, 0 ~ " << EchoSize(7) << " bytes): "
+		<< (nBad == 0 ? "ok" : "FAILED") << '\n';
+	std::cout.flush();
+
+	client.Disconnect();
+	return nBad == 0 ? 0 : 1;
+}
+
+// 对方把容量改成这些值之后，Open 必须拒绝这块共享内存
+bool CheckCapacityValidation(const std::string &sName)
+{
+	bool bOk = true;
+	for (uint32_t nBad : { 0u, 3000u, 4095u, 6144u, 1u << 31 })
+	{
+		auto pSegment = olc::net::shm_segment::Create(sName, nCapacity, sizeof(olc::net::message_header<CustomMsgTypes>));
+		pSegment->Header()->nCapacity = nBad;
+		try
+		{
+			olc::net::shm_segment::Open(sName, sizeof(olc::net::message_header<CustomMsgTypes>));
+			std::cout << "capacity " << nBad << " accepted\n";
+			bOk = false;
+		}
+		catch (std::exception &)
+		{
+
+		}
+	}
+	return bOk;
+}
+
+// 对方把环的写入位置改到超出容量的地方之后，服务器一端的连接必须断开
+bool CheckCorruptRing(const std::string &sName)
+{
+	BenchServer server;
+	server.Start();
+	if (!server.ListenShared(sName, nCapacity))
+		return false;
+
+	auto pPeer = olc::net::shm_segment::Open(sName, sizeof(olc::net::message_header<CustomMsgTypes>));
+	olc::net::shm_segment_header *pHeader = pPeer->Header();
+	pHeader->aRings[1].nHead.store(uint32_t(3 * nCapacity), std::memory_order_release);
+
+	auto tStart = std::chrono::steady_clock::now();
+	while (pHeader->nClosed.load() == 0)
+	{
+		if (std::chrono::steady_clock::now() - tStart > std::chrono::seconds(2))
+			return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return true;
+}
+
+
+int main(int argc, char *argv[])
+{
+	std::string sName = "/olc_shm_bench_" + std::to_string(::getpid());
+
+	// 先 fork，子进程中没有服务器的线程；服务器创建共享内存之前客户端会重试
+	pid_t pid = ::fork();
+	if (pid == 0)
+	{
+		// 连接的日志不输出，只保留测量的结果
+		std::ostringstream os;
+		std::streambuf *pOut = std::cout.rdbuf(os.rdbuf());
+		std::cerr.rdbuf(os.rdbuf());
+		int nResult = RunClient(sName);
+		std::cout.rdbuf(pOut);
+		std::string sOut = os.str();
+		size_t nPos = sOut.find("transport");
+		std::cout << (nPos == std::string::npos ? "client failed to connect\n" : sOut.substr(nPos));
+		std::cout.flush();
+		::_exit(nResult);
+	}
+
+	bool bOk = true;
+	{
+		std::ofstream null("/dev/null");
+		std::streambuf *pOut = std::cout.rdbuf(null.rdbuf());
+
+		BenchServer server;
+		server.Start();
+		bOk = server.ListenShared(sName, nCapacity);
+
+		// 子进程中的客户端结束之后服务器才停止
+		int nStatus = 0;
+		while (::waitpid(pid, &nStatus, WNOHANG) == 0)
+			server.Update(1000);
+		bOk = bOk && WIFEXITED(nStatus) && WEXITSTATUS(nStatus) == 0;
+
+		bool bCapacity = CheckCapacityValidation(sName + "_capacity");
+		bool bCorrupt = CheckCorruptRing(sName + "_corrupt");
+		std::cout.rdbuf(pOut);
+
+		std::cout << "invalid capacity rejected: " << (bCapacity ? "ok" : "FAILED") << '\n';
+		std::cout << "corrupt ring disconnects: " << (bCorrupt ? "ok" : "FAILED") << '\n';
+		bOk = bOk && bCapacity && bCorrupt;
+	}
+
+	return bOk ? 0 : 1;
+}
@@ -0,0 +1,343 @@
+#include <iostream>
+#include <fstream>
+#include <atomic>
+#include <random>
+#include "net_connection.h"
+#include "net_connection_coro.h"
+
+
+enum class CustomMsgTypes : uint32_t
+{
+	Data,
+	Upload,
+};
+
+using Header = olc::net::message_header<CustomMsgTypes>;
+using Message = olc::net::message<CustomMsgTypes>;
+using Connection = olc::net::connection<CustomMsgTypes>;
+
+
+/*
+流式接收 (connection<T>::SetStreamHandler，见 net_stream.h) 的检查。服务器一端是 Conn 类型的连接，
+对 Upload 设定了 stream_handler；客户端是普通的 socket，自己编码帧并按随机的长度分段写入，
+让 body 的边界落在接收缓冲区的任意位置：
+	完整的 body		几个长度不同的 Upload 和普通的报文交错发送，每个 sink 收到的数据和 body 完全一致，
+					Finish 各调用一次，普通的报文 (和 body 为空的 Upload) 仍然进入接收队列
+	中途断开		body 发送到一半的时候关闭 socket，sink 被释放，Finish 没有被调用
+	sink 出错		sink 的 Write 返回 false 之后连接被关闭，之后的报文不再进入接收队列
+两种帧格式，回调链和协程 (C++20) 两种连接实现。同时测量流式接收和整个接收 body 的吞吐量。
+任何一项检查失败的时候返回 1
+*/
+
+// 所有 sink 共享的记录，sink 在 I/O 线程中写入
+struct sink_record
+{
+	std::mutex mux;
+	std::vector<std::vector<uint8_t> > vFinished;
+	std::atomic<size_t> nWritten { 0 };
+	std::atomic<size_t> nFinish { 0 };
+	std::atomic<size_t> nDestroyed { 0 };
+	bool bFail = false;		// Write 返回 false
+	bool bKeep = true;		// 保存收到的数据，测量吞吐量的时候不保存
+};
+
+class record_sink : public olc::net::body_sink
+{
+public:
+	explicit record_sink(std::shared_ptr<sink_record> pRecord)
+		: m_pRecord(std::move(pRecord))
+	{
+
+	}
+
+	~record_sink()
+	{
+		this->m_pRecord->nDestroyed++;
+	}
+
+	bool Write(const uint8_t *pData, size_t nLength) override
+	{
+		this->m_pRecord->nWritten += nLength;
+		if (this->m_pRecord->bKeep)
+			this->m_vData.insert(this->m_vData.end(), pData, pData + nLength);
+		return !this->m_pRecord->bFail;
+	}
+
+	void Finish() override
+	{
+		std::lock_guard<std::mutex> lock(this->m_pRecord->mux);
+		this->m_pRecord->vFinished.push_back(std::move(this->m_vData));
+		this->m_pRecord->nFinish++;
+	}
+
+private:
+	std::shared_ptr<sink_record> m_pRecord;
+	std::vector<uint8_t> m_vData;
+};
+
+
+/*
+本机回环上的一个 Conn 类型的服务器连接和一个普通的 socket，所有的 I/O 都在一个 I/O 线程中完成。
+pRecord 为空的时候不设定 stream_handler，Upload 整个接收
+*/
+template <template <typename> class Conn>
+struct Session
+{
+	asio::io_context context;
+	olc::net::tsqueue<olc::net::owned_message<CustomMsgTypes> > qServerIn;
+	std::shared_ptr<Connection> pServer;
+	asio::ip::tcp::socket socket { context };
+	olc::net::framing eFraming;
+	std::thread thread;
+
+	Session(olc::net::framing eFraming, std::shared_ptr<sink_record> pRecord)
+		: eFraming(eFraming)
+	{
+		asio::ip::tcp::acceptor acceptor(this->context, asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+		std::atomic<bool> bAccepted { false };
+
+		acceptor.async_accept(
+			[&](std::error_code ec, asio::ip::tcp::socket socket)
+			{
+				this->pServer = std::make_shared<Conn<CustomMsgTypes> >(Connection::owner::server,
+					this->context, std::move(socket), this->qServerIn);
+				this->pServer->SetFraming(eFraming);
+				if (pRecord)
+				{
+					this->pServer->SetStreamHandler(CustomMsgTypes::Upload,
+						[pRecord](std::shared_ptr<Connection> pRemote, const Header &header)
+						{
+							return std::make_unique<record_sink>(pRecord);
+						});
+				}
+				this->pServer->ConnectToClient(1);
+				bAccepted = true;
+			}
+		);
+
+		this->socket.connect(acceptor.local_endpoint());
+		this->thread = std::thread([this]() { this->context.run(); });
+		while (!bAccepted)
+			std::this_thread::yield();
+	}
+
+	~Session()
+	{
+		asio::error_code ec;
+		this->socket.close(ec);
+		this->context.stop();
+		this->thread.join();
+		this->pServer.reset();
+	}
+
+	// 把报文按照连接的帧格式编码之后追加到 vWire
+	void Encode(const Message &msg, std::vector<uint8_t> &vWire)
+	{
+		uint8_t aHeader[std::max(olc::net::compact_header_max_size, sizeof(Header))];
+		size_t nHeader = sizeof(Header);
+		if (this->eFraming == olc::net::framing::compact)
+			nHeader = olc::net::encode_compact_header(aHeader, msg.header);
+		else
+			std::memcpy(aHeader, &msg.header, sizeof(Header));
+
+		vWire.insert(vWire.end(), aHeader, aHeader + nHeader);
+		vWire.insert(vWire.end(), msg.body.begin(), msg.body.end());
+	}
+
+	// 按照随机的长度 (1 ~ 70000 字节) 分段写入，对方关闭的时候返回 false
+	bool Write(const std::vector<uint8_t> &vWire, std::mt19937 &rng)
+	{
+		for (size_t nPos = 0; nPos < vWire.size(); )
+		{
+			size_t nPiece = std::min<size_t>(vWire.size() - nPos, 1 + rng() % 70000);
+			asio::error_code ec;
+			asio::write(this->socket, asio::buffer(vWire.data() + nPos, nPiece), ec);
+			if (ec)
+				return false;
+			nPos += nPiece;
+		}
+		return true;
+	}
+
+	// 等待 fnDone 成立，超时的时候返回 false
+	template <typename F>
+	static bool WaitFor(F fnDone, int nSeconds = 10)
+	{
+		auto tStart = std::chrono::steady_clock::now();
+		while (!fnDone())
+		{
+			if (std::chrono::steady_clock::now() - tStart > std::chrono::seconds(nSeconds))
+				return false;
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+		return true;
+	}
+};
+
+
+Message MakeMessage(CustomMsgTypes id, size_t nBody, uint32_t nSeed)
+{
+	Message msg;
+	msg.header.id = id;
+	msg.body.resize(nBody);
+	for (size_t i = 0; i < nBody; ++i)
+		msg.body[i] = static_cast<uint8_t>(nSeed * 97 + i * 13 + (i >> 16));
+	msg.header.size = msg.size();
+	return msg;
+}
+
+template <template <typename> class Conn>
+bool CheckExactBody(olc::net::framing eFraming)
+{
+	const size_t aUploads[] = { 1, 1000, olc::net::stream_chunk_size, olc::net::stream_chunk_size + 1, 1024 * 1024 + 3, 3 * 1024 * 1024 + 5 };
+	constexpr size_t nUploads = sizeof(aUploads) / sizeof(aUploads[0]);
+
+	auto pRecord = std::make_shared<sink_record>();
+	Session<Conn> s(eFraming, pRecord);
+	std::mt19937 rng(uint32_t(eFraming == olc::net::framing::compact) + 7);
+
+	// Upload 之间夹着普通的报文，最后是一个 body 为空的 Upload
+	std::vector<uint8_t> vWire;
+	for (size_t i = 0; i < nUploads; ++i)
+	{
+		s.Encode(MakeMessage(CustomMsgTypes::Data, i, uint32_t(i)), vWire);
+		s.Encode(MakeMessage(CustomMsgTypes::Upload, aUploads[i], uint32_t(i)), vWire);
+	}
+	s.Encode(MakeMessage(CustomMsgTypes::Upload, 0, 0), vWire);
+
+	if (!s.Write(vWire, rng))
+		return false;
+	if (!s.WaitFor([&]() { return pRecord->nFinish == nUploads && s.qServerIn.count() == nUploads + 1; }))
+		return false;
+
+	bool bOk = pRecord->nDestroyed == nUploads;
+	std::lock_guard<std::mutex> lock(pRecord->mux);
+	for (size_t i = 0; i < nUploads; ++i)
+		bOk = bOk && pRecord->vFinished[i] == MakeMessage(CustomMsgTypes::Upload, aUploads[i], uint32_t(i)).body;
+
+	for (size_t i = 0; i <= nUploads; ++i)
+	{
+		Message msg = s.qServerIn.pop_front().msg;
+		if (i < nUploads)
+			bOk = bOk && msg.header.id == CustomMsgTypes::Data && msg.body == MakeMessage(CustomMsgTypes::Data, i, uint32_t(i)).body;
+		else
+			bOk = bOk && msg.header.id == CustomMsgTypes::Upload && msg.body.empty();
+	}
+	return bOk;
+}
+
+template <template <typename> class Conn>
+bool CheckDisconnect(olc::net::framing eFraming)
+{
+	constexpr size_t nBody = 1024 * 1024;
+	constexpr size_t nSent = 4 * olc::net::stream_chunk_size + 1000;
+
+	auto pRecord = std::make_shared<sink_record>();
+	{
+		Session<Conn> s(eFraming, pRecord);
+		std::mt19937 rng(11);
+
+		std::vector<uint8_t> vWire;
+		s.Encode(MakeMessage(CustomMsgTypes::Upload, nBody, 1), vWire);
+		vWire.resize(vWire.size() - (nBody - nSent));
+		// 标准帧格式下每次读满一段 (stream_chunk_size) 才交给 sink，最后不满一段的数据留在 socket 中
+		if (!s.Write(vWire, rng) || !s.WaitFor([&]() { return pRecord->nWritten >= nSent - nSent % olc::net::stream_chunk_size; }))
+			return false;
+
+		// 对方关闭之后连接断开，sink 不等连接析构就被释放
+		s.socket.close();
+		if (!s.WaitFor([&]() { return pRecord->nDestroyed == 1; }, 2))
+			return false;
+	}
+	return pRecord->nFinish == 0 && pRecord->nDestroyed == 1;
+}
+
+template <template <typename> class Conn>
+bool CheckSinkFailure(olc::net::framing eFraming)
+{
+	auto pRecord = std::make_shared<sink_record>();
+	pRecord->bFail = true;
+	Session<Conn> s(eFraming, pRecord);
+	std::mt19937 rng(13);
+
+	std::vector<uint8_t> vWire;
+	s.Encode(MakeMessage(CustomMsgTypes::Upload, 1024 * 1024, 1), vWire);
+	s.Encode(MakeMessage(CustomMsgTypes::Data, 16, 2), vWire);
+	s.Write(vWire, rng);
+
+	// 连接关闭之后对方读出 eof
+	bool bClosed = s.WaitFor([&]()
+		{
+			asio::error_code ec;
+			s.socket.non_blocking(true);
+			uint8_t nByte;
+			s.socket.read_some(asio::buffer(&nByte, 1), ec);
+			return ec && ec != asio::error::would_block;
+		}, 2);
+
+	return bClosed && !s.pServer->IsConnected() && pRecord->nFinish == 0 && pRecord->nDestroyed == 1 && s.qServerIn.empty();
+}
+
+// 发送 nMessages 个 body 为 nBody 的 Upload，返回服务器收完的 MB/s；pRecord 为空的时候整个接收
+template <template <typename> class Conn>
+double Throughput(olc::net::framing eFraming, std::shared_ptr<sink_record> pRecord, size_t nMessages, size_t nBody)
+{
+	Session<Conn> s(eFraming, pRecord);
+	std::vector<uint8_t> vWire;
+	s.Encode(MakeMessage(CustomMsgTypes::Upload, nBody, 1), vWire);
+
+	auto tStart = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < nMessages; ++i)
+		asio::write(s.socket, asio::buffer(vWire));
+	s.WaitFor([&]() { return pRecord ? pRecord->nFinish == nMessages : s.qServerIn.count() == nMessages; }, 60);
+	auto tEnd = std::chrono::steady_clock::now();
+
+	return nMessages * (nBody / (1024.0 * 1024.0)) / std::chrono::duration<double>(tEnd - tStart).count();
+}
+
+template <template <typename> class Conn>
+bool Run(const char *szName, std::vector<std::string> &vResults)
+{
+	bool bAllOk = true;
+	for (olc::net::framing eFraming : { olc::net::framing::standard, olc::net::framing::compact })
+	{
+		bool bExact = CheckExactBody<Conn>(eFraming);
+		bool bDisconnect = CheckDisconnect<Conn>(eFraming);
+		bool bFailure = CheckSinkFailure<Conn>(eFraming);
+
+		auto pRecord = std::make_shared<sink_record>();
+		pRecord->bKeep = false;
+		double dStream = Throughput<Conn>(eFraming, pRecord, 64, 4 * 1024 * 1024);
+		double dWhole = Throughput<Conn>(eFraming, nullptr, 64, 4 * 1024 * 1024);
+
+		std::ostringstream os;
+		os << szName << "\t" << (eFraming == olc::net::framing::compact ? "compact " : "standard") << "\t"
+			<< (bExact ? "ok" : "FAILED") << "\t" << (bDisconnect ? "ok" : "FAILED") << "\t\t"
+			<< (bFailure ? "ok" : "FAILED") << "\t\t" << dStream << "\t" << dWhole;
+		vResults.push_back(os.str());
+		bAllOk = bAllOk && bExact && bDisconnect && bFailure;
+	}
+	return bAllOk;
+}
+
+
+int main(int argc, char *argv[])
+{
+	// 连接会打印日志，结果先保存起来，最后一起输出
+	std::ofstream null("/dev/null");
+	std::streambuf *pOut = std::cout.rdbuf(null.rdbuf());
+
+	std::vector<std::string> vResults;
+	bool bOk = Run<olc::net::connection>("callback", vResults);
+#ifdef ASIO_HAS_CO_AWAIT
+	bOk = Run<olc::net::coro_connection>("coroutine", vResults) && bOk;
+#else
+	vResults.push_back("coroutine\t(needs -std=c++20)");
+#endif
+
+	std::cout.rdbuf(pOut);
+	std::cout << "connection\tframing\t\tbody\tdisconnect\tsink fails\tMB/s (stream)\tMB/s (whole)\n";
+	for (auto &s : vResults)
+		std::cout << s << '\n';
+	return bOk ? 0 : 1;
+}
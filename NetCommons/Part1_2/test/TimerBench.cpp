@@ -0,0 +1,185 @@
+#include <iostream>
+#include <ctime>
+#include "net_timer.h"
+
+
+/*
+50000 个连接，每个连接一个超时 (例如空闲断开) 时两种做法的开销：
+	steady_timer	每个连接一个 asio::steady_timer，都挂在 reactor 的定时器堆中
+	timer_wheel		所有连接共享一个 olc::net::timer_wheel，每个连接只嵌入一个 timer_wheel::timer
+schedule 是第一次设定，reschedule 是收到数据之后把超时往后推 (最常见的操作)，cancel 是连接关闭，
+都在 I/O 线程中执行，steady_timer 被取消的等待需要执行一次回调 (operation_aborted)，计算在内。
+fire 是 nConnections 个超时分散在 500ms 内到期，从开始等待到全部执行完的时间和进程占用的 CPU 时间
+*/
+
+constexpr size_t nConnections = 50000;
+constexpr size_t nRounds = 10;
+
+struct asio_connection
+{
+	asio_connection(asio::io_context &context) : timer(context)
+	{
+
+	}
+
+	asio::steady_timer timer;
+	size_t nFired = 0;
+};
+
+struct wheel_connection
+{
+	olc::net::timer_wheel::timer timer;
+	size_t nFired = 0;
+};
+
+// 第 i 个连接的超时，分散在 [0, d) 中
+std::chrono::steady_clock::duration Spread(size_t i, std::chrono::steady_clock::duration d)
+{
+	return d * static_cast<int64_t>(i) / static_cast<int64_t>(nConnections);
+}
+
+template <typename Fn>
+double NsPerOp(size_t nOps, Fn fn)
+{
+	auto tStart = std::chrono::steady_clock::now();
+	fn();
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - tStart).count() / nOps;
+}
+
+struct result
+{
+	double dSchedule = 0;
+	double dReschedule = 0;
+	double dCancel = 0;
+	double dFireWall = 0;
+	double dFireCpu = 0;
+	size_t nFired = 0;
+};
+
+void Arm(asio_connection &c, std::chrono::steady_clock::duration d)
+{
+	c.timer.expires_after(d);
+	c.timer.async_wait(
+		[&c](std::error_code ec)
+		{
+			if (!ec)
+				c.nFired++;
+		});
+}
+
+result RunAsio()
+{
+	asio::io_context context;
+	std::vector<std::unique_ptr<asio_connection> > vConnections;
+	for (size_t i = 0; i < nConnections; ++i)
+		vConnections.push_back(std::make_unique<asio_connection>(context));
+
+	result r;
+	r.dSchedule = NsPerOp(nConnections, [&]()
+		{
+			for (size_t i = 0; i < nConnections; ++i)
+				Arm(*vConnections[i], std::chrono::seconds(30) + Spread(i, std::chrono::seconds(1)));
+		});
+
+	r.dReschedule = NsPerOp(nConnections * nRounds, [&]()
+		{
+			for (size_t n = 0; n < nRounds; ++n)
+			{
+				for (size_t i = 0; i < nConnections; ++i)
+					Arm(*vConnections[i], std::chrono::seconds(30) + Spread(i, std::chrono::seconds(1)));
+				context.poll();
+			}
+		});
+
+	r.dCancel = NsPerOp(nConnections, [&]()
+		{
+			for (auto &c : vConnections)
+				c->timer.cancel();
+			context.poll();
+		});
+
+	context.restart();
+	for (size_t i = 0; i < nConnections; ++i)
+		Arm(*vConnections[i], Spread(i, std::chrono::milliseconds(500)));
+
+	std::clock_t cStart = std::clock();
+	auto tStart = std::chrono::steady_clock::now();
+	context.run();
+	r.dFireWall = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	r.dFireCpu = double(std::clock() - cStart) / CLOCKS_PER_SEC;
+
+	for (auto &c : vConnections)
+		r.nFired += c->nFired;
+	return r;
+}
+
+result RunWheel()
+{
+	asio::io_context context;
+	olc::net::timer_wheel wheel(context, std::chrono::milliseconds(1));
+	std::vector<std::unique_ptr<wheel_connection> > vConnections;
+	for (size_t i = 0; i < nConnections; ++i)
+		vConnections.push_back(std::make_unique<wheel_connection>());
+
+	auto fnArm = [&](wheel_connection &c, std::chrono::steady_clock::duration d)
+	{
+		wheel.Schedule(c.timer, d, [&c]() { c.nFired++; });
+	};
+
+	result r;
+	r.dSchedule = NsPerOp(nConnections, [&]()
+		{
+			for (size_t i = 0; i < nConnections; ++i)
+				fnArm(*vConnections[i], std::chrono::seconds(30) + Spread(i, std::chrono::seconds(1)));
+		});
+
+	r.dReschedule = NsPerOp(nConnections * nRounds, [&]()
+		{
+			for (size_t n = 0; n < nRounds; ++n)
+			{
+				for (size_t i = 0; i < nConnections; ++i)
+					fnArm(*vConnections[i], std::chrono::seconds(30) + Spread(i, std::chrono::seconds(1)));
+				context.poll();
+			}
+		});
+
+	r.dCancel = NsPerOp(nConnections, [&]()
+		{
+			for (auto &c : vConnections)
+				wheel.Cancel(c->timer);
+			context.poll();
+		});
+
+	// 全部取消之后定时器轮最多再醒来一次，不影响下面的测量
+	context.restart();
+	for (size_t i = 0; i < nConnections; ++i)
+		fnArm(*vConnections[i], Spread(i, std::chrono::milliseconds(500)));
+
+	std::clock_t cStart = std::clock();
+	auto tStart = std::chrono::steady_clock::now();
+	context.run();
+	r.dFireWall = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	r.dFireCpu = double(std::clock() - cStart) / CLOCKS_PER_SEC;
+
+	for (auto &c : vConnections)
+		r.nFired += c->nFired;
+	return r;
+}
+
+void Print(const char *sName, size_t nSize, const result &r)
+{
+	std::cout << sName << '\t' << nSize << "\t\t" << r.dSchedule << "\t\t" << r.dReschedule << "\t\t" << r.dCancel
+		<< "\t\t" << r.dFireWall << "\t\t" << r.dFireCpu << "\t\t" << r.nFired << '\n';
+}
+
+
+int main(int argc, char *argv[])
+{
+	std::cout.precision(3);
+	std::cout << nConnections << " connections, " << nRounds << " reschedule rounds\n";
+	std::cout << "\t\tbytes/conn\tschedule ns\treschedule ns\tcancel ns\tfire wall s\tfire cpu s\tfired\n";
+
+	Print("steady_timer", sizeof(asio::steady_timer), RunAsio());
+	Print("timer_wheel", sizeof(olc::net::timer_wheel::timer), RunWheel());
+	return  0;
+}
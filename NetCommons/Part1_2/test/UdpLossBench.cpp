@@ -0,0 +1,245 @@
+#include <iostream>
+#include <fstream>
+#include <set>
+#include "net_server.h"
+#include "net_client.h"
+
+
+enum class CustomMsgTypes : uint32_t
+{
+	Hello,
+	Ordered,
+	Unordered,
+	Sequenced,
+};
+
+using Message = olc::net::message<CustomMsgTypes>;
+using olc::net::delivery;
+
+/*
+两个方向上在模拟丢包的 UDP 通道中发送三条通道的报文，检查：
+	reliable_ordered     全部到达，没有重复，和发送的顺序一致
+	reliable_unordered   全部到达，没有重复
+	unreliable_sequenced 收到的序号严格递增 (可以丢失)
+	可靠通道上 body 超过 udp_max_body 的报文，Send 返回 false
+客户端在 TCP 连接建立之后立即开始慢慢地发送，不等 UDP 会话，发送的过程跨越会话建立的时刻：
+会话建立之前可靠通道的报文在会话中排队，建立之后和后面的报文一起按顺序通过 UDP 发送。
+任何一项检查失败的时候返回 1
+*/
+
+constexpr uint32_t nMessages = 300;
+
+class LossServer : public olc::net::server_interface<CustomMsgTypes>
+{
+public:
+	LossServer() : olc::net::server_interface<CustomMsgTypes>(uint16_t(0))
+	{
+
+	}
+
+	uint16_t Port()
+	{
+		asio::ip::tcp::endpoint endpoint;
+		olc::net::detail::to_tcp_endpoint(this->m_asioAcceptor.local_endpoint(), endpoint);
+		return endpoint.port();
+	}
+
+	olc::net::tsqueue<olc::net::owned_message<CustomMsgTypes> >& Incoming()
+	{
+		return this->m_qMessageIn;
+	}
+
+	std::shared_ptr<olc::net::udp_channel<CustomMsgTypes> > Udp()
+	{
+		return this->m_pUdp;
+	}
+
+protected:
+	bool OnClientConnect(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client) override
+	{
+		return true;
+	}
+};
+
+class LossClient : public olc::net::client_interface<CustomMsgTypes>
+{
+public:
+	std::shared_ptr<olc::net::udp_channel<CustomMsgTypes> > Udp()
+	{
+		return this->m_pUdp;
+	}
+};
+
+struct result
+{
+	double dMilliseconds = 0;
+	size_t nOrdered = 0;
+	size_t nUnordered = 0;
+	size_t nSequenced = 0;
+	bool bOk = true;
+};
+
+// 每条通道发送 nMessages 个报文，body 是序号。pace 不为 0 的时候每一轮之后暂停 pace
+template <typename Fn>
+void SendAll(Fn fnSend, std::chrono::microseconds pace = std::chrono::microseconds(0))
+{
+	for (uint32_t i = 0; i < nMessages; ++i)
+	{
+		for (auto id : { CustomMsgTypes::Ordered, CustomMsgTypes::Unordered, CustomMsgTypes::Sequenced })
+		{
+			Message msg;
+			msg.header.id = id;
+			msg << i;
+			fnSend(msg, id == CustomMsgTypes::Ordered ? delivery::reliable_ordered :
+				id == CustomMsgTypes::Unordered ? delivery::reliable_unordered : delivery::unreliable_sequenced);
+		}
+
+		if (pace.count() > 0)
+			std::this_thread::sleep_for(pace);
+	}
+}
+
+// 从 q 中接收，直到两条可靠通道都收齐或者超时
+result Receive(olc::net::tsqueue<olc::net::owned_message<CustomMsgTypes> > &q, std::chrono::steady_clock::time_point tStart)
+{
+	result r;
+	std::vector<uint32_t> vOrdered;
+	std::set<uint32_t> setUnordered;
+	int64_t nLastSequenced = -1;
+
+	while (vOrdered.size() < nMessages || setUnordered.size() < nMessages)
+	{
+		if (std::chrono::steady_clock::now() - tStart > std::chrono::seconds(60))
+			break;
+		if (q.empty())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		olc::net::owned_message<CustomMsgTypes> in = q.pop_front();
+		if (in.msg.header.id == CustomMsgTypes::Hello)
+			continue;
+
+		uint32_t n = 0;
+		in.msg >> n;
+		switch (in.msg.header.id)
+		{
+			case CustomMsgTypes::Ordered:
+				vOrdered.push_back(n);
+				break;
+			case CustomMsgTypes::Unordered:
+				if (!setUnordered.insert(n).second)
+					r.bOk = false;
+				break;
+			case CustomMsgTypes::Sequenced:
+				if (int64_t(n) <= nLastSequenced)
+					r.bOk = false;
+				nLastSequenced = n;
+				r.nSequenced++;
+				break;
+			default:
+				break;
+		}
+	}
+
+	r.dMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+	r.nOrdered = vOrdered.size();
+	r.nUnordered = setUnordered.size();
+	for (uint32_t i = 0; i < vOrdered.size(); ++i)
+	{
+		if (vOrdered[i] != i)
+			r.bOk = false;
+	}
+	if (r.nOrdered != nMessages || r.nUnordered != nMessages)
+		r.bOk = false;
+	return r;
+}
+
+std::string Format(float fLoss, const char *sDirection, const result &r)
+{
+	std::ostringstream os;
+	os << fLoss * 100 << "%\t" << sDirection << "\t" << r.dMilliseconds << "\t\t" << r.nOrdered << "\t\t"
+		<< r.nUnordered << "\t\t" << r.nSequenced << "\t\t" << (r.bOk ? "ok" : "FAILED");
+	return os.str();
+}
+
+std::vector<std::string> RunAll(bool &bOk)
+{
+	std::vector<std::string> vResults;
+	for (float fLoss : { 0.0f, 0.01f, 0.05f, 0.3f })
+	{
+		LossServer server;
+		uint16_t nPort = server.Port();
+		server.EnableUdp();
+		server.Start();
+		server.Udp()->SimulatePacketLoss(fLoss);
+
+		LossClient client;
+		client.EnableUdp();
+		client.Connect("127.0.0.1", nPort);
+		client.Udp()->SimulatePacketLoss(fLoss);
+
+		// 客户端到服务器：还没有连接上的时候发送的报文会被丢弃，等到 TCP 连接建立，但不等 UDP 会话
+		while (!client.IsConnected())
+			std::this_thread::yield();
+
+		auto tStart = std::chrono::steady_clock::now();
+		Message hello;
+		hello.header.id = CustomMsgTypes::Hello;
+		client.Send(hello);
+
+		// 可靠通道上放不进一个数据报的报文必须被拒绝，刚好放得下的要被接受
+		Message limit;
+		limit.header.id = CustomMsgTypes::Hello;
+		limit.body.resize(olc::net::udp_max_body);
+		limit.header.size = limit.size();
+		bool bLimit = client.Send(limit, delivery::reliable_ordered);
+		limit.body.resize(olc::net::udp_max_body + 1);
+		limit.header.size = limit.size();
+		bLimit = bLimit && !client.Send(limit, delivery::reliable_ordered);
+		if (!bLimit)
+			vResults.push_back("lane size limit not enforced");
+		bOk = bOk && bLimit;
+
+		SendAll([&](const Message &msg, delivery eMode) { client.Send(msg, eMode); }, std::chrono::milliseconds(1));
+
+		std::shared_ptr<olc::net::connection<CustomMsgTypes> > remote;
+		while (!remote)
+		{
+			if (!server.Incoming().empty())
+				remote = server.Incoming().front().remote;
+		}
+
+		result up = Receive(server.Incoming(), tStart);
+		vResults.push_back(Format(fLoss, "up", up));
+
+		// 服务器到客户端
+		tStart = std::chrono::steady_clock::now();
+		SendAll([&](const Message &msg, delivery eMode) { server.MessageClient(remote, msg, eMode); });
+		result down = Receive(client.Incoming(), tStart);
+		vResults.push_back(Format(fLoss, "down", down));
+
+		bOk = bOk && up.bOk && down.bOk;
+		client.Disconnect();
+	}
+	return vResults;
+}
+
+
+int main(int argc, char *argv[])
+{
+	// 服务器每接受一个连接都会打印日志，测量的时候丢弃
+	std::ofstream null("/dev/null");
+	std::streambuf *pOut = std::cout.rdbuf(null.rdbuf());
+
+	bool bOk = true;
+	std::vector<std::string> vResults = RunAll(bOk);
+
+	std::cout.rdbuf(pOut);
+	std::cout << nMessages << " messages per lane\n";
+	std::cout << "loss\tdir\ttime (ms)\tordered\t\tunordered\tsequenced\tcheck\n";
+	for (auto &s : vResults)
+		std::cout << s << '\n';
+	return bOk ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+#include <iostream>
+#include <ctime>
+#include "net_udp.h"
+
+
+enum class CustomMsgTypes : uint32_t
+{
+	State,
+};
+
+using Message = olc::net::message<CustomMsgTypes>;
+using Channel = olc::net::udp_channel<CustomMsgTypes>;
+
+
+/*
+在本机回环地址上的两个 UDP 通道之间发送状态更新：每一轮 (tick) 发送 nPerTick 个相同长度的数据报，
+统计接收端收到的数据报个数。所有的 I/O 在一个线程中完成，结果换算成每个 CPU 秒的包数
+*/
+void Run(bool bGso, size_t nBody, size_t nTicks, size_t nPerTick)
+{
+	asio::io_context context;
+	olc::net::tsqueue<olc::net::owned_message<CustomMsgTypes> > qSenderIn;
+	olc::net::tsqueue<olc::net::owned_message<CustomMsgTypes> > qReceiverIn;
+
+	asio::ip::address loopback = asio::ip::make_address("127.0.0.1");
+	Channel sender(context, asio::ip::udp::endpoint(loopback, 0), qSenderIn);
+	Channel receiver(context, asio::ip::udp::endpoint(loopback, 0), qReceiverIn);
+	sender.SetSegmentationOffload(bGso);
+
+	// 两边都已知对方的地址，互相发送 hello 建立会话
+	const uint64_t nToken = 0x0123456789abcdefull;
+	auto pSenderState = std::make_shared<std::atomic<olc::net::udp_state> >(olc::net::udp_state::pending);
+	auto pReceiverState = std::make_shared<std::atomic<olc::net::udp_state> >(olc::net::udp_state::pending);
+	sender.Register(nToken, {}, pSenderState, receiver.LocalEndpoint());
+	receiver.Register(nToken, {}, pReceiverState, sender.LocalEndpoint());
+	sender.Start();
+	receiver.Start();
+
+	std::thread thread([&]() { context.run(); });
+
+	Message msg;
+	msg.header.id = CustomMsgTypes::State;
+	msg.body.resize(nBody, 0x5a);
+	msg.header.size = msg.size();
+
+	std::clock_t cStart = std::clock();
+	auto tStart = std::chrono::steady_clock::now();
+
+	size_t nReceived = 0;
+	std::vector<olc::net::owned_message<CustomMsgTypes> > vDrained;
+	for (size_t t = 0; t < nTicks; ++t)
+	{
+		// 一个 tick 内的所有报文在 I/O 线程的同一轮中排队，由一次 Flush 发送
+		asio::post(context,
+			[&]()
+			{
+				for (size_t i = 0; i < nPerTick; ++i)
+					sender.Send(nToken, msg);
+			}
+		);
+
+		vDrained.clear();
+		nReceived += qReceiverIn.drain(vDrained);
+		std::this_thread::sleep_for(std::chrono::microseconds(500));
+	}
+
+	// 等待最后的数据报到达
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	vDrained.clear();
+	nReceived += qReceiverIn.drain(vDrained);
+
+	double fCpu = double(std::clock() - cStart) / CLOCKS_PER_SEC;
+	double fWall = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+	context.stop();
+	thread.join();
+
+	std::cout << (bGso ? "gso on " : "gso off") << "\t" << nBody << "\t" << nTicks * nPerTick << "\t\t" << nReceived 
+		<< "\t\t" << fCpu << "\t" << fWall << "\t" << nReceived / fCpu << '\n';
+}
+
+
+int main(int argc, char *argv[])
+{
+	{
+		asio::io_context context;
+		olc::net::tsqueue<olc::net::owned_message<CustomMsgTypes> > q;
+		Channel probe(context, asio::ip::udp::endpoint(asio::ip::udp::v4(), 0), q);
+		std::cout << "UDP_SEGMENT supported: " << probe.SegmentationOffloadSupported()
+			<< ", UDP_GRO enabled: " << probe.ReceiveOffloadEnabled() << "\n\n";
+	}
+
+	std::cout << "mode\tbody\tsent\t\treceived\tcpu (s)\twall (s)\tpackets / cpu second\n";
+	for (size_t nBody : { size_t(64), size_t(1000) })
+	{
+		Run(false, nBody, 2000, 64);
+		Run(true, nBody, 2000, 64);
+	}
+	return  0;
+}
@@ -0,0 +1,188 @@
+#include <iostream>
+#include <atomic>
+#include "net_server.h"
+#include "net_client.h"
+
+
+enum class CustomMsgTypes : uint32_t
+{
+	ServerAccept,
+	Data,
+	Done,
+	Ping,
+};
+
+using Message = olc::net::message<CustomMsgTypes>;
+
+
+/*
+回显服务器：收到 Ping 原样发回；收到 nExpected 个 Data 之后发回一个 Done。
+Update 在单独的线程里执行，和真实的服务器一样通过接收队列处理报文
+*/
+class BenchServer : public olc::net::server_interface<CustomMsgTypes>
+{
+public:
+	template <typename Endpoint>
+	explicit BenchServer(const Endpoint &endpoint)
+		: olc::net::server_interface<CustomMsgTypes>(endpoint)
+	{
+
+	}
+
+	size_t nExpected = 0;
+
+protected:
+	bool OnClientConnect(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client) override
+	{
+		Message msg;
+		msg.header.id = CustomMsgTypes::ServerAccept;
+		client->Send(msg);
+		return true;
+	}
+
+	void OnMessage(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client, Message &msg) override
+	{
+		if (msg.header.id == CustomMsgTypes::Ping)
+		{
+			client->Send(msg);
+		}
+		else if (msg.header.id == CustomMsgTypes::Data && ++this->m_nReceived == this->nExpected)
+		{
+			this->m_nReceived = 0;
+			Message done;
+			done.header.id = CustomMsgTypes::Done;
+			client->Send(done);
+		}
+	}
+
+private:
+	size_t m_nReceived = 0;
+};
+
+
+// 一个服务器和一个已经连接上的客户端，Connect 的参数决定使用 TCP 还是 Unix 域套接字
+template <typename Endpoint, typename... ConnectArgs>
+struct Session
+{
+	BenchServer server;
+	olc::net::client_interface<CustomMsgTypes> client;
+	std::atomic<bool> bStop { false };
+	std::thread thread;
+
+	Session(const Endpoint &endpoint, ConnectArgs... args)
+		: server(endpoint)
+	{
+		this->server.Start();
+		this->thread = std::thread([this]()
+			{
+				while (!this->bStop)
+				{
+					this->server.Update();
+					std::this_thread::yield();
+				}
+			});
+
+		this->client.Connect(args...);
+		this->Wait(CustomMsgTypes::ServerAccept);
+	}
+
+	~Session()
+	{
+		this->client.Disconnect();
+		this->bStop = true;
+		this->thread.join();
+	}
+
+	void Wait(CustomMsgTypes id)
+	{
+		while (true)
+		{
+			if (this->client.Incoming().empty())
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			if (this->client.Incoming().pop_front().msg.header.id == id)
+				return;
+		}
+	}
+};
+
+
+// 客户端连续发送 nMessages 个报文，直到服务器全部处理完为止，返回每秒的报文数
+template <typename S>
+double Throughput(S &s, size_t nMessages, size_t nBody)
+{
+	s.server.nExpected = nMessages;
+
+	Message msg;
+	msg.header.id = CustomMsgTypes::Data;
+	msg.body.resize(nBody, 0x5a);
+	msg.header.size = msg.size();
+
+	auto tStart = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < nMessages; ++i)
+		s.client.Send(msg);
+	s.Wait(CustomMsgTypes::Done);
+	auto tEnd = std::chrono::steady_clock::now();
+
+	return nMessages / std::chrono::duration<double>(tEnd - tStart).count();
+}
+
+// 客户端和服务器之间来回发送 nRounds 次，返回平均的往返时间 (微秒)
+template <typename S>
+double RoundTrip(S &s, size_t nRounds)
+{
+	Message msg;
+	msg.header.id = CustomMsgTypes::Ping;
+	msg << uint64_t(0);
+
+	auto tStart = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < nRounds; ++i)
+	{
+		s.client.Send(msg);
+		s.Wait(CustomMsgTypes::Ping);
+	}
+	auto tEnd = std::chrono::steady_clock::now();
+
+	return std::chrono::duration<double, std::micro>(tEnd - tStart).count() / nRounds;
+}
+
+// 服务器和客户端会打印连接的日志，结果先保存起来，最后一起输出
+template <typename S>
+std::string Run(const char *szName, S &s)
+{
+	double dSmall = Throughput(s, 200000, 32);
+	double dLarge = Throughput(s, 20000, 4096);
+	double dRound = RoundTrip(s, 20000);
+
+	std::ostringstream os;
+	os << szName << "\t\t" << dSmall << "\t" << dLarge << "\t" << dRound << '\n';
+	return os.str();
+}
+
+
+int main(int argc, char *argv[])
+{
+	std::vector<std::string> vResults;
+
+	{
+		Session<uint16_t, std::string, uint16_t> tcp(60123, "127.0.0.1", 60123);
+		vResults.push_back(Run("tcp", tcp));
+	}
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+	{
+		asio::local::stream_protocol::endpoint endpoint("/tmp/olc_uds_bench.sock");
+		Session<asio::local::stream_protocol::endpoint, asio::local::stream_protocol::endpoint> uds(endpoint, endpoint);
+		vResults.push_back(Run("uds", uds));
+	}
+#else
+	vResults.push_back("uds\t\t(not available on this platform)\n");
+#endif
+
+	std::cout << "transport\tmsg/s (32B)\tmsg/s (4KB)\tround trip (us)\n";
+	for (auto &s : vResults)
+		std::cout << s;
+	return  0;
+}
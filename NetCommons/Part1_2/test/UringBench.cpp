@@ -0,0 +1,191 @@
+#include <iostream>
+#include <fstream>
+#include <atomic>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "net_server.h"
+
+
+enum class CustomMsgTypes : uint32_t
+{
+	Ping,
+};
+
+using Header = olc::net::message_header<CustomMsgTypes>;
+
+// 标准帧格式下的一个 Ping：报头 + 8 个字节的 body
+constexpr size_t nFrameSize = sizeof(Header) + sizeof(uint64_t);
+
+
+// 回显服务器，Update 在单独的线程里执行
+class EchoServer : public olc::net::server_interface<CustomMsgTypes>
+{
+public:
+	EchoServer() : olc::net::server_interface<CustomMsgTypes>(uint16_t(0))
+	{
+
+	}
+
+	uint16_t Port()
+	{
+		asio::ip::tcp::endpoint endpoint;
+		olc::net::detail::to_tcp_endpoint(this->m_asioAcceptor.local_endpoint(), endpoint);
+		return endpoint.port();
+	}
+
+protected:
+	bool OnClientConnect(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client) override
+	{
+		return true;
+	}
+
+	void OnMessage(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client, olc::net::message<CustomMsgTypes> &msg) override
+	{
+		client->Send(msg);
+	}
+};
+
+
+/*
+子进程：建立 nConnections 个连接，每个连接上同时只有一个 Ping，收到回显之后再发下一个，一共 nRounds 次。
+所有的连接都建立之后通过管道通知父进程，最后把耗时 (秒) 写回管道
+*/
+void RunClients(uint16_t nPort, size_t nConnections, size_t nRounds, int fdOut)
+{
+	asio::io_context context;
+	asio::ip::tcp::endpoint server(asio::ip::make_address("127.0.0.1"), nPort);
+
+	struct client
+	{
+		asio::ip::tcp::socket socket;
+		uint8_t aFrame[nFrameSize];
+		size_t nLeft;
+	};
+
+	std::vector<std::unique_ptr<client> > vClients;
+	for (size_t i = 0; i < nConnections; ++i)
+	{
+		vClients.push_back(std::make_unique<client>(client { asio::ip::tcp::socket(context), {}, nRounds }));
+		vClients.back()->socket.connect(server);
+		vClients.back()->socket.set_option(asio::ip::tcp::no_delay(true));
+
+		Header header;
+		header.id = CustomMsgTypes::Ping;
+		header.size = sizeof(uint64_t);
+		std::memcpy(vClients.back()->aFrame, &header, sizeof(header));
+	}
+
+	char c = 'c';
+	ssize_t n = ::write(fdOut, &c, 1);
+
+	std::function<void(client&)> fnPing = [&fnPing](client &cl)
+	{
+		asio::async_write(cl.socket, asio::buffer(cl.aFrame),
+			[&fnPing, &cl](std::error_code ec, size_t)
+			{
+				if (ec)
+					return;
+				asio::async_read(cl.socket, asio::buffer(cl.aFrame),
+					[&fnPing, &cl](std::error_code ec, size_t)
+					{
+						if (!ec && --cl.nLeft > 0)
+							fnPing(cl);
+					});
+			});
+	};
+
+	auto tStart = std::chrono::steady_clock::now();
+	for (auto &cl : vClients)
+		fnPing(*cl);
+	context.run();
+	double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+	n = ::write(fdOut, &dSeconds, sizeof(dSeconds));
+	(void)n;
+}
+
+double CpuSeconds()
+{
+	rusage usage;
+	::getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+// 返回 "msg/s \t 服务器每个报文的 CPU 微秒数"
+std::string Run(olc::net::io_engine eEngine, size_t nConnections, size_t nRounds)
+{
+	EchoServer server;
+	server.SetIoEngine(eEngine);
+	uint16_t nPort = server.Port();
+	server.Start();
+
+	std::atomic<bool> bStop { false };
+	std::thread thread([&]()
+		{
+			while (!bStop)
+			{
+				server.Update();
+				std::this_thread::yield();
+			}
+		});
+
+	int aPipe[2];
+	if (::pipe(aPipe) != 0)
+		return "pipe failed";
+
+	pid_t pid = ::fork();
+	if (pid == 0)
+	{
+		RunClients(nPort, nConnections, nRounds, aPipe[1]);
+		::_exit(0);
+	}
+
+	char c;
+	ssize_t n = ::read(aPipe[0], &c, 1);
+	double dCpuStart = CpuSeconds();
+
+	double dSeconds = 0;
+	n = ::read(aPipe[0], &dSeconds, sizeof(dSeconds));
+	double dCpu = CpuSeconds() - dCpuStart;
+	(void)n;
+
+	::waitpid(pid, nullptr, 0);
+	::close(aPipe[0]);
+	::close(aPipe[1]);
+
+	bStop = true;
+	thread.join();
+
+	double nMessages = double(nConnections) * nRounds;
+	std::ostringstream os;
+	os << nMessages / dSeconds << "\t" << dCpu * 1e6 / nMessages;
+	return os.str();
+}
+
+
+int main(int argc, char *argv[])
+{
+	// 每个连接两个 fd 分别在两个进程中，10k 个连接需要把 fd 的上限调高
+	rlimit limit;
+	::getrlimit(RLIMIT_NOFILE, &limit);
+	limit.rlim_cur = limit.rlim_max;
+	::setrlimit(RLIMIT_NOFILE, &limit);
+
+	// 服务器每接受一个连接都会打印日志，测量的时候丢弃
+	std::ofstream null("/dev/null");
+	std::streambuf *pOut = std::cout.rdbuf(null.rdbuf());
+
+	std::vector<std::string> vResults;
+	for (size_t nConnections : { 1000, 10000 })
+	{
+		size_t nRounds = 200000 / nConnections;
+		vResults.push_back(std::to_string(nConnections) + "\tepoll\t" + Run(olc::net::io_engine::asio, nConnections, nRounds));
+		vResults.push_back(std::to_string(nConnections) + "\tio_uring\t" + Run(olc::net::io_engine::uring, nConnections, nRounds));
+	}
+
+	std::cout.rdbuf(pOut);
+	std::cout << "connections\tengine\tmsg/s\tserver cpu (us/msg)\n";
+	for (auto &s : vResults)
+		std::cout << s << '\n';
+	return  0;
+}
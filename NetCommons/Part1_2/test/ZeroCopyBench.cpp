@@ -0,0 +1,177 @@
+#include <iostream>
+#include <fstream>
+#include <atomic>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "net_server.h"
+
+
+enum class CustomMsgTypes : uint32_t
+{
+	Chunk,
+	Ack,
+};
+
+using Header = olc::net::message_header<CustomMsgTypes>;
+using Message = olc::net::message<CustomMsgTypes>;
+
+/*
+回环上内核没有办法把固定的内存页直接交给接收的 socket，总会复制一份 (通知中带有
+SO_EE_CODE_ZEROCOPY_COPIED)，连接在连续收到这样的通知之后退回到普通的发送。
+所以回环上 zerocopy 一行测量的是这条路径本身的开销和退回之后的结果，省下的复制要在真实的网卡上才能看到
+*/
+
+// 发送一方最多领先接收一方这么多个报文，发送队列不会无限制地增长
+constexpr size_t nWindow = 32;
+
+
+// 服务器向客户端发送大报文 (地图分块)，客户端每收到一个回复一个 Ack
+class ChunkServer : public olc::net::server_interface<CustomMsgTypes>
+{
+public:
+	ChunkServer() : olc::net::server_interface<CustomMsgTypes>(uint16_t(0))
+	{
+
+	}
+
+	uint16_t Port()
+	{
+		asio::ip::tcp::endpoint endpoint;
+		olc::net::detail::to_tcp_endpoint(this->m_asioAcceptor.local_endpoint(), endpoint);
+		return endpoint.port();
+	}
+
+	std::shared_ptr<olc::net::connection<CustomMsgTypes> > pClient;
+	std::atomic<size_t> nAcked { 0 };
+
+protected:
+	bool OnClientConnect(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client) override
+	{
+		std::atomic_store(&this->pClient, client);
+		return true;
+	}
+
+	void OnMessage(std::shared_ptr<olc::net::connection<CustomMsgTypes> > client, Message &msg) override
+	{
+		this->nAcked++;
+	}
+};
+
+
+// 子进程：接收 nMessages 个 body 为 nBody 字节的报文，每个回复一个 Ack，最后把耗时 (秒) 写回管道
+void RunClient(uint16_t nPort, size_t nMessages, size_t nBody, int fdOut)
+{
+	asio::io_context context;
+	asio::ip::tcp::socket socket(context);
+	socket.connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), nPort));
+	socket.set_option(asio::ip::tcp::no_delay(true));
+
+	Header ack;
+	ack.id = CustomMsgTypes::Ack;
+	std::vector<uint8_t> vFrame(sizeof(Header) + nBody);
+
+	auto tStart = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < nMessages; ++i)
+	{
+		asio::read(socket, asio::buffer(vFrame));
+		asio::write(socket, asio::buffer(&ack, sizeof(ack)));
+	}
+	double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+	ssize_t n = ::write(fdOut, &dSeconds, sizeof(dSeconds));
+	(void)n;
+}
+
+double CpuSeconds()
+{
+	rusage usage;
+	::getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+// 返回 "MB/s \t 发送一方每 MB 的 CPU 毫秒数"
+std::string Run(bool bZeroCopy, size_t nMessages, size_t nBody)
+{
+	ChunkServer server;
+	if (bZeroCopy)
+		server.EnableZeroCopy();
+	uint16_t nPort = server.Port();
+	server.Start();
+
+	std::atomic<bool> bStop { false };
+	std::thread thread([&]()
+		{
+			while (!bStop)
+			{
+				server.Update();
+				std::this_thread::yield();
+			}
+		});
+
+	int aPipe[2];
+	if (::pipe(aPipe) != 0)
+		return "pipe failed";
+
+	pid_t pid = ::fork();
+	if (pid == 0)
+	{
+		RunClient(nPort, nMessages, nBody, aPipe[1]);
+		::_exit(0);
+	}
+
+	std::shared_ptr<olc::net::connection<CustomMsgTypes> > pClient;
+	while (!(pClient = std::atomic_load(&server.pClient)))
+		std::this_thread::yield();
+
+	Message msg;
+	msg.header.id = CustomMsgTypes::Chunk;
+	msg.body.resize(nBody, 0x5a);
+	msg.header.size = msg.size();
+
+	double dCpuStart = CpuSeconds();
+	for (size_t i = 0; i < nMessages; ++i)
+	{
+		while (i - server.nAcked >= nWindow)
+			std::this_thread::yield();
+		pClient->Send(msg);
+	}
+
+	double dSeconds = 0;
+	ssize_t n = ::read(aPipe[0], &dSeconds, sizeof(dSeconds));
+	double dCpu = CpuSeconds() - dCpuStart;
+	(void)n;
+
+	::waitpid(pid, nullptr, 0);
+	::close(aPipe[0]);
+	::close(aPipe[1]);
+
+	bStop = true;
+	thread.join();
+
+	double dMegabytes = double(nMessages) * nBody / (1024 * 1024);
+	std::ostringstream os;
+	os << dMegabytes / dSeconds << "\t" << dCpu * 1e3 / dMegabytes;
+	return os.str();
+}
+
+
+int main(int argc, char *argv[])
+{
+	// 服务器每接受一个连接都会打印日志，测量的时候丢弃
+	std::ofstream null("/dev/null");
+	std::streambuf *pOut = std::cout.rdbuf(null.rdbuf());
+
+	std::vector<std::string> vResults;
+	for (size_t nBody : { 64 * 1024, 256 * 1024, 1024 * 1024 })
+	{
+		size_t nMessages = (size_t(1) << 30) / nBody;
+		vResults.push_back(std::to_string(nBody / 1024) + " KB\tcopy\t\t" + Run(false, nMessages, nBody));
+		vResults.push_back(std::to_string(nBody / 1024) + " KB\tzerocopy\t" + Run(true, nMessages, nBody));
+	}
+
+	std::cout.rdbuf(pOut);
+	std::cout << "body\tsend\t\tMB/s\tsender cpu (ms/MB)\n";
+	for (auto &s : vResults)
+		std::cout << s << '\n';
+	return  0;
+}